@@ -0,0 +1,164 @@
+//-----------------------------------------------------------------------------
+// Height map blur benchmark.
+//
+// Compares HeightMap::blur() against the original implementation, which ran
+// the filter one row and then one column at a time, walking each column with
+// a stride of the height map size. HeightMap::blur() is timed both on a
+// single thread and on a thread pool using all hardware threads, and both
+// results are checked to be bit-identical to the original filter.
+//
+// Usage: bench_blur [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_blur.cpp ..\height_map.cpp ..\height_map_file.cpp
+//     ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_blur
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../height_map.h"
+#include "../simd.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int ITERATIONS = 3;
+    const float BLUR_AMOUNT = 0.5f;
+
+    void OriginalBlur(std::vector<float> &heights, int size, float amount)
+    {
+        // HeightMap::blur() as it was before it was vectorized.
+
+        for (int i = 0; i < size; ++i)
+        {
+            float *pRow = &heights[i * size];
+
+            for (int j = 1; j < size; ++j)
+                pRow[j] = (pRow[j - 1] * amount) + (pRow[j] * (1.0f - amount));
+
+            for (int j = size - 2; j >= 0; --j)
+                pRow[j] = (pRow[j + 1] * amount) + (pRow[j] * (1.0f - amount));
+        }
+
+        for (int i = 0; i < size; ++i)
+        {
+            for (int j = 1; j < size; ++j)
+            {
+                float &pixel = heights[j * size + i];
+                pixel = (heights[(j - 1) * size + i] * amount) + (pixel * (1.0f - amount));
+            }
+
+            for (int j = size - 2; j >= 0; --j)
+            {
+                float &pixel = heights[j * size + i];
+                pixel = (heights[(j + 1) * size + i] * amount) + (pixel * (1.0f - amount));
+            }
+        }
+    }
+
+    double TimeHeightMapBlur(HeightMap &heightMap, ThreadPool *pPool)
+    {
+        double best = 0.0;
+
+        heightMap.setThreadPool(pPool);
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            BenchTimer timer;
+            heightMap.blur(BLUR_AMOUNT);
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        heightMap.setThreadPool(0);
+        return best;
+    }
+
+    bool MatchesOriginal(HeightMap &heightMap, ThreadPool *pPool, const std::vector<float> &expected)
+    {
+        int size = heightMap.getSize();
+
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+        heightMap.setThreadPool(pPool);
+        heightMap.blur(BLUR_AMOUNT);
+        heightMap.setThreadPool(0);
+
+        return memcmp(heightMap.getHeights(), &expected[0], size * size * sizeof(float)) == 0;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(1024);
+        sizes.push_back(4096);
+        sizes.push_back(8192);
+    }
+
+    ThreadPool pool;
+    pool.create(ThreadPool::getHardwareThreadCount());
+
+    printf("blur amount %g, best of %d, SIMD width %d, %d threads\n\n",
+        BLUR_AMOUNT, ITERATIONS, static_cast<int>(Simd::WIDTH), pool.getThreadCount());
+    printf("%-6s %12s %12s %12s %10s %10s %8s\n",
+        "size", "original ms", "simd ms", "threaded ms", "speedup", "threaded", "match");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 2 || !heightMap.create(size, 16, 1.0f))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+
+        std::vector<float> original(heightMap.getHeights(), heightMap.getHeights() + size * size);
+        double originalMs = 0.0;
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            std::vector<float> heights(original);
+            BenchTimer timer;
+            OriginalBlur(heights, size, BLUR_AMOUNT);
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < originalMs)
+                originalMs = elapsed;
+        }
+
+        std::vector<float> expected(original);
+        OriginalBlur(expected, size, BLUR_AMOUNT);
+
+        bool match = MatchesOriginal(heightMap, 0, expected) && MatchesOriginal(heightMap, &pool, expected);
+
+        double simdMs = TimeHeightMapBlur(heightMap, 0);
+        double threadedMs = TimeHeightMapBlur(heightMap, &pool);
+
+        printf("%-6d %12.2f %12.2f %12.2f %10.2f %10.2f %8s\n", size, originalMs,
+            simdMs, threadedMs, originalMs / simdMs, originalMs / threadedMs, match ? "yes" : "NO");
+
+        if (!match)
+            return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+//-----------------------------------------------------------------------------
+// Diamond-square scaling benchmark.
+//
+// Times HeightMap::generateDiamondSquareFractal() using the serial generator
+// and then using a thread pool of 1 to N threads (N defaults to the number of
+// hardware threads). Every parallel run is checked to be bit-identical to the
+// serial run for the same seed.
+//
+// Usage: bench_diamond_square [size] [max threads] [iterations]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_diamond_square.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_diamond_square
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../height_map.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const float ROUGHNESS = 1.2f;
+    const unsigned int SEED = 12345;
+
+    double timeGenerate(HeightMap &heightMap, int iterations)
+    {
+        // Returns the fastest of 'iterations' runs in milliseconds.
+
+        double best = 0.0;
+
+        for (int i = 0; i < iterations; ++i)
+        {
+            BenchTimer timer;
+            heightMap.generateDiamondSquareFractal(ROUGHNESS, SEED);
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        return best;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int size = (argc > 1) ? atoi(argv[1]) : 4096;
+    int maxThreads = (argc > 2) ? atoi(argv[2]) : ThreadPool::getHardwareThreadCount();
+    int iterations = (argc > 3) ? atoi(argv[3]) : 3;
+
+    if (!Math::isPower2(size) || maxThreads < 1 || iterations < 1)
+    {
+        fprintf(stderr, "usage: bench_diamond_square [size (power of 2)] [max threads] [iterations]\n");
+        return 1;
+    }
+
+    HeightMap heightMap;
+
+    if (!heightMap.create(size, 16, 1.0f))
+    {
+        fprintf(stderr, "failed to allocate a %d x %d height map\n", size, size);
+        return 1;
+    }
+
+    double serialMs = timeGenerate(heightMap, iterations);
+    std::vector<float> reference(heightMap.getHeights(), heightMap.getHeights() + size * size);
+    bool allIdentical = true;
+
+    printf("diamond-square %d x %d, best of %d\n\n", size, size, iterations);
+    printf("%-8s %10s %10s %10s\n", "threads", "ms", "speedup", "identical");
+    printf("%-8s %10.2f %10.2f %10s\n", "serial", serialMs, 1.0, "-");
+
+    for (int threads = 1; threads <= maxThreads; ++threads)
+    {
+        ThreadPool pool;
+
+        if (!pool.create(threads))
+        {
+            fprintf(stderr, "failed to create a pool of %d threads\n", threads);
+            return 1;
+        }
+
+        heightMap.setThreadPool(&pool);
+
+        double ms = timeGenerate(heightMap, iterations);
+        bool identical = memcmp(&reference[0], heightMap.getHeights(), reference.size() * sizeof(float)) == 0;
+
+        heightMap.setThreadPool(0);
+        allIdentical = allIdentical && identical;
+
+        printf("%-8d %10.2f %10.2f %10s\n", threads, ms, serialMs / ms, identical ? "yes" : "NO");
+    }
+
+    return allIdentical ? 0 : 1;
+}
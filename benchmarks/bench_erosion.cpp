@@ -0,0 +1,141 @@
+//-----------------------------------------------------------------------------
+// Height map erosion benchmark.
+//
+// Times HeightMap::erodeThermal() and HeightMap::erodeHydraulic() on a
+// diamond-square terrain, both on a single thread and on a thread pool using
+// all hardware threads, and checks that both give bit-identical heights.
+// Also reports how much the erosion changed the terrain:
+//  - the mean absolute change of the heights
+//  - the change of the total of the heights, which thermal erosion should
+//    keep to float rounding and hydraulic erosion only loses through
+//    droplets that leave the map or evaporate with sediment
+//
+// Usage: bench_erosion [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_erosion.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_erosion
+//-----------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../height_map.h"
+#include "../simd.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int THERMAL_ITERATIONS = 50;
+    const float THERMAL_TALUS = 0.25f;
+    const float THERMAL_RATE = 0.5f;
+    const int DROPLETS = 200000;
+
+    enum Stage
+    {
+        STAGE_THERMAL,
+        STAGE_HYDRAULIC
+    };
+
+    void Erode(HeightMap &heightMap, Stage stage)
+    {
+        if (stage == STAGE_THERMAL)
+        {
+            heightMap.erodeThermal(THERMAL_ITERATIONS, THERMAL_TALUS, THERMAL_RATE);
+        }
+        else
+        {
+            HeightMap::HydraulicErosionParameters params;
+
+            params.dropletCount = DROPLETS;
+            heightMap.erodeHydraulic(params);
+        }
+    }
+
+    double TimeErosion(const HeightMap &source, Stage stage, ThreadPool *pPool, std::vector<float> &result)
+    {
+        // Erodes a copy of 'source' and returns the time taken.
+
+        int size = source.getSize();
+        HeightMap heightMap;
+
+        heightMap.create(size, source.getGridSpacing(), source.getHeightScale());
+        heightMap.generateDiamondSquareFractal(1.2f, source.getSeed());
+        heightMap.setThreadPool(pPool);
+
+        BenchTimer timer;
+        Erode(heightMap, stage);
+        double elapsed = timer.elapsedMs();
+
+        result.assign(heightMap.getHeights(), heightMap.getHeights() + size * size);
+        return elapsed;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(1024);
+        sizes.push_back(4096);
+    }
+
+    ThreadPool pool;
+    pool.create(ThreadPool::getHardwareThreadCount());
+
+    printf("%d thermal iterations, %d droplets, SIMD width %d, %d threads\n\n",
+        THERMAL_ITERATIONS, DROPLETS, static_cast<int>(Simd::WIDTH), pool.getThreadCount());
+    printf("%-6s %-10s %12s %12s %10s %10s %12s %12s\n",
+        "size", "stage", "single ms", "threaded ms", "speedup", "identical", "mean change", "total change");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 4 || !heightMap.create(size, 16, 1.0f))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+
+        const float *pOriginal = heightMap.getHeights();
+
+        for (int stage = STAGE_THERMAL; stage <= STAGE_HYDRAULIC; ++stage)
+        {
+            std::vector<float> single;
+            std::vector<float> threaded;
+            double singleMs = TimeErosion(heightMap, static_cast<Stage>(stage), 0, single);
+            double threadedMs = TimeErosion(heightMap, static_cast<Stage>(stage), &pool, threaded);
+            bool identical = memcmp(&single[0], &threaded[0], single.size() * sizeof(float)) == 0;
+            double change = 0.0;
+            double total = 0.0;
+
+            for (size_t i = 0; i < single.size(); ++i)
+            {
+                change += fabs(static_cast<double>(single[i]) - pOriginal[i]);
+                total += static_cast<double>(single[i]) - pOriginal[i];
+            }
+
+            printf("%-6d %-10s %12.2f %12.2f %10.2f %10s %12.4f %12.4g\n", size,
+                (stage == STAGE_THERMAL) ? "thermal" : "hydraulic", singleMs, threadedMs,
+                singleMs / threadedMs, identical ? "yes" : "NO", change / single.size(), total);
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,160 @@
+//-----------------------------------------------------------------------------
+// Height map file benchmark.
+//
+// Compares generating a height map with HeightMap::generateDiamondSquareFractal()
+// against loading the same height map with HeightMap::load(), for each of the
+// height map file layouts. Float files in row order are memory mapped, so
+// their load time is reported twice: the time load() takes, and the time
+// until every height has been read once. The other layouts are converted to
+// floats as they're loaded. The files are written to the current directory
+// and deleted afterwards. They're still in the operating system's file cache
+// when they're loaded, so the load times are warm start times.
+//
+// Usage: bench_height_map_file [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_height_map_file.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_height_map_file
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../height_map.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int ITERATIONS = 3;
+    const int GRID_SPACING = 16;
+    const float HEIGHT_SCALE = 2.0f;
+    const char FILENAME[] = "bench_height_map_file.hmap";
+
+    struct Layout
+    {
+        const char *pszName;
+        HeightMapFile::SampleFormat sampleFormat;
+        int tileSize;
+    };
+
+    const Layout LAYOUTS[] =
+    {
+        { "float rows", HeightMapFile::SAMPLE_FLOAT, 0 },
+        { "uint16 rows", HeightMapFile::SAMPLE_UINT16, 0 },
+        { "float tiles", HeightMapFile::SAMPLE_FLOAT, 256 },
+        { "uint16 tiles", HeightMapFile::SAMPLE_UINT16, 256 }
+    };
+
+    float TouchHeights(const HeightMap &heightMap)
+    {
+        // Reads one height from every 4 KB page, which faults in every page
+        // of a memory mapped height map.
+
+        const float *pHeights = heightMap.getHeights();
+        size_t count = static_cast<size_t>(heightMap.getSize()) * heightMap.getSize();
+        float sum = 0.0f;
+
+        for (size_t i = 0; i < count; i += 1024)
+            sum += pHeights[i];
+
+        return sum;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(1025);
+        sizes.push_back(2049);
+        sizes.push_back(4097);
+    }
+
+    printf("height map files (ms), best of %d\n\n", ITERATIONS);
+    printf("%-6s %-13s %10s %10s %10s %12s\n", "size", "layout", "generate", "load", "touched", "file (MB)");
+
+    float checksum = 0.0f;
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 2 || !heightMap.create(size, GRID_SPACING, HEIGHT_SCALE))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        BenchTimer generateTimer;
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+        double generateMs = generateTimer.elapsedMs();
+
+        for (size_t l = 0; l < sizeof(LAYOUTS) / sizeof(LAYOUTS[0]); ++l)
+        {
+            const Layout &layout = LAYOUTS[l];
+
+            if (!heightMap.save(FILENAME, layout.sampleFormat, layout.tileSize))
+            {
+                fprintf(stderr, "failed to write %s\n", FILENAME);
+                return 1;
+            }
+
+            double bestLoadMs = 0.0;
+            double bestTouchedMs = 0.0;
+            double fileMB = 0.0;
+
+            for (int i = 0; i < ITERATIONS; ++i)
+            {
+                HeightMap loaded;
+                BenchTimer timer;
+
+                if (!loaded.load(FILENAME))
+                {
+                    fprintf(stderr, "failed to load %s\n", FILENAME);
+                    return 1;
+                }
+
+                double loadMs = timer.elapsedMs();
+                checksum += TouchHeights(loaded);
+                double touchedMs = timer.elapsedMs();
+
+                if (i == 0 || loadMs < bestLoadMs)
+                    bestLoadMs = loadMs;
+
+                if (i == 0 || touchedMs < bestTouchedMs)
+                    bestTouchedMs = touchedMs;
+            }
+
+            HeightMapFile file;
+
+            if (file.open(FILENAME))
+            {
+                const HeightMapFileHeader &header = file.getHeader();
+                size_t samples = static_cast<size_t>(file.getTilesPerSide()) * file.getTilesPerSide()
+                    * header.tileSize * header.tileSize;
+
+                fileMB = static_cast<double>(header.dataOffset + samples
+                    * (layout.sampleFormat == HeightMapFile::SAMPLE_UINT16 ? 2 : 4)) / (1024.0 * 1024.0);
+            }
+
+            printf("%-6d %-13s %10.1f %10.2f %10.2f %12.1f\n", size, layout.pszName, generateMs,
+                bestLoadMs, bestTouchedMs, fileMB);
+        }
+    }
+
+    remove(FILENAME);
+
+    // Printed so the compiler can't discard the loads.
+    printf("\nchecksum %g\n", checksum);
+    return 0;
+}
@@ -0,0 +1,154 @@
+//-----------------------------------------------------------------------------
+// Height map point query benchmark.
+//
+// Compares HeightMap::heightAtBatch() and HeightMap::normalAtBatch() against
+// calling HeightMap::heightAt() and HeightMap::normalAt() once per point.
+// The query points are spread randomly over the whole height map, so most
+// of the time is spent fetching heights that aren't in the cache, as with a
+// crowd of agents spread over the terrain. Throughput is reported in
+// millions of queries per second, along with the largest difference between
+// the batched and the single point results.
+//
+// Usage: bench_height_queries [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_height_queries.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_height_queries
+//-----------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../height_map.h"
+#include "../simd.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int ITERATIONS = 3;
+    const int QUERY_COUNT = 1 << 20;
+    const int GRID_SPACING = 16;
+
+    template <typename Function>
+    double BestOf(Function function)
+    {
+        double best = 0.0;
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            BenchTimer timer;
+            function();
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        return best;
+    }
+
+    double QueriesPerSecond(double ms)
+    {
+        // Returns millions of queries per second.
+        return static_cast<double>(QUERY_COUNT) / (ms * 1000.0);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(256);
+        sizes.push_back(1024);
+        sizes.push_back(4096);
+    }
+
+    printf("height map queries (millions per second), %d points, best of %d, SIMD width %d\n\n",
+        QUERY_COUNT, ITERATIONS, static_cast<int>(Simd::WIDTH));
+    printf("%-6s %10s %10s %10s %10s %10s %10s\n",
+        "size", "heightAt", "batch", "max diff", "normalAt", "batch", "max diff");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 2 || !heightMap.create(size, GRID_SPACING, 2.0f))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+
+        // Uses HeightMap::random() so every run queries the same points.
+
+        float extent = static_cast<float>(size * GRID_SPACING);
+        std::vector<float> x(QUERY_COUNT), z(QUERY_COUNT);
+
+        for (int i = 0; i < QUERY_COUNT; ++i)
+        {
+            x[i] = (HeightMap::random(1, i, 0, 0) * 0.5f + 0.5f) * extent;
+            z[i] = (HeightMap::random(1, i, 0, 1) * 0.5f + 0.5f) * extent;
+        }
+
+        std::vector<float> expected(QUERY_COUNT), heights(QUERY_COUNT);
+
+        double singleHeightMs = BestOf([&]()
+        {
+            for (int i = 0; i < QUERY_COUNT; ++i)
+                expected[i] = heightMap.heightAt(x[i], z[i]);
+        });
+
+        double batchHeightMs = BestOf([&]()
+        {
+            heightMap.heightAtBatch(&x[0], &z[0], &heights[0], QUERY_COUNT);
+        });
+
+        float maxHeightDiff = 0.0f;
+
+        for (int i = 0; i < QUERY_COUNT; ++i)
+            maxHeightDiff = std::max(maxHeightDiff, fabsf(heights[i] - expected[i]));
+
+        std::vector<Vector3> expectedNormals(QUERY_COUNT);
+        std::vector<float> nx(QUERY_COUNT), ny(QUERY_COUNT), nz(QUERY_COUNT);
+
+        double singleNormalMs = BestOf([&]()
+        {
+            for (int i = 0; i < QUERY_COUNT; ++i)
+                heightMap.normalAt(x[i], z[i], expectedNormals[i]);
+        });
+
+        double batchNormalMs = BestOf([&]()
+        {
+            heightMap.normalAtBatch(&x[0], &z[0], &nx[0], &ny[0], &nz[0], QUERY_COUNT);
+        });
+
+        float maxNormalDiff = 0.0f;
+
+        for (int i = 0; i < QUERY_COUNT; ++i)
+        {
+            const Vector3 &n = expectedNormals[i];
+
+            maxNormalDiff = std::max(maxNormalDiff, fabsf(nx[i] - n.x));
+            maxNormalDiff = std::max(maxNormalDiff, fabsf(ny[i] - n.y));
+            maxNormalDiff = std::max(maxNormalDiff, fabsf(nz[i] - n.z));
+        }
+
+        printf("%-6d %10.1f %10.1f %10g %10.1f %10.1f %10g\n", size,
+            QueriesPerSecond(singleHeightMs), QueriesPerSecond(batchHeightMs), maxHeightDiff,
+            QueriesPerSecond(singleNormalMs), QueriesPerSecond(batchNormalMs), maxNormalDiff);
+    }
+
+    return 0;
+}
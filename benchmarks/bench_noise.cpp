@@ -0,0 +1,186 @@
+//-----------------------------------------------------------------------------
+// Gradient noise benchmark.
+//
+// Times HeightMap::generateNoise() for fBm, ridged and domain warped ridged
+// noise, both on a single thread and on a thread pool using all hardware
+// threads, next to HeightMap::generateDiamondSquareFractal() for scale. Each
+// noise height map is also filled again one TILE_SIZE x TILE_SIZE rectangle
+// at a time, which must give bit-identical heights to the full fill.
+//
+// Then TILE_COUNT tiles are generated through a FractalTileSource and a
+// NoiseTileSource with the same number of octaves, which is what a
+// PagedHeightMap spends its time on while streaming.
+//
+// Usage: bench_noise [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_noise.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\paged_height_map.cpp ..\profiler.cpp
+//     ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_noise
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include "../height_map.h"
+#include "../paged_height_map.h"
+#include "../simd.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const unsigned int SEED = 12345;
+    const float ROUGHNESS = 1.2f;
+    const float WARP = 64.0f;
+    const int TILE_SIZE = 256;
+    const int TILE_COUNT = 64;
+
+    enum Generator
+    {
+        GENERATOR_DIAMOND_SQUARE,
+        GENERATOR_FBM,
+        GENERATOR_RIDGED,
+        GENERATOR_WARPED,
+        GENERATOR_COUNT
+    };
+
+    const char *const GENERATOR_NAMES[GENERATOR_COUNT] =
+    {
+        "diamond-sq", "fbm", "ridged", "warped"
+    };
+
+    HeightMap::NoiseParameters NoiseParameters(Generator generator)
+    {
+        HeightMap::NoiseParameters params;
+
+        params.seed = SEED;
+        params.ridged = (generator != GENERATOR_FBM);
+        params.warp = (generator == GENERATOR_WARPED) ? WARP : 0.0f;
+        return params;
+    }
+
+    void Generate(HeightMap &heightMap, Generator generator)
+    {
+        if (generator == GENERATOR_DIAMOND_SQUARE)
+            heightMap.generateDiamondSquareFractal(ROUGHNESS, SEED);
+        else
+            heightMap.generateNoise(NoiseParameters(generator));
+    }
+
+    double TimeGenerate(HeightMap &heightMap, Generator generator, ThreadPool *pPool)
+    {
+        heightMap.setThreadPool(pPool);
+
+        BenchTimer timer;
+        Generate(heightMap, generator);
+        return timer.elapsedMs();
+    }
+
+    bool TilesMatch(const HeightMap &heightMap, Generator generator)
+    {
+        // Fills a second height map one tile at a time and compares it with
+        // 'heightMap'.
+
+        int size = heightMap.getSize();
+        HeightMap tiled;
+
+        tiled.create(size, heightMap.getGridSpacing(), heightMap.getHeightScale());
+
+        for (int z = 0; z < size; z += TILE_SIZE)
+        {
+            for (int x = 0; x < size; x += TILE_SIZE)
+            {
+                HeightMap::Rect rect = {x, z, x + TILE_SIZE, z + TILE_SIZE};
+                tiled.generateNoise(NoiseParameters(generator), rect);
+            }
+        }
+
+        return memcmp(heightMap.getHeights(), tiled.getHeights(), sizeof(float) * size * size) == 0;
+    }
+
+    double TimeTiles(HeightTileSource &source, std::vector<float> &tile)
+    {
+        BenchTimer timer;
+
+        for (int i = 0; i < TILE_COUNT; ++i)
+            source.loadTile(i % 8, i / 8, TILE_SIZE, &tile[0]);
+
+        return timer.elapsedMs();
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(1024);
+        sizes.push_back(4096);
+    }
+
+    ThreadPool pool;
+    pool.create(ThreadPool::getHardwareThreadCount());
+
+    HeightMap::NoiseParameters defaults;
+
+    printf("%d octaves, SIMD width %d, %d threads\n\n", defaults.octaves, static_cast<int>(Simd::WIDTH), pool.getThreadCount());
+    printf("%-6s %-11s %12s %12s %10s %12s %10s\n",
+        "size", "generator", "single ms", "threaded ms", "speedup", "Mtexels/s", "tiles");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 2 || !heightMap.create(size, 16, 1.0f))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        for (int g = 0; g < GENERATOR_COUNT; ++g)
+        {
+            Generator generator = static_cast<Generator>(g);
+            double singleMs = TimeGenerate(heightMap, generator, 0);
+            double threadedMs = TimeGenerate(heightMap, generator, &pool);
+            const char *pszTiles = "-";
+
+            // Diamond-square can't fill a rectangle on its own.
+            if (generator != GENERATOR_DIAMOND_SQUARE)
+                pszTiles = TilesMatch(heightMap, generator) ? "identical" : "DIFFERENT";
+
+            printf("%-6d %-11s %12.2f %12.2f %10.2f %12.2f %10s\n", size, GENERATOR_NAMES[g],
+                singleMs, threadedMs, singleMs / threadedMs,
+                static_cast<double>(size) * size / (singleMs * 1000.0), pszTiles);
+        }
+    }
+
+    // FractalTileSource halves the lattice spacing down to 1 texel, so give
+    // it the feature size that yields the same number of octaves.
+
+    HeightMap::NoiseParameters params;
+    params.seed = SEED;
+
+    FractalTileSource fractalSource(SEED, ROUGHNESS, 1 << (params.octaves - 1));
+    NoiseTileSource noiseSource(params);
+    std::vector<float> tile(TILE_SIZE * TILE_SIZE);
+    double fractalMs = TimeTiles(fractalSource, tile);
+    double noiseMs = TimeTiles(noiseSource, tile);
+    double texels = static_cast<double>(TILE_COUNT) * TILE_SIZE * TILE_SIZE;
+
+    printf("\n%d tiles of %d x %d texels, single thread\n", TILE_COUNT, TILE_SIZE, TILE_SIZE);
+    printf("%-20s %10.2f ms %10.2f Mtexels/s\n", "FractalTileSource", fractalMs, texels / (fractalMs * 1000.0));
+    printf("%-20s %10.2f ms %10.2f Mtexels/s\n", "NoiseTileSource", noiseMs, texels / (noiseMs * 1000.0));
+
+    return 0;
+}
@@ -0,0 +1,145 @@
+//-----------------------------------------------------------------------------
+// Height map normal generation benchmark.
+//
+// Compares HeightMap::computeNormals() against calling
+// HeightMap::normalAtPixel() once per texel, which is how
+// Terrain::generateVertices() used to build its normals. computeNormals() is
+// timed both on a single thread and on a thread pool using all hardware
+// threads. Throughput is reported in millions of normals per second, along
+// with the largest difference between any component of the two results.
+//
+// Usage: bench_normals [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_normals.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_normals
+//-----------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../height_map.h"
+#include "../simd.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int ITERATIONS = 3;
+
+    void NormalAtPixelNormals(const HeightMap &heightMap, float *pNormals)
+    {
+        int size = heightMap.getSize();
+        Vector3 normal;
+
+        for (int z = 0; z < size; ++z)
+        {
+            for (int x = 0; x < size; ++x, pNormals += 3)
+            {
+                heightMap.normalAtPixel(x, z, normal);
+                pNormals[0] = normal.x;
+                pNormals[1] = normal.y;
+                pNormals[2] = normal.z;
+            }
+        }
+    }
+
+    double TimeComputeNormals(HeightMap &heightMap, ThreadPool *pPool, float *pNormals)
+    {
+        double best = 0.0;
+
+        heightMap.setThreadPool(pPool);
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            BenchTimer timer;
+            heightMap.computeNormals(pNormals, 3);
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        heightMap.setThreadPool(0);
+        return best;
+    }
+
+    double NormalsPerSecond(int size, double ms)
+    {
+        // Returns millions of normals per second.
+        return (static_cast<double>(size) * size) / (ms * 1000.0);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(1024);
+        sizes.push_back(4096);
+        sizes.push_back(8192);
+    }
+
+    ThreadPool pool;
+    pool.create(ThreadPool::getHardwareThreadCount());
+
+    printf("normals (millions per second), best of %d, SIMD width %d, %d threads\n\n",
+        ITERATIONS, static_cast<int>(Simd::WIDTH), pool.getThreadCount());
+    printf("%-6s %14s %14s %14s %12s\n",
+        "size", "normalAtPixel", "computeNormals", "threaded", "max diff");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 2 || !heightMap.create(size, 16, 1.0f))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+
+        std::vector<float> expected(size * size * 3);
+        std::vector<float> normals(size * size * 3);
+        double perPixelMs = 0.0;
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            BenchTimer timer;
+            NormalAtPixelNormals(heightMap, &expected[0]);
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < perPixelMs)
+                perPixelMs = elapsed;
+        }
+
+        double simdMs = TimeComputeNormals(heightMap, 0, &normals[0]);
+        double threadedMs = TimeComputeNormals(heightMap, &pool, &normals[0]);
+        float maxDiff = 0.0f;
+
+        for (size_t i = 0; i < normals.size(); ++i)
+        {
+            float diff = fabsf(normals[i] - expected[i]);
+
+            if (diff > maxDiff)
+                maxDiff = diff;
+        }
+
+        printf("%-6d %14.1f %14.1f %14.1f %12g\n", size, NormalsPerSecond(size, perPixelMs),
+            NormalsPerSecond(size, simdMs), NormalsPerSecond(size, threadedMs), maxDiff);
+    }
+
+    return 0;
+}
@@ -0,0 +1,311 @@
+//-----------------------------------------------------------------------------
+// Paged height map benchmark.
+//
+// Moves a crowd of agents across a PagedHeightMap whose tiles are generated
+// on demand by a FractalTileSource. Each frame every agent takes a small
+// random step inside a region that travels diagonally across the whole
+// height map, and looks up the terrain height under it. The throughput in
+// millions of height queries per second is reported, both including and
+// excluding the time spent generating tiles, along with the number of tiles
+// that were generated and the memory used by the resident tiles.
+//
+// A camera then flies across the height map at 60 frames per second, and
+// each frame samples the heights of a grid around it. This runs once
+// loading the tiles on the frame's thread, and once streaming them in on
+// loader threads with prefetching along the camera's velocity. The worst and
+// average frame times, the frames that went over budget, and the streaming
+// counters are reported for both.
+//
+// Finally a stationary camera calls prefetch() repeatedly with the same
+// arguments while a single loader thread works through slow tiles. Tiles
+// that are still queued must stay queued, so the queue depth has to stay
+// steady between the calls. The benchmark fails if it doesn't.
+//
+// Usage: bench_paged_height_map [size] [budget in MB] [tile size]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_paged_height_map.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\paged_height_map.cpp ..\profiler.cpp
+//     ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_paged_height_map
+//-----------------------------------------------------------------------------
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#include "../height_map.h"
+#include "../paged_height_map.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int AGENT_COUNT = 4096;
+    const int FRAME_COUNT = 256;
+    const int GRID_SPACING = 16;
+    const float REGION_SIZE = 2048.0f;     // in texels
+    const float STEP_SIZE = 4.0f;          // in texels
+
+    const int FLY_FRAME_COUNT = 240;
+    const double FLY_FRAME_MS = 1000.0 / 60.0;
+    const int FLY_GRID_SIZE = 64;          // height samples per side
+    const float FLY_RADIUS_TILES = 2.0f;
+    const float FLY_SPEED_TILES = 3.0f;    // per second
+    const float FLY_LOOK_AHEAD_SEC = 0.5f;
+    const int FLY_LOADER_THREADS = 2;
+
+    const int PREFETCH_CALLS = 16;
+    const int PREFETCH_LOAD_MS = 20;
+    const float PREFETCH_RADIUS_TILES = 3.0f;
+
+    class TimedTileSource : public HeightTileSource
+    {
+    public:
+        // Forwards to another tile source and adds up the time it takes.
+
+        explicit TimedTileSource(HeightTileSource *pSource)
+            : m_pSource(pSource), m_elapsedMs(0.0) {}
+
+        virtual bool loadTile(int tileX, int tileZ, int tileSize, float *pHeights)
+        {
+            BenchTimer timer;
+            bool loaded = m_pSource->loadTile(tileX, tileZ, tileSize, pHeights);
+
+            m_elapsedMs += timer.elapsedMs();
+            return loaded;
+        }
+
+        double getElapsedMs() const
+        { return m_elapsedMs; }
+
+    private:
+        HeightTileSource *m_pSource;
+        double m_elapsedMs;
+    };
+
+    class SlowTileSource : public HeightTileSource
+    {
+    public:
+        // Forwards to another tile source after a delay, so that the loader
+        // threads fall behind the requests.
+
+        explicit SlowTileSource(HeightTileSource *pSource)
+            : m_pSource(pSource) {}
+
+        virtual bool loadTile(int tileX, int tileZ, int tileSize, float *pHeights)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(PREFETCH_LOAD_MS));
+            return m_pSource->loadTile(tileX, tileZ, tileSize, pHeights);
+        }
+
+    private:
+        HeightTileSource *m_pSource;
+    };
+
+    void FlyThrough(PagedHeightMap &heightMap, bool streaming)
+    {
+        // The camera starts a few tiles in from a corner and flies
+        // diagonally. Frames that finish early sleep for the rest of the
+        // frame, which gives the loader threads time to run ahead.
+
+        float tileWorldSize = static_cast<float>(heightMap.getTileSize() * GRID_SPACING);
+        float radius = FLY_RADIUS_TILES * tileWorldSize;
+        float speed = FLY_SPEED_TILES * tileWorldSize;
+        Vector3 velocity(speed * 0.7071f, 0.0f, speed * 0.7071f);
+        Vector3 position(radius * 2.0f, 0.0f, radius * 2.0f);
+        double worstMs = 0.0;
+        double totalMs = 0.0;
+        int overBudget = 0;
+        int misses = 0;
+        int maxQueueDepth = 0;
+        int maxTilesInFlight = 0;
+        double checksum = 0.0;
+
+        if (streaming)
+            heightMap.startStreaming(FLY_LOADER_THREADS);
+
+        for (int frame = 0; frame < FLY_FRAME_COUNT; ++frame)
+        {
+            BenchTimer timer;
+
+            if (streaming)
+            {
+                heightMap.prefetch(position, velocity, radius, FLY_LOOK_AHEAD_SEC);
+                heightMap.update();
+            }
+
+            for (int j = 0; j < FLY_GRID_SIZE; ++j)
+            {
+                for (int i = 0; i < FLY_GRID_SIZE; ++i)
+                {
+                    float x = position.x + radius * (2.0f * i / (FLY_GRID_SIZE - 1) - 1.0f);
+                    float z = position.z + radius * (2.0f * j / (FLY_GRID_SIZE - 1) - 1.0f);
+                    float y = 0.0f;
+
+                    if (!streaming)
+                        y = heightMap.heightAt(x, z);
+                    else if (!heightMap.tryHeightAt(x, z, y))
+                        ++misses;
+
+                    checksum += y;
+                }
+            }
+
+            double elapsedMs = timer.elapsedMs();
+
+            worstMs = std::max(worstMs, elapsedMs);
+            totalMs += elapsedMs;
+
+            if (elapsedMs > FLY_FRAME_MS)
+                ++overBudget;
+
+            maxQueueDepth = std::max(maxQueueDepth, heightMap.getQueueDepth());
+            maxTilesInFlight = std::max(maxTilesInFlight, heightMap.getTilesInFlight());
+
+            if (elapsedMs < FLY_FRAME_MS)
+                std::this_thread::sleep_for(std::chrono::microseconds(static_cast<long long>((FLY_FRAME_MS - elapsedMs) * 1000.0)));
+
+            position += velocity * static_cast<float>(FLY_FRAME_MS / 1000.0);
+        }
+
+        heightMap.stopStreaming();
+
+        printf("%-10s %10.2f %10.2f %8d %8d %8d %8d %8d %8d\n",
+            streaming ? "streamed" : "blocking", worstMs, totalMs / FLY_FRAME_COUNT, overBudget,
+            misses, heightMap.getTileLoadCount(), heightMap.getHitchesAvoidedCount(),
+            maxQueueDepth, maxTilesInFlight);
+
+        // Keeps the compiler from discarding the queries.
+        if (checksum == 0.0)
+            printf("\n");
+    }
+
+    bool PrefetchQueueSteady(PagedHeightMap &heightMap)
+    {
+        // The calls are made back to back, well within the time it takes to
+        // load one tile, so the loader can start at most one more tile and
+        // the queue depth can drop by at most one.
+
+        float tileWorldSize = static_cast<float>(heightMap.getTileSize() * GRID_SPACING);
+        float center = heightMap.getSize() * 0.5f * GRID_SPACING;
+        Vector3 position(center, 0.0f, center);
+        Vector3 velocity(0.0f, 0.0f, 0.0f);
+        int minQueueDepth = 0;
+        int maxQueueDepth = 0;
+
+        heightMap.startStreaming(1);
+
+        for (int i = 0; i < PREFETCH_CALLS; ++i)
+        {
+            heightMap.prefetch(position, velocity, PREFETCH_RADIUS_TILES * tileWorldSize, 0.0f);
+            heightMap.update();
+
+            int queueDepth = heightMap.getQueueDepth();
+
+            minQueueDepth = (i == 0) ? queueDepth : std::min(minQueueDepth, queueDepth);
+            maxQueueDepth = std::max(maxQueueDepth, queueDepth);
+        }
+
+        heightMap.stopStreaming();
+
+        bool steady = (minQueueDepth > 0 && maxQueueDepth - minQueueDepth <= 1);
+
+        printf("\nrepeated prefetch: %d calls, 1 loader thread, %d ms per tile\n\n", PREFETCH_CALLS, PREFETCH_LOAD_MS);
+        printf("%-28s %12d\n", "min queue depth", minQueueDepth);
+        printf("%-28s %12d\n", "max queue depth", maxQueueDepth);
+        printf("%-28s %12s\n", "queue", steady ? "steady" : "DROPPED");
+        return steady;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int size = (argc > 1) ? atoi(argv[1]) : 65536;
+    int budgetMB = (argc > 2) ? atoi(argv[2]) : 256;
+    int tileSize = (argc > 3) ? atoi(argv[3]) : 256;
+
+    FractalTileSource fractalSource(12345, 1.2f, 1024);
+    TimedTileSource source(&fractalSource);
+    PagedHeightMap heightMap;
+
+    if (!heightMap.create(size, GRID_SPACING, 2.0f, tileSize, static_cast<size_t>(budgetMB) << 20, &source))
+    {
+        fprintf(stderr, "failed to create a %d x %d paged height map\n", size, size);
+        return 1;
+    }
+
+    printf("paged height map: %d x %d texels (%.1f GB as a single array), %d x %d tiles, %d MB budget\n\n",
+        size, size, (4.0 * size * size) / (1 << 30), tileSize, tileSize, budgetMB);
+
+    // Agent positions are in texels, relative to the region's origin.
+
+    std::vector<float> agentX(AGENT_COUNT), agentZ(AGENT_COUNT);
+
+    for (int i = 0; i < AGENT_COUNT; ++i)
+    {
+        agentX[i] = (HeightMap::random(1, i, 0, 0) * 0.5f + 0.5f) * REGION_SIZE;
+        agentZ[i] = (HeightMap::random(1, i, 0, 1) * 0.5f + 0.5f) * REGION_SIZE;
+    }
+
+    float regionStep = (size - 1 - REGION_SIZE) / FRAME_COUNT;
+    double checksum = 0.0;
+    BenchTimer timer;
+
+    for (int frame = 0; frame < FRAME_COUNT; ++frame)
+    {
+        float regionOrigin = frame * regionStep;
+
+        for (int i = 0; i < AGENT_COUNT; ++i)
+        {
+            float x = agentX[i] + HeightMap::random(2, i, frame, 0) * STEP_SIZE;
+            float z = agentZ[i] + HeightMap::random(2, i, frame, 1) * STEP_SIZE;
+
+            agentX[i] = std::min(std::max(x, 0.0f), REGION_SIZE);
+            agentZ[i] = std::min(std::max(z, 0.0f), REGION_SIZE);
+
+            checksum += heightMap.heightAt((regionOrigin + agentX[i]) * GRID_SPACING,
+                (regionOrigin + agentZ[i]) * GRID_SPACING);
+        }
+    }
+
+    double elapsedMs = timer.elapsedMs();
+    double queries = static_cast<double>(AGENT_COUNT) * FRAME_COUNT;
+
+    printf("%-28s %12.2f\n", "queries (millions)", queries / 1e6);
+    printf("%-28s %12.1f\n", "total time (ms)", elapsedMs);
+    printf("%-28s %12.2f\n", "queries per second (M)", queries / (elapsedMs * 1000.0));
+    printf("%-28s %12.1f\n", "tile generation time (ms)", source.getElapsedMs());
+    printf("%-28s %12.2f\n", "  excluding generation (M/s)", queries / ((elapsedMs - source.getElapsedMs()) * 1000.0));
+    printf("%-28s %12d\n", "tiles generated", heightMap.getTileLoadCount());
+    printf("%-28s %12d\n", "resident tiles", heightMap.getResidentTileCount());
+    printf("%-28s %12.1f\n", "resident tile memory (MB)", heightMap.getResidentBytes() / (1024.0 * 1024.0));
+    printf("%-28s %12g\n", "checksum", checksum);
+
+    // Fly-through.
+
+    printf("\nfly-through: %d frames at 60 Hz, %d x %d height samples per frame, %d loader threads\n\n",
+        FLY_FRAME_COUNT, FLY_GRID_SIZE, FLY_GRID_SIZE, FLY_LOADER_THREADS);
+    printf("%-10s %10s %10s %8s %8s %8s %8s %8s %8s\n", "mode", "worst (ms)", "mean (ms)",
+        "over", "misses", "loads", "avoided", "queue", "flight");
+
+    for (int streaming = 0; streaming < 2; ++streaming)
+    {
+        PagedHeightMap flyHeightMap;
+
+        flyHeightMap.create(size, GRID_SPACING, 2.0f, tileSize, static_cast<size_t>(budgetMB) << 20, &fractalSource);
+        FlyThrough(flyHeightMap, streaming != 0);
+    }
+
+    // Repeated prefetch.
+
+    SlowTileSource slowSource(&fractalSource);
+    PagedHeightMap prefetchHeightMap;
+
+    prefetchHeightMap.create(size, GRID_SPACING, 2.0f, tileSize, static_cast<size_t>(budgetMB) << 20, &slowSource);
+
+    return PrefetchQueueSteady(prefetchHeightMap) ? 0 : 1;
+}
@@ -0,0 +1,606 @@
+//-----------------------------------------------------------------------------
+// Terrain pipeline benchmark.
+//
+// Times every stage of building a terrain, at several height map sizes and
+// thread counts:
+//  - diamond_square    HeightMap::generateDiamondSquareFractal()
+//  - smooth            HeightMap::smooth()
+//  - blur              HeightMap::blur()
+//  - normals           HeightMap::computeNormals()
+//  - vertices          TerrainMesh::buildVertices()
+//  - strip_indices     TerrainMesh::buildStripIndices()
+//  - patch_indices     TerrainMesh::buildPatchLodIndices()
+//  - height_at         HeightMap::heightAt(), once per query point
+//  - height_at_batch   HeightMap::heightAtBatch()
+//
+// Only the first 4 stages use a thread pool, so the others are only timed
+// with 1 thread. Each stage is run until it has been timed at least
+// --min-samples times and for at least --min-time-ms, and its median and
+// 99th percentile times are reported. With fewer than 100 samples the 99th
+// percentile is the slowest sample. Throughput is in millions of texels per
+// second, or millions of queries per second for the height queries.
+//
+// The results can be written as JSON with --json, one result per line, and
+// compared against a stored baseline with --baseline. A stage is reported as
+// a regression when its median is more than --tolerance percent slower than
+// the baseline median, and the benchmark then exits with status 2. CI can run
+// the benchmark against a baseline checked in for the same machine:
+//  bench_pipeline --sizes 128,1024 --json results.json --baseline baseline.json
+//
+// Usage: bench_pipeline [options]
+//  --sizes LIST        height map sizes, powers of 2 (default 128,512,2048,8192)
+//  --threads LIST      thread counts (default 1 and the hardware thread count)
+//  --min-samples N     minimum timings per stage (default 5)
+//  --min-time-ms N     minimum total time per stage (default 250)
+//  --max-mesh-size N   largest size the normals, vertices and index stages
+//                      are run at, since they need memory for a whole mesh
+//                      (default 4096)
+//  --json FILE         write the results as JSON
+//  --baseline FILE     compare the medians against a previous JSON file
+//  --tolerance PCT     allowed slowdown against the baseline (default 10)
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_pipeline.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\terrain_mesh.cpp
+//     ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_pipeline
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "../height_map.h"
+#include "../simd.h"
+#include "../terrain_mesh.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int GRID_SPACING = 16;
+    const float HEIGHT_SCALE = 2.0f;
+    const float ROUGHNESS = 1.2f;
+    const unsigned int SEED = 12345;
+    const int QUERY_COUNT = 1 << 16;
+    const int MAX_SAMPLES = 1000;
+
+    enum StageFlags
+    {
+        STAGE_THREADED = 1,         // uses the height map's thread pool
+        STAGE_MESH = 2,             // limited to --max-mesh-size
+        STAGE_QUERIES = 4           // throughput is in queries, not texels
+    };
+
+    enum StageId
+    {
+        DIAMOND_SQUARE,
+        SMOOTH,
+        BLUR,
+        NORMALS,
+        VERTICES,
+        STRIP_INDICES,
+        PATCH_INDICES,
+        HEIGHT_AT,
+        HEIGHT_AT_BATCH,
+        STAGE_COUNT
+    };
+
+    struct Stage
+    {
+        const char *pszName;
+        int flags;
+    };
+
+    const Stage STAGES[STAGE_COUNT] =
+    {
+        { "diamond_square", STAGE_THREADED },
+        { "smooth", STAGE_THREADED },
+        { "blur", STAGE_THREADED },
+        { "normals", STAGE_THREADED | STAGE_MESH },
+        { "vertices", STAGE_MESH },
+        { "strip_indices", STAGE_MESH },
+        { "patch_indices", STAGE_MESH },
+        { "height_at", STAGE_QUERIES },
+        { "height_at_batch", STAGE_QUERIES }
+    };
+
+    struct Options
+    {
+        std::vector<int> sizes;
+        std::vector<int> threads;
+        int minSamples;
+        double minTimeMs;
+        int maxMeshSize;
+        std::string jsonFilename;
+        std::string baselineFilename;
+        double tolerance;
+    };
+
+    struct Result
+    {
+        std::string stage;
+        int size;
+        int threads;
+        int samples;
+        double medianMs;
+        double p99Ms;
+        double minMs;
+        double throughput;
+        const char *pszUnit;
+    };
+
+    //-------------------------------------------------------------------------
+    // Command line parsing.
+
+    bool ParseList(const char *pszList, std::vector<int> &values)
+    {
+        values.clear();
+
+        for (const char *p = pszList; *p; )
+        {
+            char *pEnd = 0;
+            long value = strtol(p, &pEnd, 10);
+
+            if (pEnd == p || value < 1)
+                return false;
+
+            values.push_back(static_cast<int>(value));
+            p = pEnd;
+
+            if (*p == ',')
+                ++p;
+            else if (*p)
+                return false;
+        }
+
+        return !values.empty();
+    }
+
+    bool ParseOptions(int argc, char *argv[], Options &options)
+    {
+        int hardwareThreads = ThreadPool::getHardwareThreadCount();
+
+        options.sizes.clear();
+        options.sizes.push_back(128);
+        options.sizes.push_back(512);
+        options.sizes.push_back(2048);
+        options.sizes.push_back(8192);
+        options.threads.assign(1, 1);
+
+        if (hardwareThreads > 1)
+            options.threads.push_back(hardwareThreads);
+
+        options.minSamples = 5;
+        options.minTimeMs = 250.0;
+        options.maxMeshSize = 4096;
+        options.tolerance = 10.0;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *pszOption = argv[i];
+            const char *pszValue = (i + 1 < argc) ? argv[++i] : 0;
+
+            if (!pszValue)
+                return false;
+
+            if (strcmp(pszOption, "--sizes") == 0)
+            {
+                if (!ParseList(pszValue, options.sizes))
+                    return false;
+
+                for (size_t s = 0; s < options.sizes.size(); ++s)
+                {
+                    if (!Math::isPower2(options.sizes[s]) || options.sizes[s] < 4)
+                        return false;
+                }
+            }
+            else if (strcmp(pszOption, "--threads") == 0)
+            {
+                if (!ParseList(pszValue, options.threads))
+                    return false;
+            }
+            else if (strcmp(pszOption, "--min-samples") == 0)
+            {
+                options.minSamples = std::min(std::max(1, atoi(pszValue)), MAX_SAMPLES);
+            }
+            else if (strcmp(pszOption, "--min-time-ms") == 0)
+            {
+                options.minTimeMs = atof(pszValue);
+            }
+            else if (strcmp(pszOption, "--max-mesh-size") == 0)
+            {
+                options.maxMeshSize = atoi(pszValue);
+            }
+            else if (strcmp(pszOption, "--json") == 0)
+            {
+                options.jsonFilename = pszValue;
+            }
+            else if (strcmp(pszOption, "--baseline") == 0)
+            {
+                options.baselineFilename = pszValue;
+            }
+            else if (strcmp(pszOption, "--tolerance") == 0)
+            {
+                options.tolerance = atof(pszValue);
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    // Timing.
+
+    template <typename Function>
+    void Sample(const Options &options, Function function, Result &result)
+    {
+        // Times 'function' until there are enough samples, then fills in the
+        // statistics of 'result'. The 99th percentile uses the nearest rank
+        // method.
+
+        std::vector<double> samples;
+        double totalMs = 0.0;
+
+        while (static_cast<int>(samples.size()) < MAX_SAMPLES
+            && (static_cast<int>(samples.size()) < options.minSamples || totalMs < options.minTimeMs))
+        {
+            BenchTimer timer;
+            function();
+            double elapsed = timer.elapsedMs();
+
+            samples.push_back(elapsed);
+            totalMs += elapsed;
+        }
+
+        std::sort(samples.begin(), samples.end());
+
+        size_t count = samples.size();
+        size_t p99Rank = (count * 99 + 99) / 100;
+
+        result.samples = static_cast<int>(count);
+        result.minMs = samples[0];
+        result.medianMs = (count % 2) ? samples[count / 2] : 0.5 * (samples[count / 2 - 1] + samples[count / 2]);
+        result.p99Ms = samples[std::min(p99Rank, count) - 1];
+    }
+
+    bool RunStage(const Options &options, int id, HeightMap &heightMap, Result &result)
+    {
+        // Runs one stage on 'heightMap', which holds a generated terrain.
+        // Returns false if the stage doesn't apply to the height map's size.
+
+        const Stage &stage = STAGES[id];
+        int size = heightMap.getSize();
+        double work = static_cast<double>(size) * size;
+
+        if ((stage.flags & STAGE_MESH) && size > options.maxMeshSize)
+            return false;
+
+        switch (id)
+        {
+        case DIAMOND_SQUARE:
+            Sample(options, [&]() { heightMap.generateDiamondSquareFractal(ROUGHNESS, SEED); }, result);
+            break;
+
+        case SMOOTH:
+            Sample(options, [&]() { heightMap.smooth(); }, result);
+            break;
+
+        case BLUR:
+            Sample(options, [&]() { heightMap.blur(0.5f); }, result);
+            break;
+
+        case NORMALS:
+            {
+                std::vector<float> normals(static_cast<size_t>(size) * size * 3);
+                Sample(options, [&]() { heightMap.computeNormals(&normals[0], 3); }, result);
+            }
+            break;
+
+        case VERTICES:
+            {
+                std::vector<TerrainMesh::Vertex> vertices(static_cast<size_t>(size) * size);
+                Sample(options, [&]() { TerrainMesh::buildVertices(heightMap, &vertices[0]); }, result);
+            }
+            break;
+
+        case STRIP_INDICES:
+            {
+                std::vector<unsigned int> indices(TerrainMesh::getStripIndexCount(size));
+                Sample(options, [&]() { TerrainMesh::buildStripIndices(size, &indices[0]); }, result);
+            }
+            break;
+
+        case PATCH_INDICES:
+            {
+                std::vector<unsigned int> indices;
+                std::vector<TerrainMesh::LodRange> ranges;
+
+                if (size < 32)
+                    return false;
+
+                // The terrain's patch size and levels of detail.
+                Sample(options, [&]() { TerrainMesh::buildPatchLodIndices(size, 32, 6, indices, ranges); }, result);
+            }
+            break;
+
+        case HEIGHT_AT:
+        case HEIGHT_AT_BATCH:
+            {
+                // Uses HeightMap::random() so every run queries the same points.
+
+                float extent = static_cast<float>(size * GRID_SPACING);
+                std::vector<float> x(QUERY_COUNT), z(QUERY_COUNT), heights(QUERY_COUNT);
+
+                for (int i = 0; i < QUERY_COUNT; ++i)
+                {
+                    x[i] = (HeightMap::random(1, i, 0, 0) * 0.5f + 0.5f) * extent;
+                    z[i] = (HeightMap::random(1, i, 0, 1) * 0.5f + 0.5f) * extent;
+                }
+
+                if (id == HEIGHT_AT)
+                {
+                    Sample(options, [&]()
+                    {
+                        for (int i = 0; i < QUERY_COUNT; ++i)
+                            heights[i] = heightMap.heightAt(x[i], z[i]);
+                    }, result);
+                }
+                else
+                {
+                    Sample(options, [&]() { heightMap.heightAtBatch(&x[0], &z[0], &heights[0], QUERY_COUNT); }, result);
+                }
+
+                work = QUERY_COUNT;
+            }
+            break;
+        }
+
+        result.stage = stage.pszName;
+        result.size = size;
+        result.pszUnit = (stage.flags & STAGE_QUERIES) ? "Mqueries/s" : "Mtexels/s";
+        result.throughput = work / (result.medianMs * 1000.0);
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    // JSON output and baseline comparison.
+
+    bool WriteJson(const Options &options, const std::vector<Result> &results, const char *pszFilename)
+    {
+        // Writes one result per line so a baseline can be read back without a
+        // JSON parser, and so diffs of stored results are readable.
+
+        FILE *pFile = fopen(pszFilename, "w");
+
+        if (!pFile)
+            return false;
+
+        fprintf(pFile, "{\n");
+        fprintf(pFile, "  \"benchmark\": \"bench_pipeline\",\n");
+        fprintf(pFile, "  \"simd_width\": %d,\n", static_cast<int>(Simd::WIDTH));
+        fprintf(pFile, "  \"hardware_threads\": %d,\n", ThreadPool::getHardwareThreadCount());
+        fprintf(pFile, "  \"min_samples\": %d,\n", options.minSamples);
+        fprintf(pFile, "  \"min_time_ms\": %g,\n", options.minTimeMs);
+        fprintf(pFile, "  \"results\": [\n");
+
+        for (size_t r = 0; r < results.size(); ++r)
+        {
+            const Result &result = results[r];
+
+            fprintf(pFile, "    {\"stage\": \"%s\", \"size\": %d, \"threads\": %d, \"samples\": %d, "
+                "\"median_ms\": %.4f, \"p99_ms\": %.4f, \"min_ms\": %.4f, \"throughput\": %.3f, \"unit\": \"%s\"}%s\n",
+                result.stage.c_str(), result.size, result.threads, result.samples, result.medianMs,
+                result.p99Ms, result.minMs, result.throughput, result.pszUnit,
+                (r + 1 < results.size()) ? "," : "");
+        }
+
+        fprintf(pFile, "  ]\n");
+        fprintf(pFile, "}\n");
+
+        bool succeeded = !ferror(pFile);
+
+        fclose(pFile);
+        return succeeded;
+    }
+
+    bool FindValue(const char *pszLine, const char *pszKey, std::string &value)
+    {
+        // Finds "key": value in a result line written by WriteJson().
+
+        std::string pattern = std::string("\"") + pszKey + "\": ";
+        const char *p = strstr(pszLine, pattern.c_str());
+
+        if (!p)
+            return false;
+
+        p += pattern.size();
+
+        if (*p == '"')
+        {
+            const char *pEnd = strchr(++p, '"');
+
+            if (!pEnd)
+                return false;
+
+            value.assign(p, pEnd);
+        }
+        else
+        {
+            value.assign(p, p + strcspn(p, ",}"));
+        }
+
+        return true;
+    }
+
+    bool ReadBaseline(const char *pszFilename, std::vector<Result> &results)
+    {
+        FILE *pFile = fopen(pszFilename, "r");
+
+        if (!pFile)
+            return false;
+
+        char line[1024];
+        std::string stage, size, threads, median;
+
+        results.clear();
+
+        while (fgets(line, sizeof(line), pFile))
+        {
+            if (!FindValue(line, "stage", stage) || !FindValue(line, "size", size)
+                || !FindValue(line, "threads", threads) || !FindValue(line, "median_ms", median))
+            {
+                continue;
+            }
+
+            Result result;
+
+            result.stage = stage;
+            result.size = atoi(size.c_str());
+            result.threads = atoi(threads.c_str());
+            result.medianMs = atof(median.c_str());
+            results.push_back(result);
+        }
+
+        fclose(pFile);
+        return true;
+    }
+
+    int CompareWithBaseline(const Options &options, const std::vector<Result> &results,
+                            const std::vector<Result> &baseline)
+    {
+        // Prints the change in each median against the baseline and returns
+        // the number of regressions. Results missing from the baseline are
+        // new stages or sizes and are skipped.
+
+        int regressions = 0;
+
+        printf("\ncompared with %s, tolerance %g%%\n\n", options.baselineFilename.c_str(), options.tolerance);
+        printf("%-16s %6s %7s %12s %12s %9s\n", "stage", "size", "threads", "baseline ms", "median ms", "change");
+
+        for (size_t r = 0; r < results.size(); ++r)
+        {
+            const Result &result = results[r];
+
+            for (size_t b = 0; b < baseline.size(); ++b)
+            {
+                const Result &previous = baseline[b];
+
+                if (previous.stage != result.stage || previous.size != result.size
+                    || previous.threads != result.threads || previous.medianMs <= 0.0)
+                {
+                    continue;
+                }
+
+                double change = 100.0 * (result.medianMs - previous.medianMs) / previous.medianMs;
+                bool regressed = change > options.tolerance;
+
+                printf("%-16s %6d %7d %12.3f %12.3f %+8.1f%%%s\n", result.stage.c_str(), result.size,
+                    result.threads, previous.medianMs, result.medianMs, change, regressed ? " REGRESSION" : "");
+
+                if (regressed)
+                    ++regressions;
+
+                break;
+            }
+        }
+
+        return regressions;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        fprintf(stderr,
+            "usage: bench_pipeline [--sizes LIST] [--threads LIST] [--min-samples N]\n"
+            "                      [--min-time-ms N] [--max-mesh-size N] [--json FILE]\n"
+            "                      [--baseline FILE] [--tolerance PCT]\n");
+        return 1;
+    }
+
+    std::vector<Result> baseline;
+
+    if (!options.baselineFilename.empty() && !ReadBaseline(options.baselineFilename.c_str(), baseline))
+    {
+        fprintf(stderr, "failed to read %s\n", options.baselineFilename.c_str());
+        return 1;
+    }
+
+    printf("terrain pipeline, at least %d samples and %g ms per stage, SIMD width %d\n\n",
+        options.minSamples, options.minTimeMs, static_cast<int>(Simd::WIDTH));
+    printf("%-16s %6s %7s %8s %12s %12s %14s\n", "stage", "size", "threads", "samples", "median ms", "p99 ms", "throughput");
+
+    std::vector<Result> results;
+
+    for (size_t s = 0; s < options.sizes.size(); ++s)
+    {
+        int size = options.sizes[s];
+        HeightMap heightMap;
+
+        if (!heightMap.create(size, GRID_SPACING, HEIGHT_SCALE))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        for (size_t t = 0; t < options.threads.size(); ++t)
+        {
+            int threads = options.threads[t];
+            ThreadPool pool;
+
+            if (threads > 1)
+            {
+                pool.create(threads);
+                heightMap.setThreadPool(&pool);
+            }
+
+            for (int id = 0; id < STAGE_COUNT; ++id)
+            {
+                if (threads > 1 && !(STAGES[id].flags & STAGE_THREADED))
+                    continue;
+
+                // Every stage after the first starts from the same terrain,
+                // since smoothing and blurring flatten it a little each time.
+                if (id != DIAMOND_SQUARE)
+                    heightMap.generateDiamondSquareFractal(ROUGHNESS, SEED);
+
+                Result result;
+
+                if (!RunStage(options, id, heightMap, result))
+                    continue;
+
+                result.threads = threads;
+                results.push_back(result);
+
+                printf("%-16s %6d %7d %8d %12.3f %12.3f %9.1f %s\n", result.stage.c_str(), size, threads,
+                    result.samples, result.medianMs, result.p99Ms, result.throughput, result.pszUnit);
+            }
+
+            heightMap.setThreadPool(0);
+        }
+    }
+
+    if (!options.jsonFilename.empty() && !WriteJson(options, results, options.jsonFilename.c_str()))
+    {
+        fprintf(stderr, "failed to write %s\n", options.jsonFilename.c_str());
+        return 1;
+    }
+
+    if (!baseline.empty() && CompareWithBaseline(options, results, baseline) > 0)
+        return 2;
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+//-----------------------------------------------------------------------------
+// Height map ray casting benchmark.
+//
+// Casts random rays against HeightMap::raycast() and reports the throughput
+// in millions of rays per second, both on a single thread and on a thread
+// pool using all hardware threads. The rays start at random points up to
+// twice the height map's highest possible altitude and point in random
+// downward directions, from steep to grazing. The time taken by
+// HeightMap::buildMinMaxPyramid() is also reported.
+//
+// Usage: bench_raycast [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_raycast.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_raycast
+//-----------------------------------------------------------------------------
+
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../height_map.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int ITERATIONS = 3;
+    const int RAY_COUNT = 1 << 18;
+    const int GRID_SPACING = 16;
+    const float HEIGHT_SCALE = 2.0f;
+
+    struct Ray
+    {
+        Vector3 origin;
+        Vector3 direction;
+    };
+
+    void GenerateRays(int size, std::vector<Ray> &rays)
+    {
+        // Uses HeightMap::random() so every run casts the same rays.
+
+        float extent = static_cast<float>((size - 1) * GRID_SPACING);
+
+        rays.resize(RAY_COUNT);
+
+        for (int i = 0; i < RAY_COUNT; ++i)
+        {
+            Ray &ray = rays[i];
+
+            ray.origin.x = (HeightMap::random(1, i, 0, 0) * 0.5f + 0.5f) * extent;
+            ray.origin.y = (HeightMap::random(1, i, 0, 1) * 0.5f + 0.5f) * 2.0f * 255.0f * HEIGHT_SCALE;
+            ray.origin.z = (HeightMap::random(1, i, 0, 2) * 0.5f + 0.5f) * extent;
+
+            ray.direction.x = HeightMap::random(1, i, 0, 3);
+            ray.direction.y = -(HeightMap::random(1, i, 0, 4) * 0.5f + 0.5f);
+            ray.direction.z = HeightMap::random(1, i, 0, 5);
+            ray.direction.normalize();
+        }
+    }
+
+    int CastRays(const HeightMap &heightMap, const std::vector<Ray> &rays, int begin, int end)
+    {
+        int hits = 0;
+        float distance;
+
+        for (int i = begin; i < end; ++i)
+        {
+            if (heightMap.raycast(rays[i].origin, rays[i].direction, 1e30f, distance))
+                ++hits;
+        }
+
+        return hits;
+    }
+
+    double TimeRaycasts(const HeightMap &heightMap, const std::vector<Ray> &rays, ThreadPool *pPool, int &hits)
+    {
+        double best = 0.0;
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            BenchTimer timer;
+
+            if (pPool)
+            {
+                // Each band counts into its own slot to avoid sharing a counter.
+
+                std::vector<int> bandHits(RAY_COUNT / 1024, 0);
+
+                pPool->parallelFor(0, static_cast<int>(bandHits.size()), [&](int begin, int end)
+                {
+                    for (int band = begin; band < end; ++band)
+                        bandHits[band] = CastRays(heightMap, rays, band * 1024, (band + 1) * 1024);
+                });
+
+                hits = 0;
+
+                for (size_t band = 0; band < bandHits.size(); ++band)
+                    hits += bandHits[band];
+            }
+            else
+            {
+                hits = CastRays(heightMap, rays, 0, RAY_COUNT);
+            }
+
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        return best;
+    }
+
+    double RaysPerSecond(double ms)
+    {
+        // Returns millions of rays per second.
+        return static_cast<double>(RAY_COUNT) / (ms * 1000.0);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(1024);
+        sizes.push_back(2048);
+        sizes.push_back(4096);
+        sizes.push_back(8192);
+    }
+
+    ThreadPool pool;
+    pool.create(ThreadPool::getHardwareThreadCount());
+
+    printf("raycast (millions of rays per second), %d rays, best of %d, %d threads\n\n",
+        RAY_COUNT, ITERATIONS, pool.getThreadCount());
+    printf("%-6s %12s %12s %12s %8s\n", "size", "build (ms)", "1 thread", "threaded", "hits");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 2 || !heightMap.create(size, GRID_SPACING, HEIGHT_SCALE))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+
+        BenchTimer buildTimer;
+        heightMap.buildMinMaxPyramid();
+        double buildMs = buildTimer.elapsedMs();
+
+        std::vector<Ray> rays;
+        GenerateRays(size, rays);
+
+        int hits = 0;
+        double singleMs = TimeRaycasts(heightMap, rays, 0, hits);
+        double threadedMs = TimeRaycasts(heightMap, rays, &pool, hits);
+
+        printf("%-6d %12.1f %12.2f %12.2f %7.1f%%\n", size, buildMs, RaysPerSecond(singleMs),
+            RaysPerSecond(threadedMs), 100.0 * hits / RAY_COUNT);
+    }
+
+    return 0;
+}
@@ -0,0 +1,176 @@
+//-----------------------------------------------------------------------------
+// Height map smoothing benchmark.
+//
+// Compares HeightMap::smooth() against the original implementation, which
+// copied the whole height map and ran a 3x3 box filter with 9 bounds checks
+// per texel. HeightMap::smooth() is timed both on a single thread and on a
+// thread pool using all hardware threads.
+//
+// The original filter only checked the linear texel index against the size
+// of the height map, so texels on the left and right edges averaged in texels
+// from the neighbouring rows. The maximum difference between the two filters
+// is therefore reported for the interior texels only.
+//
+// Usage: bench_smooth [size ...]
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. bench_smooth.cpp ..\height_map.cpp ..\height_map_file.cpp
+//     ..\profiler.cpp ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target bench_smooth
+//-----------------------------------------------------------------------------
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../height_map.h"
+#include "../simd.h"
+#include "../thread_pool.h"
+#include "bench_timer.h"
+
+namespace
+{
+    const int ITERATIONS = 3;
+
+    void OriginalSmooth(std::vector<float> &heights, int size)
+    {
+        // HeightMap::smooth() as it was before it was replaced by the
+        // separable filter.
+
+        std::vector<float> source(heights);
+        float value = 0.0f;
+        float cellAverage = 0.0f;
+        int i = 0;
+        int bounds = size * size;
+
+        for (int y = 0; y < size; ++y)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                value = 0.0f;
+                cellAverage = 0.0f;
+
+                for (int dy = -1; dy <= 1; ++dy)
+                {
+                    for (int dx = -1; dx <= 1; ++dx)
+                    {
+                        i = (y + dy) * size + (x + dx);
+
+                        if (i >= 0 && i < bounds)
+                        {
+                            value += source[i];
+                            cellAverage += 1.0f;
+                        }
+                    }
+                }
+
+                heights[y * size + x] = value / cellAverage;
+            }
+        }
+    }
+
+    double TimeHeightMapSmooth(HeightMap &heightMap, ThreadPool *pPool)
+    {
+        double best = 0.0;
+
+        heightMap.setThreadPool(pPool);
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            BenchTimer timer;
+            heightMap.smooth();
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < best)
+                best = elapsed;
+        }
+
+        heightMap.setThreadPool(0);
+        return best;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    std::vector<int> sizes;
+
+    for (int i = 1; i < argc; ++i)
+        sizes.push_back(atoi(argv[i]));
+
+    if (sizes.empty())
+    {
+        sizes.push_back(1024);
+        sizes.push_back(4096);
+        sizes.push_back(8192);
+    }
+
+    ThreadPool pool;
+    pool.create(ThreadPool::getHardwareThreadCount());
+
+    printf("3x3 box filter, best of %d, SIMD width %d, %d threads\n\n",
+        ITERATIONS, static_cast<int>(Simd::WIDTH), pool.getThreadCount());
+    printf("%-6s %12s %12s %12s %10s %10s %12s\n",
+        "size", "original ms", "simd ms", "threaded ms", "speedup", "threaded", "max diff");
+
+    for (size_t s = 0; s < sizes.size(); ++s)
+    {
+        int size = sizes[s];
+        HeightMap heightMap;
+
+        if (size < 4 || !heightMap.create(size, 16, 1.0f))
+        {
+            fprintf(stderr, "failed to create a %d x %d height map\n", size, size);
+            return 1;
+        }
+
+        heightMap.generateDiamondSquareFractal(1.2f, 12345);
+
+        std::vector<float> original(heightMap.getHeights(), heightMap.getHeights() + size * size);
+        double originalMs = 0.0;
+
+        for (int i = 0; i < ITERATIONS; ++i)
+        {
+            std::vector<float> heights(original);
+            BenchTimer timer;
+            OriginalSmooth(heights, size);
+            double elapsed = timer.elapsedMs();
+
+            if (i == 0 || elapsed < originalMs)
+                originalMs = elapsed;
+        }
+
+        // Compare a single pass of each filter over the same input.
+
+        std::vector<float> expected(original);
+        OriginalSmooth(expected, size);
+
+        HeightMap filtered;
+        filtered.create(size, 16, 1.0f);
+        filtered.generateDiamondSquareFractal(1.2f, 12345);
+        filtered.smooth();
+
+        float maxDiff = 0.0f;
+
+        for (int z = 1; z < size - 1; ++z)
+        {
+            for (int x = 1; x < size - 1; ++x)
+            {
+                float diff = fabsf(expected[z * size + x] - filtered.getHeights()[z * size + x]);
+
+                if (diff > maxDiff)
+                    maxDiff = diff;
+            }
+        }
+
+        double simdMs = TimeHeightMapSmooth(heightMap, 0);
+        double threadedMs = TimeHeightMapSmooth(heightMap, &pool);
+
+        printf("%-6d %12.2f %12.2f %12.2f %10.2f %10.2f %12g\n", size, originalMs,
+            simdMs, threadedMs, originalMs / simdMs, originalMs / threadedMs, maxDiff);
+    }
+
+    return 0;
+}
@@ -0,0 +1,59 @@
+#if !defined(BENCH_TIMER_H)
+#define BENCH_TIMER_H
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <chrono>
+#endif
+
+//-----------------------------------------------------------------------------
+// High resolution wall clock timer used by the benchmark programs.
+//
+// QueryPerformanceCounter() is used on Windows because the Visual C++ 2012
+// std::chrono::high_resolution_clock only has a resolution of about 1ms.
+//-----------------------------------------------------------------------------
+
+class BenchTimer
+{
+public:
+    BenchTimer()
+    {
+#if defined(_WIN32)
+        QueryPerformanceFrequency(&m_freq);
+#endif
+        start();
+    }
+
+    void start()
+    {
+#if defined(_WIN32)
+        QueryPerformanceCounter(&m_start);
+#else
+        m_start = std::chrono::steady_clock::now();
+#endif
+    }
+
+    double elapsedMs() const
+    {
+#if defined(_WIN32)
+        LARGE_INTEGER now;
+        QueryPerformanceCounter(&now);
+        return 1000.0 * static_cast<double>(now.QuadPart - m_start.QuadPart)
+            / static_cast<double>(m_freq.QuadPart);
+#else
+        std::chrono::steady_clock::duration elapsed = std::chrono::steady_clock::now() - m_start;
+        return std::chrono::duration<double, std::milli>(elapsed).count();
+#endif
+    }
+
+private:
+#if defined(_WIN32)
+    LARGE_INTEGER m_freq;
+    LARGE_INTEGER m_start;
+#else
+    std::chrono::steady_clock::time_point m_start;
+#endif
+};
+
+#endif
@@ -729,4 +729,6 @@ void Camera::updateViewMatrix()
     m_viewMatrix[3][0] = -Vector3::dot(m_xAxis, m_eye);
     m_viewMatrix[3][1] = -Vector3::dot(m_yAxis, m_eye);
     m_viewMatrix[3][2] = -Vector3::dot(m_zAxis, m_eye);
+
+    m_viewProjMatrix = m_viewMatrix * m_projMatrix;
 }
\ No newline at end of file
@@ -34,6 +34,25 @@ shader. The height is stored in the normal vector's 'w' component. Passing the
 vertex height this way to the fragment shader means that we don't need to look
 up the terrain height from the heightmap texture in the fragement shader.
 
+When COMPACT_VERTICES is defined the vertex shader expects the compact
+terrain vertex format instead. Each vertex only contains a 16-bit height
+('compactHeight') and an octahedral encoded normal ('compactNormal'). The grid
+position and the texture coordinates are rebuilt from gl_VertexID, which
+requires GL_EXT_gpu_shader4. The terrain vertex buffer is then 4 bytes per
+vertex rather than 32 bytes. Geomipmapped patches are drawn with gl_VertexID
+relative to the patch's first vertex, whose grid position is 'compactOrigin'.
+When they're drawn with a base vertex gl_VertexID already includes the patch's
+first vertex, and 'compactOrigin' is 0.
+
+When INSTANCED_PATCHES is defined the terrain is drawn as instances of a
+single patch. 'patchVertex' is the grid position of the vertex within the
+patch, and 'patchOrigin' is the grid position of the patch, which changes
+once per instance. The heights are fetched from the 'heightMap' float
+texture with texelFetch2D(), which also requires GL_EXT_gpu_shader4, and the
+normal is computed from the neighbouring heights in the same way as
+HeightMap::computeNormals(). Patches that hang over the far edges of the
+grid have their vertices clamped to the last row and column.
+
 The fragment shader is where all the work is done. Simple diffuse per-fragment
 lighting is applied to the terrain mesh. The resulting lit color is then
 modulated with the terrain texture color as calculated by the
@@ -48,10 +67,97 @@ regions.
 
 #version 120
 
+#if defined(COMPACT_VERTICES) || defined(INSTANCED_PATCHES)
+#extension GL_EXT_gpu_shader4 : require
+#endif
+
 uniform float tilingFactor;
 
 varying vec4 normal;
 
+#if defined(COMPACT_VERTICES)
+
+uniform int gridSize;
+uniform float gridSpacing;
+uniform float compactHeightScale;
+
+attribute float compactHeight;
+attribute vec2 compactNormal;
+attribute vec2 compactOrigin;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.x, 1.0 - abs(e.x) - abs(e.y), e.y);
+
+    if (n.y < 0.0)
+    {
+        vec2 signs = vec2(n.x >= 0.0 ? 1.0 : -1.0, n.z >= 0.0 ? 1.0 : -1.0);
+        n.xz = (1.0 - abs(n.zx)) * signs;
+    }
+
+    return normalize(n);
+}
+
+void main()
+{
+    int row = gl_VertexID / gridSize;
+    int x = gl_VertexID - row * gridSize + int(compactOrigin.x);
+    int z = row + int(compactOrigin.y);
+    vec4 vertex = vec4(float(x) * gridSpacing, compactHeight * compactHeightScale,
+                       float(z) * gridSpacing, 1.0);
+    vec2 texCoord = vec2(float(x), float(z)) / float(gridSize);
+
+    normal.xyz = normalize(gl_NormalMatrix * DecodeOctahedral(compactNormal / 127.0));
+    normal.w = vertex.y;
+
+    gl_Position = gl_ModelViewProjectionMatrix * vertex;
+    gl_TexCoord[0] = vec4(texCoord, 0.0, 1.0) * tilingFactor;
+}
+
+#elif defined(INSTANCED_PATCHES)
+
+uniform int gridSize;
+uniform float gridSpacing;
+uniform float heightScale;
+uniform sampler2D heightMap;
+
+attribute vec2 patchVertex;
+attribute vec2 patchOrigin;
+
+float HeightAt(int x, int z)
+{
+    ivec2 texel = clamp(ivec2(x, z), ivec2(0, 0), ivec2(gridSize - 1, gridSize - 1));
+    return texelFetch2D(heightMap, texel, 0).r;
+}
+
+void main()
+{
+    int last = gridSize - 1;
+    int x = min(int(patchOrigin.x + patchVertex.x), last);
+    int z = min(int(patchOrigin.y + patchVertex.y), last);
+    vec4 vertex = vec4(float(x) * gridSpacing, HeightAt(x, z) * heightScale,
+                       float(z) * gridSpacing, 1.0);
+    vec2 texCoord = vec2(float(x), float(z)) / float(gridSize);
+
+    // Central differences, one sided and doubled at the edges of the grid.
+    vec3 n = vec3(HeightAt(x - 1, z) - HeightAt(x + 1, z), 2.0 * gridSpacing,
+                  HeightAt(x, z - 1) - HeightAt(x, z + 1));
+
+    if (x == 0 || x == last)
+        n.x *= 2.0;
+
+    if (z == 0 || z == last)
+        n.z *= 2.0;
+
+    normal.xyz = normalize(gl_NormalMatrix * normalize(n));
+    normal.w = vertex.y;
+
+    gl_Position = gl_ModelViewProjectionMatrix * vertex;
+    gl_TexCoord[0] = vec4(texCoord, 0.0, 1.0) * tilingFactor;
+}
+
+#else
+
 void main()
 {
     normal.xyz = normalize(gl_NormalMatrix * gl_Normal);
@@ -61,6 +167,8 @@ void main()
     gl_TexCoord[0] = gl_MultiTexCoord0 * tilingFactor;
 }
 
+#endif
+
 [frag]
 
 #version 120
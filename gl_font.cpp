@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "gl_font.h"
+#include "gl_state_cache.h"
 
 // Taken from: wingdi.h
 #if !defined(CLEARTYPE_QUALITY)
@@ -26,7 +27,7 @@ GLFont::GLFont()
     m_charMaxWidth = 0;
     m_numCharsToDraw = 0;
     m_fontTexture = 0;
-    m_vertexBuffer = 0;
+    m_vertexOffset = 0;
     m_drawDropShadows = false;
     m_color[0] = m_color[1] = m_color[2] = m_color[3] = 1.0f;
     m_pVertex = 0;
@@ -108,10 +109,14 @@ bool GLFont::create(const char *pszName, int ptSize, Style style)
         return false;
     }
 
-    glGenBuffers(1, &m_vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * MAX_VERTICES, 0, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    // Each batch of characters gets its own part of the vertex buffer, so
+    // writing the next batch doesn't wait for the last one to be drawn.
+
+    if (!m_vertexBuffer.create(GL_ARRAY_BUFFER, sizeof(Vertex) * MAX_VERTICES * MAX_BATCHES_IN_FLIGHT))
+    {
+        destroy();
+        return false;
+    }
 
     return true;
 }
@@ -126,15 +131,11 @@ void GLFont::destroy()
 
     if (m_fontTexture)
     {
-        glDeleteTextures(1, &m_fontTexture);
+        GLStateCache::instance().deleteTexture(m_fontTexture);
         m_fontTexture = 0;
     }
 
-    if (m_vertexBuffer)
-    {
-        glDeleteBuffers(1, &m_vertexBuffer);
-        m_vertexBuffer = 0;
-    }
+    m_vertexBuffer.destroy();
 }
 
 void GLFont::begin()
@@ -154,8 +155,16 @@ void GLFont::begin()
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
+    // Text is drawn with the fixed function pipeline and the default vertex
+    // array, using texture unit 0.
+
+    GLStateCache &stateCache = GLStateCache::instance();
+
+    stateCache.useProgram(0);
+    stateCache.bindVertexArray(0);
+    stateCache.bindTexture(0, m_fontTexture);
+    stateCache.activeTexture(0);
     glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, m_fontTexture);
 
     glMatrixMode(GL_PROJECTION);
     glPushMatrix();
@@ -165,7 +174,7 @@ void GLFont::begin()
     glMatrixMode(GL_MODELVIEW);
     glLoadIdentity();
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    stateCache.bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer.getBuffer());
 
     drawTextBegin();
 }
@@ -296,9 +305,8 @@ void GLFont::end()
 {
     drawTextEnd();
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-
-    glBindTexture(GL_TEXTURE_2D, 0);
+    // The font's buffer and texture are left bound. Texture unit 0 is still
+    // the active one.
     glDisable(GL_TEXTURE_2D);
 
     glDisable(GL_BLEND);
@@ -414,7 +422,7 @@ bool GLFont::createTexture(const Bitmap &bitmap)
     bitmap.copyBytesAlpha8Bit(&pixels[0]);
 
     glGenTextures(1, &m_fontTexture);
-    glBindTexture(GL_TEXTURE_2D, m_fontTexture);
+    GLStateCache::instance().bindTexture(0, m_fontTexture);
 
     // Only use GL_NEAREST filtering for the min and mag filter. Using anything
     // else will cause the font glyphs to be blurred. Using only GL_NEAREST
@@ -428,8 +436,6 @@ bool GLFont::createTexture(const Bitmap &bitmap)
     glTexImage2D(GL_TEXTURE_2D, 0, GL_ALPHA, w, h, 0, GL_ALPHA,
         GL_UNSIGNED_BYTE, &pixels[0]);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-
     return true;
 }
 
@@ -489,9 +495,9 @@ void GLFont::drawBatchOfChars()
     glEnableClientState(GL_TEXTURE_COORD_ARRAY);
     glEnableClientState(GL_COLOR_ARRAY);
 
-    glVertexPointer(2, GL_INT, sizeof(Vertex), BUFFER_OFFSET(0));
-    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(sizeof(float) * 2));
-    glColorPointer(4, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(sizeof(float) * 4));
+    glVertexPointer(2, GL_INT, sizeof(Vertex), BUFFER_OFFSET(m_vertexOffset));
+    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(m_vertexOffset + sizeof(float) * 2));
+    glColorPointer(4, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(m_vertexOffset + sizeof(float) * 4));
 
     glDrawArrays(GL_QUADS, 0, m_numCharsToDraw * 4);
 
@@ -503,14 +509,14 @@ void GLFont::drawBatchOfChars()
 void GLFont::drawTextBegin()
 {
     m_numCharsToDraw = 0;
-    m_pVertex = reinterpret_cast<Vertex *>(glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY));
+    m_pVertex = static_cast<Vertex *>(m_vertexBuffer.map(sizeof(Vertex) * MAX_VERTICES, m_vertexOffset));
 }
 
 void GLFont::drawTextEnd()
 {
     if (m_pVertex)
     {
-        glUnmapBuffer(GL_ARRAY_BUFFER);
+        m_vertexBuffer.unmap(sizeof(Vertex) * 4 * m_numCharsToDraw);
         m_pVertex = 0;
     }
 
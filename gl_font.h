@@ -10,6 +10,7 @@
 
 #include "bitmap.h"
 #include "opengl.h"
+#include "stream_buffer.h"
 
 //-----------------------------------------------------------------------------
 // This GLFont class draws text as a bunch of textured quads. The GLFont class
@@ -105,6 +106,7 @@ private:
     static const int MAX_CHARS_PER_BATCH = 256;
     static const int MAX_STR_SIZE = 1024;
     static const int MAX_VERTICES = MAX_CHARS_PER_BATCH * 4;
+    static const int MAX_BATCHES_IN_FLIGHT = 12;
 
     static int m_logPixelsY;
     static BYTE m_lfQuality;
@@ -120,7 +122,8 @@ private:
     int m_charMaxWidth;
     int m_numCharsToDraw;
     GLuint m_fontTexture;
-    GLuint m_vertexBuffer;
+    size_t m_vertexOffset;
+    StreamBuffer m_vertexBuffer;
     bool m_drawDropShadows;
     float m_color[4];
     Vertex *m_pVertex;
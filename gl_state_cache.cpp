@@ -0,0 +1,278 @@
+
+
+#include <cassert>
+#include <cstring>
+
+#include "gl_state_cache.h"
+
+const GLuint GLStateCache::UNKNOWN;
+
+GLStateCache &GLStateCache::instance()
+{
+    static GLStateCache theInstance;
+    return theInstance;
+}
+
+GLStateCache::GLStateCache()
+{
+    memset(&m_frameStats, 0, sizeof(m_frameStats));
+    memset(&m_lastFrameStats, 0, sizeof(m_lastFrameStats));
+    m_supportsBaseVertex = -1;
+    m_supportsInstancing = -1;
+    m_supportsPrimitiveRestart = -1;
+    m_supportsVertexArrays = -1;
+    invalidate();
+}
+
+GLStateCache::~GLStateCache()
+{
+}
+
+void GLStateCache::activeTexture(GLuint unit)
+{
+    assert(unit < MAX_TEXTURE_UNITS);
+
+    if (m_activeTexture == unit)
+    {
+        ++m_frameStats.bindsFiltered;
+        return;
+    }
+
+    glActiveTexture(GL_TEXTURE0 + unit);
+    m_activeTexture = unit;
+    ++m_frameStats.bindsIssued;
+}
+
+void GLStateCache::beginFrame()
+{
+    // Starts counting the binds of a new frame. The counts of the frame that
+    // just ended are returned by getLastFrameStats().
+
+    m_lastFrameStats = m_frameStats;
+    memset(&m_frameStats, 0, sizeof(m_frameStats));
+}
+
+void GLStateCache::bindBuffer(GLenum target, GLuint buffer)
+{
+    // Only GL_ARRAY_BUFFER and GL_ELEMENT_ARRAY_BUFFER are tracked. Binds to
+    // any other target are always passed on, as are element array buffer
+    // binds while it's unknown which vertex array object is bound.
+
+    GLuint *pBinding = 0;
+
+    if (target == GL_ARRAY_BUFFER)
+    {
+        pBinding = &m_arrayBuffer;
+    }
+    else if (target == GL_ELEMENT_ARRAY_BUFFER)
+    {
+        if (m_vertexArray == UNKNOWN && !supportsVertexArrays())
+            m_vertexArray = 0;
+
+        if (m_vertexArray != UNKNOWN)
+            pBinding = &elementArrayBuffer(m_vertexArray);
+    }
+
+    if (pBinding && *pBinding == buffer)
+    {
+        ++m_frameStats.bindsFiltered;
+        return;
+    }
+
+    glBindBuffer(target, buffer);
+    ++m_frameStats.bindsIssued;
+
+    if (pBinding)
+        *pBinding = buffer;
+}
+
+void GLStateCache::bindTexture(GLuint unit, GLuint texture)
+{
+    // Binds 'texture' to the GL_TEXTURE_2D target of texture unit 'unit'.
+    // The active texture unit is only changed when the binding changes.
+
+    assert(unit < MAX_TEXTURE_UNITS);
+
+    if (m_textures[unit] == texture)
+    {
+        ++m_frameStats.bindsFiltered;
+        return;
+    }
+
+    activeTexture(unit);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    m_textures[unit] = texture;
+    ++m_frameStats.bindsIssued;
+}
+
+void GLStateCache::bindVertexArray(GLuint vertexArray)
+{
+    // Without vertex array object support only the default vertex array 0
+    // exists, so binding it does nothing.
+
+    if (!supportsVertexArrays())
+    {
+        assert(vertexArray == 0);
+        m_vertexArray = 0;
+        return;
+    }
+
+    if (m_vertexArray == vertexArray)
+    {
+        ++m_frameStats.bindsFiltered;
+        return;
+    }
+
+    glBindVertexArray(vertexArray);
+    m_vertexArray = vertexArray;
+    ++m_frameStats.bindsIssued;
+}
+
+void GLStateCache::deleteBuffer(GLuint buffer)
+{
+    // Deleting a buffer unbinds it from the current bindings. A vertex array
+    // object that isn't bound keeps its reference to the buffer, but the
+    // buffer's name can be reused, so those bindings become unknown.
+
+    if (!buffer)
+        return;
+
+    glDeleteBuffers(1, &buffer);
+
+    if (m_arrayBuffer == buffer)
+        m_arrayBuffer = 0;
+
+    for (size_t i = 0; i < m_elementArrayBuffers.size(); ++i)
+    {
+        if (m_elementArrayBuffers[i] == buffer)
+            m_elementArrayBuffers[i] = (i == m_vertexArray) ? 0 : UNKNOWN;
+    }
+}
+
+void GLStateCache::deleteProgram(GLuint program)
+{
+    // A program that's in use is only deleted once it's no longer in use,
+    // so it's unbound first.
+
+    if (!program)
+        return;
+
+    if (m_program == program)
+        useProgram(0);
+
+    glDeleteProgram(program);
+}
+
+void GLStateCache::deleteTexture(GLuint texture)
+{
+    // Deleting a texture reverts every texture unit bound to it to texture 0.
+
+    if (!texture)
+        return;
+
+    glDeleteTextures(1, &texture);
+
+    for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+    {
+        if (m_textures[i] == texture)
+            m_textures[i] = 0;
+    }
+}
+
+void GLStateCache::deleteVertexArray(GLuint vertexArray)
+{
+    // Deleting the bound vertex array object reverts to vertex array 0. A new
+    // vertex array object can reuse the name, so its element array buffer
+    // binding starts out unknown.
+
+    if (!vertexArray)
+        return;
+
+    glDeleteVertexArrays(1, &vertexArray);
+    elementArrayBuffer(vertexArray) = UNKNOWN;
+
+    if (m_vertexArray == vertexArray)
+        m_vertexArray = 0;
+}
+
+GLuint &GLStateCache::elementArrayBuffer(GLuint vertexArray)
+{
+    assert(vertexArray != UNKNOWN);
+
+    if (vertexArray >= m_elementArrayBuffers.size())
+        m_elementArrayBuffers.resize(vertexArray + 1, UNKNOWN);
+
+    return m_elementArrayBuffers[vertexArray];
+}
+
+void GLStateCache::invalidate()
+{
+    // Forgets every binding, so the next bind of each is passed on to OpenGL.
+
+    m_vertexArray = UNKNOWN;
+    m_arrayBuffer = UNKNOWN;
+    m_program = UNKNOWN;
+    m_activeTexture = UNKNOWN;
+
+    for (int i = 0; i < MAX_TEXTURE_UNITS; ++i)
+        m_textures[i] = UNKNOWN;
+
+    m_elementArrayBuffers.assign(m_elementArrayBuffers.size(), UNKNOWN);
+}
+
+bool GLStateCache::supportsBaseVertex()
+{
+    if (m_supportsBaseVertex < 0)
+    {
+        m_supportsBaseVertex = (OpenGLSupportsGLVersion(3, 2)
+            || OpenGLExtensionSupported("GL_ARB_draw_elements_base_vertex")) ? 1 : 0;
+    }
+
+    return m_supportsBaseVertex != 0;
+}
+
+bool GLStateCache::supportsInstancing()
+{
+    // Instanced draws with per instance vertex attributes.
+
+    if (m_supportsInstancing < 0)
+    {
+        m_supportsInstancing = (OpenGLSupportsGLVersion(3, 3)
+            || (OpenGLExtensionSupported("GL_ARB_draw_instanced")
+                && OpenGLExtensionSupported("GL_ARB_instanced_arrays"))) ? 1 : 0;
+    }
+
+    return m_supportsInstancing != 0;
+}
+
+bool GLStateCache::supportsPrimitiveRestart()
+{
+    if (m_supportsPrimitiveRestart < 0)
+        m_supportsPrimitiveRestart = OpenGLSupportsGLVersion(3, 1) ? 1 : 0;
+
+    return m_supportsPrimitiveRestart != 0;
+}
+
+bool GLStateCache::supportsVertexArrays()
+{
+    if (m_supportsVertexArrays < 0)
+    {
+        m_supportsVertexArrays = (OpenGLSupportsGLVersion(3, 0)
+            || OpenGLExtensionSupported("GL_ARB_vertex_array_object")) ? 1 : 0;
+    }
+
+    return m_supportsVertexArrays != 0;
+}
+
+void GLStateCache::useProgram(GLuint program)
+{
+    if (m_program == program)
+    {
+        ++m_frameStats.bindsFiltered;
+        return;
+    }
+
+    glUseProgram(program);
+    m_program = program;
+    ++m_frameStats.bindsIssued;
+}
@@ -0,0 +1,99 @@
+
+
+#if !defined(GL_STATE_CACHE_H)
+#define GL_STATE_CACHE_H
+
+#include <windows.h>
+#include <GL/gl.h>
+#include <vector>
+
+#include "opengl.h"
+
+//-----------------------------------------------------------------------------
+// Tracks the OpenGL object bindings of the current context and filters out
+// redundant binds.
+//
+// The cache remembers the bound vertex array object, GL_ARRAY_BUFFER,
+// GL_ELEMENT_ARRAY_BUFFER, shader program, active texture unit and the
+// GL_TEXTURE_2D texture of each texture unit. A bind is only passed on to
+// OpenGL when it changes the current binding. Every bind of this state must
+// go through the cache, and tracked objects must be deleted with the cache's
+// delete methods, otherwise the cache no longer matches OpenGL. Call
+// invalidate() after OpenGL state was changed behind the cache's back.
+//
+// The GL_ELEMENT_ARRAY_BUFFER binding is part of the vertex array object, so
+// it's tracked separately for each vertex array object.
+//
+// Vertex array objects record the vertex array state, so once a mesh's
+// vertex layout is recorded drawing it only needs a single bind. Code that
+// enables or points vertex arrays without its own vertex array object must
+// bind vertex array 0 first, or it changes whichever vertex array object is
+// still bound.
+//
+// To use the GLStateCache class:
+//  GLStateCache &stateCache = GLStateCache::instance();
+//  stateCache.beginFrame();
+//  stateCache.useProgram(program);
+//  stateCache.bindTexture(0, texture);
+//  stateCache.bindVertexArray(vertexArray);
+//  stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer);
+//  glDrawElements(...);
+//-----------------------------------------------------------------------------
+
+class GLStateCache
+{
+public:
+    enum { MAX_TEXTURE_UNITS = 16 };
+
+    struct FrameStats
+    {
+        int bindsIssued;        // binds passed on to OpenGL
+        int bindsFiltered;      // binds skipped, already bound
+    };
+
+    static GLStateCache &instance();
+
+    void activeTexture(GLuint unit);
+    void beginFrame();
+    void bindBuffer(GLenum target, GLuint buffer);
+    void bindTexture(GLuint unit, GLuint texture);
+    void bindVertexArray(GLuint vertexArray);
+    void deleteBuffer(GLuint buffer);
+    void deleteProgram(GLuint program);
+    void deleteTexture(GLuint texture);
+    void deleteVertexArray(GLuint vertexArray);
+    void invalidate();
+    bool supportsBaseVertex();
+    bool supportsInstancing();
+    bool supportsPrimitiveRestart();
+    bool supportsVertexArrays();
+    void useProgram(GLuint program);
+
+    const FrameStats &getLastFrameStats() const
+    { return m_lastFrameStats; }
+
+private:
+    static const GLuint UNKNOWN = ~0u;
+
+    GLStateCache();
+    ~GLStateCache();
+    GLStateCache(const GLStateCache &);
+    GLStateCache &operator=(const GLStateCache &);
+
+    GLuint &elementArrayBuffer(GLuint vertexArray);
+
+    FrameStats m_frameStats;
+    FrameStats m_lastFrameStats;
+    int m_supportsBaseVertex;       // -1 until first queried
+    int m_supportsInstancing;       // -1 until first queried
+    int m_supportsPrimitiveRestart; // -1 until first queried
+    int m_supportsVertexArrays;     // -1 until first queried
+    GLuint m_vertexArray;
+    GLuint m_arrayBuffer;
+    GLuint m_program;
+    GLuint m_activeTexture;
+    GLuint m_textures[MAX_TEXTURE_UNITS];
+    std::vector<GLuint> m_elementArrayBuffers;  // indexed by vertex array
+};
+
+#endif
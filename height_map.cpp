@@ -0,0 +1,2231 @@
+
+
+#include <algorithm>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <new>
+
+#include "height_map.h"
+#include "profiler.h"
+#include "simd.h"
+#include "thread_pool.h"
+
+namespace
+{
+    void BoxSumRow(const float *pSrc, float *pDst, int size)
+    {
+        // Sums each texel of the row 'pSrc' with its left and right
+        // neighbours. The first and last texels only have one neighbour.
+
+        int x = 1;
+
+        pDst[0] = pSrc[0] + pSrc[1];
+
+        for (; x + Simd::WIDTH <= size - 1; x += Simd::WIDTH)
+        {
+            SimdFloat sum = Simd::add(Simd::load(&pSrc[x - 1]), Simd::load(&pSrc[x]));
+            Simd::store(&pDst[x], Simd::add(sum, Simd::load(&pSrc[x + 1])));
+        }
+
+        for (; x < size - 1; ++x)
+            pDst[x] = pSrc[x - 1] + pSrc[x] + pSrc[x + 1];
+
+        pDst[size - 1] = pSrc[size - 2] + pSrc[size - 1];
+    }
+
+    void BoxAverageRows(const float *pA, const float *pB, const float *pC,
+                        const float *pWeights, float *pDst, int size)
+    {
+        // pDst = (pA + pB + pC) * pWeights. 'pC' may be null.
+
+        int x = 0;
+
+        if (pC)
+        {
+            for (; x + Simd::WIDTH <= size; x += Simd::WIDTH)
+            {
+                SimdFloat sum = Simd::add(Simd::load(&pA[x]), Simd::load(&pB[x]));
+                sum = Simd::add(sum, Simd::load(&pC[x]));
+                Simd::store(&pDst[x], Simd::mul(sum, Simd::load(&pWeights[x])));
+            }
+
+            for (; x < size; ++x)
+                pDst[x] = (pA[x] + pB[x] + pC[x]) * pWeights[x];
+        }
+        else
+        {
+            for (; x + Simd::WIDTH <= size; x += Simd::WIDTH)
+            {
+                SimdFloat sum = Simd::add(Simd::load(&pA[x]), Simd::load(&pB[x]));
+                Simd::store(&pDst[x], Simd::mul(sum, Simd::load(&pWeights[x])));
+            }
+
+            for (; x < size; ++x)
+                pDst[x] = (pA[x] + pB[x]) * pWeights[x];
+        }
+    }
+
+    void BlurRow(const float *pPrev, float *pRow, int columnBegin, int columnEnd, float amount)
+    {
+        // pRow = pPrev * amount + pRow * (1 - amount) for the columns
+        // [columnBegin, columnEnd).
+
+        float keep = 1.0f - amount;
+        SimdFloat amountVec = Simd::set(amount);
+        SimdFloat keepVec = Simd::set(keep);
+        int x = columnBegin;
+
+        for (; x + Simd::WIDTH <= columnEnd; x += Simd::WIDTH)
+        {
+            SimdFloat prev = Simd::mul(Simd::load(&pPrev[x]), amountVec);
+            Simd::store(&pRow[x], Simd::add(prev, Simd::mul(Simd::load(&pRow[x]), keepVec)));
+        }
+
+        for (; x < columnEnd; ++x)
+            pRow[x] = (pPrev[x] * amount) + (pRow[x] * keep);
+    }
+
+    void BlurColumns(float *pData, int rows, int pitch, int columnBegin, int columnEnd, float amount)
+    {
+        // Runs the blur recurrence down the columns [columnBegin, columnEnd) of
+        // the 'rows' x 'pitch' array 'pData', both top-to-bottom and
+        // bottom-to-top. The recurrence is serial down each column, so the
+        // columns are processed side by side one row at a time. This keeps
+        // every load and store sequential in memory and lets the columns of a
+        // row overlap in the pipeline.
+
+        for (int z = 1; z < rows; ++z)
+            BlurRow(&pData[(z - 1) * pitch], &pData[z * pitch], columnBegin, columnEnd, amount);
+
+        for (int z = rows - 2; z >= 0; --z)
+            BlurRow(&pData[(z + 1) * pitch], &pData[z * pitch], columnBegin, columnEnd, amount);
+    }
+
+    void Transpose(const float *pSrc, int srcPitch, int rows, int columns, float *pDst, int dstPitch)
+    {
+        // Writes the transpose of the 'rows' x 'columns' array 'pSrc' to
+        // 'pDst'. Blocks of Simd::WIDTH x Simd::WIDTH floats are transposed
+        // in registers. Whatever is left over is copied one float at a time.
+
+        int z = 0;
+
+        for (; z + Simd::WIDTH <= rows; z += Simd::WIDTH)
+        {
+            int x = 0;
+
+            for (; x + Simd::WIDTH <= columns; x += Simd::WIDTH)
+            {
+                SimdFloat block[Simd::WIDTH];
+
+                for (int i = 0; i < Simd::WIDTH; ++i)
+                    block[i] = Simd::load(&pSrc[(z + i) * srcPitch + x]);
+
+                Simd::transpose(block);
+
+                for (int i = 0; i < Simd::WIDTH; ++i)
+                    Simd::store(&pDst[(x + i) * dstPitch + z], block[i]);
+            }
+
+            for (; x < columns; ++x)
+            {
+                for (int i = z; i < z + Simd::WIDTH; ++i)
+                    pDst[x * dstPitch + i] = pSrc[i * srcPitch + x];
+            }
+        }
+
+        for (; z < rows; ++z)
+        {
+            for (int x = 0; x < columns; ++x)
+                pDst[x * dstPitch + z] = pSrc[z * srcPitch + x];
+        }
+    }
+
+    void NormalizeRow(float *pX, float *pY, float *pZ, int size)
+    {
+        // Normalizes the 'size' vectors stored in the arrays 'pX', 'pY' and
+        // 'pZ'. The reciprocal square root estimate is refined with one
+        // Newton-Raphson step, which is accurate to about 23 bits.
+
+        SimdFloat half = Simd::set(0.5f);
+        SimdFloat threeHalves = Simd::set(1.5f);
+        int x = 0;
+
+        for (; x + Simd::WIDTH <= size; x += Simd::WIDTH)
+        {
+            SimdFloat vx = Simd::load(&pX[x]);
+            SimdFloat vy = Simd::load(&pY[x]);
+            SimdFloat vz = Simd::load(&pZ[x]);
+            SimdFloat lengthSq = Simd::add(Simd::add(Simd::mul(vx, vx), Simd::mul(vy, vy)), Simd::mul(vz, vz));
+            SimdFloat invLength = Simd::rsqrt(lengthSq);
+
+            // invLength = invLength * (1.5 - 0.5 * lengthSq * invLength^2)
+            SimdFloat error = Simd::mul(Simd::mul(half, lengthSq), Simd::mul(invLength, invLength));
+            invLength = Simd::mul(invLength, Simd::sub(threeHalves, error));
+
+            Simd::store(&pX[x], Simd::mul(vx, invLength));
+            Simd::store(&pY[x], Simd::mul(vy, invLength));
+            Simd::store(&pZ[x], Simd::mul(vz, invLength));
+        }
+
+        for (; x < size; ++x)
+        {
+            float invLength = 1.0f / sqrtf(pX[x] * pX[x] + pY[x] * pY[x] + pZ[x] * pZ[x]);
+
+            pX[x] *= invLength;
+            pY[x] *= invLength;
+            pZ[x] *= invLength;
+        }
+    }
+
+    bool RayTriangle(const Vector3 &origin, const Vector3 &direction,
+                     const Vector3 &v0, const Vector3 &v1, const Vector3 &v2, float &t)
+    {
+        // Moller-Trumbore ray/triangle intersection. Both sides of the
+        // triangle are hit. Only hits with t >= 0 are reported.
+
+        Vector3 edge1 = v1 - v0;
+        Vector3 edge2 = v2 - v0;
+        Vector3 p = Vector3::cross(direction, edge2);
+        float det = Vector3::dot(edge1, p);
+
+        if (fabsf(det) < 1e-12f)
+            return false;
+
+        float invDet = 1.0f / det;
+        Vector3 s = origin - v0;
+        float u = Vector3::dot(s, p) * invDet;
+
+        if (u < 0.0f || u > 1.0f)
+            return false;
+
+        Vector3 q = Vector3::cross(s, edge1);
+        float v = Vector3::dot(direction, q) * invDet;
+
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+
+        t = Vector3::dot(edge2, q) * invDet;
+        return t >= 0.0f;
+    }
+
+    //-------------------------------------------------------------------------
+    // Erosion.
+
+    struct ErosionBrushTexel
+    {
+        int dx, dz;
+        float weight;
+    };
+
+    void BuildErosionBrush(int radius, std::vector<ErosionBrushTexel> &brush)
+    {
+        // The texels within 'radius' of a droplet, weighted by how close they
+        // are to it. The weights add up to 1.
+
+        float sum = 0.0f;
+
+        brush.clear();
+
+        for (int dz = -radius; dz <= radius; ++dz)
+        {
+            for (int dx = -radius; dx <= radius; ++dx)
+            {
+                float weight = static_cast<float>(radius) - sqrtf(static_cast<float>(dx * dx + dz * dz));
+
+                if (weight <= 0.0f)
+                    continue;
+
+                ErosionBrushTexel texel = {dx, dz, weight};
+                brush.push_back(texel);
+                sum += weight;
+            }
+        }
+
+        if (brush.empty())
+        {
+            ErosionBrushTexel texel = {0, 0, 1.0f};
+            brush.push_back(texel);
+            sum = 1.0f;
+        }
+
+        for (size_t i = 0; i < brush.size(); ++i)
+            brush[i].weight /= sum;
+    }
+
+    void HeightAndGradient(const float *pHeights, int size, float x, float z, float &height, float &gradX, float &gradZ)
+    {
+        // Bilinearly interpolates the height and the gradient of the cell
+        // that contains (x, z), in texels.
+
+        int ix = static_cast<int>(x);
+        int iz = static_cast<int>(z);
+        float u = x - static_cast<float>(ix);
+        float v = z - static_cast<float>(iz);
+        const float *pCell = &pHeights[iz * size + ix];
+        float h00 = pCell[0], h10 = pCell[1], h01 = pCell[size], h11 = pCell[size + 1];
+
+        gradX = (h10 - h00) * (1.0f - v) + (h11 - h01) * v;
+        gradZ = (h01 - h00) * (1.0f - u) + (h11 - h10) * u;
+        height = (h00 * (1.0f - u) + h10 * u) * (1.0f - v) + (h01 * (1.0f - u) + h11 * u) * v;
+    }
+
+    void SimulateDroplet(float *pHeights, int size, const HeightMap::HydraulicErosionParameters &params,
+                         const std::vector<ErosionBrushTexel> &brush, float x, float z)
+    {
+        // Rolls a droplet downhill from (x, z), one texel per step. Going
+        // downhill a droplet picks up sediment from the texels around it
+        // until it carries as much as its slope, speed and water allow. It
+        // drops sediment into the cell it leaves when it carries too much or
+        // goes uphill, but never more than fills the cell up to where it's
+        // going. A droplet never moves more than params.maxSteps texels
+        // from where it starts, and never touches texels further than
+        // params.radius + 1 texels from its path.
+
+        float dirX = 0.0f, dirZ = 0.0f;
+        float speed = 1.0f;
+        float water = 1.0f;
+        float sediment = 0.0f;
+
+        for (int step = 0; step < params.maxSteps; ++step)
+        {
+            int ix = static_cast<int>(x);
+            int iz = static_cast<int>(z);
+            float u = x - static_cast<float>(ix);
+            float v = z - static_cast<float>(iz);
+            float height = 0.0f, gradX = 0.0f, gradZ = 0.0f;
+
+            HeightAndGradient(pHeights, size, x, z, height, gradX, gradZ);
+
+            dirX = dirX * params.inertia - gradX * (1.0f - params.inertia);
+            dirZ = dirZ * params.inertia - gradZ * (1.0f - params.inertia);
+
+            float length = sqrtf(dirX * dirX + dirZ * dirZ);
+
+            // A droplet on perfectly flat ground has nowhere to go.
+            if (length <= 0.0f)
+                break;
+
+            dirX /= length;
+            dirZ /= length;
+            x += dirX;
+            z += dirZ;
+
+            if (x < 0.0f || z < 0.0f || x >= static_cast<float>(size - 1) || z >= static_cast<float>(size - 1))
+                break;
+
+            float newHeight = 0.0f;
+
+            HeightAndGradient(pHeights, size, x, z, newHeight, gradX, gradZ);
+
+            float deltaHeight = newHeight - height;
+            float capacity = std::max(-deltaHeight * speed * water * params.capacity, params.minCapacity);
+
+            if (sediment > capacity || deltaHeight > 0.0f)
+            {
+                float deposit = (deltaHeight > 0.0f) ? std::min(deltaHeight, sediment) : (sediment - capacity) * params.deposition;
+                float *pCell = &pHeights[iz * size + ix];
+
+                sediment -= deposit;
+                pCell[0] += deposit * (1.0f - u) * (1.0f - v);
+                pCell[1] += deposit * u * (1.0f - v);
+                pCell[size] += deposit * (1.0f - u) * v;
+                pCell[size + 1] += deposit * u * v;
+            }
+            else
+            {
+                float erode = std::min((capacity - sediment) * params.erosion, -deltaHeight);
+
+                for (size_t i = 0; i < brush.size(); ++i)
+                {
+                    int bx = ix + brush[i].dx;
+                    int bz = iz + brush[i].dz;
+
+                    if (bx < 0 || bz < 0 || bx >= size || bz >= size)
+                        continue;
+
+                    float amount = erode * brush[i].weight;
+
+                    pHeights[bz * size + bx] -= amount;
+                    sediment += amount;
+                }
+            }
+
+            speed = sqrtf(std::max(speed * speed - deltaHeight * params.gravity, 0.0f));
+            water *= 1.0f - params.evaporation;
+        }
+    }
+
+    float ThermalSlide(float d, float talus)
+    {
+        // The part of the height difference 'd' beyond the talus, with the
+        // sign of 'd'.
+
+        return std::max(d - talus, 0.0f) + std::min(d + talus, 0.0f);
+    }
+
+    float ThermalTexel(float h, float left, float right, float above, float below, float talus, float rate)
+    {
+        float inflow = ThermalSlide(left - h, talus) + ThermalSlide(right - h, talus);
+
+        inflow = inflow + ThermalSlide(above - h, talus);
+        inflow = inflow + ThermalSlide(below - h, talus);
+        return h + rate * inflow;
+    }
+
+    void ThermalErodeRow(const float *pAbove, const float *pRow, const float *pBelow, float *pDst,
+                         int size, float talus, float rate)
+    {
+        // One thermal erosion step of the row 'pRow' into 'pDst'. Each texel
+        // gains 'rate' times the part of the height difference to each of its
+        // 4 neighbours that exceeds 'talus', and loses the same when it's the
+        // higher one, so material is conserved. Neighbours outside the height
+        // map are passed as the texel itself, which exchanges nothing. The
+        // SIMD and scalar code perform the same operations in the same order,
+        // so the result doesn't depend on the SIMD width.
+
+        SimdFloat talusVec = Simd::set(talus);
+        SimdFloat rateVec = Simd::set(rate);
+        SimdFloat zero = Simd::set(0.0f);
+        int x = 1;
+
+        pDst[0] = ThermalTexel(pRow[0], pRow[0], pRow[1], pAbove[0], pBelow[0], talus, rate);
+
+        for (; x + Simd::WIDTH <= size - 1; x += Simd::WIDTH)
+        {
+            SimdFloat h = Simd::load(&pRow[x]);
+            SimdFloat d[4] =
+            {
+                Simd::sub(Simd::load(&pRow[x - 1]), h),
+                Simd::sub(Simd::load(&pRow[x + 1]), h),
+                Simd::sub(Simd::load(&pAbove[x]), h),
+                Simd::sub(Simd::load(&pBelow[x]), h)
+            };
+            SimdFloat slide[4];
+
+            for (int i = 0; i < 4; ++i)
+            {
+                slide[i] = Simd::add(Simd::maximum(Simd::sub(d[i], talusVec), zero),
+                    Simd::minimum(Simd::add(d[i], talusVec), zero));
+            }
+
+            SimdFloat inflow = Simd::add(Simd::add(Simd::add(slide[0], slide[1]), slide[2]), slide[3]);
+            Simd::store(&pDst[x], Simd::add(h, Simd::mul(rateVec, inflow)));
+        }
+
+        for (; x < size - 1; ++x)
+            pDst[x] = ThermalTexel(pRow[x], pRow[x - 1], pRow[x + 1], pAbove[x], pBelow[x], talus, rate);
+
+        pDst[size - 1] = ThermalTexel(pRow[size - 1], pRow[size - 2], pRow[size - 1],
+            pAbove[size - 1], pBelow[size - 1], talus, rate);
+    }
+
+    //-------------------------------------------------------------------------
+    // Gradient noise.
+    //
+    // The lattice is hashed with the permutation polynomial (34x^2 + x) mod
+    // 289 from Stefan Gustavson's GPU noise, which only needs float
+    // arithmetic and therefore vectorizes without integer or gather
+    // instructions. The hash repeats every 289 lattice cells, which the
+    // random offset and rotation of each octave hide.
+
+    // random() pass of the octave offsets. Diamond-square only uses passes
+    // from 0 up.
+    const int NOISE_PASS = -1;
+    const float NOISE_PERIOD = 289.0f;
+    // 2D gradient noise can reach +-0.7, but rarely goes beyond +-0.5.
+    const float NOISE_SCALE = 2.0f;
+    const int NOISE_WARP_OCTAVES = 2;
+    // How much each ridge octave is masked by the ridges of the octaves
+    // before it.
+    const float NOISE_RIDGE_SHARPNESS = 2.0f;
+
+    // Each octave's lattice is rotated by about 37 degrees against the one
+    // before it, so the lattice axes don't line up across octaves.
+    const float NOISE_ROTATION_COS = 0.8f;
+    const float NOISE_ROTATION_SIN = 0.6f;
+
+    const float NOISE_LANES[16] =
+    {
+        0.0f, 1.0f, 2.0f, 3.0f, 4.0f, 5.0f, 6.0f, 7.0f,
+        8.0f, 9.0f, 10.0f, 11.0f, 12.0f, 13.0f, 14.0f, 15.0f
+    };
+
+    struct NoiseOctave
+    {
+        float offsetX, offsetZ;     // in lattice cells
+        float amplitude;
+    };
+
+    void BuildNoiseOctaves(const HeightMap::NoiseParameters &params, int field, int count, NoiseOctave *pOctaves)
+    {
+        // The random lattice offsets and the amplitudes of the octaves of
+        // the noise field 'field'. The amplitudes add up to 1.
+
+        float amplitude = 1.0f;
+        float total = 0.0f;
+
+        for (int i = 0; i < count; ++i)
+        {
+            pOctaves[i].offsetX = HeightMap::random(params.seed, i, 2 * field, NOISE_PASS) * NOISE_PERIOD;
+            pOctaves[i].offsetZ = HeightMap::random(params.seed, i, 2 * field + 1, NOISE_PASS) * NOISE_PERIOD;
+            pOctaves[i].amplitude = amplitude;
+            total += amplitude;
+            amplitude *= params.gain;
+        }
+
+        for (int i = 0; i < count; ++i)
+            pOctaves[i].amplitude /= total;
+    }
+
+    SimdFloat NoiseAbs(SimdFloat a)
+    {
+        return Simd::maximum(a, Simd::sub(Simd::set(0.0f), a));
+    }
+
+    SimdFloat NoiseMod289(SimdFloat a)
+    {
+        SimdFloat periods = Simd::floor(Simd::mul(a, Simd::set(1.0f / NOISE_PERIOD)));
+        return Simd::sub(a, Simd::mul(periods, Simd::set(NOISE_PERIOD)));
+    }
+
+    SimdFloat NoisePermute(SimdFloat a)
+    {
+        // For integers a in [-2,600) every intermediate is an integer below
+        // 2^24, so this is exact. The multiply by 1 / 289 can leave
+        // the result one period off, but that doesn't change its value mod
+        // 289, and only depends on 'a'.
+
+        SimdFloat square = Simd::mul(Simd::add(Simd::mul(a, Simd::set(34.0f)), Simd::set(1.0f)), a);
+        return NoiseMod289(square);
+    }
+
+    SimdFloat NoiseGradient(SimdFloat hash, SimdFloat dx, SimdFloat dz)
+    {
+        // The dot product of (dx, dz) with the gradient picked by 'hash'.
+        // The gradients lie on a diamond, and are scaled to about unit length
+        // with a Taylor series of 1 / sqrt(length^2).
+
+        SimdFloat half = Simd::set(0.5f);
+        SimdFloat t = Simd::mul(hash, Simd::set(1.0f / 41.0f));
+        SimdFloat gx = Simd::sub(Simd::mul(Simd::set(2.0f), Simd::sub(t, Simd::floor(t))), Simd::set(1.0f));
+        SimdFloat gz = Simd::sub(NoiseAbs(gx), half);
+
+        gx = Simd::sub(gx, Simd::floor(Simd::add(gx, half)));
+
+        SimdFloat lengthSq = Simd::add(Simd::mul(gx, gx), Simd::mul(gz, gz));
+        SimdFloat scale = Simd::sub(Simd::set(1.79284291f), Simd::mul(Simd::set(0.85373472f), lengthSq));
+
+        return Simd::mul(scale, Simd::add(Simd::mul(gx, dx), Simd::mul(gz, dz)));
+    }
+
+    SimdFloat NoiseFade(SimdFloat t)
+    {
+        // 6t^5 - 15t^4 + 10t^3, which has zero first and second derivatives
+        // at 0 and 1.
+
+        SimdFloat p = Simd::add(Simd::mul(t, Simd::sub(Simd::mul(t, Simd::set(6.0f)), Simd::set(15.0f))), Simd::set(10.0f));
+        return Simd::mul(Simd::mul(Simd::mul(t, t), t), p);
+    }
+
+    SimdFloat GradientNoise(SimdFloat x, SimdFloat z)
+    {
+        // Perlin's gradient noise at (x, z), in about [-1,1].
+
+        SimdFloat one = Simd::set(1.0f);
+        SimdFloat cellX = Simd::floor(x);
+        SimdFloat cellZ = Simd::floor(z);
+        SimdFloat fx = Simd::sub(x, cellX);
+        SimdFloat fz = Simd::sub(z, cellZ);
+        SimdFloat fx1 = Simd::sub(fx, one);
+        SimdFloat fz1 = Simd::sub(fz, one);
+
+        cellX = NoiseMod289(cellX);
+        cellZ = NoiseMod289(cellZ);
+
+        SimdFloat hashX0 = NoisePermute(cellX);
+        SimdFloat hashX1 = NoisePermute(Simd::add(cellX, one));
+        SimdFloat cellZ1 = Simd::add(cellZ, one);
+        SimdFloat n00 = NoiseGradient(NoisePermute(Simd::add(hashX0, cellZ)), fx, fz);
+        SimdFloat n10 = NoiseGradient(NoisePermute(Simd::add(hashX1, cellZ)), fx1, fz);
+        SimdFloat n01 = NoiseGradient(NoisePermute(Simd::add(hashX0, cellZ1)), fx, fz1);
+        SimdFloat n11 = NoiseGradient(NoisePermute(Simd::add(hashX1, cellZ1)), fx1, fz1);
+
+        SimdFloat u = NoiseFade(fx);
+        SimdFloat top = Simd::add(n00, Simd::mul(u, Simd::sub(n10, n00)));
+        SimdFloat bottom = Simd::add(n01, Simd::mul(u, Simd::sub(n11, n01)));
+        SimdFloat n = Simd::add(top, Simd::mul(NoiseFade(fz), Simd::sub(bottom, top)));
+
+        return Simd::mul(n, Simd::set(NOISE_SCALE));
+    }
+
+    SimdFloat FractalNoise(SimdFloat x, SimdFloat z, const NoiseOctave *pOctaves, int count,
+                           float lacunarity, bool ridged)
+    {
+        // Sums 'count' octaves of gradient noise at (x, z), which are in
+        // lattice cells of the first octave. Returns fBm in about [-1,1], or
+        // ridged multifractal noise in [0,1].
+
+        SimdFloat sum = Simd::set(0.0f);
+        SimdFloat weight = Simd::set(1.0f);
+        SimdFloat one = Simd::set(1.0f);
+        SimdFloat cosine = Simd::set(NOISE_ROTATION_COS * lacunarity);
+        SimdFloat sine = Simd::set(NOISE_ROTATION_SIN * lacunarity);
+
+        for (int i = 0; i < count; ++i)
+        {
+            SimdFloat n = GradientNoise(Simd::add(x, Simd::set(pOctaves[i].offsetX)),
+                Simd::add(z, Simd::set(pOctaves[i].offsetZ)));
+
+            if (ridged)
+            {
+                SimdFloat ridge = Simd::sub(one, NoiseAbs(n));
+
+                ridge = Simd::mul(Simd::mul(ridge, ridge), weight);
+                weight = Simd::minimum(Simd::mul(ridge, Simd::set(NOISE_RIDGE_SHARPNESS)), one);
+                n = ridge;
+            }
+
+            sum = Simd::add(sum, Simd::mul(n, Simd::set(pOctaves[i].amplitude)));
+
+            SimdFloat nextX = Simd::sub(Simd::mul(x, cosine), Simd::mul(z, sine));
+            z = Simd::add(Simd::mul(x, sine), Simd::mul(z, cosine));
+            x = nextX;
+        }
+
+        return sum;
+    }
+
+    void NoiseRow(const HeightMap::NoiseParameters &params, const NoiseOctave *pOctaves, int count,
+                  const NoiseOctave *pWarpX, const NoiseOctave *pWarpZ, int x0, int z, int width, float *pDst)
+    {
+        // The heights of the 'width' texels starting at noise coordinates
+        // (x0, z). The last block of a row is computed in full and only
+        // partly stored, so every texel goes through the same instructions.
+
+        float tail[Simd::WIDTH];
+        SimdFloat lanes = Simd::load(NOISE_LANES);
+        SimdFloat rowZ = Simd::set(static_cast<float>(z));
+        SimdFloat frequency = Simd::set(params.frequency);
+        SimdFloat warpFrequency = Simd::set(params.warpFrequency);
+        SimdFloat warp = Simd::set(params.warp);
+        SimdFloat scale = Simd::set(params.ridged ? 255.0f : 127.5f);
+        SimdFloat bias = Simd::set(params.ridged ? 0.0f : 127.5f);
+
+        for (int x = 0; x < width; x += Simd::WIDTH)
+        {
+            SimdFloat px = Simd::add(Simd::set(static_cast<float>(x0 + x)), lanes);
+            SimdFloat pz = rowZ;
+
+            if (params.warp > 0.0f)
+            {
+                SimdFloat wx = Simd::mul(px, warpFrequency);
+                SimdFloat wz = Simd::mul(pz, warpFrequency);
+                SimdFloat dx = FractalNoise(wx, wz, pWarpX, NOISE_WARP_OCTAVES, params.lacunarity, false);
+                SimdFloat dz = FractalNoise(wx, wz, pWarpZ, NOISE_WARP_OCTAVES, params.lacunarity, false);
+
+                px = Simd::add(px, Simd::mul(dx, warp));
+                pz = Simd::add(pz, Simd::mul(dz, warp));
+            }
+
+            SimdFloat n = FractalNoise(Simd::mul(px, frequency), Simd::mul(pz, frequency),
+                pOctaves, count, params.lacunarity, params.ridged);
+            SimdFloat h = Simd::add(Simd::mul(n, scale), bias);
+
+            h = Simd::minimum(Simd::maximum(h, Simd::set(0.0f)), Simd::set(255.0f));
+
+            if (x + Simd::WIDTH <= width)
+            {
+                Simd::store(&pDst[x], h);
+            }
+            else
+            {
+                Simd::store(tail, h);
+                std::copy(tail, tail + (width - x), &pDst[x]);
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// HeightMap.
+//-----------------------------------------------------------------------------
+
+HeightMap::HydraulicErosionParameters::HydraulicErosionParameters()
+{
+    dropletCount = 100000;
+    maxSteps = 64;
+    radius = 3;
+    inertia = 0.05f;
+    capacity = 4.0f;
+    minCapacity = 0.01f;
+    erosion = 0.3f;
+    deposition = 0.3f;
+    evaporation = 0.02f;
+    gravity = 4.0f;
+    seed = 1;
+}
+
+HeightMap::NoiseParameters::NoiseParameters()
+{
+    frequency = 1.0f / 256.0f;
+    octaves = 8;
+    lacunarity = 2.0f;
+    gain = 0.5f;
+    ridged = false;
+    warp = 0.0f;
+    warpFrequency = 1.0f / 512.0f;
+    offsetX = 0;
+    offsetZ = 0;
+    seed = 1;
+}
+
+HeightMap::HeightMap() : m_size(0), m_gridSpacing(0), m_heightScale(1.0f), m_seed(0), m_pThreadPool(0)
+{
+}
+
+HeightMap::~HeightMap()
+{
+    destroy();
+}
+
+bool HeightMap::create(int size, int gridSpacing, float scale)
+{
+    // The min/max pyramid of the previous height field no longer matches,
+    // so everything is thrown away first, as load() does.
+
+    destroy();
+
+    m_heightScale = scale;
+    m_size = size;
+    m_gridSpacing = gridSpacing;
+
+    try
+    {
+        m_heights.resize(m_size * m_size);
+    }
+    catch (const std::bad_alloc &)
+    {
+        return false;
+    }
+
+    memset(&m_heights[0], 0, m_heights.size());
+    return true;
+}
+
+void HeightMap::destroy()
+{
+    m_heightScale = 1.0f;
+    m_size = 0;
+    m_gridSpacing = 0;
+    m_seed = 0;
+    m_heights.clear();
+    m_minMaxPyramid.clear();
+    m_minMaxLevelOffsets.clear();
+}
+
+bool HeightMap::load(const char *pszFilename)
+{
+    // Loads a height map written by save(). Files of float heights in row
+    // order are memory mapped, so loading only reads the header and the
+    // heights are paged in from disk as they're first used. All other files
+    // are converted to row order floats as they're read.
+    //
+    // The heights are loaded into a separate array that only replaces the
+    // current heights once it has been loaded in full, so the height map is
+    // left unchanged when loading fails.
+
+    HeightMapFile file;
+    HeightArray heights;
+
+    if (!file.open(pszFilename))
+        return false;
+
+    HeightMapFileHeader header = file.getHeader();
+    size_t count = static_cast<size_t>(header.size) * header.size;
+
+    if (header.sampleFormat == HeightMapFile::SAMPLE_FLOAT && file.isRowOrder())
+    {
+        file.close();
+
+        if (!heights.map(pszFilename, static_cast<size_t>(header.dataOffset), count))
+            return false;
+    }
+    else
+    {
+        try
+        {
+            heights.resize(count);
+        }
+        catch (const std::bad_alloc &)
+        {
+            return false;
+        }
+
+        if (!file.readHeights(&heights[0]))
+            return false;
+    }
+
+    destroy();
+    m_heights.swap(heights);
+    m_size = header.size;
+    m_gridSpacing = header.gridSpacing;
+    m_heightScale = header.heightScale;
+    m_seed = header.seed;
+    return true;
+}
+
+bool HeightMap::save(const char *pszFilename, HeightMapFile::SampleFormat sampleFormat, int tileSize) const
+{
+    // A 'tileSize' of 0 saves the heights in row order, which load() can
+    // memory map when 'sampleFormat' is SAMPLE_FLOAT. Tiled files are meant
+    // to be paged with a PagedHeightMap.
+
+    if (m_heights.size() == 0)
+        return false;
+
+    return HeightMapFile::write(pszFilename, &m_heights[0], m_size, m_gridSpacing,
+        m_heightScale, m_seed, tileSize, sampleFormat);
+}
+
+void HeightMap::generateDiamondSquareFractal(float roughness)
+{
+    generateDiamondSquareFractal(roughness, static_cast<unsigned int>(time(0)));
+}
+
+void HeightMap::generateDiamondSquareFractal(float roughness, unsigned int seed)
+{
+    // Generates a fractal height field using the diamond-square (midpoint
+    // displacement) algorithm. Note that only square height fields work with
+    // this algorithm.
+    //
+    // Based on article and associated code:
+    // "Fractal Terrain Generation - Midpoint Displacement" by Jason Shankel
+    // (Game Programming Gems I, pp.503-507).
+    //
+    // The random displacement of each cell comes from random(), which is
+    // keyed by the seed, the cell being written and the pass writing it. The
+    // displacement of any cell can therefore be computed independently of all
+    // the others, and the height field only depends on 'seed'. When a thread
+    // pool has been set each pass is split into row bands and run on the pool.
+
+    PROFILE_ZONE("HeightMap::generateDiamondSquareFractal");
+
+    m_seed = seed;
+
+    std::fill(m_heights.begin(), m_heights.end(), 0.0f);
+
+    float dH = m_size * 0.5f;
+    float dHFactor = powf(2.0f, -roughness);
+    float minH = 0.0f, maxH = 0.0f;
+    int pass = 0;
+
+    for (int w = m_size; w > 0; dH *= dHFactor, w /= 2, pass += 3)
+    {
+        diamondSquareStep(DIAMOND_STEP, w, pass, dH, minH, maxH);
+        diamondSquareStep(SQUARE_STEP, w, pass + 1, dH, minH, maxH);
+    }
+
+    smooth();
+
+    // Normalize height field so altitudes fall into range [0,255].
+
+    if (m_pThreadPool)
+    {
+        m_pThreadPool->parallelFor(0, m_size * m_size, [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+                m_heights[i] = 255.0f * (m_heights[i] - minH) / (maxH - minH);
+        });
+    }
+    else
+    {
+        for (int i = 0; i < m_size * m_size; ++i)
+            m_heights[i] = 255.0f * (m_heights[i] - minH) / (maxH - minH);
+    }
+}
+
+void HeightMap::generateNoise(const NoiseParameters &params)
+{
+    // Fills the height field with fractal gradient noise (see
+    // evaluateNoise()). Unlike diamond-square this works for any size, and
+    // the heights aren't rescaled to the range the terrain happens to cover.
+    // When a thread pool has been set the rows are split into one band per
+    // thread. Call buildMinMaxPyramid() afterwards.
+
+    PROFILE_ZONE("HeightMap::generateNoise");
+
+    Rect rect = {0, 0, m_size, m_size};
+
+    m_seed = params.seed;
+    generateNoiseRows(params, rect);
+}
+
+void HeightMap::generateNoise(const NoiseParameters &params, const Rect &rect)
+{
+    // Regenerates only the texels in 'rect', which come out exactly as
+    // generateNoise() would have made them, and updates the min/max pyramid
+    // over them if it has been built. Use it to fill a height map in pieces,
+    // or to restore part of an edited one. Like generateNoise() it records
+    // the seed that getSeed() returns.
+
+    PROFILE_ZONE("HeightMap::generateNoise");
+
+    Rect clipped = {std::max(rect.x0, 0), std::max(rect.z0, 0),
+        std::min(rect.x1, m_size), std::min(rect.z1, m_size)};
+
+    if (clipped.isEmpty())
+        return;
+
+    m_seed = params.seed;
+    generateNoiseRows(params, clipped);
+    updateMinMaxPyramid(clipped);
+}
+
+void HeightMap::evaluateNoise(const NoiseParameters &params, int x0, int z0, int width, int height, float *pHeights, int stride)
+{
+    // Writes the heights of the 'width' x 'height' texels starting at texel
+    // (x0, z0) to 'pHeights', with rows 'stride' floats apart. The heights
+    // are octaves of Perlin gradient noise in [0,255]: fBm, or ridged
+    // multifractal noise, with the sample positions optionally displaced by
+    // two more fields of fBm (domain warping).
+    //
+    // A texel only depends on its coordinates and 'params', so any part of
+    // the height field can be generated on its own, such as the tiles of a
+    // PagedHeightMap. Simd::WIDTH texels of a row are evaluated at once.
+
+    int count = std::min(std::max(params.octaves, 1), static_cast<int>(MAX_NOISE_OCTAVES));
+    NoiseOctave octaves[MAX_NOISE_OCTAVES];
+    NoiseOctave warpX[NOISE_WARP_OCTAVES];
+    NoiseOctave warpZ[NOISE_WARP_OCTAVES];
+
+    BuildNoiseOctaves(params, 0, count, octaves);
+    BuildNoiseOctaves(params, 1, NOISE_WARP_OCTAVES, warpX);
+    BuildNoiseOctaves(params, 2, NOISE_WARP_OCTAVES, warpZ);
+
+    for (int z = 0; z < height; ++z)
+    {
+        NoiseRow(params, octaves, count, warpX, warpZ, x0 + params.offsetX, z0 + z + params.offsetZ,
+            width, &pHeights[z * stride]);
+    }
+}
+
+float HeightMap::random(unsigned int seed, int x, int z, int pass)
+{
+    // Counter based random number generator. Returns a random number in range
+    // [-1,1) that only depends on the key (seed, x, z, pass). The key is
+    // hashed with Math::splitMix64().
+    //
+    // The diamond-square generator uses pass 3 * i for the diamond step of its
+    // i-th pass, and passes 3 * i + 1 and 3 * i + 2 for the two cells written
+    // by each cell of the square step.
+
+    unsigned long long key = (static_cast<unsigned long long>(seed) << 32) | static_cast<unsigned int>(pass);
+    unsigned long long cell = (static_cast<unsigned long long>(static_cast<unsigned int>(z)) << 32) | static_cast<unsigned int>(x);
+    unsigned long long h = Math::splitMix64(Math::splitMix64(key) ^ cell);
+
+    // Use the top 24 bits, which is all the precision a float can hold.
+    return static_cast<float>(h >> 40) * (1.0f / 8388608.0f) - 1.0f;
+}
+
+float HeightMap::heightAt(float x, float z) const
+{
+    // Given a (x, z) position on the rendered height map this method
+    // calculates the exact height of the height map at that (x, z)
+    // position using bilinear interpolation.
+
+    x /= static_cast<float>(m_gridSpacing);
+    z /= static_cast<float>(m_gridSpacing);
+
+    assert(x >= 0.0f && x < float(m_size));
+    assert(z >= 0.0f && z < float(m_size));
+
+    long ix = Math::floatToLong(x);
+    long iz = Math::floatToLong(z);
+    float topLeft = m_heights[heightIndexAt(ix, iz)] * m_heightScale;
+    float topRight = m_heights[heightIndexAt(ix + 1, iz)] * m_heightScale;
+    float bottomLeft = m_heights[heightIndexAt(ix, iz + 1)] * m_heightScale;
+    float bottomRight = m_heights[heightIndexAt(ix + 1, iz + 1)] * m_heightScale;
+    float percentX = x - static_cast<float>(ix);
+    float percentZ = z - static_cast<float>(iz);
+
+    return Math::bilerp(topLeft, topRight, bottomLeft, bottomRight, percentX, percentZ);
+}
+
+void HeightMap::heightAtBatch(const float *pX, const float *pZ, float *pHeights, int count) const
+{
+    // Computes heightAt() for the 'count' points whose coordinates are
+    // stored in the arrays 'pX' and 'pZ', and writes the heights to
+    // 'pHeights'. Simd::WIDTH points are interpolated at a time. The results
+    // can differ from heightAt() in the last bit.
+
+    int i = 0;
+
+    for (; i + Simd::WIDTH <= count; i += Simd::WIDTH)
+        heightAtBlock(&pX[i], &pZ[i], &pHeights[i]);
+
+    if (i < count)
+    {
+        // Pad the last block with points at the origin.
+
+        float x[Simd::WIDTH] = {0.0f};
+        float z[Simd::WIDTH] = {0.0f};
+        float heights[Simd::WIDTH];
+
+        std::copy(pX + i, pX + count, x);
+        std::copy(pZ + i, pZ + count, z);
+        heightAtBlock(x, z, heights);
+        std::copy(heights, heights + (count - i), pHeights + i);
+    }
+}
+
+void HeightMap::normalAt(float x, float z, Vector3 &n) const
+{
+    // Given a (x, z) position on the rendered height map this method
+    // calculates the exact normal of the height map at that (x, z) position
+    // using bilinear interpolation.
+
+    x /= static_cast<float>(m_gridSpacing);
+    z /= static_cast<float>(m_gridSpacing);
+
+    assert(x >= 0.0f && x < float(m_size));
+    assert(z >= 0.0f && z < float(m_size));
+
+    long ix = Math::floatToLong(x);
+    long iz = Math::floatToLong(z);
+
+    float percentX = x - static_cast<float>(ix);
+    float percentZ = z - static_cast<float>(iz);
+
+    Vector3 topLeft;
+    Vector3 topRight;
+    Vector3 bottomLeft;
+    Vector3 bottomRight;
+    Vector3 normal;
+
+    normalAtPixel(ix, iz, topLeft);
+    normalAtPixel(ix + 1, iz, topRight);
+    normalAtPixel(ix, iz + 1, bottomLeft);
+    normalAtPixel(ix + 1, iz + 1, bottomRight);
+
+    n = Math::bilerp(topLeft, topRight, bottomLeft, bottomRight, percentX, percentZ);
+    n.normalize();
+}
+
+void HeightMap::normalAtBatch(const float *pX, const float *pZ, float *pNx, float *pNy, float *pNz, int count) const
+{
+    // Computes normalAt() for the 'count' points whose coordinates are
+    // stored in the arrays 'pX' and 'pZ', and writes the normals' components
+    // to 'pNx', 'pNy' and 'pNz'. Simd::WIDTH points are interpolated at a
+    // time. The results can differ from normalAt() in the last few bits.
+
+    int i = 0;
+
+    for (; i + Simd::WIDTH <= count; i += Simd::WIDTH)
+        normalAtBlock(&pX[i], &pZ[i], &pNx[i], &pNy[i], &pNz[i]);
+
+    if (i < count)
+    {
+        // Pad the last block with points at the origin.
+
+        float x[Simd::WIDTH] = {0.0f};
+        float z[Simd::WIDTH] = {0.0f};
+        float nx[Simd::WIDTH], ny[Simd::WIDTH], nz[Simd::WIDTH];
+
+        std::copy(pX + i, pX + count, x);
+        std::copy(pZ + i, pZ + count, z);
+        normalAtBlock(x, z, nx, ny, nz);
+        std::copy(nx, nx + (count - i), pNx + i);
+        std::copy(ny, ny + (count - i), pNy + i);
+        std::copy(nz, nz + (count - i), pNz + i);
+    }
+}
+
+void HeightMap::normalAtPixel(int x, int z, Vector3 &n) const
+{
+    // Returns the normal at the specified location on the height map.
+    // The normal is calculated using the properties of the height map.
+    // This approach is much quicker and more elegant than triangulating the
+    // height map and averaging triangle surface normals.
+
+    if (x > 0 && x < m_size - 1)
+        n.x = heightAtPixel(x - 1, z) - heightAtPixel(x + 1, z);
+    else if (x > 0)
+        n.x = 2.0f * (heightAtPixel(x - 1, z) - heightAtPixel(x, z));
+    else
+        n.x = 2.0f * (heightAtPixel(x, z) - heightAtPixel(x + 1, z));
+
+    if (z > 0 && z < m_size - 1)
+        n.z = heightAtPixel(x, z - 1) - heightAtPixel(x, z + 1);
+    else if (z > 0)
+        n.z = 2.0f * (heightAtPixel(x, z - 1) - heightAtPixel(x, z));
+    else
+        n.z = 2.0f * (heightAtPixel(x, z) - heightAtPixel(x, z + 1));
+
+    n.y = 2.0f * m_gridSpacing;
+    n.normalize();
+}
+
+void HeightMap::buildMinMaxNodes(int level, const Rect &nodes)
+{
+    // Rebuilds the nodes 'nodes' of level 'level' of the min/max pyramid
+    // from the level below it, or from the height map for level 1.
+
+    int levelSize = minMaxLevelSize(level);
+    MinMax *pLevel = &m_minMaxPyramid[m_minMaxLevelOffsets[level]];
+    const MinMax *pChildren = &m_minMaxPyramid[m_minMaxLevelOffsets[level - 1]];
+
+    for (int z = nodes.z0; z < nodes.z1; ++z)
+    {
+        for (int x = nodes.x0; x < nodes.x1; ++x)
+        {
+            MinMax &node = pLevel[z * levelSize + x];
+
+            if (level == 1)
+            {
+                // The node spans up to 3 x 3 texels.
+
+                int x0 = x * 2, x1 = std::min(x0 + 2, m_size - 1);
+                int z0 = z * 2, z1 = std::min(z0 + 2, m_size - 1);
+
+                node.minH = node.maxH = m_heights[z0 * m_size + x0];
+
+                for (int tz = z0; tz <= z1; ++tz)
+                {
+                    for (int tx = x0; tx <= x1; ++tx)
+                    {
+                        node.minH = std::min(node.minH, m_heights[tz * m_size + tx]);
+                        node.maxH = std::max(node.maxH, m_heights[tz * m_size + tx]);
+                    }
+                }
+
+                continue;
+            }
+
+            int childSize = minMaxLevelSize(level - 1);
+            int childX = x * 2;
+            int childZ = z * 2;
+
+            node = pChildren[childZ * childSize + childX];
+
+            for (int i = 1; i < 4; ++i)
+            {
+                int cx = childX + (i & 1);
+                int cz = childZ + (i >> 1);
+
+                if (cx < childSize && cz < childSize)
+                {
+                    const MinMax &child = pChildren[cz * childSize + cx];
+
+                    node.minH = std::min(node.minH, child.minH);
+                    node.maxH = std::max(node.maxH, child.maxH);
+                }
+            }
+        }
+    }
+}
+
+void HeightMap::buildMinMaxPyramid()
+{
+    // Builds the min/max height pyramid that raycast() uses to skip over
+    // parts of the height map the ray can't hit. Each node of level i holds
+    // the lowest and highest height of a block of 2^i x 2^i quads of the
+    // height map, down to a single node covering the whole height map. Level
+    // 0 (a single quad) isn't stored since its bounds are just as quick to
+    // read from the height map, and it would take twice the memory of the
+    // height map itself. Must be called again whenever the heights change,
+    // except by applyBrush(), which rebuilds the nodes it affects itself.
+
+    PROFILE_ZONE("HeightMap::buildMinMaxPyramid");
+
+    int levels = 1;
+
+    while (minMaxLevelSize(levels - 1) > 1)
+        ++levels;
+
+    m_minMaxLevelOffsets.assign(levels + 1, 0);
+
+    for (int level = 1; level < levels; ++level)
+    {
+        int levelSize = minMaxLevelSize(level);
+        m_minMaxLevelOffsets[level + 1] = m_minMaxLevelOffsets[level] + levelSize * levelSize;
+    }
+
+    m_minMaxPyramid.resize(m_minMaxLevelOffsets[levels]);
+
+    for (int level = 1; level < levels; ++level)
+    {
+        int levelSize = minMaxLevelSize(level);
+
+        auto buildRows = [&](int rowBegin, int rowEnd)
+        {
+            Rect nodes = {0, rowBegin, levelSize, rowEnd};
+            buildMinMaxNodes(level, nodes);
+        };
+
+        if (m_pThreadPool)
+            m_pThreadPool->parallelFor(0, levelSize, buildRows);
+        else
+            buildRows(0, levelSize);
+    }
+}
+
+void HeightMap::computeNormals(float *pNormals, int stride) const
+{
+    // Computes the normal of every texel of the height map, in the same way
+    // as normalAtPixel(), and writes them to 'pNormals' in row order. Each
+    // normal is stored as 3 consecutive floats (x, y, z), and consecutive
+    // normals are 'stride' floats apart. This allows the normals to be written
+    // straight into an interleaved vertex buffer.
+
+    computeNormals(0, m_size, pNormals, stride);
+}
+
+void HeightMap::computeNormals(int rowBegin, int rowEnd, float *pNormals, int stride) const
+{
+    // Computes the normals of the rows [rowBegin, rowEnd) only. 'pNormals'
+    // receives the first normal of row 'rowBegin'.
+    //
+    // Each row is processed in 3 passes over small per row buffers: central
+    // differences for the interior texels with SIMD (the first and last texels
+    // of each row are done separately), normalization with SIMD, and finally
+    // the copy to 'pNormals'. The top and bottom rows use the same kernel as
+    // the other rows, but with one sided differences. When a thread pool has
+    // been set the rows are split into one band per thread.
+
+    Rect rect = {0, rowBegin, m_size, rowEnd};
+
+    computeNormals(rect, pNormals, stride);
+}
+
+void HeightMap::computeNormals(const Rect &rect, float *pNormals, int stride) const
+{
+    // Computes the normals of the texels in 'rect' only. The normals of each
+    // row of the rectangle follow those of the row above it, so 'pNormals'
+    // receives rect.x1 - rect.x0 normals per row. This is how the normals of
+    // an edited part of the height map are recomputed.
+
+    PROFILE_ZONE("HeightMap::computeNormals");
+
+    if (m_size < 2 || rect.isEmpty())
+        return;
+
+    size_t rowStride = static_cast<size_t>(rect.x1 - rect.x0) * stride;
+
+    if (m_pThreadPool)
+    {
+        m_pThreadPool->parallelFor(rect.z0, rect.z1, [&](int begin, int end)
+        {
+            Rect band = {rect.x0, begin, rect.x1, end};
+            computeNormalRows(band, pNormals + (begin - rect.z0) * rowStride, stride);
+        });
+    }
+    else
+    {
+        computeNormalRows(rect, pNormals, stride);
+    }
+}
+
+void HeightMap::computeNormalRows(const Rect &rect, float *pNormals, int stride) const
+{
+    // Computes the normals of the texels in 'rect'. 'pNormals' receives the
+    // normal of the top left texel. See computeNormals().
+
+    int width = rect.x1 - rect.x0;
+    std::vector<float> normals(width * 3);
+    float *pX = &normals[0];
+    float *pY = &normals[width];
+    float *pZ = &normals[width * 2];
+    float ny = 2.0f * m_gridSpacing;
+
+    // Only the first and last columns of the height map use one sided
+    // differences for x.
+    int interiorBegin = std::max(rect.x0, 1);
+    int interiorEnd = std::min(rect.x1, m_size - 1);
+
+    std::fill(pY, pY + width, ny);
+
+    for (int z = rect.z0; z < rect.z1; ++z)
+    {
+        const float *pRow = &m_heights[z * m_size];
+        const float *pAbove = (z > 0) ? pRow - m_size : pRow;
+        const float *pBelow = (z < m_size - 1) ? pRow + m_size : pRow;
+        float zScale = (z > 0 && z < m_size - 1) ? 1.0f : 2.0f;
+        SimdFloat zScaleVec = Simd::set(zScale);
+        int x = interiorBegin;
+
+        if (rect.x0 == 0)
+            pX[0] = 2.0f * (pRow[0] - pRow[1]);
+
+        for (; x + Simd::WIDTH <= interiorEnd; x += Simd::WIDTH)
+            Simd::store(&pX[x - rect.x0], Simd::sub(Simd::load(&pRow[x - 1]), Simd::load(&pRow[x + 1])));
+
+        for (; x < interiorEnd; ++x)
+            pX[x - rect.x0] = pRow[x - 1] - pRow[x + 1];
+
+        if (rect.x1 == m_size)
+            pX[m_size - 1 - rect.x0] = 2.0f * (pRow[m_size - 2] - pRow[m_size - 1]);
+
+        for (x = rect.x0; x + Simd::WIDTH <= rect.x1; x += Simd::WIDTH)
+            Simd::store(&pZ[x - rect.x0], Simd::mul(zScaleVec, Simd::sub(Simd::load(&pAbove[x]), Simd::load(&pBelow[x]))));
+
+        for (; x < rect.x1; ++x)
+            pZ[x - rect.x0] = zScale * (pAbove[x] - pBelow[x]);
+
+        NormalizeRow(pX, pY, pZ, width);
+
+        float *pNormal = &pNormals[static_cast<size_t>(z - rect.z0) * width * stride];
+
+        for (x = 0; x < width; ++x, pNormal += stride)
+        {
+            pNormal[0] = pX[x];
+            pNormal[1] = pY[x];
+            pNormal[2] = pZ[x];
+        }
+
+        // NormalizeRow() overwrote the y components.
+        std::fill(pY, pY + width, ny);
+    }
+}
+
+bool HeightMap::raycast(const Vector3 &origin, const Vector3 &direction, float maxDistance, float &distance) const
+{
+    // Finds the first point along the ray 'origin' + t * 'direction', with t
+    // in range [0, 'maxDistance'], where the ray hits the triangulated height
+    // map. The height map is triangulated in the same way as the terrain's
+    // vertex grid. On a hit 't' is returned in 'distance', which is the world
+    // space distance to the hit point when 'direction' is a unit vector.
+    //
+    // The ray is tested against the bounding boxes of the min/max pyramid
+    // built by buildMinMaxPyramid(), starting at the single quad covering the
+    // whole height map. Only the children of boxes the ray passes through
+    // are visited, nearest first, and only the two triangles of each level 0
+    // quad that is reached are tested exactly.
+
+    if (m_minMaxLevelOffsets.empty() || m_size < 2)
+        return false;
+
+    // Scaling the ray into height map space (1 unit per texel horizontally
+    // and 1 unit per height map value vertically) doesn't change 't'.
+
+    float invSpacing = 1.0f / static_cast<float>(m_gridSpacing);
+    Vector3 o(origin.x * invSpacing, origin.y / m_heightScale, origin.z * invSpacing);
+    Vector3 d(direction.x * invSpacing, direction.y / m_heightScale, direction.z * invSpacing);
+    Vector3 invD((d.x != 0.0f) ? 1.0f / d.x : 1e30f,
+                 (d.y != 0.0f) ? 1.0f / d.y : 1e30f,
+                 (d.z != 0.0f) ? 1.0f / d.z : 1e30f);
+
+    // Children are pushed far to near so the nearest is popped first.
+
+    int firstChildX = (d.x < 0.0f) ? 1 : 0;
+    int firstChildZ = (d.z < 0.0f) ? 1 : 0;
+
+    struct Node
+    {
+        int level, x, z;
+    };
+
+    Node stack[128];
+    int stackSize = 0;
+    float bestT = maxDistance;
+    bool hit = false;
+    int cells = m_size - 1;
+
+    Node root = {static_cast<int>(m_minMaxLevelOffsets.size()) - 2, 0, 0};
+    stack[stackSize++] = root;
+
+    while (stackSize > 0)
+    {
+        Node node = stack[--stackSize];
+        MinMax bounds;
+
+        if (node.level == 0)
+        {
+            const float *pRow = &m_heights[node.z * m_size + node.x];
+
+            bounds.minH = std::min(std::min(pRow[0], pRow[1]), std::min(pRow[m_size], pRow[m_size + 1]));
+            bounds.maxH = std::max(std::max(pRow[0], pRow[1]), std::max(pRow[m_size], pRow[m_size + 1]));
+        }
+        else
+        {
+            int levelSize = minMaxLevelSize(node.level);
+            bounds = m_minMaxPyramid[m_minMaxLevelOffsets[node.level] + node.z * levelSize + node.x];
+        }
+
+        float x0 = static_cast<float>(node.x << node.level);
+        float z0 = static_cast<float>(node.z << node.level);
+        float x1 = static_cast<float>(std::min((node.x + 1) << node.level, cells));
+        float z1 = static_cast<float>(std::min((node.z + 1) << node.level, cells));
+
+        float tx0 = (x0 - o.x) * invD.x, tx1 = (x1 - o.x) * invD.x;
+        float ty0 = (bounds.minH - o.y) * invD.y, ty1 = (bounds.maxH - o.y) * invD.y;
+        float tz0 = (z0 - o.z) * invD.z, tz1 = (z1 - o.z) * invD.z;
+
+        float tNear = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+        float tFar = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), bestT));
+
+        if (tNear > tFar)
+            continue;
+
+        if (node.level == 0)
+        {
+            float t;
+
+            if (intersectCell(node.x, node.z, o, d, t) && t <= bestT)
+            {
+                bestT = t;
+                hit = true;
+            }
+
+            continue;
+        }
+
+        int childLevel = node.level - 1;
+        int childSize = minMaxLevelSize(childLevel);
+
+        for (int i = 3; i >= 0; --i)
+        {
+            Node child = {childLevel, node.x * 2 + ((i & 1) ^ firstChildX), node.z * 2 + ((i >> 1) ^ firstChildZ)};
+
+            if (child.x < childSize && child.z < childSize)
+                stack[stackSize++] = child;
+        }
+    }
+
+    if (hit)
+        distance = bestT;
+
+    return hit;
+}
+
+HeightMap::Rect HeightMap::applyBrush(BrushMode mode, float x, float z, float radius, float strength)
+{
+    // Paints a round brush centred on the world position (x, z). The brush's
+    // weight falls off smoothly from 1 at its centre to 0 at 'radius' world
+    // units. BRUSH_RAISE and BRUSH_LOWER add or subtract 'strength' height
+    // map units at the centre. BRUSH_FLATTEN and BRUSH_SMOOTH move each texel
+    // the fraction 'strength' of the way towards the height at the centre
+    // or the average of its 3x3 neighbourhood respectively.
+    //
+    // Returns the texels the brush covers, which is empty when it misses the
+    // height map. Only those texels and the min/max pyramid nodes above them
+    // are touched, so the cost depends on the size of the brush rather than
+    // the size of the height map. The caller has to update anything else
+    // derived from the heights, such as the normals.
+
+    PROFILE_ZONE("HeightMap::applyBrush");
+
+    float cx = x / static_cast<float>(m_gridSpacing);
+    float cz = z / static_cast<float>(m_gridSpacing);
+    float r = radius / static_cast<float>(m_gridSpacing);
+    Rect rect;
+
+    rect.x0 = std::max(0, static_cast<int>(ceilf(cx - r)));
+    rect.z0 = std::max(0, static_cast<int>(ceilf(cz - r)));
+    rect.x1 = std::min(m_size, static_cast<int>(floorf(cx + r)) + 1);
+    rect.z1 = std::min(m_size, static_cast<int>(floorf(cz + r)) + 1);
+
+    if (r <= 0.0f || rect.isEmpty())
+    {
+        rect.x0 = rect.z0 = rect.x1 = rect.z1 = 0;
+        return rect;
+    }
+
+    // Smoothing reads the unpainted heights of the covered texels and of a
+    // one texel border around them.
+
+    Rect source = {std::max(rect.x0 - 1, 0), std::max(rect.z0 - 1, 0),
+        std::min(rect.x1 + 1, m_size), std::min(rect.z1 + 1, m_size)};
+    int sourceWidth = source.x1 - source.x0;
+    std::vector<float> sourceHeights;
+
+    if (mode == BRUSH_SMOOTH)
+    {
+        sourceHeights.resize(sourceWidth * (source.z1 - source.z0));
+
+        for (int tz = source.z0; tz < source.z1; ++tz)
+        {
+            const float *pRow = &m_heights[tz * m_size];
+            std::copy(pRow + source.x0, pRow + source.x1, sourceHeights.begin() + (tz - source.z0) * sourceWidth);
+        }
+    }
+
+    int centreX = std::min(std::max(static_cast<int>(cx + 0.5f), 0), m_size - 1);
+    int centreZ = std::min(std::max(static_cast<int>(cz + 0.5f), 0), m_size - 1);
+    float flattenHeight = heightAtPixel(centreX, centreZ);
+    float invRadiusSq = 1.0f / (r * r);
+
+    for (int tz = rect.z0; tz < rect.z1; ++tz)
+    {
+        for (int tx = rect.x0; tx < rect.x1; ++tx)
+        {
+            float dx = static_cast<float>(tx) - cx;
+            float dz = static_cast<float>(tz) - cz;
+            float falloff = 1.0f - (dx * dx + dz * dz) * invRadiusSq;
+
+            if (falloff <= 0.0f)
+                continue;
+
+            float weight = falloff * falloff;
+            float &height = m_heights[tz * m_size + tx];
+
+            switch (mode)
+            {
+            case BRUSH_RAISE:
+                height += strength * weight;
+                break;
+
+            case BRUSH_LOWER:
+                height -= strength * weight;
+                break;
+
+            case BRUSH_FLATTEN:
+                height += (flattenHeight - height) * std::min(strength * weight, 1.0f);
+                break;
+
+            default:
+                {
+                    float sum = 0.0f;
+                    int count = 0;
+
+                    for (int nz = std::max(tz - 1, source.z0); nz <= std::min(tz + 1, source.z1 - 1); ++nz)
+                    {
+                        for (int nx = std::max(tx - 1, source.x0); nx <= std::min(tx + 1, source.x1 - 1); ++nx)
+                        {
+                            sum += sourceHeights[(nz - source.z0) * sourceWidth + (nx - source.x0)];
+                            ++count;
+                        }
+                    }
+
+                    height += (sum / static_cast<float>(count) - height) * std::min(strength * weight, 1.0f);
+                }
+                break;
+            }
+        }
+    }
+
+    updateMinMaxPyramid(rect);
+    return rect;
+}
+
+void HeightMap::blur(float amount)
+{
+    // Applies a simple FIR (Finite Impulse Response) filter across the height
+    // map to blur it. 'amount' is in range [0,1]. 0 is no blurring, and 1 is
+    // very strong blurring.
+    //
+    // The filter runs left-to-right and right-to-left along every row, then
+    // top-to-bottom and bottom-to-top along every column. Each texel depends
+    // on the one before it, so the filter is vectorized across neighbouring
+    // columns instead, one row at a time, which only ever walks memory in
+    // order:
+    //
+    // - The vertical pass does this directly on the height map.
+    // - The horizontal pass transposes blocks of BLUR_TILE_ROWS rows into a
+    //   small tile that stays in cache, filters the columns of the tile, and
+    //   transposes the result back. Each tile row holds two SIMD registers so
+    //   two independent recurrences are in flight at once.
+    //
+    // When a thread pool has been set the row blocks and the columns are
+    // split across the pool. Every texel goes through exactly the same
+    // arithmetic as the original row by row filter, so the result doesn't
+    // depend on the SIMD width or the number of threads.
+
+    PROFILE_ZONE("HeightMap::blur");
+
+    if (m_size < 2)
+        return;
+
+    const int BLUR_TILE_ROWS = 2 * Simd::WIDTH;
+
+    int rowBlocks = (m_size + BLUR_TILE_ROWS - 1) / BLUR_TILE_ROWS;
+    int columnGroups = (m_size + Simd::WIDTH - 1) / Simd::WIDTH;
+
+    // Blur horizontally. Both left-to-right, and right-to-left.
+    auto blurRowBlocks = [&](int begin, int end)
+    {
+        std::vector<float> tile(m_size * BLUR_TILE_ROWS);
+
+        for (int block = begin; block < end; ++block)
+        {
+            float *pRows = &m_heights[block * BLUR_TILE_ROWS * m_size];
+            int rowCount = std::min(BLUR_TILE_ROWS, m_size - block * BLUR_TILE_ROWS);
+
+            Transpose(pRows, m_size, rowCount, m_size, &tile[0], BLUR_TILE_ROWS);
+            BlurColumns(&tile[0], m_size, BLUR_TILE_ROWS, 0, rowCount, amount);
+            Transpose(&tile[0], BLUR_TILE_ROWS, m_size, rowCount, pRows, m_size);
+        }
+    };
+
+    // Blur vertically. Both top-to-bottom, and bottom-to-top.
+    auto blurColumnGroups = [&](int begin, int end)
+    {
+        BlurColumns(&m_heights[0], m_size, m_size, begin * Simd::WIDTH,
+            std::min(end * static_cast<int>(Simd::WIDTH), m_size), amount);
+    };
+
+    if (m_pThreadPool)
+    {
+        m_pThreadPool->parallelFor(0, rowBlocks, blurRowBlocks);
+        m_pThreadPool->parallelFor(0, columnGroups, blurColumnGroups);
+    }
+    else
+    {
+        blurRowBlocks(0, rowBlocks);
+        blurColumnGroups(0, columnGroups);
+    }
+}
+
+void HeightMap::erodeHydraulic(const HydraulicErosionParameters &params)
+{
+    // Rains params.dropletCount droplets onto random texels and lets each
+    // roll downhill, eroding and depositing sediment along the way (see
+    // SimulateDroplet()). Droplets carve gullies and fill in valleys, which
+    // neither smooth() nor blur() can do.
+    //
+    // The droplets run in parallel on square tiles. A droplet belongs to the
+    // tile it starts in and can't reach further than 'reach' texels beyond
+    // it, and tiles are twice that wide. So the tiles of each colour of a
+    // 2 x 2 checkerboard can run at the same time without touching the same
+    // texels, and the colours run one after another. Each tile runs its
+    // droplets in order, and the droplets' start positions are hashed from
+    // params.seed, so the result only depends on the parameters, not on the
+    // number of threads. Call buildMinMaxPyramid() afterwards.
+
+    PROFILE_ZONE("HeightMap::erodeHydraulic");
+
+    if (m_size < 2 || params.dropletCount <= 0 || params.maxSteps <= 0)
+        return;
+
+    std::vector<ErosionBrushTexel> brush;
+    BuildErosionBrush(std::max(params.radius, 0), brush);
+
+    int reach = params.maxSteps + std::max(params.radius, 1) + 2;
+    int tileSize = 2 * reach;
+    int tilesPerSide = (m_size + tileSize - 1) / tileSize;
+    int tileCount = tilesPerSide * tilesPerSide;
+    float extent = static_cast<float>(m_size - 1);
+
+    // Bucket the droplets by tile, keeping them in order within each tile.
+
+    std::vector<float> positions(params.dropletCount * 2);
+    std::vector<int> tiles(params.dropletCount);
+    std::vector<int> tileStarts(tileCount + 1, 0);
+    std::vector<float> tileDroplets(params.dropletCount * 2);
+
+    for (int i = 0; i < params.dropletCount; ++i)
+    {
+        float x = (random(params.seed, i, 0, 0) + 1.0f) * 0.5f * extent;
+        float z = (random(params.seed, i, 1, 0) + 1.0f) * 0.5f * extent;
+
+        positions[i * 2] = x;
+        positions[i * 2 + 1] = z;
+        tiles[i] = (static_cast<int>(z) / tileSize) * tilesPerSide + static_cast<int>(x) / tileSize;
+        ++tileStarts[tiles[i] + 1];
+    }
+
+    for (int t = 0; t < tileCount; ++t)
+        tileStarts[t + 1] += tileStarts[t];
+
+    std::vector<int> next(tileStarts.begin(), tileStarts.end() - 1);
+
+    for (int i = 0; i < params.dropletCount; ++i)
+    {
+        int slot = next[tiles[i]]++;
+
+        tileDroplets[slot * 2] = positions[i * 2];
+        tileDroplets[slot * 2 + 1] = positions[i * 2 + 1];
+    }
+
+    float *pHeights = &m_heights[0];
+    std::vector<int> colourTiles;
+
+    for (int colour = 0; colour < 4; ++colour)
+    {
+        colourTiles.clear();
+
+        for (int tz = colour >> 1; tz < tilesPerSide; tz += 2)
+        {
+            for (int tx = colour & 1; tx < tilesPerSide; tx += 2)
+                colourTiles.push_back(tz * tilesPerSide + tx);
+        }
+
+        auto erodeTiles = [&](int begin, int end)
+        {
+            for (int i = begin; i < end; ++i)
+            {
+                int tile = colourTiles[i];
+
+                for (int d = tileStarts[tile]; d < tileStarts[tile + 1]; ++d)
+                    SimulateDroplet(pHeights, m_size, params, brush, tileDroplets[d * 2], tileDroplets[d * 2 + 1]);
+            }
+        };
+
+        int count = static_cast<int>(colourTiles.size());
+
+        if (m_pThreadPool)
+            m_pThreadPool->parallelFor(0, count, erodeTiles);
+        else
+            erodeTiles(0, count);
+    }
+}
+
+void HeightMap::erodeThermal(int iterations, float talus, float rate)
+{
+    // Lets material slide down slopes that are steeper than 'talus' height
+    // map units per texel, which wears down sharp peaks and ridges into
+    // scree slopes. 'rate' in [0,1] is how much of the excess slope slides
+    // in each iteration; 1 is the fastest rate that can't overshoot.
+    //
+    // Every iteration reads the heights of the previous one and writes a
+    // second buffer, so the rows of an iteration are independent. They're
+    // split into one band per thread when a thread pool has been set, and
+    // the result doesn't depend on the number of threads. Call
+    // buildMinMaxPyramid() afterwards.
+
+    PROFILE_ZONE("HeightMap::erodeThermal");
+
+    if (m_size < 2 || iterations <= 0)
+        return;
+
+    // A texel exchanges material with 4 neighbours at once.
+    float k = 0.125f * std::min(std::max(rate, 0.0f), 1.0f);
+
+    std::vector<float> scratch(m_heights.size());
+    float *pSrc = &m_heights[0];
+    float *pDst = &scratch[0];
+
+    for (int i = 0; i < iterations; ++i)
+    {
+        auto erodeRows = [&](int rowBegin, int rowEnd)
+        {
+            for (int z = rowBegin; z < rowEnd; ++z)
+            {
+                const float *pRow = &pSrc[z * m_size];
+                const float *pAbove = (z > 0) ? pRow - m_size : pRow;
+                const float *pBelow = (z < m_size - 1) ? pRow + m_size : pRow;
+
+                ThermalErodeRow(pAbove, pRow, pBelow, &pDst[z * m_size], m_size, talus, k);
+            }
+        };
+
+        if (m_pThreadPool)
+            m_pThreadPool->parallelFor(0, m_size, erodeRows);
+        else
+            erodeRows(0, m_size);
+
+        std::swap(pSrc, pDst);
+    }
+
+    if (pSrc != &m_heights[0])
+        std::copy(pSrc, pSrc + m_heights.size(), m_heights.begin());
+}
+
+void HeightMap::diamondSquareStep(DiamondSquareStep step, int w, int pass, float dH, float &minH, float &maxH)
+{
+    // Runs one diamond or square step. Within a step every cell only reads
+    // cells that the step doesn't write, so the rows of a step are split into
+    // one band per thread when a thread pool has been set.
+    //
+    // The exception is the final pass (w == 1), which updates every cell in
+    // place, with each cell reading the not yet updated cells to its right and
+    // in the row below it. Each band therefore reads the row below it from a
+    // copy taken before the band below it starts. The last row of the height
+    // map reads the already updated first row (the height map wraps around),
+    // so it's processed on the calling thread once all the other rows are
+    // done. This gives exactly the same results as processing the rows in
+    // order on a single thread.
+
+    int rows = m_size / w;
+    int threadCount = m_pThreadPool ? m_pThreadPool->getThreadCount() : 1;
+    int parallelRows = (w == 1) ? rows - 1 : rows;
+    int bandCount = std::min(threadCount, parallelRows);
+
+    if (bandCount <= 1)
+    {
+        diamondSquareRows(step, w, pass, dH, 0, rows, 0, minH, maxH);
+        return;
+    }
+
+    std::vector<int> bandRows(bandCount + 1);
+    std::vector<float> bandMinH(bandCount, minH);
+    std::vector<float> bandMaxH(bandCount, maxH);
+    std::vector<float> nextRows;
+
+    for (int i = 0; i <= bandCount; ++i)
+        bandRows[i] = (parallelRows * i) / bandCount;
+
+    if (w == 1)
+    {
+        nextRows.resize((bandCount - 1) * m_size);
+
+        for (int i = 0; i < bandCount - 1; ++i)
+        {
+            std::copy(m_heights.begin() + bandRows[i + 1] * m_size,
+                m_heights.begin() + (bandRows[i + 1] + 1) * m_size,
+                nextRows.begin() + i * m_size);
+        }
+    }
+
+    m_pThreadPool->parallelFor(0, bandCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const float *pNextRow = (w == 1 && i < bandCount - 1) ? &nextRows[i * m_size] : 0;
+
+            diamondSquareRows(step, w, pass, dH, bandRows[i], bandRows[i + 1],
+                pNextRow, bandMinH[i], bandMaxH[i]);
+        }
+    });
+
+    for (int i = 0; i < bandCount; ++i)
+    {
+        minH = std::min(minH, bandMinH[i]);
+        maxH = std::max(maxH, bandMaxH[i]);
+    }
+
+    if (parallelRows < rows)
+        diamondSquareRows(step, w, pass, dH, parallelRows, rows, &m_heights[0], minH, maxH);
+}
+
+void HeightMap::diamondSquareRows(DiamondSquareStep step, int w, int pass, float dH, int rowBegin, int rowEnd, const float *pNextRow, float &minH, float &maxH)
+{
+    // Runs the diamond or square step for the rows of cells [rowBegin, rowEnd).
+    // When w == 1 the row below the last row is read from 'pNextRow' if it
+    // isn't null.
+
+    if (step == DIAMOND_STEP)
+        diamondStepRows(w, pass, dH, rowBegin, rowEnd, pNextRow, minH, maxH);
+    else
+        squareStepRows(w, pass, dH, rowBegin, rowEnd, pNextRow, minH, maxH);
+}
+
+void HeightMap::diamondStepRows(int w, int pass, float dH, int rowBegin, int rowEnd, const float *pNextRow, float &minH, float &maxH)
+{
+    if (w == 1)
+    {
+        for (int z = rowBegin; z < rowEnd; ++z)
+        {
+            float *pRow = &m_heights[z * m_size];
+            const float *pBelow = (z + 1 == rowEnd && pNextRow) ? pNextRow : &m_heights[((z + 1) % m_size) * m_size];
+
+            for (int x = 0; x < m_size; ++x)
+            {
+                int right = (x + 1 == m_size) ? 0 : x + 1;
+
+                pRow[x] = dH * random(m_seed, x, z, pass) + (pRow[x] + pRow[right] + pBelow[right] + pBelow[x]) * 0.25f;
+
+                minH = std::min(minH, pRow[x]);
+                maxH = std::max(maxH, pRow[x]);
+            }
+        }
+
+        return;
+    }
+
+    int p1, p2, p3, p4, mid;
+
+    for (int z = rowBegin * w; z < rowEnd * w; z += w)
+    {
+        for (int x = 0; x < m_size; x += w)
+        {
+            p1 = heightIndexAt(x, z);
+            p2 = heightIndexAt(x + w, z);
+            p3 = heightIndexAt(x + w, z + w);
+            p4 = heightIndexAt(x, z + w);
+            mid = heightIndexAt(x + w / 2, z + w / 2);
+
+            m_heights[mid] = dH * random(m_seed, x + w / 2, z + w / 2, pass) + (m_heights[p1] + m_heights[p2] + m_heights[p3] + m_heights[p4]) * 0.25f;
+
+            minH = std::min(minH, m_heights[mid]);
+            maxH = std::max(maxH, m_heights[mid]);
+        }
+    }
+}
+
+void HeightMap::generateNoiseRows(const NoiseParameters &params, const Rect &rect)
+{
+    auto generateRows = [&](int rowBegin, int rowEnd)
+    {
+        evaluateNoise(params, rect.x0, rowBegin, rect.x1 - rect.x0, rowEnd - rowBegin,
+            &m_heights[rowBegin * m_size + rect.x0], m_size);
+    };
+
+    if (m_pThreadPool)
+        m_pThreadPool->parallelFor(rect.z0, rect.z1, generateRows);
+    else
+        generateRows(rect.z0, rect.z1);
+}
+
+void HeightMap::heightAtBlock(const float *pX, const float *pZ, float *pHeights) const
+{
+    // Computes heightAt() for Simd::WIDTH points. The grid coordinates and
+    // the interpolation weights are computed with SIMD. The 4 heights around
+    // each point are then fetched one point at a time. Points inside the map
+    // are read directly. Only the points in the last row or column of the
+    // map wrap around with heightIndexAt(), just like in heightAt().
+
+    SimdFloat invSpacing = Simd::set(1.0f / static_cast<float>(m_gridSpacing));
+    SimdFloat x = Simd::mul(Simd::load(pX), invSpacing);
+    SimdFloat z = Simd::mul(Simd::load(pZ), invSpacing);
+    int ix[Simd::WIDTH], iz[Simd::WIDTH];
+    float h00[Simd::WIDTH], h10[Simd::WIDTH], h01[Simd::WIDTH], h11[Simd::WIDTH];
+
+    Simd::storeInt(ix, x);
+    Simd::storeInt(iz, z);
+
+    for (int i = 0; i < Simd::WIDTH; ++i)
+    {
+        if (ix[i] >= 0 && ix[i] < m_size - 1 && iz[i] >= 0 && iz[i] < m_size - 1)
+        {
+            const float *p = &m_heights[iz[i] * m_size + ix[i]];
+
+            h00[i] = p[0];
+            h10[i] = p[1];
+            h01[i] = p[m_size];
+            h11[i] = p[m_size + 1];
+        }
+        else
+        {
+            h00[i] = m_heights[heightIndexAt(ix[i], iz[i])];
+            h10[i] = m_heights[heightIndexAt(ix[i] + 1, iz[i])];
+            h01[i] = m_heights[heightIndexAt(ix[i], iz[i] + 1)];
+            h11[i] = m_heights[heightIndexAt(ix[i] + 1, iz[i] + 1)];
+        }
+    }
+
+    SimdFloat u = Simd::sub(x, Simd::truncate(x));
+    SimdFloat v = Simd::sub(z, Simd::truncate(z));
+    SimdFloat top = Simd::load(h00);
+    SimdFloat bottom = Simd::load(h01);
+
+    top = Simd::add(top, Simd::mul(u, Simd::sub(Simd::load(h10), top)));
+    bottom = Simd::add(bottom, Simd::mul(u, Simd::sub(Simd::load(h11), bottom)));
+
+    SimdFloat height = Simd::add(top, Simd::mul(v, Simd::sub(bottom, top)));
+
+    Simd::store(pHeights, Simd::mul(height, Simd::set(m_heightScale)));
+}
+
+unsigned int HeightMap::heightIndexAt(int x, int z) const
+{
+    // Given a 2D height map coordinate, this method returns the index
+    // into the height map. This method wraps around for coordinates larger
+    // than the height map size.
+    return (((x + m_size) % m_size) + ((z + m_size) % m_size) * m_size);
+}
+
+bool HeightMap::intersectCell(int x, int z, const Vector3 &origin, const Vector3 &direction, float &t) const
+{
+    // Intersects a ray in height map space with the two triangles of the
+    // quad whose top left texel is (x, z). The quad is split along the same
+    // diagonal as the terrain's triangle strips. Returns the nearest hit with
+    // t >= 0.
+
+    Vector3 p00(static_cast<float>(x), heightAtPixel(x, z), static_cast<float>(z));
+    Vector3 p10(static_cast<float>(x + 1), heightAtPixel(x + 1, z), static_cast<float>(z));
+    Vector3 p01(static_cast<float>(x), heightAtPixel(x, z + 1), static_cast<float>(z + 1));
+    Vector3 p11(static_cast<float>(x + 1), heightAtPixel(x + 1, z + 1), static_cast<float>(z + 1));
+    float t0 = 0.0f, t1 = 0.0f;
+    bool hit0 = RayTriangle(origin, direction, p00, p01, p10, t0);
+    bool hit1 = RayTriangle(origin, direction, p10, p01, p11, t1);
+
+    if (hit0 && (!hit1 || t0 <= t1))
+        t = t0;
+    else if (hit1)
+        t = t1;
+
+    return hit0 || hit1;
+}
+
+void HeightMap::normalAtBlock(const float *pX, const float *pZ, float *pNx, float *pNy, float *pNz) const
+{
+    // Computes normalAt() for Simd::WIDTH points. The normals of the 4 texels
+    // around each point are built from central differences, which are
+    // fetched one point at a time. Points that are less than 2 texels from
+    // the edge of the map use normalAtPixel() instead so that they are
+    // handled exactly like in normalAt(). The corner normals are then
+    // normalized, interpolated and normalized again with SIMD.
+
+    SimdFloat invSpacing = Simd::set(1.0f / static_cast<float>(m_gridSpacing));
+    SimdFloat x = Simd::mul(Simd::load(pX), invSpacing);
+    SimdFloat z = Simd::mul(Simd::load(pZ), invSpacing);
+    float ny = 2.0f * m_gridSpacing;
+    int ix[Simd::WIDTH], iz[Simd::WIDTH];
+
+    // Corner normals, in the order top left, top right, bottom left and
+    // bottom right.
+    float cornerX[4][Simd::WIDTH], cornerY[4][Simd::WIDTH], cornerZ[4][Simd::WIDTH];
+
+    Simd::storeInt(ix, x);
+    Simd::storeInt(iz, z);
+
+    for (int i = 0; i < Simd::WIDTH; ++i)
+    {
+        if (ix[i] >= 1 && ix[i] < m_size - 2 && iz[i] >= 1 && iz[i] < m_size - 2)
+        {
+            const float *p = &m_heights[iz[i] * m_size + ix[i]];
+
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                const float *pCorner = p + (corner >> 1) * m_size + (corner & 1);
+
+                cornerX[corner][i] = pCorner[-1] - pCorner[1];
+                cornerY[corner][i] = ny;
+                cornerZ[corner][i] = pCorner[-m_size] - pCorner[m_size];
+            }
+        }
+        else
+        {
+            Vector3 n;
+
+            for (int corner = 0; corner < 4; ++corner)
+            {
+                normalAtPixel(ix[i] + (corner & 1), iz[i] + (corner >> 1), n);
+                cornerX[corner][i] = n.x;
+                cornerY[corner][i] = n.y;
+                cornerZ[corner][i] = n.z;
+            }
+        }
+    }
+
+    for (int corner = 0; corner < 4; ++corner)
+        NormalizeRow(cornerX[corner], cornerY[corner], cornerZ[corner], Simd::WIDTH);
+
+    SimdFloat u = Simd::sub(x, Simd::truncate(x));
+    SimdFloat v = Simd::sub(z, Simd::truncate(z));
+    float *pComponents[3] = {pNx, pNy, pNz};
+    float (*pCorners[3])[Simd::WIDTH] = {cornerX, cornerY, cornerZ};
+
+    for (int c = 0; c < 3; ++c)
+    {
+        SimdFloat top = Simd::load(pCorners[c][0]);
+        SimdFloat bottom = Simd::load(pCorners[c][2]);
+
+        top = Simd::add(top, Simd::mul(u, Simd::sub(Simd::load(pCorners[c][1]), top)));
+        bottom = Simd::add(bottom, Simd::mul(u, Simd::sub(Simd::load(pCorners[c][3]), bottom)));
+
+        Simd::store(pComponents[c], Simd::add(top, Simd::mul(v, Simd::sub(bottom, top))));
+    }
+
+    NormalizeRow(pNx, pNy, pNz, Simd::WIDTH);
+}
+
+void HeightMap::smooth()
+{
+    // Applies a 3x3 box filter to the height map to smooth it out. Texels on
+    // the edges of the height map only average the neighbours that lie inside
+    // the height map.
+    //
+    // The filter is separable. The horizontal sums of 3 texels are kept in a
+    // rolling buffer of 3 rows, and each output row is the sum of the rows of
+    // horizontal sums above, at, and below it, multiplied by a per column
+    // weight. The weights take care of the edge columns, so only the first and
+    // last texels of the horizontal sums and the top and bottom rows need to
+    // be handled separately. This filters the height map in place without
+    // making a copy of it.
+    //
+    // When a thread pool has been set the rows are split into one band per
+    // thread. Each band reads the source rows just outside of it from copies
+    // taken before any band starts.
+
+    PROFILE_ZONE("HeightMap::smooth");
+
+    if (m_size < 2)
+        return;
+
+    // Weights for the top and bottom rows, followed by the weights for all
+    // other rows.
+    std::vector<float> weights(m_size * 2);
+
+    for (int x = 0; x < m_size; ++x)
+    {
+        float columnCount = (x == 0 || x == m_size - 1) ? 2.0f : 3.0f;
+
+        weights[x] = 1.0f / (columnCount * 2.0f);
+        weights[m_size + x] = 1.0f / (columnCount * 3.0f);
+    }
+
+    int threadCount = m_pThreadPool ? m_pThreadPool->getThreadCount() : 1;
+    int bandCount = std::min(threadCount, m_size / 2);
+
+    if (bandCount <= 1)
+    {
+        smoothRows(0, m_size, 0, 0, &weights[0]);
+        return;
+    }
+
+    std::vector<int> bandRows(bandCount + 1);
+    std::vector<float> edgeRows(bandCount * 2 * m_size);
+
+    for (int i = 0; i <= bandCount; ++i)
+        bandRows[i] = (m_size * i) / bandCount;
+
+    for (int i = 0; i < bandCount; ++i)
+    {
+        if (i > 0)
+        {
+            std::copy(m_heights.begin() + (bandRows[i] - 1) * m_size,
+                m_heights.begin() + bandRows[i] * m_size,
+                edgeRows.begin() + (i * 2) * m_size);
+        }
+
+        if (i < bandCount - 1)
+        {
+            std::copy(m_heights.begin() + bandRows[i + 1] * m_size,
+                m_heights.begin() + (bandRows[i + 1] + 1) * m_size,
+                edgeRows.begin() + (i * 2 + 1) * m_size);
+        }
+    }
+
+    m_pThreadPool->parallelFor(0, bandCount, [&](int begin, int end)
+    {
+        for (int i = begin; i < end; ++i)
+        {
+            const float *pAbove = (i > 0) ? &edgeRows[(i * 2) * m_size] : 0;
+            const float *pBelow = (i < bandCount - 1) ? &edgeRows[(i * 2 + 1) * m_size] : 0;
+
+            smoothRows(bandRows[i], bandRows[i + 1], pAbove, pBelow, &weights[0]);
+        }
+    });
+}
+
+void HeightMap::smoothRows(int rowBegin, int rowEnd, const float *pAbove, const float *pBelow, const float *pWeights)
+{
+    // Box filters the rows [rowBegin, rowEnd) in place. 'pAbove' and 'pBelow'
+    // are the unfiltered rows just above and below the range. They're null
+    // when the range starts at the top or ends at the bottom of the height
+    // map respectively.
+
+    std::vector<float> sums(m_size * 3);
+    float *pSums[3] = {&sums[0], &sums[m_size], &sums[m_size * 2]};
+
+    // Row 'z' uses the horizontal sums in pSums[(z + 1) % 3].
+
+    if (pAbove)
+        BoxSumRow(pAbove, pSums[rowBegin % 3], m_size);
+
+    BoxSumRow(&m_heights[rowBegin * m_size], pSums[(rowBegin + 1) % 3], m_size);
+
+    for (int z = rowBegin; z < rowEnd; ++z)
+    {
+        const float *pPrev = (z > rowBegin || pAbove) ? pSums[z % 3] : 0;
+        const float *pCurr = pSums[(z + 1) % 3];
+        const float *pNext = 0;
+
+        if (z + 1 < rowEnd)
+            pNext = &m_heights[(z + 1) * m_size];
+        else
+            pNext = pBelow;
+
+        if (pNext)
+        {
+            BoxSumRow(pNext, pSums[(z + 2) % 3], m_size);
+            pNext = pSums[(z + 2) % 3];
+        }
+
+        float *pRow = &m_heights[z * m_size];
+
+        if (pPrev && pNext)
+            BoxAverageRows(pPrev, pCurr, pNext, &pWeights[m_size], pRow, m_size);
+        else
+            BoxAverageRows(pCurr, pPrev ? pPrev : pNext, 0, pWeights, pRow, m_size);
+    }
+}
+
+void HeightMap::squareStepRows(int w, int pass, float dH, int rowBegin, int rowEnd, const float *pNextRow, float &minH, float &maxH)
+{
+    if (w == 1)
+    {
+        for (int z = rowBegin; z < rowEnd; ++z)
+        {
+            float *pRow = &m_heights[z * m_size];
+            const float *pBelow = (z + 1 == rowEnd && pNextRow) ? pNextRow : &m_heights[((z + 1) % m_size) * m_size];
+
+            for (int x = 0; x < m_size; ++x)
+            {
+                int right = (x + 1 == m_size) ? 0 : x + 1;
+
+                pRow[x] = dH * random(m_seed, x, z, pass) + (pRow[x] + pRow[right] + pRow[x] + pRow[x]) * 0.25f;
+
+                minH = std::min(minH, pRow[x]);
+                maxH = std::max(maxH, pRow[x]);
+
+                pRow[x] = dH * random(m_seed, x, z, pass + 1) + (pRow[x] + pBelow[x] + pRow[x] + pRow[x]) * 0.25f;
+
+                minH = std::min(minH, pRow[x]);
+                maxH = std::max(maxH, pRow[x]);
+            }
+        }
+
+        return;
+    }
+
+    int p1, p2, p3, p4, mid;
+
+    for (int z = rowBegin * w; z < rowEnd * w; z += w)
+    {
+        for (int x = 0; x < m_size; x += w)
+        {
+            p1 = heightIndexAt(x, z);
+            p2 = heightIndexAt(x + w, z);
+            p3 = heightIndexAt(x + w / 2, z - w / 2);
+            p4 = heightIndexAt(x + w / 2, z + w / 2);
+            mid = heightIndexAt(x + w / 2, z);
+
+            m_heights[mid] = dH * random(m_seed, x + w / 2, z, pass) + (m_heights[p1] + m_heights[p2] + m_heights[p3] + m_heights[p4]) * 0.25f;
+
+            minH = std::min(minH, m_heights[mid]);
+            maxH = std::max(maxH, m_heights[mid]);
+
+            // 'p4' is deliberately carried over from above.
+            p1 = heightIndexAt(x, z);
+            p2 = heightIndexAt(x, z + w);
+            p3 = heightIndexAt(x - w / 2, z + w / 2);
+            mid = heightIndexAt(x, z + w / 2);
+
+            m_heights[mid] = dH * random(m_seed, x, z + w / 2, pass + 1) + (m_heights[p1] + m_heights[p2] + m_heights[p3] + m_heights[p4]) * 0.25f;
+
+            minH = std::min(minH, m_heights[mid]);
+            maxH = std::max(maxH, m_heights[mid]);
+        }
+    }
+}
+
+void HeightMap::updateMinMaxPyramid(const Rect &rect)
+{
+    // Rebuilds the nodes of the min/max pyramid that cover the texels in
+    // 'rect'. A level 1 node covers the texels 2x to 2x + 2, so a texel is
+    // shared by up to two nodes in each direction.
+
+    if (m_minMaxPyramid.empty() || rect.isEmpty())
+        return;
+
+    Rect nodes = {std::max(rect.x0 - 1, 0) / 2, std::max(rect.z0 - 1, 0) / 2,
+        (rect.x1 - 1) / 2 + 1, (rect.z1 - 1) / 2 + 1};
+
+    for (int level = 1; level + 1 < static_cast<int>(m_minMaxLevelOffsets.size()); ++level)
+    {
+        int levelSize = minMaxLevelSize(level);
+
+        nodes.x1 = std::min(nodes.x1, levelSize);
+        nodes.z1 = std::min(nodes.z1, levelSize);
+        buildMinMaxNodes(level, nodes);
+
+        nodes.x0 /= 2;
+        nodes.z0 /= 2;
+        nodes.x1 = (nodes.x1 - 1) / 2 + 1;
+        nodes.z1 = (nodes.z1 - 1) / 2 + 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// NoiseTileSource.
+//-----------------------------------------------------------------------------
+
+bool NoiseTileSource::loadTile(int tileX, int tileZ, int tileSize, float *pHeights)
+{
+    HeightMap::evaluateNoise(m_params, tileX * tileSize, tileZ * tileSize, tileSize, tileSize, pHeights, tileSize);
+    return true;
+}
@@ -0,0 +1,281 @@
+
+
+#if !defined(HEIGHT_MAP_H)
+#define HEIGHT_MAP_H
+
+#include <utility>
+#include <vector>
+#include "height_map_file.h"
+#include "mathlib.h"
+
+class ThreadPool;
+
+//-----------------------------------------------------------------------------
+// The storage of the HeightMap heights. The heights are either owned by the
+// array, or are a view into a memory mapped height map file. Writes to mapped
+// heights are private to the process, so a mapped height map can still be
+// smoothed, blurred or regenerated.
+//-----------------------------------------------------------------------------
+
+class HeightArray
+{
+public:
+    HeightArray() : m_pData(0), m_size(0) {}
+
+    float &operator[](size_t i)
+    { return m_pData[i]; }
+
+    const float &operator[](size_t i) const
+    { return m_pData[i]; }
+
+    float *begin()
+    { return m_pData; }
+
+    const float *begin() const
+    { return m_pData; }
+
+    float *end()
+    { return m_pData + m_size; }
+
+    const float *end() const
+    { return m_pData + m_size; }
+
+    bool isMapped() const
+    { return m_file.isOpen(); }
+
+    size_t size() const
+    { return m_size; }
+
+    void clear()
+    {
+        m_file.close();
+        std::vector<float>().swap(m_storage);
+        m_pData = 0;
+        m_size = 0;
+    }
+
+    bool map(const char *pszFilename, size_t offset, size_t count)
+    {
+        clear();
+
+        if (!m_file.open(pszFilename) || offset + count * sizeof(float) > m_file.getSize())
+        {
+            m_file.close();
+            return false;
+        }
+
+        m_pData = reinterpret_cast<float *>(m_file.getData() + offset);
+        m_size = count;
+        return true;
+    }
+
+    void resize(size_t count)
+    {
+        if (isMapped())
+            clear();
+
+        m_storage.resize(count);
+        m_pData = m_storage.empty() ? 0 : &m_storage[0];
+        m_size = count;
+    }
+
+    void swap(HeightArray &other)
+    {
+        std::swap(m_pData, other.m_pData);
+        std::swap(m_size, other.m_size);
+        m_storage.swap(other.m_storage);
+        m_file.swap(other.m_file);
+    }
+
+private:
+    HeightArray(const HeightArray &);
+    HeightArray &operator=(const HeightArray &);
+
+    float *m_pData;
+    size_t m_size;
+    std::vector<float> m_storage;
+    MappedFile m_file;
+};
+
+class HeightMap
+{
+public:
+    // The brushes applyBrush() paints with.
+    enum BrushMode
+    {
+        BRUSH_RAISE,
+        BRUSH_LOWER,
+        BRUSH_FLATTEN,
+        BRUSH_SMOOTH
+    };
+
+    // The texels in columns [x0, x1) of rows [z0, z1).
+    struct Rect
+    {
+        int x0, z0, x1, z1;
+
+        bool isEmpty() const
+        { return x0 >= x1 || z0 >= z1; }
+    };
+
+    // The parameters of erodeHydraulic(). The defaults suit heights in the
+    // range [0,255], such as those of generateDiamondSquareFractal().
+    struct HydraulicErosionParameters
+    {
+        HydraulicErosionParameters();
+
+        int dropletCount;
+        int maxSteps;           // steps of one texel before a droplet dies
+        int radius;             // radius in texels of the eroded area
+        float inertia;          // [0,1], how much of its direction a droplet keeps
+        float capacity;         // sediment carried per unit of slope, speed and water
+        float minCapacity;      // lets droplets erode almost flat ground
+        float erosion;          // [0,1], fraction of the free capacity eroded per step
+        float deposition;       // [0,1], fraction of the excess sediment dropped per step
+        float evaporation;      // [0,1], fraction of the water lost per step
+        float gravity;          // how quickly droplets speed up downhill
+        unsigned int seed;
+    };
+
+    // The parameters of generateNoise() and evaluateNoise(). Frequencies are
+    // in cycles per texel.
+    struct NoiseParameters
+    {
+        NoiseParameters();
+
+        float frequency;        // of the first octave
+        int octaves;            // [1,MAX_NOISE_OCTAVES]
+        float lacunarity;       // frequency factor between octaves
+        float gain;             // amplitude factor between octaves
+        bool ridged;            // sharp ridges instead of rounded hills
+        float warp;             // domain warp distance in texels, 0 disables it
+        float warpFrequency;
+        int offsetX;            // where texel (0, 0) lies in the noise
+        int offsetZ;
+        unsigned int seed;
+    };
+
+    enum { MAX_NOISE_OCTAVES = 16 };
+
+    HeightMap();
+    ~HeightMap();
+
+    float getHeightScale() const
+    { return m_heightScale; }
+
+    int getSize() const
+    { return m_size; }
+
+    int getGridSpacing() const
+    { return m_gridSpacing; }
+
+    const float *getHeights() const
+    { return &m_heights[0]; }
+
+    unsigned int getSeed() const
+    { return m_seed; }
+
+    ThreadPool *getThreadPool() const
+    { return m_pThreadPool; }
+
+    void setThreadPool(ThreadPool *pThreadPool)
+    { m_pThreadPool = pThreadPool; }
+
+    bool create(int size, int gridSpacing, float scale);
+    void destroy();
+    bool load(const char *pszFilename);
+    bool save(const char *pszFilename, HeightMapFile::SampleFormat sampleFormat, int tileSize = 0) const;
+
+    void buildMinMaxPyramid();
+    void computeNormals(float *pNormals, int stride) const;
+    void computeNormals(int rowBegin, int rowEnd, float *pNormals, int stride) const;
+    void computeNormals(const Rect &rect, float *pNormals, int stride) const;
+    void generateDiamondSquareFractal(float roughness);
+    void generateDiamondSquareFractal(float roughness, unsigned int seed);
+    void generateNoise(const NoiseParameters &params);
+    void generateNoise(const NoiseParameters &params, const Rect &rect);
+
+    static void evaluateNoise(const NoiseParameters &params, int x0, int z0, int width, int height, float *pHeights, int stride);
+    static float random(unsigned int seed, int x, int z, int pass);
+
+    float randomAt(int x, int z, int pass) const
+    { return random(m_seed, x, z, pass); }
+
+    float heightAt(float x, float z) const;
+    void heightAtBatch(const float *pX, const float *pZ, float *pHeights, int count) const;
+
+    float heightAtPixel(int x, int z) const
+    { return m_heights[z * m_size + x]; };
+
+    void normalAt(float x, float z, Vector3 &n) const;
+    void normalAtBatch(const float *pX, const float *pZ, float *pNx, float *pNy, float *pNz, int count) const;
+    void normalAtPixel(int x, int z, Vector3 &n) const;
+
+    bool raycast(const Vector3 &origin, const Vector3 &direction, float maxDistance, float &distance) const;
+
+    Rect applyBrush(BrushMode mode, float x, float z, float radius, float strength);
+    void blur(float amount);
+    void erodeHydraulic(const HydraulicErosionParameters &params);
+    void erodeThermal(int iterations, float talus, float rate);
+    void smooth();
+
+private:
+    enum DiamondSquareStep
+    {
+        DIAMOND_STEP,
+        SQUARE_STEP
+    };
+
+    struct MinMax
+    {
+        float minH;
+        float maxH;
+    };
+
+    void buildMinMaxNodes(int level, const Rect &nodes);
+    void computeNormalRows(const Rect &rect, float *pNormals, int stride) const;
+    void diamondSquareRows(DiamondSquareStep step, int w, int pass, float dH, int rowBegin, int rowEnd, const float *pNextRow, float &minH, float &maxH);
+    void diamondSquareStep(DiamondSquareStep step, int w, int pass, float dH, float &minH, float &maxH);
+    void diamondStepRows(int w, int pass, float dH, int rowBegin, int rowEnd, const float *pNextRow, float &minH, float &maxH);
+    void generateNoiseRows(const NoiseParameters &params, const Rect &rect);
+    void heightAtBlock(const float *pX, const float *pZ, float *pHeights) const;
+    unsigned int heightIndexAt(int x, int z) const;
+    bool intersectCell(int x, int z, const Vector3 &origin, const Vector3 &direction, float &t) const;
+    void normalAtBlock(const float *pX, const float *pZ, float *pNx, float *pNy, float *pNz) const;
+
+    int minMaxLevelSize(int level) const
+    { return (m_size - 1 + (1 << level) - 1) >> level; }
+
+    void smoothRows(int rowBegin, int rowEnd, const float *pAbove, const float *pBelow, const float *pWeights);
+    void squareStepRows(int w, int pass, float dH, int rowBegin, int rowEnd, const float *pNextRow, float &minH, float &maxH);
+    void updateMinMaxPyramid(const Rect &rect);
+
+    int m_size;
+    int m_gridSpacing;
+    float m_heightScale;
+    unsigned int m_seed;
+    HeightArray m_heights;
+    std::vector<MinMax> m_minMaxPyramid;
+    std::vector<int> m_minMaxLevelOffsets;
+    ThreadPool *m_pThreadPool;
+};
+
+//-----------------------------------------------------------------------------
+// Generates PagedHeightMap tiles on demand with HeightMap::evaluateNoise().
+// Unlike FractalTileSource the noise can be ridged and domain warped, and
+// each row of a tile is evaluated several texels at a time.
+//-----------------------------------------------------------------------------
+
+class NoiseTileSource : public HeightTileSource
+{
+public:
+    explicit NoiseTileSource(const HeightMap::NoiseParameters &params) : m_params(params) {}
+    virtual ~NoiseTileSource() {}
+
+    virtual bool loadTile(int tileX, int tileZ, int tileSize, float *pHeights);
+
+private:
+    HeightMap::NoiseParameters m_params;
+};
+
+#endif
@@ -0,0 +1,425 @@
+
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "height_map_file.h"
+
+namespace
+{
+    const float UINT16_TO_HEIGHT = 255.0f / 65535.0f;
+    const float HEIGHT_TO_UINT16 = 65535.0f / 255.0f;
+
+    unsigned short EncodeHeight(float height)
+    {
+        if (height <= 0.0f)
+            return 0;
+
+        if (height >= 255.0f)
+            return 65535;
+
+        return static_cast<unsigned short>(height * HEIGHT_TO_UINT16 + 0.5f);
+    }
+
+    bool RenameOver(const char *pszFrom, const char *pszTo)
+    {
+        // Replaces 'pszTo' with 'pszFrom'. On POSIX systems a process that
+        // has the old file mapped keeps seeing the old contents. Windows
+        // refuses to replace a file that is mapped.
+
+#if defined(_WIN32)
+        return MoveFileExA(pszFrom, pszTo, MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+        return rename(pszFrom, pszTo) == 0;
+#endif
+    }
+}
+
+//-----------------------------------------------------------------------------
+// MappedFile.
+
+MappedFile::MappedFile() : m_pData(0), m_size(0)
+{
+#if defined(_WIN32)
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = 0;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+bool MappedFile::open(const char *pszFilename)
+{
+    close();
+
+#if defined(_WIN32)
+    HANDLE hFile = CreateFileA(pszFilename, GENERIC_READ, FILE_SHARE_READ, 0,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, 0);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+        return false;
+
+    LARGE_INTEGER fileSize;
+
+    if (!GetFileSizeEx(hFile, &fileSize) || fileSize.QuadPart == 0
+        || static_cast<unsigned long long>(fileSize.QuadPart) > static_cast<size_t>(-1))
+    {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    // PAGE_WRITECOPY gives the process private copies of the pages it writes
+    // to, so the height map can be edited in place without the changes
+    // reaching the file.
+
+    HANDLE hMapping = CreateFileMappingA(hFile, 0, PAGE_WRITECOPY, 0, 0, 0);
+
+    if (!hMapping)
+    {
+        CloseHandle(hFile);
+        return false;
+    }
+
+    void *pView = MapViewOfFile(hMapping, FILE_MAP_COPY, 0, 0, 0);
+
+    if (!pView)
+    {
+        CloseHandle(hMapping);
+        CloseHandle(hFile);
+        return false;
+    }
+
+    m_hFile = hFile;
+    m_hMapping = hMapping;
+    m_pData = static_cast<unsigned char *>(pView);
+    m_size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = ::open(pszFilename, O_RDONLY);
+
+    if (fd == -1)
+        return false;
+
+    struct stat status;
+
+    if (fstat(fd, &status) == -1 || status.st_size == 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    // MAP_PRIVATE gives the process private copies of the pages it writes
+    // to. The mapping stays valid after the file is closed.
+
+    void *pView = mmap(0, static_cast<size_t>(status.st_size),
+        PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+
+    ::close(fd);
+
+    if (pView == MAP_FAILED)
+        return false;
+
+    m_pData = static_cast<unsigned char *>(pView);
+    m_size = static_cast<size_t>(status.st_size);
+#endif
+
+    return true;
+}
+
+void MappedFile::close()
+{
+#if defined(_WIN32)
+    if (m_pData)
+        UnmapViewOfFile(m_pData);
+
+    if (m_hMapping)
+        CloseHandle(m_hMapping);
+
+    if (m_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle(m_hFile);
+
+    m_hFile = INVALID_HANDLE_VALUE;
+    m_hMapping = 0;
+#else
+    if (m_pData)
+        munmap(m_pData, m_size);
+#endif
+
+    m_pData = 0;
+    m_size = 0;
+}
+
+void MappedFile::swap(MappedFile &other)
+{
+    std::swap(m_pData, other.m_pData);
+    std::swap(m_size, other.m_size);
+#if defined(_WIN32)
+    std::swap(m_hFile, other.m_hFile);
+    std::swap(m_hMapping, other.m_hMapping);
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// HeightMapFile.
+
+bool HeightMapFile::write(const char *pszFilename, const float *pHeights, int size,
+                          int gridSpacing, float heightScale, unsigned int seed,
+                          int tileSize, SampleFormat sampleFormat)
+{
+    // 'pHeights' are the size x size heights of the height map in row order.
+    // A 'tileSize' of 0 writes the heights in row order as a single tile.
+    //
+    // The file is written under a temporary name and then renamed over
+    // 'pszFilename'. 'pHeights' may therefore point into a mapping of
+    // 'pszFilename' itself, as it does after HeightMap::load(), and a failed
+    // write leaves the old file untouched.
+
+    if (size < 2 || size > MAX_SIZE || tileSize < 0)
+        return false;
+
+    if (tileSize == 0 || tileSize > size)
+        tileSize = size;
+
+    HeightMapFileHeader header;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "HMAP", 4);
+    header.version = VERSION;
+    header.size = size;
+    header.gridSpacing = gridSpacing;
+    header.heightScale = heightScale;
+    header.seed = seed;
+    header.tileSize = tileSize;
+    header.sampleFormat = sampleFormat;
+    header.dataOffset = sizeof(header);
+
+    std::string tempFilename = std::string(pszFilename) + ".tmp";
+    std::ofstream file(tempFilename.c_str(), std::ios::binary | std::ios::trunc);
+
+    if (!file.is_open())
+        return false;
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+
+    // Each tile is written one row at a time. Texels outside of the height
+    // map are padded with zeros.
+
+    int tilesPerSide = (size + tileSize - 1) / tileSize;
+    std::vector<float> floatRow(tileSize);
+    std::vector<unsigned short> uint16Row(tileSize);
+
+    for (int tileZ = 0; tileZ < tilesPerSide && file; ++tileZ)
+    {
+        for (int tileX = 0; tileX < tilesPerSide && file; ++tileX)
+        {
+            int x0 = tileX * tileSize;
+            int width = std::min(tileSize, size - x0);
+
+            for (int z = tileZ * tileSize; z < (tileZ + 1) * tileSize; ++z)
+            {
+                int rowWidth = (z < size) ? width : 0;
+                const float *pRow = pHeights + static_cast<size_t>(std::min(z, size - 1)) * size + x0;
+
+                if (sampleFormat == SAMPLE_UINT16)
+                {
+                    std::fill(uint16Row.begin(), uint16Row.end(), 0);
+
+                    for (int x = 0; x < rowWidth; ++x)
+                        uint16Row[x] = EncodeHeight(pRow[x]);
+
+                    file.write(reinterpret_cast<const char *>(&uint16Row[0]), tileSize * sizeof(unsigned short));
+                }
+                else
+                {
+                    std::fill(floatRow.begin(), floatRow.end(), 0.0f);
+
+                    std::copy(pRow, pRow + rowWidth, floatRow.begin());
+
+                    file.write(reinterpret_cast<const char *>(&floatRow[0]), tileSize * sizeof(float));
+                }
+            }
+        }
+    }
+
+    file.close();
+
+    if (file.fail() || !RenameOver(tempFilename.c_str(), pszFilename))
+    {
+        remove(tempFilename.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+HeightMapFile::HeightMapFile()
+{
+}
+
+HeightMapFile::~HeightMapFile()
+{
+    close();
+}
+
+bool HeightMapFile::open(const char *pszFilename)
+{
+    // The whole file is mapped, but only the header is read here. The
+    // samples are paged in from disk as they're read.
+
+    if (!m_file.open(pszFilename))
+        return false;
+
+    if (m_file.getSize() < sizeof(HeightMapFileHeader))
+    {
+        close();
+        return false;
+    }
+
+    const HeightMapFileHeader &header = getHeader();
+
+    if (memcmp(header.magic, "HMAP", 4) != 0 || header.version != VERSION
+        || header.size < 2 || header.size > MAX_SIZE
+        || header.tileSize < 1 || header.tileSize > MAX_SIZE
+        || (header.sampleFormat != SAMPLE_FLOAT && header.sampleFormat != SAMPLE_UINT16)
+        || header.dataOffset < sizeof(HeightMapFileHeader)
+        || header.dataOffset > m_file.getSize()
+        || header.dataOffset % sizeof(float) != 0)
+    {
+        close();
+        return false;
+    }
+
+    // With both sizes at most MAX_SIZE the tiles span fewer than 2^17
+    // samples per side, so the data size is below 2^37 bytes.
+
+    unsigned long long samplesPerSide = static_cast<unsigned long long>(getTilesPerSide()) * header.tileSize;
+    unsigned long long dataSize = samplesPerSide * samplesPerSide * getSampleSize();
+
+    if (dataSize > m_file.getSize() - header.dataOffset)
+    {
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void HeightMapFile::close()
+{
+    m_file.close();
+}
+
+bool HeightMapFile::loadTile(int tileX, int tileZ, int tileSize, float *pHeights)
+{
+    // 'tileSize' doesn't have to match the tile size of the file. Texels
+    // outside of the height map are set to zero.
+
+    if (!isOpen())
+        return false;
+
+    int size = getHeader().size;
+    int x0 = tileX * tileSize;
+    int z0 = tileZ * tileSize;
+    int width = std::max(0, std::min(tileSize, size - x0));
+
+    for (int z = 0; z < tileSize; ++z)
+    {
+        float *pRow = &pHeights[z * tileSize];
+
+        if (z0 + z < size && width > 0 && !readSamples(x0, z0 + z, width, pRow))
+            return false;
+
+        std::fill(pRow + width, pRow + tileSize, 0.0f);
+    }
+
+    return true;
+}
+
+bool HeightMapFile::readHeights(float *pHeights) const
+{
+    // Reads all the heights into 'pHeights' in row order. Returns false if
+    // no file is open.
+
+    if (!isOpen())
+        return false;
+
+    int size = getHeader().size;
+
+    for (int z = 0; z < size; ++z)
+    {
+        if (!readSamples(0, z, size, &pHeights[static_cast<size_t>(z) * size]))
+            return false;
+    }
+
+    return true;
+}
+
+bool HeightMapFile::readSamples(int x, int z, int count, float *pHeights) const
+{
+    // Reads the 'count' heights starting at texel (x, z) into 'pHeights'. The
+    // run of texels may span several tiles. Returns false if no file is open
+    // or the run doesn't lie inside the height map.
+
+    if (!isOpen())
+        return false;
+
+    const HeightMapFileHeader &header = getHeader();
+
+    if (x < 0 || z < 0 || count < 0 || z >= header.size || count > header.size - x)
+        return false;
+
+    const unsigned char *pData = m_file.getData() + header.dataOffset;
+    int tileSize = header.tileSize;
+    int tilesPerSide = getTilesPerSide();
+    size_t sampleSize = getSampleSize();
+    int tileZ = z / tileSize;
+    int rowInTile = z - tileZ * tileSize;
+
+    while (count > 0)
+    {
+        int tileX = x / tileSize;
+        int columnInTile = x - tileX * tileSize;
+        int run = std::min(count, tileSize - columnInTile);
+        size_t tile = static_cast<size_t>(tileZ) * tilesPerSide + tileX;
+        size_t sample = (tile * tileSize + rowInTile) * tileSize + columnInTile;
+        const unsigned char *pSamples = pData + sample * sampleSize;
+
+        if (header.sampleFormat == SAMPLE_UINT16)
+        {
+            const unsigned short *pUint16 = reinterpret_cast<const unsigned short *>(pSamples);
+
+            for (int i = 0; i < run; ++i)
+                pHeights[i] = static_cast<float>(pUint16[i]) * UINT16_TO_HEIGHT;
+        }
+        else
+        {
+            memcpy(pHeights, pSamples, run * sizeof(float));
+        }
+
+        pHeights += run;
+        x += run;
+        count -= run;
+    }
+
+    return true;
+}
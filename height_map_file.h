@@ -0,0 +1,139 @@
+
+
+#if !defined(HEIGHT_MAP_FILE_H)
+#define HEIGHT_MAP_FILE_H
+
+#include <cstddef>
+#include "paged_height_map.h"
+
+//-----------------------------------------------------------------------------
+// A read only, copy-on-write memory mapping of a whole file.
+//
+// Pages are only read from disk when they're first touched. Writing to the
+// mapping is allowed, but the changes are private to the process and never
+// reach the file.
+//-----------------------------------------------------------------------------
+
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool open(const char *pszFilename);
+    void close();
+    void swap(MappedFile &other);
+
+    unsigned char *getData() const
+    { return m_pData; }
+
+    size_t getSize() const
+    { return m_size; }
+
+    bool isOpen() const
+    { return m_pData != 0; }
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+
+    unsigned char *m_pData;
+    size_t m_size;
+#if defined(_WIN32)
+    void *m_hFile;
+    void *m_hMapping;
+#endif
+};
+
+//-----------------------------------------------------------------------------
+// The header at the start of a height map file. All fields are little
+// endian. The header is 64 bytes long.
+//
+// The samples follow at 'dataOffset'. They're stored one tile at a time,
+// tiles in row order, and the samples of each tile in row order. Every tile
+// is tileSize x tileSize samples. Samples of the last row and column of tiles
+// that lie outside the height map are padding. When 'tileSize' is at least
+// 'size' the file holds a single tile and the samples are simply in row
+// order, which HeightMap::load() can map without copying.
+//-----------------------------------------------------------------------------
+
+struct HeightMapFileHeader
+{
+    char magic[4];                  // "HMAP"
+    unsigned int version;           // HeightMapFile::VERSION
+    int size;
+    int gridSpacing;
+    float heightScale;
+    unsigned int seed;
+    int tileSize;
+    unsigned int sampleFormat;      // HeightMapFile::SampleFormat
+    unsigned long long dataOffset;
+    unsigned int reserved[6];
+};
+
+//-----------------------------------------------------------------------------
+// Reads and writes height map files.
+//
+// Samples are either 32-bit floats, or 16-bit unsigned integers that map the
+// range [0,255] of HeightMap heights onto [0,65535]. 16-bit heights halve the
+// file size and are accurate to about 0.002. Heights outside [0,255] are
+// clamped when they're written as 16-bit samples.
+//
+// A HeightMapFile is also a HeightTileSource, so a PagedHeightMap can page
+// its tiles in from a file that is far larger than the available memory.
+//
+// To use the HeightMapFile class:
+//  HeightMapFile file;
+//  if (file.open("terrain.hmap") && file.readHeights(pHeights))
+//      ...
+//-----------------------------------------------------------------------------
+
+class HeightMapFile : public HeightTileSource
+{
+public:
+    enum { VERSION = 1 };
+
+    // The largest size and tile size a file may have. This keeps every size
+    // computed from a header well within 64 bits.
+    enum { MAX_SIZE = 65536 };
+
+    enum SampleFormat
+    {
+        SAMPLE_FLOAT,
+        SAMPLE_UINT16
+    };
+
+    static bool write(const char *pszFilename, const float *pHeights, int size,
+                      int gridSpacing, float heightScale, unsigned int seed,
+                      int tileSize, SampleFormat sampleFormat);
+
+    HeightMapFile();
+    virtual ~HeightMapFile();
+
+    bool open(const char *pszFilename);
+    void close();
+
+    virtual bool loadTile(int tileX, int tileZ, int tileSize, float *pHeights);
+    bool readHeights(float *pHeights) const;
+    bool readSamples(int x, int z, int count, float *pHeights) const;
+
+    const HeightMapFileHeader &getHeader() const
+    { return *reinterpret_cast<const HeightMapFileHeader *>(m_file.getData()); }
+
+    int getTilesPerSide() const
+    { return (getHeader().size + getHeader().tileSize - 1) / getHeader().tileSize; }
+
+    bool isOpen() const
+    { return m_file.isOpen(); }
+
+    bool isRowOrder() const
+    { return getHeader().tileSize >= getHeader().size; }
+
+private:
+    size_t getSampleSize() const
+    { return (getHeader().sampleFormat == SAMPLE_UINT16) ? sizeof(unsigned short) : sizeof(float); }
+
+    MappedFile m_file;
+};
+
+#endif
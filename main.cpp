@@ -31,6 +31,7 @@
 #include <GL/gl.h>
 #include <GL/glu.h>
 #include <cmath>
+#include <cstdio>
 #include <iomanip>
 #include <fstream>
 #include <sstream>
@@ -45,10 +46,15 @@
 #include "bitmap.h"
 #include "camera.h"
 #include "gl_font.h"
+#include "gl_state_cache.h"
 #include "input.h"
 #include "mathlib.h"
 #include "opengl.h"
+#include "profiler.h"
+#include "shader_program.h"
+#include "stream_buffer.h"
 #include "terrain.h"
+#include "thread_pool.h"
 #include "WGL_ARB_multisample.h"
 
 //-----------------------------------------------------------------------------
@@ -69,10 +75,23 @@
 const int       TERRAIN_REGIONS_COUNT = 4;
 
 const float     HEIGHTMAP_ROUGHNESS = 1.2f; //  float > 0 Roughness Increases. Determines smoothness of terrain
+const float     HEIGHTMAP_NOISE_FREQUENCY = 1.0f / 64.0f; // cycles per texel
+const float     HEIGHTMAP_NOISE_WARP = 16.0f; // texels
 const float     HEIGHTMAP_SCALE = 2.0f;
 const float     HEIGHTMAP_TILING_FACTOR = 12.0f;
 const int       HEIGHTMAP_SIZE = 128; // SIZE OF MAP
 const int       HEIGHTMAP_GRID_SPACING = 16;
+const float     HEIGHTMAP_LOD_MAX_PIXEL_ERROR = 2.0f;
+const char      HEIGHTMAP_FILENAME[] = "terrain.hmap"; // F2 saves, F3 and startup load
+
+const float     TERRAIN_BRUSH_RADIUS = 128.0f; // world units
+const float     TERRAIN_BRUSH_RAISE_RATE = 32.0f; // height map units per second
+const float     TERRAIN_BRUSH_BLEND_RATE = 2.0f; // flatten and smooth strength per second
+const int       TERRAIN_EROSION_THERMAL_ITERATIONS = 20;
+const float     TERRAIN_EROSION_TALUS = 0.5f; // height map units between neighbours
+const int       TERRAIN_EROSION_DROPLETS = 50000;
+
+const char      PROFILE_FILENAME[] = "profile.json"; // P starts and stops profiling
 
 const float     CAMERA_FOVX = 90.0f;
 const float     CAMERA_ZFAR = HEIGHTMAP_SIZE * HEIGHTMAP_GRID_SPACING * 2.0f;
@@ -93,6 +112,22 @@ struct TerrainRegion
     std::string filename;
 };
 
+// The terrain shader program and the indices of its uniforms, which are
+// looked up once when the shader is loaded.
+struct TerrainShader
+{
+    ShaderProgram program;
+    int tilingFactor;
+    int gridSize;
+    int gridSpacing;
+    int compactHeightScale;
+    int heightScale;
+    int heightMap;
+    int regionMin[TERRAIN_REGIONS_COUNT];
+    int regionMax[TERRAIN_REGIONS_COUNT];
+    int regionColorMap[TERRAIN_REGIONS_COUNT];
+};
+
 //-----------------------------------------------------------------------------
 // Globals.
 //-----------------------------------------------------------------------------
@@ -112,9 +147,13 @@ bool                g_displayHelp;
 bool                g_disableColorMaps;
 float               g_lightDir[4] = {0.0f, 1.0f, 0.0f, 0.0f};
 GLuint              g_nullTexture;
-GLuint              g_terrainShader;
+TerrainShader       g_terrainShader;
+TerrainShader       g_terrainCompactShader;
+TerrainShader       g_terrainInstancedShader;
 GLFont              g_font;
 Terrain             g_terrain;
+HeightMap::BrushMode g_terrainBrush = HeightMap::BRUSH_RAISE;
+ThreadPool          g_threadPool;
 Camera              g_camera;
 Vector3             g_cameraBoundsMax;
 Vector3             g_cameraBoundsMin;
@@ -144,15 +183,26 @@ void    CleanupApp();
 GLuint  CompileShader(GLenum type, const GLchar *pszSource, GLint length);
 HWND    CreateAppWindow(const WNDCLASSEX &wcl, const char *pszTitle);
 GLuint  CreateNullTexture(int width, int height);
+void    EditTerrain(float elapsedTimeSec);
 void    EnableVerticalSync(bool enableVerticalSync);
+void    ErodeTerrain();
+void    GenerateNoiseTerrain();
 void    GenerateTerrain();
 float   GetElapsedTimeInSeconds();
 Vector3 GetMovementDirection();
+TerrainShader &GetTerrainShader();
+const char *GetTerrainBrushName();
+const char *GetTerrainIndexOrderName();
+const char *GetTerrainVertexFormatName();
 bool    Init();
 void    InitApp();
 void    InitGL();
+std::string InsertShaderDefines(const std::string &source, const char *pszDefines);
 GLuint  LinkShaders(GLuint vertShader, GLuint fragShader);
 GLuint  LoadShaderProgram(const char *pszFilename, std::string &infoLog);
+GLuint  LoadShaderProgram(const char *pszFilename, const char *pszDefines, std::string &infoLog);
+bool    LoadTerrain();
+bool    LoadTerrainShader(TerrainShader &shader, const char *pszDefines, std::string &infoLog);
 GLuint  LoadTexture(const char *pszFilename);
 GLuint  LoadTexture(const char *pszFilename, GLint magFilter, GLint minFilter,
                     GLint wrapS, GLint wrapT);
@@ -162,8 +212,12 @@ void    ReadTextFile(const char *pszFilename, std::string &buffer);
 void    RenderFrame();
 void    RenderTerrain();
 void    RenderText();
+void    SaveTerrain();
 void    SetProcessorAffinity();
 void    ToggleFullScreen();
+void    ToggleProfiler();
+void    ToggleTerrainIndexOrder();
+void    ToggleTerrainVertexFormat();
 void    UpdateCamera(float elapsedTimeSec);
 void    UpdateFrame(float elapsedTimeSec);
 void    UpdateFrameRate(float elapsedTimeSec);
@@ -236,6 +290,8 @@ int WINAPI WinMain(HINSTANCE hInstance, HINSTANCE hPrevInstance, LPSTR lpCmdLine
                 {
                     UpdateFrame(GetElapsedTimeInSeconds());
                     RenderFrame();
+
+                    PROFILE_ZONE("SwapBuffers");
                     SwapBuffers(g_hDC);
                 }
                 else
@@ -299,9 +355,11 @@ LRESULT CALLBACK WindowProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 
 void BindTexture(GLuint texture, GLuint unit)
 {
-    glActiveTexture(GL_TEXTURE0 + unit);
-    glEnable(GL_TEXTURE_2D);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    // The terrain shader samples the textures itself, so GL_TEXTURE_2D
+    // doesn't need to be enabled. The textures stay bound after drawing and
+    // rebinding them next frame is filtered out by the state cache.
+
+    GLStateCache::instance().bindTexture(unit, texture);
 }
 
 void Cleanup()
@@ -328,25 +386,24 @@ void CleanupApp()
     {
         if (g_regions[i].texture)
         {
-            glDeleteTextures(1, &g_regions[i].texture);
+            GLStateCache::instance().deleteTexture(g_regions[i].texture);
             g_regions[i].texture = 0;
         }
     }
 
     if (g_nullTexture)
     {
-        glDeleteTextures(1, &g_nullTexture);
+        GLStateCache::instance().deleteTexture(g_nullTexture);
         g_nullTexture = 0;
     }
 
-    if (g_terrainShader)
-    {
-        glUseProgram(0);
-        glDeleteProgram(g_terrainShader);
-        g_terrainShader = 0;
-    }
+    ShaderProgram::unbind();
+    g_terrainShader.program.destroy();
+    g_terrainCompactShader.program.destroy();
+    g_terrainInstancedShader.program.destroy();
 
     g_terrain.destroy();
+    g_threadPool.destroy();
     g_font.destroy();
 }
 
@@ -431,7 +488,7 @@ GLuint CreateNullTexture(int width, int height)
     GLuint texture = 0;
 
     glGenTextures(1, &texture);
-    glBindTexture(GL_TEXTURE_2D, texture);
+    GLStateCache::instance().bindTexture(0, texture);
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
@@ -441,11 +498,35 @@ GLuint CreateNullTexture(int width, int height)
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA,
         GL_UNSIGNED_BYTE, &pixels[0]);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
-
     return texture;
 }
 
+void EditTerrain(float elapsedTimeSec)
+{
+    // Paints the terrain brush where the centre of the view meets the
+    // terrain while the left mouse button is held down.
+
+    if (!Mouse::instance().buttonDown(Mouse::BUTTON_LEFT))
+        return;
+
+    float distance = 0.0f;
+    Vector3 hit;
+
+    if (!g_terrain.getHeightMap().raycast(g_camera.getPosition(), g_camera.getViewDirection(), CAMERA_ZFAR, distance))
+        return;
+
+    hit = g_camera.getPosition() + g_camera.getViewDirection() * distance;
+
+    float strength = elapsedTimeSec;
+
+    if (g_terrainBrush == HeightMap::BRUSH_RAISE || g_terrainBrush == HeightMap::BRUSH_LOWER)
+        strength *= TERRAIN_BRUSH_RAISE_RATE;
+    else
+        strength *= TERRAIN_BRUSH_BLEND_RATE;
+
+    g_terrain.applyBrush(g_terrainBrush, hit.x, hit.z, TERRAIN_BRUSH_RADIUS, strength);
+}
+
 void EnableVerticalSync(bool enableVerticalSync)
 {
     // WGL_EXT_swap_control.
@@ -463,8 +544,45 @@ void EnableVerticalSync(bool enableVerticalSync)
     }
 }
 
+void ErodeTerrain()
+{
+    // Each press drops a new set of droplets on the terrain.
+
+    PROFILE_ZONE("ErodeTerrain");
+
+    static unsigned int passes = 0;
+    HeightMap::HydraulicErosionParameters params;
+
+    params.dropletCount = TERRAIN_EROSION_DROPLETS;
+    params.seed = g_terrain.getHeightMap().getSeed() + ++passes;
+
+    if (!g_terrain.erode(TERRAIN_EROSION_THERMAL_ITERATIONS, TERRAIN_EROSION_TALUS, params))
+        throw std::runtime_error("Failed to erode terrain.");
+}
+
+void GenerateNoiseTerrain()
+{
+    // Generates domain warped ridged noise, which gives sharper mountain
+    // ranges than diamond-square.
+
+    PROFILE_ZONE("GenerateNoiseTerrain");
+
+    HeightMap::NoiseParameters params;
+
+    params.frequency = HEIGHTMAP_NOISE_FREQUENCY;
+    params.warpFrequency = HEIGHTMAP_NOISE_FREQUENCY * 0.5f;
+    params.warp = HEIGHTMAP_NOISE_WARP;
+    params.ridged = true;
+    params.seed = GetTickCount();
+
+    if (!g_terrain.generateUsingNoise(params))
+        throw std::runtime_error("Failed to generate terrain.");
+}
+
 void GenerateTerrain()
 {
+    PROFILE_ZONE("GenerateTerrain");
+
     if (!g_terrain.generateUsingDiamondSquareFractal(HEIGHTMAP_ROUGHNESS))
         throw std::runtime_error("Failed to generate terrain.");
 }
@@ -626,6 +744,49 @@ Vector3 GetMovementDirection()
     return direction;
 }
 
+TerrainShader &GetTerrainShader()
+{
+    // Returns the terrain shader for the terrain's current vertex format.
+
+    switch (g_terrain.getVertexFormat())
+    {
+    case Terrain::VERTEX_FORMAT_COMPACT:   return g_terrainCompactShader;
+    case Terrain::VERTEX_FORMAT_INSTANCED: return g_terrainInstancedShader;
+    default:                               return g_terrainShader;
+    }
+}
+
+const char *GetTerrainBrushName()
+{
+    switch (g_terrainBrush)
+    {
+    case HeightMap::BRUSH_LOWER:   return "lower";
+    case HeightMap::BRUSH_FLATTEN: return "flatten";
+    case HeightMap::BRUSH_SMOOTH:  return "smooth";
+    default:                       return "raise";
+    }
+}
+
+const char *GetTerrainIndexOrderName()
+{
+    switch (g_terrain.getIndexOrder())
+    {
+    case Terrain::INDEX_ORDER_BLOCK_LIST:   return "block list";
+    case Terrain::INDEX_ORDER_BLOCK_STRIPS: return "block strips";
+    default:                                return "strip";
+    }
+}
+
+const char *GetTerrainVertexFormatName()
+{
+    switch (g_terrain.getVertexFormat())
+    {
+    case Terrain::VERTEX_FORMAT_COMPACT:   return "compact";
+    case Terrain::VERTEX_FORMAT_INSTANCED: return "instanced";
+    default:                               return "float";
+    }
+}
+
 bool Init()
 {
     try
@@ -652,6 +813,10 @@ bool Init()
 
 void InitApp()
 {
+    // Setup the profiler. It must exist before the thread pool starts.
+
+    Profiler::instance().setThreadName("main");
+
     // Setup fonts.
 
     if (!g_font.create("Arial", 10, GLFont::BOLD))
@@ -672,15 +837,35 @@ void InitApp()
 
     std::string infoLog;
 
-    if (!(g_terrainShader = LoadShaderProgram("content/shaders/terrain.glsl", infoLog)))
+    if (!LoadTerrainShader(g_terrainShader, "", infoLog))
         throw std::runtime_error("Failed to load shader: terrain.glsl.\n" + infoLog);
 
-    // Setup terrain.
+    // The compact terrain vertex format is optional. It needs gl_VertexID.
+    if (OpenGLExtensionSupported("GL_EXT_gpu_shader4"))
+        LoadTerrainShader(g_terrainCompactShader, "#define COMPACT_VERTICES\n", infoLog);
+
+    // So are instanced terrain patches. They also need texelFetch2D() and
+    // instanced arrays.
+    if (OpenGLExtensionSupported("GL_EXT_gpu_shader4") && GLStateCache::instance().supportsInstancing())
+        LoadTerrainShader(g_terrainInstancedShader, "#define INSTANCED_PATCHES\n", infoLog);
+
+    // Setup worker threads.
+
+    if (!g_threadPool.create(ThreadPool::getHardwareThreadCount()))
+        throw std::runtime_error("Failed to create thread pool.");
+
+    // Setup terrain. The block list index order makes the best use of the
+    // vertex cache and works without primitive restart.
+
+    g_terrain.setIndexOrder(Terrain::INDEX_ORDER_BLOCK_LIST);
 
     if (!g_terrain.create(HEIGHTMAP_SIZE, HEIGHTMAP_GRID_SPACING, HEIGHTMAP_SCALE))
         throw std::runtime_error("Failed to create terrain.");
 
-    GenerateTerrain();
+    g_terrain.getHeightMap().setThreadPool(&g_threadPool);
+
+    if (!LoadTerrain())
+        GenerateTerrain();
             
     // Setup camera.
 
@@ -765,6 +950,24 @@ void InitGL()
         g_maxAnisotrophy = 1;
 }
 
+std::string InsertShaderDefines(const std::string &source, const char *pszDefines)
+{
+    // Returns 'source' with 'pszDefines' inserted after its #version
+    // directive, or at the start when there isn't one.
+
+    std::string::size_type offset = source.find("#version");
+
+    if (offset == std::string::npos)
+        return pszDefines + source;
+
+    offset = source.find('\n', offset);
+
+    if (offset == std::string::npos)
+        return source + "\n" + pszDefines;
+
+    return source.substr(0, offset + 1) + pszDefines + source.substr(offset + 1);
+}
+
 GLuint LinkShaders(GLuint vertShader, GLuint fragShader)
 {
     // Links the compiled vertex and/or fragment shaders into an executable
@@ -784,6 +987,14 @@ GLuint LinkShaders(GLuint vertShader, GLuint fragShader)
         if (fragShader)
             glAttachShader(program, fragShader);
 
+        // Attributes used by the compact and instanced terrain vertex
+        // formats. Binding names that the shaders don't use is harmless.
+        glBindAttribLocation(program, Terrain::COMPACT_HEIGHT_ATTRIB, "compactHeight");
+        glBindAttribLocation(program, Terrain::COMPACT_NORMAL_ATTRIB, "compactNormal");
+        glBindAttribLocation(program, Terrain::COMPACT_ORIGIN_ATTRIB, "compactOrigin");
+        glBindAttribLocation(program, Terrain::PATCH_VERTEX_ATTRIB, "patchVertex");
+        glBindAttribLocation(program, Terrain::PATCH_ORIGIN_ATTRIB, "patchOrigin");
+
         glLinkProgram(program);
         glGetProgramiv(program, GL_LINK_STATUS, &linked);
 
@@ -816,6 +1027,15 @@ GLuint LinkShaders(GLuint vertShader, GLuint fragShader)
 
 GLuint LoadShaderProgram(const char *pszFilename, std::string &infoLog)
 {
+    return LoadShaderProgram(pszFilename, "", infoLog);
+}
+
+GLuint LoadShaderProgram(const char *pszFilename, const char *pszDefines, std::string &infoLog)
+{
+    // 'pszDefines' is inserted into both the vertex and fragment shaders
+    // right after their #version directives. This allows the same shader
+    // file to be compiled with different preprocessor definitions.
+
     infoLog.clear();
 
     GLuint program = 0;
@@ -828,8 +1048,7 @@ GLuint LoadShaderProgram(const char *pszFilename, std::string &infoLog)
     // Compile and link the vertex and fragment shaders.
     if (buffer.length() > 0)
     {
-        const GLchar *pSource = 0;
-        GLint length = 0;
+        std::string source;
         GLuint vertShader = 0;
         GLuint fragShader = 0;
 
@@ -843,9 +1062,8 @@ GLuint LoadShaderProgram(const char *pszFilename, std::string &infoLog)
             if (vertOffset != std::string::npos)
             {
                 vertOffset += 6;        // skip over the [vert] tag
-                pSource = reinterpret_cast<const GLchar *>(&buffer[vertOffset]);
-                length = static_cast<GLint>(fragOffset - vertOffset);
-                vertShader = CompileShader(GL_VERTEX_SHADER, pSource, length);
+                source = InsertShaderDefines(buffer.substr(vertOffset, fragOffset - vertOffset), pszDefines);
+                vertShader = CompileShader(GL_VERTEX_SHADER, source.c_str(), static_cast<GLint>(source.length()));
             }
 
             // Get the fragment shader source and compile it.
@@ -853,9 +1071,8 @@ GLuint LoadShaderProgram(const char *pszFilename, std::string &infoLog)
             if (fragOffset != std::string::npos)
             {
                 fragOffset += 6;        // skip over the [frag] tag
-                pSource = reinterpret_cast<const GLchar *>(&buffer[fragOffset]);
-                length = static_cast<GLint>(buffer.length() - fragOffset - 1);
-                fragShader = CompileShader(GL_FRAGMENT_SHADER, pSource, length);
+                source = InsertShaderDefines(buffer.substr(fragOffset, buffer.length() - fragOffset - 1), pszDefines);
+                fragShader = CompileShader(GL_FRAGMENT_SHADER, source.c_str(), static_cast<GLint>(source.length()));
             }
 
             // Now link the vertex and fragment shaders into a shader program.
@@ -870,6 +1087,48 @@ GLuint LoadShaderProgram(const char *pszFilename, std::string &infoLog)
     return program;
 }
 
+bool LoadTerrain()
+{
+    // Float height map files in row order are memory mapped, so loading a
+    // saved terrain is much faster than generating a new one.
+
+    PROFILE_ZONE("LoadTerrain");
+    return g_terrain.loadHeightMap(HEIGHTMAP_FILENAME);
+}
+
+bool LoadTerrainShader(TerrainShader &shader, const char *pszDefines, std::string &infoLog)
+{
+    // Loads the terrain shader and looks up its uniforms. Uniforms that the
+    // shader doesn't use, such as the compact vertex format's grid
+    // parameters in the float vertex format's shader, get an index of -1.
+
+    char name[32];
+
+    if (!shader.program.create(LoadShaderProgram("content/shaders/terrain.glsl", pszDefines, infoLog)))
+        return false;
+
+    shader.tilingFactor = shader.program.getUniformIndex("tilingFactor");
+    shader.gridSize = shader.program.getUniformIndex("gridSize");
+    shader.gridSpacing = shader.program.getUniformIndex("gridSpacing");
+    shader.compactHeightScale = shader.program.getUniformIndex("compactHeightScale");
+    shader.heightScale = shader.program.getUniformIndex("heightScale");
+    shader.heightMap = shader.program.getUniformIndex("heightMap");
+
+    for (int i = 0; i < TERRAIN_REGIONS_COUNT; ++i)
+    {
+        sprintf(name, "region%d.min", i + 1);
+        shader.regionMin[i] = shader.program.getUniformIndex(name);
+
+        sprintf(name, "region%d.max", i + 1);
+        shader.regionMax[i] = shader.program.getUniformIndex(name);
+
+        sprintf(name, "region%dColorMap", i + 1);
+        shader.regionColorMap[i] = shader.program.getUniformIndex(name);
+    }
+
+    return true;
+}
+
 GLuint LoadTexture(const char *pszFilename)
 {
     return LoadTexture(pszFilename, GL_LINEAR, GL_LINEAR_MIPMAP_LINEAR,
@@ -889,7 +1148,7 @@ GLuint LoadTexture(const char *pszFilename, GLint magFilter, GLint minFilter,
         bitmap.flipVertical();
 
         glGenTextures(1, &id);
-        glBindTexture(GL_TEXTURE_2D, id);
+        GLStateCache::instance().bindTexture(0, id);
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, magFilter);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
@@ -905,8 +1164,6 @@ GLuint LoadTexture(const char *pszFilename, GLint magFilter, GLint minFilter,
 
         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, bitmap.width, bitmap.height,
             0, GL_BGRA, GL_UNSIGNED_BYTE, bitmap.getPixels());
-
-        glBindTexture(GL_TEXTURE_2D, 0);
     }
 
     return id;
@@ -936,6 +1193,8 @@ void PerformCameraCollisionDetection()
 
 void ProcessUserInput()
 {
+    PROFILE_ZONE("ProcessUserInput");
+
     Keyboard &keyboard = Keyboard::instance();
 
     if (keyboard.keyPressed(Keyboard::KEY_ESCAPE))
@@ -972,11 +1231,41 @@ void ProcessUserInput()
     if (keyboard.keyPressed(Keyboard::KEY_SPACE))
         GenerateTerrain();
 
+    if (keyboard.keyPressed(Keyboard::KEY_N))
+        GenerateNoiseTerrain();
+
+    if (keyboard.keyPressed(Keyboard::KEY_R))
+        ErodeTerrain();
+
+    if (keyboard.keyPressed(Keyboard::KEY_F2))
+        SaveTerrain();
+
+    if (keyboard.keyPressed(Keyboard::KEY_F3))
+        LoadTerrain();
+
     if (keyboard.keyPressed(Keyboard::KEY_M))
         Mouse::instance().smoothMouse(!Mouse::instance().mouseSmoothingIsEnabled());
 
     if (keyboard.keyPressed(Keyboard::KEY_T))
         g_disableColorMaps = !g_disableColorMaps;
+
+    if (keyboard.keyPressed(Keyboard::KEY_C))
+        ToggleTerrainVertexFormat();
+
+    if (keyboard.keyPressed(Keyboard::KEY_I))
+        ToggleTerrainIndexOrder();
+
+    if (keyboard.keyPressed(Keyboard::KEY_B))
+        g_terrainBrush = static_cast<HeightMap::BrushMode>((g_terrainBrush + 1) % (HeightMap::BRUSH_SMOOTH + 1));
+
+    if (keyboard.keyPressed(Keyboard::KEY_F))
+        g_terrain.enableFrustumCulling(!g_terrain.frustumCullingIsEnabled());
+
+    if (keyboard.keyPressed(Keyboard::KEY_G))
+        g_terrain.enableGeomipmapping(!g_terrain.geomipmappingIsEnabled());
+
+    if (keyboard.keyPressed(Keyboard::KEY_P))
+        ToggleProfiler();
 }
 
 void ReadTextFile(const char *pszFilename, std::string &buffer)
@@ -997,6 +1286,12 @@ void ReadTextFile(const char *pszFilename, std::string &buffer)
 
 void RenderFrame()
 {
+    PROFILE_ZONE("RenderFrame");
+
+    ShaderProgram::beginFrame();
+    GLStateCache::instance().beginFrame();
+    StreamBuffer::beginFrame();
+
     glEnable(GL_DEPTH_TEST);
     glEnable(GL_CULL_FACE);
 
@@ -1018,7 +1313,9 @@ void RenderFrame()
 
 void RenderTerrain()
 {
-    glUseProgram(g_terrainShader);
+    PROFILE_ZONE("RenderTerrain");
+
+    GetTerrainShader().program.bind();
     UpdateTerrainShaderParameters();
 
     glEnable(GL_LIGHTING);
@@ -1041,22 +1338,15 @@ void RenderTerrain()
     }
     
     g_terrain.draw();
-    
-    for (int i = 3; i >= 0; --i)
-    {
-        glActiveTexture(GL_TEXTURE0 + i);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        glDisable(GL_TEXTURE_2D);
-    }
 
     glDisable(GL_LIGHT0);
     glDisable(GL_LIGHTING);
-
-    glUseProgram(0);
 }
 
 void RenderText()
 {
+    PROFILE_ZONE("RenderText");
+
     std::ostringstream output;
 
     if (g_displayHelp)
@@ -1069,7 +1359,17 @@ void RenderText()
             << "Press M to enable/disable mouse smoothing" << std::endl
             << "Press T to enable/disable textures" << std::endl
             << "Press V to enable/disable vertical sync" << std::endl
+            << "Press C to cycle through the terrain vertex formats" << std::endl
+            << "Press I to cycle through the terrain index orders" << std::endl
+            << "Press B to cycle through the terrain brushes" << std::endl
+            << "Hold the left mouse button to edit the terrain" << std::endl
+            << "Press F to enable/disable terrain frustum culling" << std::endl
+            << "Press G to enable/disable terrain geomipmapping" << std::endl
             << "Press SPACE to generate a new random terrain" << std::endl
+            << "Press N to generate a new random ridged noise terrain" << std::endl
+            << "Press R to erode the terrain" << std::endl
+            << "Press F2 to save the terrain and F3 to load it" << std::endl
+            << "Press P to start/stop profiling to " << PROFILE_FILENAME << std::endl
             << "Press +/- to change camera rotation speed" << std::endl
             << "Press ALT + ENTER to toggle full screen" << std::endl
             << "Press ESC to exit" << std::endl
@@ -1086,6 +1386,29 @@ void RenderText()
             << "Anti-aliasing: " << GetAntiAliasingPixelFormatString() << std::endl
             << "Anisotropic filtering: " << g_maxAnisotrophy << "x" << std::endl
             << "Mouse smoothing: " << (Mouse::instance().mouseSmoothingIsEnabled() ? "on" : "off") << std::endl
+            << "Terrain vertex format: " << GetTerrainVertexFormatName()
+            << " (" << g_terrain.getVertexBufferSize() / 1024 << " KB vertices, "
+            << g_terrain.getIndexBufferSize() / 1024 << " KB indices, "
+            << g_terrain.getDrawCallCount() << " draw calls)" << std::endl
+            << "Terrain index order: " << GetTerrainIndexOrderName() << std::endl
+            << "Terrain brush: " << GetTerrainBrushName() << std::endl
+            << "Terrain geomipmapping: " << (g_terrain.geomipmappingIsEnabled() ? "on" : "off")
+            << " (" << g_terrain.getTriangleCount() << " triangles)" << std::endl
+            << "Terrain frustum culling: " << (g_terrain.frustumCullingIsEnabled() ? "on" : "off")
+            << " (" << g_terrain.getVisiblePatchCount() << " patches visible, "
+            << g_terrain.getCulledPatchCount() << " culled)" << std::endl
+            << "Profiler: " << (Profiler::instance().isEnabled() ? "recording" : "off")
+            << " (" << Profiler::instance().getEventCount() << " zones)" << std::endl
+            << "Shader uniforms: " << ShaderProgram::getLastFrameStats().uniformsUploaded << " uploaded, "
+            << ShaderProgram::getLastFrameStats().uniformsSkipped << " unchanged, "
+            << ShaderProgram::getLastFrameStats().locationLookupsSaved << " lookups saved" << std::endl
+            << "GL binds: " << GLStateCache::instance().getLastFrameStats().bindsIssued << " issued, "
+            << GLStateCache::instance().getLastFrameStats().bindsFiltered << " filtered" << std::endl
+            << "Buffer uploads: " << StreamBuffer::getLastFrameStats().bytesUploaded / 1024 << " KB in "
+            << StreamBuffer::getLastFrameStats().maps << " maps, "
+            << StreamBuffer::getLastFrameStats().stalls << " stalls ("
+            << StreamBuffer::getLastFrameStats().stallMs << " ms), "
+            << StreamBuffer::getLastFrameStats().mapMs << " ms mapping" << std::endl
             << std::endl
             << "Camera:" << std::endl
             << "  Position:"
@@ -1107,6 +1430,22 @@ void RenderText()
     g_font.end();
 }
 
+void SaveTerrain()
+{
+    PROFILE_ZONE("SaveTerrain");
+
+    if (!g_terrain.getHeightMap().save(HEIGHTMAP_FILENAME, HeightMapFile::SAMPLE_FLOAT))
+    {
+        // Windows won't replace the file while the terrain loaded from it
+        // is still mapped.
+
+        std::ostringstream msg;
+
+        msg << "Failed to save the terrain to " << HEIGHTMAP_FILENAME << ".";
+        MessageBox(g_hWnd, msg.str().c_str(), "Error", MB_ICONWARNING);
+    }
+}
+
 void SetProcessorAffinity()
 {
     // Assign the current thread to one processor. This ensures that timing
@@ -1191,8 +1530,68 @@ void ToggleFullScreen()
         CAMERA_ZNEAR, CAMERA_ZFAR);
 }
 
+void ToggleProfiler()
+{
+    // Starts recording a new profile, or stops recording and writes the
+    // recorded zones out as a Chrome trace.
+
+    Profiler &profiler = Profiler::instance();
+
+    if (profiler.isEnabled())
+    {
+        profiler.enable(false);
+        profiler.writeChromeTrace(PROFILE_FILENAME);
+    }
+    else
+    {
+        profiler.clear();
+        profiler.enable(true);
+    }
+}
+
+void ToggleTerrainIndexOrder()
+{
+    // Cycles the terrain through the strip, block list and block strips
+    // index orders. Block strips are skipped without primitive restart. The
+    // order only affects drawing with geomipmapping and frustum culling
+    // disabled.
+
+    Terrain::IndexOrder indexOrder = g_terrain.getIndexOrder();
+    bool switched = false;
+
+    if (indexOrder == Terrain::INDEX_ORDER_STRIP)
+        switched = g_terrain.setIndexOrder(Terrain::INDEX_ORDER_BLOCK_LIST);
+
+    if (!switched && indexOrder != Terrain::INDEX_ORDER_BLOCK_STRIPS)
+        switched = g_terrain.setIndexOrder(Terrain::INDEX_ORDER_BLOCK_STRIPS);
+
+    if (!switched && !g_terrain.setIndexOrder(Terrain::INDEX_ORDER_STRIP))
+        throw std::runtime_error("Failed to switch terrain index order.");
+}
+
+void ToggleTerrainVertexFormat()
+{
+    // Cycles the terrain through the float, compact and instanced vertex
+    // formats. Formats whose shader couldn't be built are skipped, and so is
+    // the instanced format when the terrain can't create its buffers.
+
+    Terrain::VertexFormat vertexFormat = g_terrain.getVertexFormat();
+    bool switched = false;
+
+    if (vertexFormat == Terrain::VERTEX_FORMAT_FLOAT && !g_terrainCompactShader.program.isNull())
+        switched = g_terrain.setVertexFormat(Terrain::VERTEX_FORMAT_COMPACT);
+
+    if (!switched && vertexFormat != Terrain::VERTEX_FORMAT_INSTANCED && !g_terrainInstancedShader.program.isNull())
+        switched = g_terrain.setVertexFormat(Terrain::VERTEX_FORMAT_INSTANCED);
+
+    if (!switched && !g_terrain.setVertexFormat(Terrain::VERTEX_FORMAT_FLOAT))
+        throw std::runtime_error("Failed to switch terrain vertex format.");
+}
+
 void UpdateCamera(float elapsedTimeSec)
 {
+    PROFILE_ZONE("UpdateCamera");
+
     Mouse &mouse = Mouse::instance();
     float dx = -mouse.xPosRelative();
     float dy = -mouse.yPosRelative();
@@ -1207,6 +1606,8 @@ void UpdateCamera(float elapsedTimeSec)
 
 void UpdateFrame(float elapsedTimeSec)
 {
+    PROFILE_ZONE("UpdateFrame");
+
     UpdateFrameRate(elapsedTimeSec);
 
     Mouse::instance().update();
@@ -1214,6 +1615,11 @@ void UpdateFrame(float elapsedTimeSec)
 
     ProcessUserInput();
     UpdateCamera(elapsedTimeSec);
+    EditTerrain(elapsedTimeSec);
+
+    g_terrain.setLodParameters(HEIGHTMAP_LOD_MAX_PIXEL_ERROR,
+        static_cast<float>(g_windowWidth), CAMERA_FOVX);
+    g_terrain.update(g_camera.getPosition(), Frustum(g_camera.getViewProjectionMatrix()));
 }
 
 void UpdateFrameRate(float elapsedTimeSec)
@@ -1238,49 +1644,31 @@ void UpdateFrameRate(float elapsedTimeSec)
 
 void UpdateTerrainShaderParameters()
 {
-    GLint handle = -1;
-
-    // Update the terrain tiling factor.
-
-    handle = glGetUniformLocation(g_terrainShader, "tilingFactor");
-    glUniform1f(handle, HEIGHTMAP_TILING_FACTOR);
-
-    // Update terrain region 1.
+    // Sets every uniform of the terrain shader each frame. ShaderProgram
+    // only calls glUniform*() for the values that have changed since the
+    // last frame, which after the first frame is usually none of them.
 
-    handle = glGetUniformLocation(g_terrainShader, "region1.max");
-    glUniform1f(handle, g_regions[0].max);
+    TerrainShader &shader = GetTerrainShader();
+    ShaderProgram &program = shader.program;
 
-    handle = glGetUniformLocation(g_terrainShader, "region1.min");
-    glUniform1f(handle, g_regions[0].min);    
+    program.setUniform(shader.tilingFactor, HEIGHTMAP_TILING_FACTOR);
 
-    // Update terrain region 2.
+    // The compact and instanced vertex format grid parameters. The float
+    // vertex format's shader doesn't have them, so their indices are -1 and
+    // nothing is set.
 
-    handle = glGetUniformLocation(g_terrainShader, "region2.max");
-    glUniform1f(handle, g_regions[1].max);
+    program.setUniform(shader.gridSize, HEIGHTMAP_SIZE);
+    program.setUniform(shader.gridSpacing, static_cast<float>(HEIGHTMAP_GRID_SPACING));
+    program.setUniform(shader.compactHeightScale, g_terrain.getCompactHeightScale());
+    program.setUniform(shader.heightScale, g_terrain.getHeightMap().getHeightScale());
+    program.setUniform(shader.heightMap, static_cast<int>(Terrain::HEIGHT_MAP_TEXTURE_UNIT));
 
-    handle = glGetUniformLocation(g_terrainShader, "region2.min");
-    glUniform1f(handle, g_regions[1].min);
+    // The terrain regions and their texture units.
 
-    // Update terrain region 3.
-
-    handle = glGetUniformLocation(g_terrainShader, "region3.max");
-    glUniform1f(handle, g_regions[2].max);
-
-    handle = glGetUniformLocation(g_terrainShader, "region3.min");
-    glUniform1f(handle, g_regions[2].min);
-
-    // Update terrain region 4.
-
-    handle = glGetUniformLocation(g_terrainShader, "region4.max");
-    glUniform1f(handle, g_regions[3].max);
-
-    handle = glGetUniformLocation(g_terrainShader, "region4.min");
-    glUniform1f(handle, g_regions[3].min);
-
-    // Bind textures.
-
-    glUniform1i(glGetUniformLocation(g_terrainShader, "region1ColorMap"), 0);
-    glUniform1i(glGetUniformLocation(g_terrainShader, "region2ColorMap"), 1);
-    glUniform1i(glGetUniformLocation(g_terrainShader, "region3ColorMap"), 2);
-    glUniform1i(glGetUniformLocation(g_terrainShader, "region4ColorMap"), 3);
+    for (int i = 0; i < TERRAIN_REGIONS_COUNT; ++i)
+    {
+        program.setUniform(shader.regionMax[i], g_regions[i].max);
+        program.setUniform(shader.regionMin[i], g_regions[i].min);
+        program.setUniform(shader.regionColorMap[i], i);
+    }
 }
\ No newline at end of file
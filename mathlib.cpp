@@ -21,6 +21,32 @@ int Math::nextPower2(int x)
     return i;
 }
 
+//-----------------------------------------------------------------------------
+// Frustum.
+
+void Frustum::extractPlanes(const Matrix4 &viewProj)
+{
+    // Vectors are multiplied to the left of the matrix, so each clip space
+    // coordinate is the dot product of the point with a column of the matrix.
+    // A point is inside the frustum when -w <= x, y, z <= w. Each of these 6
+    // inequalities is a plane equation made up of the sum or the difference
+    // of the w column and the x, y, or z column.
+
+    for (int i = 0; i < PLANE_COUNT; ++i)
+    {
+        int column = i / 2;
+        float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+        float a = viewProj[0][3] + sign * viewProj[0][column];
+        float b = viewProj[1][3] + sign * viewProj[1][column];
+        float c = viewProj[2][3] + sign * viewProj[2][column];
+        float d = viewProj[3][3] + sign * viewProj[3][column];
+        float invLength = 1.0f / sqrtf(a * a + b * b + c * c);
+
+        m_normals[i].set(a * invLength, b * invLength, c * invLength);
+        m_distances[i] = d * invLength;
+    }
+}
+
 //-----------------------------------------------------------------------------
 // Matrix3.
 
@@ -6,6 +6,7 @@
 
 #include <cmath>
 #include <cstdlib>
+#include <cstring>
 
 //-----------------------------------------------------------------------------
 // Classes.
@@ -69,7 +70,10 @@ public:
         // Fractional values are truncated as in ANSI C.
         // About 5 to 6 times faster than a standard typecast to an integer.
 
-        long fpBits = *reinterpret_cast<const long*>(&f);
+        int fpBits;
+
+        memcpy(&fpBits, &f, sizeof(fpBits));
+
         long shift = 23 - (((fpBits & 0x7fffffff) >> 23) - 127);
         long result = ((fpBits & 0x7fffff) | (1 << 23)) >> shift;
 
@@ -157,6 +161,19 @@ public:
         y = rho * sinf(phi);
         z = rho * cosf(phi) * sinf(theta);
     }
+
+    static unsigned long long splitMix64(unsigned long long x)
+    {
+        // The SplitMix64 finalizer. A fast, high quality 64-bit integer hash.
+        //
+        // Reference:
+        //  Guy L. Steele Jr., Doug Lea, and Christine H. Flood, "Fast
+        //  Splittable Pseudorandom Number Generators", OOPSLA 2014.
+
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
 };
 
 //-----------------------------------------------------------------------------
@@ -1329,6 +1346,96 @@ inline void Quaternion::toHeadPitchRoll(float &headDegrees, float &pitchDegrees,
     m.toHeadPitchRoll(headDegrees, pitchDegrees, rollDegrees);
 }
 
+//-----------------------------------------------------------------------------
+// A view frustum made up of 6 planes that point into the frustum.
+//
+// The planes are extracted from a combined view and projection matrix as
+// described in "Fast Extraction of Viewing Frustum Planes from the
+// World-View-Projection Matrix" (Gribb and Hartmann). The matrix is expected
+// to map onto OpenGL's clip space (i.e., -w <= z <= w).
+
+class Frustum
+{
+public:
+    enum Plane
+    {
+        PLANE_LEFT,
+        PLANE_RIGHT,
+        PLANE_BOTTOM,
+        PLANE_TOP,
+        PLANE_NEAR,
+        PLANE_FAR,
+        PLANE_COUNT
+    };
+
+    Frustum() {}
+    explicit Frustum(const Matrix4 &viewProj);
+    ~Frustum() {}
+
+    bool boxVisible(const Vector3 &boxMin, const Vector3 &boxMax) const;
+    void extractPlanes(const Matrix4 &viewProj);
+    const Vector3 &getPlaneNormal(Plane plane) const;
+    float getPlaneDistance(Plane plane) const;
+    bool pointVisible(const Vector3 &point) const;
+    bool sphereVisible(const Vector3 &center, float radius) const;
+
+private:
+    Vector3 m_normals[PLANE_COUNT];
+    float m_distances[PLANE_COUNT];
+};
+
+inline Frustum::Frustum(const Matrix4 &viewProj)
+{
+    extractPlanes(viewProj);
+}
+
+inline bool Frustum::boxVisible(const Vector3 &boxMin, const Vector3 &boxMax) const
+{
+    // The box is outside the frustum when the corner that lies furthest
+    // along a plane's normal is behind that plane. Boxes that straddle the
+    // corner of 2 planes outside the frustum are conservatively reported as
+    // visible.
+
+    for (int i = 0; i < PLANE_COUNT; ++i)
+    {
+        const Vector3 &n = m_normals[i];
+        float x = (n.x >= 0.0f) ? boxMax.x : boxMin.x;
+        float y = (n.y >= 0.0f) ? boxMax.y : boxMin.y;
+        float z = (n.z >= 0.0f) ? boxMax.z : boxMin.z;
+
+        if (n.x * x + n.y * y + n.z * z + m_distances[i] < 0.0f)
+            return false;
+    }
+
+    return true;
+}
+
+inline const Vector3 &Frustum::getPlaneNormal(Plane plane) const
+{
+    return m_normals[plane];
+}
+
+inline float Frustum::getPlaneDistance(Plane plane) const
+{
+    return m_distances[plane];
+}
+
+inline bool Frustum::pointVisible(const Vector3 &point) const
+{
+    return sphereVisible(point, 0.0f);
+}
+
+inline bool Frustum::sphereVisible(const Vector3 &center, float radius) const
+{
+    for (int i = 0; i < PLANE_COUNT; ++i)
+    {
+        if (Vector3::dot(m_normals[i], center) + m_distances[i] < -radius)
+            return false;
+    }
+
+    return true;
+}
+
 //-----------------------------------------------------------------------------
 
 #endif
\ No newline at end of file
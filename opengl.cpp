@@ -2130,4 +2130,164 @@ void glUniformMatrix4x3fv(GLint location, GLsizei count, GLboolean transpose, co
     static PFNGLUNIFORMMATRIX4X3FVPROC pfnUniformMatrix4x3fv = 0;
     LOAD_ENTRYPOINT("glUniformMatrix4x3fv", pfnUniformMatrix4x3fv, PFNGLUNIFORMMATRIX4X3FVPROC);
     pfnUniformMatrix4x3fv(location, count, transpose, value);
+}
+
+//
+// GL_ARB_vertex_array_object
+//
+
+void glBindVertexArray(GLuint array)
+{
+    typedef void (APIENTRY * PFNGLBINDVERTEXARRAYPROC) (GLuint array);
+    static PFNGLBINDVERTEXARRAYPROC pfnBindVertexArray = 0;
+    LOAD_ENTRYPOINT("glBindVertexArray", pfnBindVertexArray, PFNGLBINDVERTEXARRAYPROC);
+    pfnBindVertexArray(array);
+}
+
+void glDeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    typedef void (APIENTRY * PFNGLDELETEVERTEXARRAYSPROC) (GLsizei n, const GLuint *arrays);
+    static PFNGLDELETEVERTEXARRAYSPROC pfnDeleteVertexArrays = 0;
+    LOAD_ENTRYPOINT("glDeleteVertexArrays", pfnDeleteVertexArrays, PFNGLDELETEVERTEXARRAYSPROC);
+    pfnDeleteVertexArrays(n, arrays);
+}
+
+void glGenVertexArrays(GLsizei n, GLuint *arrays)
+{
+    typedef void (APIENTRY * PFNGLGENVERTEXARRAYSPROC) (GLsizei n, GLuint *arrays);
+    static PFNGLGENVERTEXARRAYSPROC pfnGenVertexArrays = 0;
+    LOAD_ENTRYPOINT("glGenVertexArrays", pfnGenVertexArrays, PFNGLGENVERTEXARRAYSPROC);
+    pfnGenVertexArrays(n, arrays);
+}
+
+GLboolean glIsVertexArray(GLuint array)
+{
+    typedef GLboolean (APIENTRY * PFNGLISVERTEXARRAYPROC) (GLuint array);
+    static PFNGLISVERTEXARRAYPROC pfnIsVertexArray = 0;
+    LOAD_ENTRYPOINT("glIsVertexArray", pfnIsVertexArray, PFNGLISVERTEXARRAYPROC);
+    return pfnIsVertexArray(array);
+}
+
+//
+// GL_ARB_map_buffer_range
+//
+
+GLvoid *glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access)
+{
+    typedef GLvoid *(APIENTRY * PFNGLMAPBUFFERRANGEPROC) (GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+    static PFNGLMAPBUFFERRANGEPROC pfnMapBufferRange = 0;
+    LOAD_ENTRYPOINT("glMapBufferRange", pfnMapBufferRange, PFNGLMAPBUFFERRANGEPROC);
+    return pfnMapBufferRange(target, offset, length, access);
+}
+
+void glFlushMappedBufferRange(GLenum target, GLintptr offset, GLsizeiptr length)
+{
+    typedef void (APIENTRY * PFNGLFLUSHMAPPEDBUFFERRANGEPROC) (GLenum target, GLintptr offset, GLsizeiptr length);
+    static PFNGLFLUSHMAPPEDBUFFERRANGEPROC pfnFlushMappedBufferRange = 0;
+    LOAD_ENTRYPOINT("glFlushMappedBufferRange", pfnFlushMappedBufferRange, PFNGLFLUSHMAPPEDBUFFERRANGEPROC);
+    pfnFlushMappedBufferRange(target, offset, length);
+}
+
+//
+// GL_ARB_draw_instanced
+//
+
+void glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei primcount)
+{
+    typedef void (APIENTRY * PFNGLDRAWARRAYSINSTANCEDPROC) (GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+    static PFNGLDRAWARRAYSINSTANCEDPROC pfnDrawArraysInstanced = 0;
+    LOAD_ENTRYPOINT("glDrawArraysInstanced", pfnDrawArraysInstanced, PFNGLDRAWARRAYSINSTANCEDPROC);
+    pfnDrawArraysInstanced(mode, first, count, primcount);
+}
+
+void glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount)
+{
+    typedef void (APIENTRY * PFNGLDRAWELEMENTSINSTANCEDPROC) (GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount);
+    static PFNGLDRAWELEMENTSINSTANCEDPROC pfnDrawElementsInstanced = 0;
+    LOAD_ENTRYPOINT("glDrawElementsInstanced", pfnDrawElementsInstanced, PFNGLDRAWELEMENTSINSTANCEDPROC);
+    pfnDrawElementsInstanced(mode, count, type, indices, primcount);
+}
+
+//
+// OpenGL 3.1
+//
+
+void glPrimitiveRestartIndex(GLuint index)
+{
+    typedef void (APIENTRY * PFNGLPRIMITIVERESTARTINDEXPROC) (GLuint index);
+    static PFNGLPRIMITIVERESTARTINDEXPROC pfnPrimitiveRestartIndex = 0;
+    LOAD_ENTRYPOINT("glPrimitiveRestartIndex", pfnPrimitiveRestartIndex, PFNGLPRIMITIVERESTARTINDEXPROC);
+    pfnPrimitiveRestartIndex(index);
+}
+
+//
+// GL_ARB_draw_elements_base_vertex
+//
+
+void glDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex)
+{
+    typedef void (APIENTRY * PFNGLDRAWELEMENTSBASEVERTEXPROC) (GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex);
+    static PFNGLDRAWELEMENTSBASEVERTEXPROC pfnDrawElementsBaseVertex = 0;
+    LOAD_ENTRYPOINT("glDrawElementsBaseVertex", pfnDrawElementsBaseVertex, PFNGLDRAWELEMENTSBASEVERTEXPROC);
+    pfnDrawElementsBaseVertex(mode, count, type, indices, basevertex);
+}
+
+void glDrawRangeElementsBaseVertex(GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex)
+{
+    typedef void (APIENTRY * PFNGLDRAWRANGEELEMENTSBASEVERTEXPROC) (GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex);
+    static PFNGLDRAWRANGEELEMENTSBASEVERTEXPROC pfnDrawRangeElementsBaseVertex = 0;
+    LOAD_ENTRYPOINT("glDrawRangeElementsBaseVertex", pfnDrawRangeElementsBaseVertex, PFNGLDRAWRANGEELEMENTSBASEVERTEXPROC);
+    pfnDrawRangeElementsBaseVertex(mode, start, end, count, type, indices, basevertex);
+}
+
+//
+// GL_ARB_sync
+//
+
+GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout)
+{
+    typedef GLenum (APIENTRY * PFNGLCLIENTWAITSYNCPROC) (GLsync sync, GLbitfield flags, GLuint64 timeout);
+    static PFNGLCLIENTWAITSYNCPROC pfnClientWaitSync = 0;
+    LOAD_ENTRYPOINT("glClientWaitSync", pfnClientWaitSync, PFNGLCLIENTWAITSYNCPROC);
+    return pfnClientWaitSync(sync, flags, timeout);
+}
+
+void glDeleteSync(GLsync sync)
+{
+    typedef void (APIENTRY * PFNGLDELETESYNCPROC) (GLsync sync);
+    static PFNGLDELETESYNCPROC pfnDeleteSync = 0;
+    LOAD_ENTRYPOINT("glDeleteSync", pfnDeleteSync, PFNGLDELETESYNCPROC);
+    pfnDeleteSync(sync);
+}
+
+GLsync glFenceSync(GLenum condition, GLbitfield flags)
+{
+    typedef GLsync (APIENTRY * PFNGLFENCESYNCPROC) (GLenum condition, GLbitfield flags);
+    static PFNGLFENCESYNCPROC pfnFenceSync = 0;
+    LOAD_ENTRYPOINT("glFenceSync", pfnFenceSync, PFNGLFENCESYNCPROC);
+    return pfnFenceSync(condition, flags);
+}
+
+//
+// GL_ARB_instanced_arrays
+//
+
+void glVertexAttribDivisor(GLuint index, GLuint divisor)
+{
+    typedef void (APIENTRY * PFNGLVERTEXATTRIBDIVISORPROC) (GLuint index, GLuint divisor);
+    static PFNGLVERTEXATTRIBDIVISORPROC pfnVertexAttribDivisor = 0;
+    LOAD_ENTRYPOINT("glVertexAttribDivisor", pfnVertexAttribDivisor, PFNGLVERTEXATTRIBDIVISORPROC);
+    pfnVertexAttribDivisor(index, divisor);
+}
+
+//
+// GL_ARB_buffer_storage
+//
+
+void glBufferStorage(GLenum target, GLsizeiptr size, const GLvoid *data, GLbitfield flags)
+{
+    typedef void (APIENTRY * PFNGLBUFFERSTORAGEPROC) (GLenum target, GLsizeiptr size, const GLvoid *data, GLbitfield flags);
+    static PFNGLBUFFERSTORAGEPROC pfnBufferStorage = 0;
+    LOAD_ENTRYPOINT("glBufferStorage", pfnBufferStorage, PFNGLBUFFERSTORAGEPROC);
+    pfnBufferStorage(target, size, data, flags);
 }
\ No newline at end of file
@@ -2,7 +2,8 @@
 //-----------------------------------------------------------------------------
 //
 // This header file contains the new symbols and functions for OpenGL up to and
-// including OpenGL 2.1. Each function is initialized on first use.
+// including OpenGL 2.1, and for the few later extensions the demo uses. Each
+// function is initialized on first use.
 //
 // Also included are a few support functions to help determine the version of
 // OpenGL and GLSL supported by the host operating system.
@@ -739,5 +740,117 @@ extern void glUniformMatrix4x2fv(GLint location, GLsizei count, GLboolean transp
 extern void glUniformMatrix3x4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
 extern void glUniformMatrix4x3fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat *value);
 
+//
+// GL_ARB_vertex_array_object (core in OpenGL 3.0)
+//
+
+#define GL_VERTEX_ARRAY_BINDING           0x85B5
+
+extern void glBindVertexArray(GLuint array);
+extern void glDeleteVertexArrays(GLsizei n, const GLuint *arrays);
+extern void glGenVertexArrays(GLsizei n, GLuint *arrays);
+extern GLboolean glIsVertexArray(GLuint array);
+
+//
+// GL_ARB_map_buffer_range (core in OpenGL 3.0)
+//
+
+#define GL_MAP_READ_BIT                   0x0001
+#define GL_MAP_WRITE_BIT                  0x0002
+#define GL_MAP_INVALIDATE_RANGE_BIT       0x0004
+#define GL_MAP_INVALIDATE_BUFFER_BIT      0x0008
+#define GL_MAP_FLUSH_EXPLICIT_BIT         0x0010
+#define GL_MAP_UNSYNCHRONIZED_BIT         0x0020
+
+extern GLvoid *glMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access);
+extern void glFlushMappedBufferRange(GLenum target, GLintptr offset, GLsizeiptr length);
+
+//
+// GL_ARB_texture_rg (core in OpenGL 3.0)
+//
+
+#define GL_RG                             0x8227
+#define GL_RG_INTEGER                     0x8228
+#define GL_R8                             0x8229
+#define GL_R16                            0x822A
+#define GL_RG8                            0x822B
+#define GL_RG16                           0x822C
+#define GL_R16F                           0x822D
+#define GL_R32F                           0x822E
+#define GL_RG16F                          0x822F
+#define GL_RG32F                          0x8230
+
+//
+// GL_ARB_draw_instanced (core in OpenGL 3.1)
+//
+
+extern void glDrawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei primcount);
+extern void glDrawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLsizei primcount);
+
+//
+// OpenGL 3.1
+//
+
+#define GL_PRIMITIVE_RESTART              0x8F9D
+#define GL_PRIMITIVE_RESTART_INDEX        0x8F9E
+
+extern void glPrimitiveRestartIndex(GLuint index);
+
+//
+// GL_ARB_draw_elements_base_vertex (core in OpenGL 3.2)
+//
+
+extern void glDrawElementsBaseVertex(GLenum mode, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex);
+extern void glDrawRangeElementsBaseVertex(GLenum mode, GLuint start, GLuint end, GLsizei count, GLenum type, const GLvoid *indices, GLint basevertex);
+
+//
+// GL_ARB_sync (core in OpenGL 3.2)
+//
+
+typedef struct __GLsync *GLsync;
+typedef long long GLint64;
+typedef unsigned long long GLuint64;
+
+#define GL_MAX_SERVER_WAIT_TIMEOUT        0x9111
+#define GL_OBJECT_TYPE                    0x9112
+#define GL_SYNC_CONDITION                 0x9113
+#define GL_SYNC_STATUS                    0x9114
+#define GL_SYNC_FLAGS                     0x9115
+#define GL_SYNC_FENCE                     0x9116
+#define GL_SYNC_GPU_COMMANDS_COMPLETE     0x9117
+#define GL_UNSIGNALED                     0x9118
+#define GL_SIGNALED                       0x9119
+#define GL_ALREADY_SIGNALED               0x911A
+#define GL_TIMEOUT_EXPIRED                0x911B
+#define GL_CONDITION_SATISFIED            0x911C
+#define GL_WAIT_FAILED                    0x911D
+#define GL_SYNC_FLUSH_COMMANDS_BIT        0x00000001
+#define GL_TIMEOUT_IGNORED                0xFFFFFFFFFFFFFFFFull
+
+extern GLenum glClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout);
+extern void glDeleteSync(GLsync sync);
+extern GLsync glFenceSync(GLenum condition, GLbitfield flags);
+
+//
+// GL_ARB_instanced_arrays (core in OpenGL 3.3)
+//
+
+#define GL_VERTEX_ATTRIB_ARRAY_DIVISOR    0x88FE
+
+extern void glVertexAttribDivisor(GLuint index, GLuint divisor);
+
+//
+// GL_ARB_buffer_storage (core in OpenGL 4.4)
+//
+
+#define GL_MAP_PERSISTENT_BIT             0x0040
+#define GL_MAP_COHERENT_BIT               0x0080
+#define GL_DYNAMIC_STORAGE_BIT            0x0100
+#define GL_CLIENT_STORAGE_BIT             0x0200
+#define GL_BUFFER_IMMUTABLE_STORAGE       0x821F
+#define GL_BUFFER_STORAGE_FLAGS           0x8220
+
+extern void glBufferStorage(GLenum target, GLsizeiptr size, const GLvoid *data, GLbitfield flags);
+
 } // extern "C"
 #endif
\ No newline at end of file
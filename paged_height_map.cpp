@@ -0,0 +1,669 @@
+
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <iterator>
+#include <system_error>
+#include "height_map.h"
+#include "paged_height_map.h"
+#include "profiler.h"
+
+//-----------------------------------------------------------------------------
+// FractalTileSource.
+
+FractalTileSource::FractalTileSource(unsigned int seed, float roughness, int featureSize)
+{
+    m_seed = seed;
+    m_roughness = roughness;
+    m_featureSize = (featureSize > 0) ? featureSize : 1;
+}
+
+bool FractalTileSource::loadTile(int tileX, int tileZ, int tileSize, float *pHeights)
+{
+    int x0 = tileX * tileSize;
+    int z0 = tileZ * tileSize;
+    float amplitudeFactor = powf(2.0f, -m_roughness);
+    float amplitude = 1.0f;
+    float totalAmplitude = 0.0f;
+    std::vector<float> lattice;
+    std::vector<float> weights(tileSize);
+    std::vector<int> cells(tileSize);
+
+    std::fill(pHeights, pHeights + tileSize * tileSize, 0.0f);
+
+    for (int spacing = m_featureSize, octave = 0; spacing >= 1; spacing /= 2, ++octave)
+    {
+        // Fetch the random values of the lattice points covering the tile.
+
+        int latticeX0 = x0 / spacing;
+        int latticeZ0 = z0 / spacing;
+        int latticeWidth = (x0 + tileSize - 1) / spacing + 2 - latticeX0;
+        int latticeHeight = (z0 + tileSize - 1) / spacing + 2 - latticeZ0;
+
+        lattice.resize(latticeWidth * latticeHeight);
+
+        for (int z = 0; z < latticeHeight; ++z)
+        {
+            for (int x = 0; x < latticeWidth; ++x)
+                lattice[z * latticeWidth + x] = HeightMap::random(m_seed, latticeX0 + x, latticeZ0 + z, octave);
+        }
+
+        // The lattice cell and the smoothstep weight of each column of the
+        // tile.
+
+        for (int x = 0; x < tileSize; ++x)
+        {
+            float t = static_cast<float>((x0 + x) % spacing) / static_cast<float>(spacing);
+
+            cells[x] = (x0 + x) / spacing - latticeX0;
+            weights[x] = t * t * (3.0f - 2.0f * t);
+        }
+
+        for (int z = 0; z < tileSize; ++z)
+        {
+            const float *pTop = &lattice[((z0 + z) / spacing - latticeZ0) * latticeWidth];
+            const float *pBottom = pTop + latticeWidth;
+            float t = static_cast<float>((z0 + z) % spacing) / static_cast<float>(spacing);
+            float v = t * t * (3.0f - 2.0f * t);
+            float *pRow = &pHeights[z * tileSize];
+
+            for (int x = 0; x < tileSize; ++x)
+            {
+                int cell = cells[x];
+                float u = weights[x];
+                float top = pTop[cell] + u * (pTop[cell + 1] - pTop[cell]);
+                float bottom = pBottom[cell] + u * (pBottom[cell + 1] - pBottom[cell]);
+
+                pRow[x] += amplitude * (top + v * (bottom - top));
+            }
+        }
+
+        totalAmplitude += amplitude;
+        amplitude *= amplitudeFactor;
+    }
+
+    // Map the range [-totalAmplitude, totalAmplitude] to [0,255].
+
+    float scale = 127.5f / totalAmplitude;
+
+    for (int i = 0; i < tileSize * tileSize; ++i)
+        pHeights[i] = 127.5f + pHeights[i] * scale;
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// PagedHeightMap.
+
+PagedHeightMap::PagedHeightMap() : m_pStreamedTiles(0), m_queueDepth(0), m_tilesInFlight(0)
+{
+    m_size = 0;
+    m_gridSpacing = 0;
+    m_heightScale = 1.0f;
+    m_tileSize = 0;
+    m_tileShift = 0;
+    m_memoryBudget = 0;
+    m_maxResidentTiles = 0;
+    m_tileLoads = 0;
+    m_tileFailures = 0;
+    m_pSource = 0;
+    m_pLastTile = 0;
+    m_streamedTiles = 0;
+    m_hitchesAvoided = 0;
+    m_stopLoaders = false;
+}
+
+PagedHeightMap::~PagedHeightMap()
+{
+    destroy();
+}
+
+bool PagedHeightMap::create(int size, int gridSpacing, float scale, int tileSize,
+                            size_t memoryBudget, HeightTileSource *pSource)
+{
+    // 'tileSize' must be a power of 2. 'memoryBudget' is the most memory, in
+    // bytes, that the resident tiles may use. At least 4 tiles are always kept
+    // so that a single bilinear lookup never evicts a tile it needs.
+
+    destroy();
+
+    if (size < 2 || !Math::isPower2(tileSize) || !pSource)
+        return false;
+
+    m_size = size;
+    m_gridSpacing = gridSpacing;
+    m_heightScale = scale;
+    m_tileSize = tileSize;
+    m_pSource = pSource;
+
+    while ((1 << m_tileShift) < tileSize)
+        ++m_tileShift;
+
+    setMemoryBudget(memoryBudget);
+    return true;
+}
+
+void PagedHeightMap::destroy()
+{
+    stopStreaming();
+    m_tiles.clear();
+    m_tileLookup.clear();
+    m_pLastTile = 0;
+    m_pSource = 0;
+    m_size = 0;
+    m_gridSpacing = 0;
+    m_heightScale = 1.0f;
+    m_tileSize = 0;
+    m_tileShift = 0;
+    m_tileLoads = 0;
+    m_tileFailures = 0;
+    m_streamedTiles = 0;
+    m_hitchesAvoided = 0;
+}
+
+float PagedHeightMap::heightAt(float x, float z)
+{
+    // Given a (x, z) position on the rendered height map this method
+    // calculates the exact height of the height map at that (x, z)
+    // position using bilinear interpolation. When all 4 texels are in the
+    // same tile the tile is only looked up once.
+
+    x /= static_cast<float>(m_gridSpacing);
+    z /= static_cast<float>(m_gridSpacing);
+
+    assert(x >= 0.0f && x < float(m_size));
+    assert(z >= 0.0f && z < float(m_size));
+
+    int ix = static_cast<int>(x);
+    int iz = static_cast<int>(z);
+    int mask = m_tileSize - 1;
+    float percentX = x - static_cast<float>(ix);
+    float percentZ = z - static_cast<float>(iz);
+    float topLeft, topRight, bottomLeft, bottomRight;
+
+    if ((ix & mask) != mask && (iz & mask) != mask && ix + 1 < m_size && iz + 1 < m_size)
+    {
+        const float *pTexel = tileAt(ix >> m_tileShift, iz >> m_tileShift)
+            + ((iz & mask) << m_tileShift) + (ix & mask);
+
+        topLeft = pTexel[0];
+        topRight = pTexel[1];
+        bottomLeft = pTexel[m_tileSize];
+        bottomRight = pTexel[m_tileSize + 1];
+    }
+    else
+    {
+        topLeft = heightAtPixel(ix, iz);
+        topRight = heightAtPixel(ix + 1, iz);
+        bottomLeft = heightAtPixel(ix, iz + 1);
+        bottomRight = heightAtPixel(ix + 1, iz + 1);
+    }
+
+    return Math::bilerp(topLeft, topRight, bottomLeft, bottomRight, percentX, percentZ) * m_heightScale;
+}
+
+float PagedHeightMap::heightAtPixel(int x, int z)
+{
+    x = wrap(x);
+    z = wrap(z);
+
+    int mask = m_tileSize - 1;
+    const float *pHeights = tileAt(x >> m_tileShift, z >> m_tileShift);
+
+    return pHeights[((z & mask) << m_tileShift) + (x & mask)];
+}
+
+void PagedHeightMap::normalAt(float x, float z, Vector3 &n)
+{
+    // Given a (x, z) position on the rendered height map this method
+    // calculates the exact normal of the height map at that (x, z) position
+    // using bilinear interpolation.
+
+    x /= static_cast<float>(m_gridSpacing);
+    z /= static_cast<float>(m_gridSpacing);
+
+    assert(x >= 0.0f && x < float(m_size));
+    assert(z >= 0.0f && z < float(m_size));
+
+    int ix = static_cast<int>(x);
+    int iz = static_cast<int>(z);
+    float percentX = x - static_cast<float>(ix);
+    float percentZ = z - static_cast<float>(iz);
+
+    Vector3 topLeft;
+    Vector3 topRight;
+    Vector3 bottomLeft;
+    Vector3 bottomRight;
+
+    normalAtPixel(ix, iz, topLeft);
+    normalAtPixel(ix + 1, iz, topRight);
+    normalAtPixel(ix, iz + 1, bottomLeft);
+    normalAtPixel(ix + 1, iz + 1, bottomRight);
+
+    n = Math::bilerp(topLeft, topRight, bottomLeft, bottomRight, percentX, percentZ);
+    n.normalize();
+}
+
+void PagedHeightMap::normalAtPixel(int x, int z, Vector3 &n)
+{
+    // Returns the normal at the specified location on the height map, in the
+    // same way as HeightMap::normalAtPixel().
+
+    x = wrap(x);
+    z = wrap(z);
+
+    if (x > 0 && x < m_size - 1)
+        n.x = heightAtPixel(x - 1, z) - heightAtPixel(x + 1, z);
+    else if (x > 0)
+        n.x = 2.0f * (heightAtPixel(x - 1, z) - heightAtPixel(x, z));
+    else
+        n.x = 2.0f * (heightAtPixel(x, z) - heightAtPixel(x + 1, z));
+
+    if (z > 0 && z < m_size - 1)
+        n.z = heightAtPixel(x, z - 1) - heightAtPixel(x, z + 1);
+    else if (z > 0)
+        n.z = 2.0f * (heightAtPixel(x, z - 1) - heightAtPixel(x, z));
+    else
+        n.z = 2.0f * (heightAtPixel(x, z) - heightAtPixel(x, z + 1));
+
+    n.y = 2.0f * m_gridSpacing;
+    n.normalize();
+}
+
+void PagedHeightMap::prefetch(const Vector3 &position, const Vector3 &velocity, float radius, float lookAheadSec)
+{
+    // Queues the tiles within 'radius' of 'position', followed by the tiles
+    // within 'radius' of where 'position' will be over the next
+    // 'lookAheadSec' seconds when moving at 'velocity'. Positions and
+    // velocities are in the same world units as heightAt(). The queue is
+    // replaced rather than added to, so tiles that were queued for an older
+    // position and not started yet are dropped. Resident tiles that would be
+    // queued are marked as recently used instead, to keep them in the cache.
+    // At most half the cache is queued, so prefetching never evicts the tiles
+    // it has just streamed in.
+
+    if (!isStreaming())
+        return;
+
+    float tileWorldSize = static_cast<float>(m_tileSize * m_gridSpacing);
+    float speed = sqrtf(velocity.x * velocity.x + velocity.z * velocity.z);
+    float distance = speed * lookAheadSec;
+    int steps = static_cast<int>(ceilf(distance / (tileWorldSize * 0.5f)));
+    int maxRequests = m_maxResidentTiles / 2;
+    std::deque<unsigned long long> requests;
+    std::unordered_set<unsigned long long> requested;
+
+    for (int step = 0; step <= steps && static_cast<int>(requests.size()) < maxRequests; ++step)
+    {
+        float t = (steps > 0) ? lookAheadSec * step / steps : 0.0f;
+        float centerX = (position.x + velocity.x * t) / tileWorldSize;
+        float centerZ = (position.z + velocity.z * t) / tileWorldSize;
+        float tileRadius = radius / tileWorldSize;
+        int minTileX = static_cast<int>(floorf(centerX - tileRadius));
+        int maxTileX = static_cast<int>(floorf(centerX + tileRadius));
+        int minTileZ = static_cast<int>(floorf(centerZ - tileRadius));
+        int maxTileZ = static_cast<int>(floorf(centerZ + tileRadius));
+
+        for (int tileZ = minTileZ; tileZ <= maxTileZ; ++tileZ)
+        {
+            for (int tileX = minTileX; tileX <= maxTileX; ++tileX)
+            {
+                // Skip tiles whose square doesn't touch the circle.
+
+                float dx = std::max(0.0f, std::max(tileX - centerX, centerX - (tileX + 1)));
+                float dz = std::max(0.0f, std::max(tileZ - centerZ, centerZ - (tileZ + 1)));
+
+                if (dx * dx + dz * dz > tileRadius * tileRadius)
+                    continue;
+
+                int wrappedX = wrapTile(tileX);
+                int wrappedZ = wrapTile(tileZ);
+                unsigned long long key = tileKey(wrappedX, wrappedZ);
+
+                if (!requested.insert(key).second || findTile(wrappedX, wrappedZ))
+                    continue;
+
+                if (static_cast<int>(requests.size()) < maxRequests)
+                    requests.push_back(key);
+            }
+        }
+    }
+
+    // The new requests replace the queued ones. Once those are taken out of
+    // m_pendingTiles only the tiles in flight are left, and they don't need
+    // to be queued again. Tiles that are still queued and still wanted are
+    // queued again in their new order.
+
+    std::deque<unsigned long long> newRequests;
+
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+
+        for (size_t i = 0; i < m_requests.size(); ++i)
+            m_pendingTiles.erase(m_requests[i]);
+
+        for (size_t i = 0; i < requests.size(); ++i)
+        {
+            if (!m_pendingTiles.count(requests[i]))
+                newRequests.push_back(requests[i]);
+        }
+
+        m_requests.swap(newRequests);
+
+        for (size_t i = 0; i < m_requests.size(); ++i)
+            m_pendingTiles.insert(m_requests[i]);
+
+        m_queueDepth = static_cast<int>(m_requests.size());
+    }
+
+    m_requestReady.notify_all();
+}
+
+void PagedHeightMap::setMemoryBudget(size_t memoryBudget)
+{
+    // Evicts the least recently used tiles until the resident tiles fit in
+    // the new budget.
+
+    m_memoryBudget = memoryBudget;
+    m_maxResidentTiles = static_cast<int>(std::min<size_t>(memoryBudget / getTileBytes(), 1 << 30));
+
+    if (m_maxResidentTiles < 4)
+        m_maxResidentTiles = 4;
+
+    while (static_cast<int>(m_tiles.size()) > m_maxResidentTiles)
+    {
+        const Tile &tile = m_tiles.front();
+
+        m_tileLookup.erase(tileKey(tile.tileX, tile.tileZ));
+        m_tiles.pop_front();
+        m_pLastTile = 0;
+    }
+}
+
+bool PagedHeightMap::startStreaming(int threadCount)
+{
+    // Starts 'threadCount' loader threads. The tile source must be thread
+    // safe.
+
+    stopStreaming();
+
+    if (!m_pSource || threadCount < 1)
+        return false;
+
+    m_stopLoaders = false;
+
+    try
+    {
+        for (int i = 0; i < threadCount; ++i)
+            m_loaders.push_back(std::thread(&PagedHeightMap::loaderMain, this));
+    }
+    catch (const std::system_error &)
+    {
+        stopStreaming();
+        return false;
+    }
+
+    return true;
+}
+
+void PagedHeightMap::stopStreaming()
+{
+    // Waits for the loader threads to finish the tiles they're working on,
+    // and throws away all the tiles that haven't been moved into the cache.
+
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        m_stopLoaders = true;
+        m_requests.clear();
+        m_queueDepth = 0;
+    }
+
+    m_requestReady.notify_all();
+
+    for (size_t i = 0; i < m_loaders.size(); ++i)
+        m_loaders[i].join();
+
+    m_loaders.clear();
+
+    StreamedTile *pStreamedTile = m_pStreamedTiles.exchange(0);
+
+    while (pStreamedTile)
+    {
+        StreamedTile *pNext = pStreamedTile->pNext;
+        delete pStreamedTile;
+        pStreamedTile = pNext;
+    }
+
+    m_pendingTiles.clear();
+    m_tilesInFlight = 0;
+}
+
+bool PagedHeightMap::tryHeightAt(float x, float z, float &height)
+{
+    // Same as heightAt(), but never loads a tile. Returns false, and queues
+    // the missing tiles for the loader threads, when the tiles that the
+    // height depends on aren't resident. Positions outside of the height map
+    // wrap around, like they do for heightAtPixel().
+
+    x /= static_cast<float>(m_gridSpacing);
+    z /= static_cast<float>(m_gridSpacing);
+
+    float floorX = floorf(x);
+    float floorZ = floorf(z);
+    float percentX = x - floorX;
+    float percentZ = z - floorZ;
+    int ix = wrap(static_cast<int>(floorX));
+    int iz = wrap(static_cast<int>(floorZ));
+    int tileX[2] = { ix >> m_tileShift, wrap(ix + 1) >> m_tileShift };
+    int tileZ[2] = { iz >> m_tileShift, wrap(iz + 1) >> m_tileShift };
+    bool resident = true;
+
+    for (int j = 0; j < 2; ++j)
+    {
+        for (int i = 0; i < 2; ++i)
+        {
+            if (!findTile(tileX[i], tileZ[j]))
+            {
+                requestTile(tileX[i], tileZ[j]);
+                resident = false;
+            }
+        }
+    }
+
+    if (!resident)
+        return false;
+
+    // heightAtPixel() wraps the texels and only looks up the tiles found
+    // above, so nothing is loaded here.
+
+    height = Math::bilerp(heightAtPixel(ix, iz), heightAtPixel(ix + 1, iz),
+        heightAtPixel(ix, iz + 1), heightAtPixel(ix + 1, iz + 1), percentX, percentZ) * m_heightScale;
+    return true;
+}
+
+int PagedHeightMap::update()
+{
+    // Moves the tiles finished by the loader threads into the cache, and
+    // returns how many there were. Tiles that were loaded on the calling
+    // thread in the meantime are thrown away.
+
+    StreamedTile *pStreamedTile = m_pStreamedTiles.exchange(0);
+    int count = 0;
+
+    while (pStreamedTile)
+    {
+        StreamedTile *pNext = pStreamedTile->pNext;
+
+        m_pendingTiles.erase(tileKey(pStreamedTile->tileX, pStreamedTile->tileZ));
+        --m_tilesInFlight;
+
+        if (!findTile(pStreamedTile->tileX, pStreamedTile->tileZ))
+        {
+            Tile &tile = allocateTile(pStreamedTile->tileX, pStreamedTile->tileZ);
+
+            tile.heights.swap(pStreamedTile->heights);
+            tile.streamed = true;
+
+            if (!pStreamedTile->loaded)
+            {
+                std::fill(tile.heights.begin(), tile.heights.end(), 0.0f);
+                ++m_tileFailures;
+            }
+
+            ++m_tileLoads;
+            ++m_streamedTiles;
+            ++count;
+        }
+
+        delete pStreamedTile;
+        pStreamedTile = pNext;
+    }
+
+    return count;
+}
+
+PagedHeightMap::Tile &PagedHeightMap::allocateTile(int tileX, int tileZ)
+{
+    // Adds a tile to the cache as the most recently used tile. The storage
+    // of the least recently used tile is reused once the cache is full,
+    // otherwise the new tile has no storage yet.
+
+    if (static_cast<int>(m_tiles.size()) >= m_maxResidentTiles)
+    {
+        TileList::iterator leastRecentlyUsed = m_tiles.begin();
+
+        m_tileLookup.erase(tileKey(leastRecentlyUsed->tileX, leastRecentlyUsed->tileZ));
+        m_tiles.splice(m_tiles.end(), m_tiles, leastRecentlyUsed);
+    }
+    else
+    {
+        m_tiles.push_back(Tile());
+    }
+
+    Tile &tile = m_tiles.back();
+
+    tile.tileX = tileX;
+    tile.tileZ = tileZ;
+    tile.streamed = false;
+    m_tileLookup[tileKey(tileX, tileZ)] = std::prev(m_tiles.end());
+
+    return tile;
+}
+
+PagedHeightMap::Tile *PagedHeightMap::findTile(int tileX, int tileZ)
+{
+    // Returns the tile if it's resident, and marks it as the most recently
+    // used tile.
+
+    std::unordered_map<unsigned long long, TileList::iterator>::iterator found = m_tileLookup.find(tileKey(tileX, tileZ));
+
+    if (found == m_tileLookup.end())
+        return 0;
+
+    m_tiles.splice(m_tiles.end(), m_tiles, found->second);
+    return &m_tiles.back();
+}
+
+void PagedHeightMap::loaderMain()
+{
+    Profiler::instance().setThreadName("PagedHeightMap loader");
+
+    for (;;)
+    {
+        unsigned long long key;
+
+        {
+            std::unique_lock<std::mutex> lock(m_requestMutex);
+
+            while (!m_stopLoaders && m_requests.empty())
+                m_requestReady.wait(lock);
+
+            if (m_stopLoaders)
+                return;
+
+            key = m_requests.front();
+            m_requests.pop_front();
+            m_queueDepth = static_cast<int>(m_requests.size());
+            ++m_tilesInFlight;
+        }
+
+        PROFILE_ZONE("PagedHeightMap::loadTile");
+
+        StreamedTile *pStreamedTile = new StreamedTile;
+
+        pStreamedTile->tileX = static_cast<int>(key & 0xffffffff);
+        pStreamedTile->tileZ = static_cast<int>(key >> 32);
+        pStreamedTile->heights.resize(m_tileSize * m_tileSize);
+        pStreamedTile->loaded = m_pSource->loadTile(pStreamedTile->tileX,
+            pStreamedTile->tileZ, m_tileSize, &pStreamedTile->heights[0]);
+
+        // Lock-free push onto the list of finished tiles.
+
+        pStreamedTile->pNext = m_pStreamedTiles.load();
+
+        while (!m_pStreamedTiles.compare_exchange_weak(pStreamedTile->pNext, pStreamedTile))
+            ;
+    }
+}
+
+void PagedHeightMap::requestTile(int tileX, int tileZ)
+{
+    // Queues a single tile ahead of the prefetched tiles, since a query is
+    // already waiting for it.
+
+    if (!isStreaming())
+        return;
+
+    unsigned long long key = tileKey(tileX, tileZ);
+
+    if (!m_pendingTiles.insert(key).second)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_requestMutex);
+        m_requests.push_front(key);
+        m_queueDepth = static_cast<int>(m_requests.size());
+    }
+
+    m_requestReady.notify_one();
+}
+
+const float *PagedHeightMap::tileAt(int tileX, int tileZ)
+{
+    // Returns the heights of the tile, loading it first if it isn't resident.
+    // The most recently used tile is remembered, since consecutive queries
+    // usually fall inside the same tile.
+
+    if (m_pLastTile && m_pLastTile->tileX == tileX && m_pLastTile->tileZ == tileZ)
+        return &m_pLastTile->heights[0];
+
+    Tile *pTile = findTile(tileX, tileZ);
+
+    if (pTile)
+    {
+        if (pTile->streamed)
+        {
+            pTile->streamed = false;
+            ++m_hitchesAvoided;
+        }
+
+        m_pLastTile = pTile;
+        return &pTile->heights[0];
+    }
+
+    Tile &tile = allocateTile(tileX, tileZ);
+
+    tile.heights.resize(m_tileSize * m_tileSize);
+
+    if (!m_pSource->loadTile(tileX, tileZ, m_tileSize, &tile.heights[0]))
+    {
+        std::fill(tile.heights.begin(), tile.heights.end(), 0.0f);
+        ++m_tileFailures;
+    }
+
+    ++m_tileLoads;
+    m_pLastTile = &tile;
+
+    return &tile.heights[0];
+}
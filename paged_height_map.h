@@ -0,0 +1,253 @@
+
+
+#if !defined(PAGED_HEIGHT_MAP_H)
+#define PAGED_HEIGHT_MAP_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "mathlib.h"
+
+//-----------------------------------------------------------------------------
+// A source of height map tiles for PagedHeightMap.
+//
+// loadTile() fills 'pHeights' with the tileSize x tileSize heights, in row
+// order, of the texels starting at (tileX * tileSize, tileZ * tileSize).
+// Texels that lie outside the height map can be filled with anything.
+// Heights are in the same [0,255] range that HeightMap uses.
+//
+// When a PagedHeightMap streams tiles in the background, loadTile() is called
+// from several threads at once, so it must be thread safe.
+//-----------------------------------------------------------------------------
+
+class HeightTileSource
+{
+public:
+    virtual ~HeightTileSource() {}
+    virtual bool loadTile(int tileX, int tileZ, int tileSize, float *pHeights) = 0;
+};
+
+//-----------------------------------------------------------------------------
+// Generates tiles on demand from fractal value noise.
+//
+// Each octave interpolates random values on a square lattice. The lattice of
+// the first octave is 'featureSize' texels wide, and each following octave
+// halves the lattice spacing and scales the amplitude by 2^-roughness, down
+// to a spacing of 1 texel. The random values come from HeightMap::random(),
+// so any texel of the height field can be generated independently of all
+// the others, and the height field only depends on the seed.
+//-----------------------------------------------------------------------------
+
+class FractalTileSource : public HeightTileSource
+{
+public:
+    FractalTileSource(unsigned int seed, float roughness, int featureSize);
+    virtual ~FractalTileSource() {}
+
+    virtual bool loadTile(int tileX, int tileZ, int tileSize, float *pHeights);
+
+private:
+    unsigned int m_seed;
+    float m_roughness;
+    int m_featureSize;
+};
+
+//-----------------------------------------------------------------------------
+// A height map that is split into square tiles which are only kept in memory
+// while they are being used.
+//
+// Tiles are loaded from a HeightTileSource the first time heightAt(),
+// heightAtPixel(), normalAt() or normalAtPixel() touch them. Once the
+// resident tiles use up the memory budget, the least recently used tile is
+// evicted to make room for the next one. The height map can therefore be far
+// larger than the available memory. A 65536 x 65536 height map takes 16 GB
+// as a single array of floats, yet only needs the few hundred MB of tiles
+// around where it is being queried.
+//
+// The queries behave like the HeightMap queries with the same name, and
+// coordinates outside of the height map wrap around. They're not const
+// because they update the tile cache, and they must not be called from
+// several threads at once.
+//
+// Tiles can also be streamed in by background loader threads. Once
+// startStreaming() has been called, prefetch() queues the tiles around a
+// position and along the path it's moving on, nearest first. The loader
+// threads fill the tiles and hand them back through a lock-free list, and
+// update() moves the finished tiles into the cache. tryHeightAt() never
+// loads a tile on the calling thread: it returns false and queues the
+// missing tile instead. None of prefetch(), update() or tryHeightAt() wait
+// for a tile to be loaded, so a render loop that only uses these never
+// stalls on disk or generation. The other queries still load missing tiles
+// on the calling thread.
+//
+// To use the PagedHeightMap class:
+//  FractalTileSource source(seed, 1.2f, 1024);
+//  PagedHeightMap heightMap;
+//  heightMap.create(65536, 16, 2.0f, 256, 256 * 1024 * 1024, &source);
+//  float y = heightMap.heightAt(x, z);
+//
+// To stream tiles in the background:
+//  heightMap.startStreaming(2);
+//  ...
+//  heightMap.prefetch(camera.getPosition(), camera.getCurrentVelocity(), radius, 1.0f);
+//  heightMap.update();
+//  if (heightMap.tryHeightAt(x, z, y)) ...
+//-----------------------------------------------------------------------------
+
+class PagedHeightMap
+{
+public:
+    PagedHeightMap();
+    ~PagedHeightMap();
+
+    bool create(int size, int gridSpacing, float scale, int tileSize,
+                size_t memoryBudget, HeightTileSource *pSource);
+    void destroy();
+
+    float heightAt(float x, float z);
+    float heightAtPixel(int x, int z);
+    void normalAt(float x, float z, Vector3 &n);
+    void normalAtPixel(int x, int z, Vector3 &n);
+    void prefetch(const Vector3 &position, const Vector3 &velocity, float radius, float lookAheadSec);
+    void setMemoryBudget(size_t memoryBudget);
+    bool startStreaming(int threadCount);
+    void stopStreaming();
+    bool tryHeightAt(float x, float z, float &height);
+    int update();
+
+    int getGridSpacing() const
+    { return m_gridSpacing; }
+
+    // Tiles that were streamed in before a query first needed them. Each
+    // one is a tile that would otherwise have been loaded on the querying
+    // thread.
+    int getHitchesAvoidedCount() const
+    { return m_hitchesAvoided; }
+
+    float getHeightScale() const
+    { return m_heightScale; }
+
+    int getMaxResidentTiles() const
+    { return m_maxResidentTiles; }
+
+    size_t getMemoryBudget() const
+    { return m_memoryBudget; }
+
+    // Tiles queued for the loader threads that they haven't started on yet.
+    int getQueueDepth() const
+    { return m_queueDepth.load(); }
+
+    size_t getResidentBytes() const
+    { return m_tiles.size() * getTileBytes(); }
+
+    int getResidentTileCount() const
+    { return static_cast<int>(m_tiles.size()); }
+
+    int getSize() const
+    { return m_size; }
+
+    int getStreamedTileCount() const
+    { return m_streamedTiles; }
+
+    size_t getTileBytes() const
+    { return sizeof(float) * m_tileSize * m_tileSize; }
+
+    int getTileFailureCount() const
+    { return m_tileFailures; }
+
+    int getTileLoadCount() const
+    { return m_tileLoads; }
+
+    int getTileSize() const
+    { return m_tileSize; }
+
+    // Tiles the loader threads are filling, or have finished but update()
+    // hasn't moved into the cache yet.
+    int getTilesInFlight() const
+    { return m_tilesInFlight.load(); }
+
+    bool isStreaming() const
+    { return !m_loaders.empty(); }
+
+private:
+    struct Tile
+    {
+        int tileX;
+        int tileZ;
+        bool streamed;              // streamed in and not used by a query yet
+        std::vector<float> heights;
+    };
+
+    // A tile filled by a loader thread. Finished tiles form a singly linked
+    // list that the loader threads push onto and update() takes in one go.
+    struct StreamedTile
+    {
+        int tileX;
+        int tileZ;
+        bool loaded;
+        std::vector<float> heights;
+        StreamedTile *pNext;
+    };
+
+    // Tiles are kept in least to most recently used order.
+    typedef std::list<Tile> TileList;
+
+    PagedHeightMap(const PagedHeightMap &);
+    PagedHeightMap &operator=(const PagedHeightMap &);
+
+    Tile &allocateTile(int tileX, int tileZ);
+    Tile *findTile(int tileX, int tileZ);
+    void loaderMain();
+    void requestTile(int tileX, int tileZ);
+    const float *tileAt(int tileX, int tileZ);
+
+    int getTilesPerSide() const
+    { return (m_size + m_tileSize - 1) >> m_tileShift; }
+
+    static unsigned long long tileKey(int tileX, int tileZ)
+    { return (static_cast<unsigned long long>(static_cast<unsigned int>(tileZ)) << 32) | static_cast<unsigned int>(tileX); }
+
+    int wrap(int i) const
+    { return (i >= 0 && i < m_size) ? i : ((i % m_size) + m_size) % m_size; }
+
+    int wrapTile(int i) const
+    { return ((i % getTilesPerSide()) + getTilesPerSide()) % getTilesPerSide(); }
+
+    int m_size;
+    int m_gridSpacing;
+    float m_heightScale;
+    int m_tileSize;
+    int m_tileShift;
+    size_t m_memoryBudget;
+    int m_maxResidentTiles;
+    int m_tileLoads;
+    int m_tileFailures;
+    HeightTileSource *m_pSource;
+    TileList m_tiles;
+    std::unordered_map<unsigned long long, TileList::iterator> m_tileLookup;
+    Tile *m_pLastTile;
+
+    // Streaming. The request queue is shared with the loader threads and
+    // guarded by m_requestMutex. m_pendingTiles holds the tiles that are
+    // queued or in flight, and is only used by the thread owning the cache.
+    std::vector<std::thread> m_loaders;
+    std::mutex m_requestMutex;
+    std::condition_variable m_requestReady;
+    std::deque<unsigned long long> m_requests;
+    std::unordered_set<unsigned long long> m_pendingTiles;
+    std::atomic<StreamedTile *> m_pStreamedTiles;
+    std::atomic<int> m_queueDepth;
+    std::atomic<int> m_tilesInFlight;
+    int m_streamedTiles;
+    int m_hitchesAvoided;
+    bool m_stopLoaders;
+};
+
+#endif
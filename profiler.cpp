@@ -0,0 +1,242 @@
+
+
+#if defined(_WIN32)
+#if !defined(WIN32_LEAN_AND_MEAN)
+#define WIN32_LEAN_AND_MEAN
+#endif
+#if !defined(NOMINMAX)
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <chrono>
+#endif
+
+#include <cstdio>
+#include "profiler.h"
+
+// Visual C++ 2012 doesn't support thread_local, but both compilers support
+// thread local pointers.
+#if defined(_MSC_VER)
+#define PROFILER_THREAD_LOCAL __declspec(thread)
+#else
+#define PROFILER_THREAD_LOCAL __thread
+#endif
+
+namespace
+{
+    PROFILER_THREAD_LOCAL void *t_pThreadBuffer = 0;
+    PROFILER_THREAD_LOCAL const char *t_pszThreadName = 0;
+
+    void WriteJsonString(FILE *pFile, const char *pszText)
+    {
+        fputc('"', pFile);
+
+        for (const char *p = pszText; *p; ++p)
+        {
+            if (*p == '"' || *p == '\\')
+                fputc('\\', pFile);
+
+            fputc(*p, pFile);
+        }
+
+        fputc('"', pFile);
+    }
+}
+
+Profiler &Profiler::instance()
+{
+    static Profiler theInstance;
+    return theInstance;
+}
+
+long long Profiler::getTicks()
+{
+    // QueryPerformanceCounter() is used on Windows because the Visual C++
+    // 2012 steady_clock only has a resolution of about 1ms.
+
+#if defined(_WIN32)
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart;
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+Profiler::Profiler() : m_enabled(false)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER freq;
+    QueryPerformanceFrequency(&freq);
+    m_ticksPerMicrosecond = static_cast<double>(freq.QuadPart) / 1000000.0;
+#else
+    m_ticksPerMicrosecond = 1000.0;
+#endif
+
+    m_startTicks = getTicks();
+}
+
+Profiler::~Profiler()
+{
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+        delete m_buffers[i];
+}
+
+void Profiler::clear()
+{
+    std::lock_guard<std::mutex> buffersLock(m_buffersMutex);
+
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+    {
+        std::lock_guard<std::mutex> lock(m_buffers[i]->mutex);
+        m_buffers[i]->written = 0;
+    }
+}
+
+void Profiler::enable(bool enable)
+{
+    m_enabled.store(enable, std::memory_order_relaxed);
+}
+
+size_t Profiler::getEventCount() const
+{
+    // Returns the number of zones currently held in the ring buffers.
+
+    std::lock_guard<std::mutex> buffersLock(m_buffersMutex);
+    size_t count = 0;
+
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+    {
+        std::lock_guard<std::mutex> lock(m_buffers[i]->mutex);
+
+        if (m_buffers[i]->written < EVENTS_PER_THREAD)
+            count += static_cast<size_t>(m_buffers[i]->written);
+        else
+            count += EVENTS_PER_THREAD;
+    }
+
+    return count;
+}
+
+Profiler::ThreadBuffer *Profiler::getThreadBuffer()
+{
+    // Creates the calling thread's ring buffer the first time it's needed.
+    // The buffers are never freed before the profiler, so the zones of
+    // threads that have exited can still be written out.
+
+    ThreadBuffer *pBuffer = static_cast<ThreadBuffer *>(t_pThreadBuffer);
+
+    if (!pBuffer)
+    {
+        pBuffer = new ThreadBuffer;
+        pBuffer->events.resize(EVENTS_PER_THREAD);
+        pBuffer->written = 0;
+        pBuffer->pszName = t_pszThreadName;
+
+        std::lock_guard<std::mutex> lock(m_buffersMutex);
+        pBuffer->threadId = static_cast<int>(m_buffers.size()) + 1;
+        m_buffers.push_back(pBuffer);
+        t_pThreadBuffer = pBuffer;
+    }
+
+    return pBuffer;
+}
+
+void Profiler::recordZone(const char *pszName, long long startTicks, long long endTicks)
+{
+    // Only the owning thread writes to a ring buffer, so its lock is only
+    // ever contended while the zones are being written out.
+
+    ThreadBuffer *pBuffer = getThreadBuffer();
+    std::lock_guard<std::mutex> lock(pBuffer->mutex);
+    Event &event = pBuffer->events[pBuffer->written % EVENTS_PER_THREAD];
+
+    event.pszName = pszName;
+    event.startTicks = startTicks;
+    event.endTicks = endTicks;
+    ++pBuffer->written;
+}
+
+void Profiler::setThreadName(const char *pszName)
+{
+    // Names the calling thread in the trace. The name must outlive the
+    // profiler, so it should be a string literal. The thread's ring buffer
+    // isn't created until it records a zone, so naming threads that never
+    // do costs no memory.
+
+    ThreadBuffer *pBuffer = static_cast<ThreadBuffer *>(t_pThreadBuffer);
+
+    t_pszThreadName = pszName;
+
+    if (pBuffer)
+    {
+        std::lock_guard<std::mutex> lock(pBuffer->mutex);
+        pBuffer->pszName = pszName;
+    }
+}
+
+bool Profiler::writeChromeTrace(const char *pszFilename) const
+{
+    // Zones are written as complete ("X") events with microsecond times
+    // relative to when the profiler was created. Each ring buffer is copied
+    // under its lock so the other threads can keep recording.
+
+    FILE *pFile = fopen(pszFilename, "w");
+
+    if (!pFile)
+        return false;
+
+    std::lock_guard<std::mutex> buffersLock(m_buffersMutex);
+    std::vector<Event> events;
+    bool first = true;
+
+    fprintf(pFile, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+    for (size_t i = 0; i < m_buffers.size(); ++i)
+    {
+        const ThreadBuffer &buffer = *m_buffers[i];
+        const char *pszThreadName = 0;
+
+        {
+            std::lock_guard<std::mutex> lock(buffer.mutex);
+            unsigned long long count = (buffer.written < EVENTS_PER_THREAD) ? buffer.written : EVENTS_PER_THREAD;
+
+            events.clear();
+
+            for (unsigned long long e = buffer.written - count; e < buffer.written; ++e)
+                events.push_back(buffer.events[e % EVENTS_PER_THREAD]);
+
+            pszThreadName = buffer.pszName;
+        }
+
+        if (pszThreadName)
+        {
+            fprintf(pFile, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, \"args\": {\"name\": ",
+                first ? "" : ",\n", buffer.threadId);
+            WriteJsonString(pFile, pszThreadName);
+            fprintf(pFile, "}}");
+            first = false;
+        }
+
+        for (size_t e = 0; e < events.size(); ++e)
+        {
+            const Event &event = events[e];
+
+            fprintf(pFile, "%s{\"name\": ", first ? "" : ",\n");
+            WriteJsonString(pFile, event.pszName);
+            fprintf(pFile, ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f}", buffer.threadId,
+                (event.startTicks - m_startTicks) / m_ticksPerMicrosecond,
+                (event.endTicks - event.startTicks) / m_ticksPerMicrosecond);
+            first = false;
+        }
+    }
+
+    fprintf(pFile, "\n]}\n");
+
+    bool succeeded = !ferror(pFile);
+
+    fclose(pFile);
+    return succeeded;
+}
@@ -0,0 +1,122 @@
+
+
+#if !defined(PROFILER_H)
+#define PROFILER_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// A lightweight scoped zone profiler.
+//
+// Zones are marked with PROFILE_ZONE("name") at the top of a scope. While the
+// profiler is enabled each zone records its start and end time when the scope
+// exits. While it's disabled a zone costs a single relaxed atomic load. The
+// name must be a string literal, since only the pointer is stored.
+//
+// Every thread that records a zone gets its own ring buffer, so recording
+// never contends with other threads. When a ring buffer is full the oldest
+// zones are overwritten, so the profiler always holds the most recent
+// history of each thread.
+//
+// writeChromeTrace() writes the recorded zones in the Chrome trace event
+// format, which can be opened in chrome://tracing or https://ui.perfetto.dev.
+//
+// Profiler::instance() must first be called before any other threads are
+// started. Defining TERRAIN_DISABLE_PROFILER compiles all the zones out.
+//
+// To use the Profiler class:
+//  Profiler::instance().enable(true);
+//  {
+//      PROFILE_ZONE("UpdateFrame");
+//      ...
+//  }
+//  Profiler::instance().writeChromeTrace("profile.json");
+//-----------------------------------------------------------------------------
+
+class Profiler
+{
+public:
+    static const int EVENTS_PER_THREAD = 1 << 16;
+
+    static Profiler &instance();
+    static long long getTicks();
+
+    void clear();
+    void enable(bool enable);
+    size_t getEventCount() const;
+    void recordZone(const char *pszName, long long startTicks, long long endTicks);
+    void setThreadName(const char *pszName);
+    bool writeChromeTrace(const char *pszFilename) const;
+
+    bool isEnabled() const
+    { return m_enabled.load(std::memory_order_relaxed); }
+
+private:
+    struct Event
+    {
+        const char *pszName;
+        long long startTicks;
+        long long endTicks;
+    };
+
+    struct ThreadBuffer
+    {
+        mutable std::mutex mutex;
+        std::vector<Event> events;
+        unsigned long long written;
+        const char *pszName;
+        int threadId;
+    };
+
+    Profiler();
+    ~Profiler();
+    Profiler(const Profiler &);
+    Profiler &operator=(const Profiler &);
+
+    ThreadBuffer *getThreadBuffer();
+
+    std::atomic<bool> m_enabled;
+    mutable std::mutex m_buffersMutex;
+    std::vector<ThreadBuffer *> m_buffers;
+    long long m_startTicks;
+    double m_ticksPerMicrosecond;
+};
+
+//-----------------------------------------------------------------------------
+// Records the time from its construction to its destruction as a zone.
+//-----------------------------------------------------------------------------
+
+class ProfileZone
+{
+public:
+    explicit ProfileZone(const char *pszName)
+        : m_pszName(pszName), m_startTicks(Profiler::instance().isEnabled() ? Profiler::getTicks() : -1)
+    {
+    }
+
+    ~ProfileZone()
+    {
+        if (m_startTicks >= 0)
+            Profiler::instance().recordZone(m_pszName, m_startTicks, Profiler::getTicks());
+    }
+
+private:
+    ProfileZone(const ProfileZone &);
+    ProfileZone &operator=(const ProfileZone &);
+
+    const char *m_pszName;
+    long long m_startTicks;
+};
+
+#define PROFILER_CONCAT_IMPL(a, b) a##b
+#define PROFILER_CONCAT(a, b) PROFILER_CONCAT_IMPL(a, b)
+
+#if defined(TERRAIN_DISABLE_PROFILER)
+#define PROFILE_ZONE(name)
+#else
+#define PROFILE_ZONE(name) ProfileZone PROFILER_CONCAT(profileZone, __LINE__)(name)
+#endif
+
+#endif
@@ -0,0 +1,310 @@
+
+
+#include <cassert>
+#include <cstring>
+
+#include "gl_state_cache.h"
+#include "shader_program.h"
+
+namespace
+{
+    void GetUniformTypeInfo(GLenum type, int &components, bool &isFloat)
+    {
+        // Returns the number of values in one element of a uniform of type
+        // 'type', and whether they're set with the float or the integer
+        // glUniform*() functions. Booleans and samplers are set as integers.
+
+        isFloat = true;
+
+        switch (type)
+        {
+        case GL_FLOAT:         components = 1; break;
+        case GL_FLOAT_VEC2:    components = 2; break;
+        case GL_FLOAT_VEC3:    components = 3; break;
+        case GL_FLOAT_VEC4:    components = 4; break;
+        case GL_FLOAT_MAT2:    components = 4; break;
+        case GL_FLOAT_MAT3:    components = 9; break;
+        case GL_FLOAT_MAT4:    components = 16; break;
+
+        case GL_INT_VEC2:
+        case GL_BOOL_VEC2:
+            components = 2;
+            isFloat = false;
+            break;
+
+        case GL_INT_VEC3:
+        case GL_BOOL_VEC3:
+            components = 3;
+            isFloat = false;
+            break;
+
+        case GL_INT_VEC4:
+        case GL_BOOL_VEC4:
+            components = 4;
+            isFloat = false;
+            break;
+
+        default:
+            components = 1;
+            isFloat = false;
+            break;
+        }
+    }
+}
+
+ShaderProgram::FrameStats ShaderProgram::m_frameStats = {0};
+ShaderProgram::FrameStats ShaderProgram::m_lastFrameStats = {0};
+
+void ShaderProgram::beginFrame()
+{
+    // Starts counting the GL calls of a new frame. The counts of the frame
+    // that just ended are returned by getLastFrameStats().
+
+    m_lastFrameStats = m_frameStats;
+    memset(&m_frameStats, 0, sizeof(m_frameStats));
+}
+
+const ShaderProgram::FrameStats &ShaderProgram::getLastFrameStats()
+{
+    return m_lastFrameStats;
+}
+
+void ShaderProgram::unbind()
+{
+    GLStateCache::instance().useProgram(0);
+}
+
+ShaderProgram::ShaderProgram() : m_program(0)
+{
+}
+
+ShaderProgram::~ShaderProgram()
+{
+    destroy();
+}
+
+bool ShaderProgram::create(GLuint program)
+{
+    // Takes ownership of the linked shader program 'program' and builds the
+    // table of its active uniforms. Built-in uniforms such as
+    // gl_ModelViewMatrix are active but have no location, so they're left
+    // out of the table.
+
+    destroy();
+
+    if (!program)
+        return false;
+
+    GLint uniformCount = 0;
+    GLint maxNameLength = 0;
+
+    glGetProgramiv(program, GL_ACTIVE_UNIFORMS, &uniformCount);
+    glGetProgramiv(program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+    std::vector<GLchar> name(maxNameLength + 1);
+    int floatCount = 0;
+    int intCount = 0;
+
+    for (GLint i = 0; i < uniformCount; ++i)
+    {
+        GLsizei length = 0;
+        GLint size = 0;
+        GLenum type = 0;
+        Uniform uniform;
+
+        glGetActiveUniform(program, i, static_cast<GLsizei>(name.size()), &length, &size, &type, &name[0]);
+        uniform.name.assign(&name[0], length);
+
+        // Arrays are reported as "name[0]".
+        if (uniform.name.size() > 3 && uniform.name.compare(uniform.name.size() - 3, 3, "[0]") == 0)
+            uniform.name.resize(uniform.name.size() - 3);
+
+        uniform.location = glGetUniformLocation(program, uniform.name.c_str());
+
+        if (uniform.location == -1)
+            continue;
+
+        GetUniformTypeInfo(type, uniform.components, uniform.isFloat);
+        uniform.type = type;
+        uniform.elements = size;
+        uniform.isSet = false;
+
+        if (uniform.isFloat)
+        {
+            uniform.offset = floatCount;
+            floatCount += uniform.components * uniform.elements;
+        }
+        else
+        {
+            uniform.offset = intCount;
+            intCount += uniform.components * uniform.elements;
+        }
+
+        m_uniforms.push_back(uniform);
+    }
+
+    m_floatValues.assign(floatCount, 0.0f);
+    m_intValues.assign(intCount, 0);
+    m_program = program;
+    return true;
+}
+
+void ShaderProgram::destroy()
+{
+    if (m_program)
+    {
+        GLStateCache::instance().deleteProgram(m_program);
+        m_program = 0;
+    }
+
+    m_uniforms.clear();
+    m_floatValues.clear();
+    m_intValues.clear();
+}
+
+void ShaderProgram::bind() const
+{
+    // Binding the program that's already in use is filtered out by the
+    // state cache.
+
+    GLStateCache::instance().useProgram(m_program);
+}
+
+int ShaderProgram::getUniformIndex(const char *pszName) const
+{
+    // Returns -1 if the program has no active uniform called 'pszName'.
+    // Setting a uniform with an index of -1 does nothing, in the same way
+    // as setting a uniform at location -1 does nothing in OpenGL.
+
+    for (size_t i = 0; i < m_uniforms.size(); ++i)
+    {
+        if (m_uniforms[i].name == pszName)
+            return static_cast<int>(i);
+    }
+
+    return -1;
+}
+
+void ShaderProgram::setUniform(int index, float value)
+{
+    // Only for uniforms that hold a single value.
+
+    if (index >= 0 && index < static_cast<int>(m_uniforms.size()))
+    {
+        assert(m_uniforms[index].components * m_uniforms[index].elements == 1);
+
+        if (m_uniforms[index].components * m_uniforms[index].elements == 1)
+            setUniformv(index, &value);
+    }
+}
+
+void ShaderProgram::setUniform(int index, int value)
+{
+    // Only for uniforms that hold a single value.
+
+    if (index >= 0 && index < static_cast<int>(m_uniforms.size()))
+    {
+        assert(m_uniforms[index].components * m_uniforms[index].elements == 1);
+
+        if (m_uniforms[index].components * m_uniforms[index].elements == 1)
+            setUniformv(index, &value);
+    }
+}
+
+void ShaderProgram::setUniformv(int index, const float *pValues)
+{
+    // 'pValues' holds every component of every element of the uniform.
+
+    if (index < 0 || index >= static_cast<int>(m_uniforms.size()))
+        return;
+
+    Uniform &uniform = m_uniforms[index];
+
+    // A uniform of the other type has its shadow copy in the other array.
+    assert(uniform.isFloat);
+
+    if (!uniform.isFloat)
+        return;
+
+    size_t bytes = uniform.components * uniform.elements * sizeof(float);
+    float *pShadow = &m_floatValues[uniform.offset];
+
+    ++m_frameStats.locationLookupsSaved;
+
+    if (uniform.isSet && memcmp(pShadow, pValues, bytes) == 0)
+    {
+        ++m_frameStats.uniformsSkipped;
+        return;
+    }
+
+    memcpy(pShadow, pValues, bytes);
+    uniform.isSet = true;
+    upload(uniform);
+}
+
+void ShaderProgram::setUniformv(int index, const int *pValues)
+{
+    // 'pValues' holds every component of every element of the uniform.
+
+    if (index < 0 || index >= static_cast<int>(m_uniforms.size()))
+        return;
+
+    Uniform &uniform = m_uniforms[index];
+
+    // A uniform of the other type has its shadow copy in the other array.
+    assert(!uniform.isFloat);
+
+    if (uniform.isFloat)
+        return;
+
+    size_t bytes = uniform.components * uniform.elements * sizeof(GLint);
+    GLint *pShadow = &m_intValues[uniform.offset];
+
+    ++m_frameStats.locationLookupsSaved;
+
+    if (uniform.isSet && memcmp(pShadow, pValues, bytes) == 0)
+    {
+        ++m_frameStats.uniformsSkipped;
+        return;
+    }
+
+    memcpy(pShadow, pValues, bytes);
+    uniform.isSet = true;
+    upload(uniform);
+}
+
+void ShaderProgram::upload(const Uniform &uniform)
+{
+    // Sends the shadow copy of 'uniform' to OpenGL. The program must be
+    // bound.
+
+    ++m_frameStats.uniformsUploaded;
+
+    if (uniform.isFloat)
+    {
+        const GLfloat *pValues = &m_floatValues[uniform.offset];
+
+        switch (uniform.type)
+        {
+        case GL_FLOAT_VEC2: glUniform2fv(uniform.location, uniform.elements, pValues); break;
+        case GL_FLOAT_VEC3: glUniform3fv(uniform.location, uniform.elements, pValues); break;
+        case GL_FLOAT_VEC4: glUniform4fv(uniform.location, uniform.elements, pValues); break;
+        case GL_FLOAT_MAT2: glUniformMatrix2fv(uniform.location, uniform.elements, GL_FALSE, pValues); break;
+        case GL_FLOAT_MAT3: glUniformMatrix3fv(uniform.location, uniform.elements, GL_FALSE, pValues); break;
+        case GL_FLOAT_MAT4: glUniformMatrix4fv(uniform.location, uniform.elements, GL_FALSE, pValues); break;
+        default:            glUniform1fv(uniform.location, uniform.elements, pValues); break;
+        }
+    }
+    else
+    {
+        const GLint *pValues = &m_intValues[uniform.offset];
+
+        switch (uniform.components)
+        {
+        case 2:  glUniform2iv(uniform.location, uniform.elements, pValues); break;
+        case 3:  glUniform3iv(uniform.location, uniform.elements, pValues); break;
+        case 4:  glUniform4iv(uniform.location, uniform.elements, pValues); break;
+        default: glUniform1iv(uniform.location, uniform.elements, pValues); break;
+        }
+    }
+}
@@ -0,0 +1,106 @@
+
+
+#if !defined(SHADER_PROGRAM_H)
+#define SHADER_PROGRAM_H
+
+#include <windows.h>
+#include <GL/gl.h>
+#include <string>
+#include <vector>
+
+#include "opengl.h"
+
+//-----------------------------------------------------------------------------
+// Wraps a linked GLSL shader program and caches its uniforms.
+//
+// Every active uniform is looked up once, when the program is attached, and
+// stored in a table. Uniforms are then set by their index in the table, so
+// glGetUniformLocation() is never called while rendering. A shadow copy of
+// each uniform's value is kept, and glUniform*() is only called when a value
+// actually changes. Uniforms are part of the program object, so the shadow
+// copies stay valid while the program isn't bound.
+//
+// The setUniform() methods must be called while the program is bound. The
+// number of glUniform*() calls made and saved are counted for each frame.
+//
+// Uniforms that are arrays are set all at once. Struct members are looked up
+// by their full names, such as "region1.max".
+//
+// To use the ShaderProgram class:
+//  ShaderProgram program;
+//  program.create(LoadShaderProgram("shader.glsl", infoLog));
+//  int tilingFactor = program.getUniformIndex("tilingFactor");
+//  ...
+//  ShaderProgram::beginFrame();
+//  program.bind();
+//  program.setUniform(tilingFactor, 12.0f);
+//  ...
+//  program.destroy();
+//-----------------------------------------------------------------------------
+
+class ShaderProgram
+{
+public:
+    struct FrameStats
+    {
+        int uniformsUploaded;       // glUniform*() calls made
+        int uniformsSkipped;        // glUniform*() calls saved, value unchanged
+        int locationLookupsSaved;   // glGetUniformLocation() calls saved
+    };
+
+    static void beginFrame();
+    static const FrameStats &getLastFrameStats();
+    static void unbind();
+
+    ShaderProgram();
+    ~ShaderProgram();
+
+    bool create(GLuint program);
+    void destroy();
+
+    void bind() const;
+
+    GLuint getProgram() const
+    { return m_program; }
+
+    int getUniformCount() const
+    { return static_cast<int>(m_uniforms.size()); }
+
+    int getUniformIndex(const char *pszName) const;
+
+    bool isNull() const
+    { return m_program == 0; }
+
+    void setUniform(int index, float value);
+    void setUniform(int index, int value);
+    void setUniformv(int index, const float *pValues);
+    void setUniformv(int index, const int *pValues);
+
+private:
+    ShaderProgram(const ShaderProgram &);
+    ShaderProgram &operator=(const ShaderProgram &);
+
+    struct Uniform
+    {
+        std::string name;
+        GLint location;
+        GLenum type;
+        int components;         // per array element
+        int elements;
+        int offset;             // into m_floatValues or m_intValues
+        bool isFloat;
+        bool isSet;
+    };
+
+    void upload(const Uniform &uniform);
+
+    static FrameStats m_frameStats;
+    static FrameStats m_lastFrameStats;
+
+    GLuint m_program;
+    std::vector<Uniform> m_uniforms;
+    std::vector<float> m_floatValues;
+    std::vector<GLint> m_intValues;
+};
+
+#endif
@@ -0,0 +1,200 @@
+#if !defined(SIMD_H)
+#define SIMD_H
+
+//-----------------------------------------------------------------------------
+// Thin wrappers around the SSE and AVX intrinsics used by the height map
+// processing code.
+//
+// Simd::WIDTH floats are processed at a time. This is 8 when the compiler
+// targets AVX (/arch:AVX or -mavx), 4 when it targets SSE (the default for
+// x64 and for x86 with /arch:SSE2), and 1 otherwise. With a width of 1 all
+// operations fall back to plain scalar code, so code written against this
+// class always compiles.
+//
+// rsqrt() is the hardware reciprocal square root estimate, which is only
+// accurate to about 12 bits. Refine it with a Newton-Raphson step when more
+// precision is needed.
+//
+// transpose() transposes the Simd::WIDTH x Simd::WIDTH matrix held in an
+// array of Simd::WIDTH registers, one row per register.
+//
+// truncate() and storeInt() round towards zero, like a cast to int, and
+// floor() rounds towards minus infinity. They only work for values that fit
+// in an int.
+//
+// All loads and stores are unaligned. The min and max operations are named
+// minimum() and maximum() so that they don't clash with the min() and max()
+// macros defined by <windows.h>.
+//-----------------------------------------------------------------------------
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#define SIMD_WIDTH 8
+typedef __m256 SimdFloat;
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIMD_WIDTH 4
+typedef __m128 SimdFloat;
+#else
+#include <cmath>
+#define SIMD_WIDTH 1
+typedef float SimdFloat;
+#endif
+
+class Simd
+{
+public:
+    enum { WIDTH = SIMD_WIDTH };
+
+#if SIMD_WIDTH == 8
+    static SimdFloat add(SimdFloat a, SimdFloat b)
+    { return _mm256_add_ps(a, b); }
+
+    static SimdFloat floor(SimdFloat a)
+    { return _mm256_floor_ps(a); }
+
+    static SimdFloat load(const float *p)
+    { return _mm256_loadu_ps(p); }
+
+    static SimdFloat maximum(SimdFloat a, SimdFloat b)
+    { return _mm256_max_ps(a, b); }
+
+    static SimdFloat minimum(SimdFloat a, SimdFloat b)
+    { return _mm256_min_ps(a, b); }
+
+    static SimdFloat mul(SimdFloat a, SimdFloat b)
+    { return _mm256_mul_ps(a, b); }
+
+    static SimdFloat rsqrt(SimdFloat a)
+    { return _mm256_rsqrt_ps(a); }
+
+    static SimdFloat set(float f)
+    { return _mm256_set1_ps(f); }
+
+    static void store(float *p, SimdFloat a)
+    { _mm256_storeu_ps(p, a); }
+
+    static void storeInt(int *p, SimdFloat a)
+    { _mm256_storeu_si256(reinterpret_cast<__m256i *>(p), _mm256_cvttps_epi32(a)); }
+
+    static SimdFloat sub(SimdFloat a, SimdFloat b)
+    { return _mm256_sub_ps(a, b); }
+
+    static void transpose(SimdFloat rows[8])
+    {
+        __m256 t0 = _mm256_unpacklo_ps(rows[0], rows[1]);
+        __m256 t1 = _mm256_unpackhi_ps(rows[0], rows[1]);
+        __m256 t2 = _mm256_unpacklo_ps(rows[2], rows[3]);
+        __m256 t3 = _mm256_unpackhi_ps(rows[2], rows[3]);
+        __m256 t4 = _mm256_unpacklo_ps(rows[4], rows[5]);
+        __m256 t5 = _mm256_unpackhi_ps(rows[4], rows[5]);
+        __m256 t6 = _mm256_unpacklo_ps(rows[6], rows[7]);
+        __m256 t7 = _mm256_unpackhi_ps(rows[6], rows[7]);
+        __m256 s0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+        __m256 s6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+        __m256 s7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+        rows[0] = _mm256_permute2f128_ps(s0, s4, 0x20);
+        rows[1] = _mm256_permute2f128_ps(s1, s5, 0x20);
+        rows[2] = _mm256_permute2f128_ps(s2, s6, 0x20);
+        rows[3] = _mm256_permute2f128_ps(s3, s7, 0x20);
+        rows[4] = _mm256_permute2f128_ps(s0, s4, 0x31);
+        rows[5] = _mm256_permute2f128_ps(s1, s5, 0x31);
+        rows[6] = _mm256_permute2f128_ps(s2, s6, 0x31);
+        rows[7] = _mm256_permute2f128_ps(s3, s7, 0x31);
+    }
+
+    static SimdFloat truncate(SimdFloat a)
+    { return _mm256_round_ps(a, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC); }
+#elif SIMD_WIDTH == 4
+    static SimdFloat add(SimdFloat a, SimdFloat b)
+    { return _mm_add_ps(a, b); }
+
+    static SimdFloat floor(SimdFloat a)
+    {
+        // SSE2 has no floor, so truncate and step down the values that were
+        // rounded up.
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+    }
+
+    static SimdFloat load(const float *p)
+    { return _mm_loadu_ps(p); }
+
+    static SimdFloat maximum(SimdFloat a, SimdFloat b)
+    { return _mm_max_ps(a, b); }
+
+    static SimdFloat minimum(SimdFloat a, SimdFloat b)
+    { return _mm_min_ps(a, b); }
+
+    static SimdFloat mul(SimdFloat a, SimdFloat b)
+    { return _mm_mul_ps(a, b); }
+
+    static SimdFloat rsqrt(SimdFloat a)
+    { return _mm_rsqrt_ps(a); }
+
+    static SimdFloat set(float f)
+    { return _mm_set1_ps(f); }
+
+    static void store(float *p, SimdFloat a)
+    { _mm_storeu_ps(p, a); }
+
+    static void storeInt(int *p, SimdFloat a)
+    { _mm_storeu_si128(reinterpret_cast<__m128i *>(p), _mm_cvttps_epi32(a)); }
+
+    static SimdFloat sub(SimdFloat a, SimdFloat b)
+    { return _mm_sub_ps(a, b); }
+
+    static void transpose(SimdFloat rows[4])
+    { _MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]); }
+
+    static SimdFloat truncate(SimdFloat a)
+    { return _mm_cvtepi32_ps(_mm_cvttps_epi32(a)); }
+#else
+    static SimdFloat add(SimdFloat a, SimdFloat b)
+    { return a + b; }
+
+    static SimdFloat floor(SimdFloat a)
+    { return floorf(a); }
+
+    static SimdFloat load(const float *p)
+    { return *p; }
+
+    static SimdFloat maximum(SimdFloat a, SimdFloat b)
+    { return (a > b) ? a : b; }
+
+    static SimdFloat minimum(SimdFloat a, SimdFloat b)
+    { return (a < b) ? a : b; }
+
+    static SimdFloat mul(SimdFloat a, SimdFloat b)
+    { return a * b; }
+
+    static SimdFloat rsqrt(SimdFloat a)
+    { return 1.0f / sqrtf(a); }
+
+    static SimdFloat set(float f)
+    { return f; }
+
+    static void store(float *p, SimdFloat a)
+    { *p = a; }
+
+    static void storeInt(int *p, SimdFloat a)
+    { *p = static_cast<int>(a); }
+
+    static SimdFloat sub(SimdFloat a, SimdFloat b)
+    { return a - b; }
+
+    static void transpose(SimdFloat *)
+    {}
+
+    static SimdFloat truncate(SimdFloat a)
+    { return static_cast<float>(static_cast<int>(a)); }
+#endif
+};
+
+#endif
@@ -0,0 +1,320 @@
+
+
+#include <cassert>
+#include <cstring>
+
+#include "gl_state_cache.h"
+#include "profiler.h"
+#include "stream_buffer.h"
+
+namespace
+{
+    double ElapsedMilliseconds(const LARGE_INTEGER &start)
+    {
+        static LARGE_INTEGER freq = {0};
+        LARGE_INTEGER now;
+
+        if (!freq.QuadPart)
+            QueryPerformanceFrequency(&freq);
+
+        QueryPerformanceCounter(&now);
+        return static_cast<double>(now.QuadPart - start.QuadPart) * 1000.0 / static_cast<double>(freq.QuadPart);
+    }
+
+    StreamBuffer::Mode SelectMode()
+    {
+        bool mapBufferRange = OpenGLSupportsGLVersion(3, 0) || OpenGLExtensionSupported("GL_ARB_map_buffer_range");
+        bool sync = OpenGLSupportsGLVersion(3, 2) || OpenGLExtensionSupported("GL_ARB_sync");
+        bool bufferStorage = OpenGLSupportsGLVersion(4, 4) || OpenGLExtensionSupported("GL_ARB_buffer_storage");
+
+        if (!mapBufferRange || !sync)
+            return StreamBuffer::MODE_ORPHAN;
+
+        return bufferStorage ? StreamBuffer::MODE_PERSISTENT : StreamBuffer::MODE_UNSYNCHRONIZED;
+    }
+}
+
+StreamBuffer::FrameStats StreamBuffer::m_frameStats = {0};
+StreamBuffer::FrameStats StreamBuffer::m_lastFrameStats = {0};
+
+void StreamBuffer::beginFrame()
+{
+    // Starts counting the uploads of a new frame. The counts of the frame
+    // that just ended are returned by getLastFrameStats().
+
+    m_lastFrameStats = m_frameStats;
+    memset(&m_frameStats, 0, sizeof(m_frameStats));
+}
+
+void StreamBuffer::bufferSubData(GLenum target, size_t offset, size_t size, const void *pData)
+{
+    // Replaces 'size' bytes of the buffer bound to 'target' at 'offset'.
+    // Unlike mapForOverwrite() the rest of the buffer is kept, so this is
+    // for small updates. The driver copies the data before the GPU is done
+    // with the old contents.
+
+    glBufferSubData(target, offset, size, pData);
+    m_frameStats.bytesUploaded += size;
+}
+
+const StreamBuffer::FrameStats &StreamBuffer::getLastFrameStats()
+{
+    return m_lastFrameStats;
+}
+
+void *StreamBuffer::mapForOverwrite(GLenum target, size_t size, GLenum usage)
+{
+    // Maps the buffer bound to 'target' for writing all 'size' bytes of it.
+    // The buffer's old storage is orphaned first, so the GPU can finish
+    // drawing from it while the new storage is written. Unmap the buffer
+    // with glUnmapBuffer().
+
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    glBufferData(target, size, 0, usage);
+    void *pData = glMapBuffer(target, GL_WRITE_ONLY);
+
+    m_frameStats.mapMs += ElapsedMilliseconds(start);
+    ++m_frameStats.maps;
+
+    if (pData)
+        m_frameStats.bytesUploaded += size;
+
+    return pData;
+}
+
+StreamBuffer::StreamBuffer()
+{
+    m_target = 0;
+    m_buffer = 0;
+    m_mode = MODE_NONE;
+    m_size = 0;
+    m_head = 0;
+    m_mappedOffset = 0;
+    m_unfencedBegin = 0;
+    m_unfencedEnd = 0;
+    m_mapped = false;
+    m_pPersistent = 0;
+}
+
+StreamBuffer::~StreamBuffer()
+{
+    destroy();
+}
+
+bool StreamBuffer::create(GLenum target, size_t size)
+{
+    destroy();
+
+    GLStateCache &stateCache = GLStateCache::instance();
+
+    m_target = target;
+    m_size = (size + ALIGNMENT - 1) & ~static_cast<size_t>(ALIGNMENT - 1);
+    m_mode = SelectMode();
+
+    glGenBuffers(1, &m_buffer);
+    stateCache.bindBuffer(m_target, m_buffer);
+
+    if (m_mode == MODE_PERSISTENT)
+    {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+        glBufferStorage(m_target, m_size, 0, flags);
+        m_pPersistent = static_cast<unsigned char *>(glMapBufferRange(m_target, 0, m_size, flags));
+
+        if (!m_pPersistent)
+        {
+            // Fall back to mapping each allocation. Storage created with
+            // glBufferStorage() can't be respecified, so start over.
+
+            stateCache.deleteBuffer(m_buffer);
+            glGenBuffers(1, &m_buffer);
+            stateCache.bindBuffer(m_target, m_buffer);
+            m_mode = MODE_UNSYNCHRONIZED;
+        }
+    }
+
+    if (m_mode != MODE_PERSISTENT)
+        glBufferData(m_target, m_size, 0, GL_STREAM_DRAW);
+
+    return true;
+}
+
+void StreamBuffer::destroy()
+{
+    GLStateCache &stateCache = GLStateCache::instance();
+
+    if (m_mapped)
+        unmap(0);
+
+    for (size_t i = 0; i < m_fences.size(); ++i)
+        glDeleteSync(m_fences[i].sync);
+
+    m_fences.clear();
+
+    if (m_buffer)
+    {
+        if (m_pPersistent)
+        {
+            stateCache.bindBuffer(m_target, m_buffer);
+            glUnmapBuffer(m_target);
+            m_pPersistent = 0;
+        }
+
+        stateCache.deleteBuffer(m_buffer);
+        m_buffer = 0;
+    }
+
+    m_mode = MODE_NONE;
+    m_size = 0;
+    m_head = 0;
+    m_unfencedBegin = m_unfencedEnd = 0;
+}
+
+void *StreamBuffer::map(size_t bytes, size_t &offset)
+{
+    // Returns a pointer to 'bytes' bytes of the buffer starting at 'offset'.
+    // Returns null when 'bytes' is larger than the buffer.
+
+    assert(m_buffer && !m_mapped);
+
+    size_t alignedBytes = (bytes + ALIGNMENT - 1) & ~static_cast<size_t>(ALIGNMENT - 1);
+    void *pData = 0;
+
+    if (alignedBytes > m_size)
+        return 0;
+
+    fenceLastAllocation();
+
+    if (m_mode == MODE_ORPHAN)
+    {
+        m_head = 0;
+    }
+    else if (m_head + alignedBytes > m_size)
+    {
+        // The end of the buffer is skipped, so it must be free too before
+        // the ring wraps around.
+        waitForRange(m_head, m_size);
+        m_head = 0;
+    }
+
+    waitForRange(m_head, m_head + alignedBytes);
+    offset = m_head;
+
+    if (m_mode == MODE_PERSISTENT)
+    {
+        pData = m_pPersistent + offset;
+    }
+    else
+    {
+        LARGE_INTEGER start;
+        QueryPerformanceCounter(&start);
+
+        GLStateCache::instance().bindBuffer(m_target, m_buffer);
+
+        if (m_mode == MODE_UNSYNCHRONIZED)
+        {
+            pData = glMapBufferRange(m_target, offset, alignedBytes,
+                GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_FLUSH_EXPLICIT_BIT);
+        }
+        else
+        {
+            glBufferData(m_target, m_size, 0, GL_STREAM_DRAW);
+            pData = glMapBuffer(m_target, GL_WRITE_ONLY);
+        }
+
+        m_frameStats.mapMs += ElapsedMilliseconds(start);
+    }
+
+    ++m_frameStats.maps;
+
+    if (!pData)
+        return 0;
+
+    m_mappedOffset = offset;
+    m_mapped = true;
+    return pData;
+}
+
+void StreamBuffer::unmap(size_t bytesWritten)
+{
+    // Ends the current allocation. Only the first 'bytesWritten' bytes of it
+    // are kept, the rest is reused by the next allocation.
+
+    assert(m_mapped);
+
+    if (m_mode != MODE_PERSISTENT)
+    {
+        GLStateCache::instance().bindBuffer(m_target, m_buffer);
+
+        if (m_mode == MODE_UNSYNCHRONIZED && bytesWritten > 0)
+            glFlushMappedBufferRange(m_target, 0, bytesWritten);
+
+        glUnmapBuffer(m_target);
+    }
+
+    m_head = m_mappedOffset + ((bytesWritten + ALIGNMENT - 1) & ~static_cast<size_t>(ALIGNMENT - 1));
+    m_unfencedBegin = m_mappedOffset;
+    m_unfencedEnd = m_head;
+    m_mapped = false;
+    m_frameStats.bytesUploaded += bytesWritten;
+}
+
+void StreamBuffer::fenceLastAllocation()
+{
+    // The draws that read the last allocation have been issued by the time
+    // the next one is mapped, so the fence inserted now signals once the GPU
+    // is done with it. Orphaned storage is never written again, so it needs
+    // no fence.
+
+    if (m_unfencedBegin == m_unfencedEnd)
+        return;
+
+    if (m_mode != MODE_ORPHAN)
+    {
+        Fence fence;
+
+        fence.begin = m_unfencedBegin;
+        fence.end = m_unfencedEnd;
+        fence.sync = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        m_fences.push_back(fence);
+    }
+
+    m_unfencedBegin = m_unfencedEnd = 0;
+}
+
+void StreamBuffer::waitForRange(size_t begin, size_t end)
+{
+    // Waits until the GPU is done with every allocation that overlaps the
+    // bytes [begin, end). The allocations are made in ring order, so the
+    // oldest fence is always the next one to overlap.
+
+    while (!m_fences.empty() && m_fences.front().begin < end && begin < m_fences.front().end)
+    {
+        GLsync sync = m_fences.front().sync;
+        GLenum result = glClientWaitSync(sync, 0, 0);
+
+        if (result == GL_TIMEOUT_EXPIRED)
+        {
+            PROFILE_ZONE("StreamBuffer::waitForRange");
+
+            LARGE_INTEGER start;
+            QueryPerformanceCounter(&start);
+
+            // The first wait flushes the pending commands, otherwise the
+            // fence might never reach the GPU. The timeouts are in
+            // nanoseconds.
+            result = glClientWaitSync(sync, GL_SYNC_FLUSH_COMMANDS_BIT, 10000000);
+
+            while (result == GL_TIMEOUT_EXPIRED)
+                result = glClientWaitSync(sync, 0, 10000000);
+
+            ++m_frameStats.stalls;
+            m_frameStats.stallMs += ElapsedMilliseconds(start);
+        }
+
+        glDeleteSync(sync);
+        m_fences.pop_front();
+    }
+}
@@ -0,0 +1,131 @@
+
+
+#if !defined(STREAM_BUFFER_H)
+#define STREAM_BUFFER_H
+
+#include <windows.h>
+#include <GL/gl.h>
+#include <deque>
+
+#include "opengl.h"
+
+//-----------------------------------------------------------------------------
+// A ring buffer for streaming data the GPU reads once or for a few frames.
+//
+// Mapping a buffer the GPU may still be drawing from makes the driver wait
+// for those draws to finish. The StreamBuffer class avoids that by never
+// writing to the part of the buffer the GPU may still be reading. Each
+// allocation is guarded by a fence, and the ring is only wrapped onto an
+// allocation once its fence has signaled. Make the buffer a few frames
+// worth of data large and the fences will normally have signaled long
+// before they're waited for.
+//
+// The best method the driver supports is used:
+//  MODE_PERSISTENT     GL_ARB_buffer_storage. The buffer is mapped once.
+//  MODE_UNSYNCHRONIZED GL_ARB_map_buffer_range and GL_ARB_sync. Each
+//                      allocation is mapped without synchronization.
+//  MODE_ORPHAN         The buffer's storage is orphaned on every map(), so
+//                      the driver hands out new storage and frees the old
+//                      storage once the GPU is done with it. Only the most
+//                      recent allocation can be drawn from.
+//
+// The fence of an allocation is inserted by the next map(), so the draws
+// that use an allocation must be issued before the next map().
+//
+// The bytes uploaded and the time spent waiting are counted for each frame.
+// mapForOverwrite() applies the same accounting, and orphaning, to buffers
+// that are rewritten as a whole, such as the terrain's vertex buffer, and
+// bufferSubData() to the parts of a buffer rewritten in place.
+//
+// To use the StreamBuffer class:
+//  StreamBuffer buffer;
+//  buffer.create(GL_ARRAY_BUFFER, 3 * 64 * 1024);
+//  ...
+//  StreamBuffer::beginFrame();
+//  size_t offset = 0;
+//  void *pVertices = buffer.map(bytes, offset);
+//  ...
+//  buffer.unmap(bytesWritten);
+//  glVertexPointer(3, GL_FLOAT, 0, BUFFER_OFFSET(offset));
+//  glDrawArrays(...);
+//  ...
+//  buffer.destroy();
+//-----------------------------------------------------------------------------
+
+class StreamBuffer
+{
+public:
+    enum Mode
+    {
+        MODE_NONE,
+        MODE_PERSISTENT,
+        MODE_UNSYNCHRONIZED,
+        MODE_ORPHAN
+    };
+
+    // Allocations start at multiples of ALIGNMENT bytes.
+    enum { ALIGNMENT = 64 };
+
+    struct FrameStats
+    {
+        size_t bytesUploaded;
+        int maps;               // map() and mapForOverwrite() calls
+        int stalls;             // fence waits that had to block
+        double stallMs;         // time spent blocked on fences
+        double mapMs;           // time spent mapping, includes any waiting
+                                // done inside the driver
+    };
+
+    static void beginFrame();
+    static void bufferSubData(GLenum target, size_t offset, size_t size, const void *pData);
+    static const FrameStats &getLastFrameStats();
+    static void *mapForOverwrite(GLenum target, size_t size, GLenum usage);
+
+    StreamBuffer();
+    ~StreamBuffer();
+
+    bool create(GLenum target, size_t size);
+    void destroy();
+    void *map(size_t bytes, size_t &offset);
+    void unmap(size_t bytesWritten);
+
+    GLuint getBuffer() const
+    { return m_buffer; }
+
+    Mode getMode() const
+    { return m_mode; }
+
+    size_t getSize() const
+    { return m_size; }
+
+private:
+    StreamBuffer(const StreamBuffer &);
+    StreamBuffer &operator=(const StreamBuffer &);
+
+    struct Fence
+    {
+        size_t begin;
+        size_t end;
+        GLsync sync;
+    };
+
+    void fenceLastAllocation();
+    void waitForRange(size_t begin, size_t end);
+
+    static FrameStats m_frameStats;
+    static FrameStats m_lastFrameStats;
+
+    GLenum m_target;
+    GLuint m_buffer;
+    Mode m_mode;
+    size_t m_size;
+    size_t m_head;                  // start of the next allocation
+    size_t m_mappedOffset;
+    size_t m_unfencedBegin;         // last allocation, not yet fenced
+    size_t m_unfencedEnd;
+    bool m_mapped;
+    unsigned char *m_pPersistent;
+    std::deque<Fence> m_fences;     // oldest first
+};
+
+#endif
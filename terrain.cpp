@@ -6,603 +6,1181 @@
 #include <algorithm>
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 #include <ctime>
 
+#include "gl_state_cache.h"
 #include "opengl.h"
+#include "profiler.h"
+#include "stream_buffer.h"
 #include "terrain.h"
+#include "thread_pool.h"
+
+namespace
+{
+    template <typename Index>
+    void BuildIndices(Terrain::IndexOrder indexOrder, int size, int blockWidth, Index *pIndices)
+    {
+        switch (indexOrder)
+        {
+        case Terrain::INDEX_ORDER_BLOCK_LIST:
+            TerrainMesh::buildBlockListIndices(size, blockWidth, pIndices);
+            break;
+
+        case Terrain::INDEX_ORDER_BLOCK_STRIPS:
+            TerrainMesh::buildBlockStripIndices(size, blockWidth, pIndices);
+            break;
+
+        default:
+            TerrainMesh::buildStripIndices(size, pIndices);
+            break;
+        }
+    }
+}
 
 //-----------------------------------------------------------------------------
-// HeightMap.
+// Terrain.
 //-----------------------------------------------------------------------------
 
-HeightMap::HeightMap() : m_size(0), m_gridSpacing(0), m_heightScale(1.0f)
+const float Terrain::COMPACT_HEIGHT_RANGE = 255.0f;
+
+Terrain::Terrain()
 {
+    m_vertexArray = 0;
+    m_vertexBuffer = 0;
+    m_indexBuffer = 0;
+    m_totalVertices = 0;
+    m_totalIndices = 0;
+    m_lodIndexBuffer = 0;
+    m_lodIndexCount = 0;
+    m_patchVertexBuffer = 0;
+    m_patchIndexBuffer = 0;
+    m_patchIndexCount = 0;
+    m_heightTexture = 0;
+    m_patchesPerSide = 0;
+    m_triangleCount = 0;
+    m_lodErrorPerDistance = 0.0f;
+    m_visiblePatchCount = 0;
+    m_culledPatchCount = 0;
+    m_drawCallCount = 0;
+    m_geomipmapping = false;
+    m_frustumCulling = true;
+    m_vertexFormat = VERTEX_FORMAT_FLOAT;
+    m_indexOrder = INDEX_ORDER_STRIP;
+    m_dirtyRect.x0 = m_dirtyRect.z0 = m_dirtyRect.x1 = m_dirtyRect.z1 = 0;
+
+    setLodParameters(4.0f, 1024.0f, 90.0f);
 }
 
-HeightMap::~HeightMap()
+Terrain::~Terrain()
 {
     destroy();
 }
 
-bool HeightMap::create(int size, int gridSpacing, float scale)
+void Terrain::applyBrush(HeightMap::BrushMode mode, float x, float z, float radius, float strength)
 {
-    m_heightScale = scale;
-    m_size = size;
-    m_gridSpacing = gridSpacing;
+    // Edits the height map with HeightMap::applyBrush(). The bounds and
+    // errors of the patches the brush touches are updated straight away, but
+    // the vertices are only uploaded by the next update(), so several brush
+    // strokes in one frame are uploaded together.
+
+    HeightMap::Rect rect = m_heightMap.applyBrush(mode, x, z, radius, strength);
+
+    if (rect.isEmpty())
+        return;
+
+    computePatchErrors(rect);
 
-    try
+    if (m_dirtyRect.isEmpty())
     {
-        m_heights.resize(m_size * m_size);
+        m_dirtyRect = rect;
     }
-    catch (const std::bad_alloc &)
+    else
     {
-        return false;
+        m_dirtyRect.x0 = min(m_dirtyRect.x0, rect.x0);
+        m_dirtyRect.z0 = min(m_dirtyRect.z0, rect.z0);
+        m_dirtyRect.x1 = max(m_dirtyRect.x1, rect.x1);
+        m_dirtyRect.z1 = max(m_dirtyRect.z1, rect.z1);
     }
+}
 
-    memset(&m_heights[0], 0, m_heights.size());
-    return true;
+bool Terrain::create(int size, int gridSpacing, float scale)
+{
+    if (!m_heightMap.create(size, gridSpacing, scale))
+        return false;
+
+    return terrainCreate(size, gridSpacing, scale);
 }
 
-void HeightMap::destroy()
+void Terrain::destroy()
 {
-    m_heightScale = 1.0f;
-    m_size = 0;
-    m_gridSpacing = 0;
-    m_heights.clear();
+    m_heightMap.destroy();
+    terrainDestroy();
 }
 
-void HeightMap::generateDiamondSquareFractal(float roughness)
+void Terrain::draw()
+{
+    terrainDraw();
+}
+
+void Terrain::enableFrustumCulling(bool enable)
 {
-    // Generates a fractal height field using the diamond-square (midpoint
-    // displacement) algorithm. Note that only square height fields work with
-    // this algorithm.
-    //
-    // Based on article and associated code:
-    // "Fractal Terrain Generation - Midpoint Displacement" by Jason Shankel
-    // (Game Programming Gems I, pp.503-507).
+    // When frustum culling is enabled only the patches that were inside the
+    // view frustum during the last call to update() are drawn.
+
+    m_frustumCulling = enable;
 
-    srand(static_cast<unsigned int>(time(0)));
+    for (size_t i = 0; i < m_patches.size(); ++i)
+        m_patches[i].visible = true;
 
-    std::fill(m_heights.begin(), m_heights.end(), 0.0f);
+    countTriangles();
+}
+
+void Terrain::enableGeomipmapping(bool enable)
+{
+    // When geomipmapping is disabled the whole grid is drawn at full detail.
+    // Otherwise each patch is drawn at the level of detail picked by the last
+    // call to update().
 
-    int p1, p2, p3, p4, mid;
-    float dH = m_size * 0.5f;
-    float dHFactor = powf(2.0f, -roughness);
-    float minH = 0.0f, maxH = 0.0f;
+    m_geomipmapping = enable;
 
-    for (int w = m_size; w > 0; dH *= dHFactor, w /= 2)
+    if (!enable)
     {
-        // Diamond Step.
-        for (int z = 0; z < m_size; z += w)
+        for (size_t i = 0; i < m_patches.size(); ++i)
         {
-            for (int x = 0; x < m_size; x += w)
-            {
-                p1 = heightIndexAt(x, z);
-                p2 = heightIndexAt(x + w, z);
-                p3 = heightIndexAt(x + w, z + w);
-                p4 = heightIndexAt(x, z + w);
-                mid = heightIndexAt(x + w / 2, z + w / 2);
+            m_patches[i].lod = 0;
+            m_patches[i].lodIndices = lodIndicesFor(m_patches[i], 0);
+            m_patches[i].edgeMask = 0;
+        }
+    }
 
-                m_heights[mid] = Math::random(-dH, dH) + (m_heights[p1] + m_heights[p2] + m_heights[p3] + m_heights[p4]) * 0.25f;
+    countTriangles();
+}
 
-                minH = min(minH, m_heights[mid]);
-                maxH = max(maxH, m_heights[mid]);
-            }
-        }
+bool Terrain::erode(int thermalIterations, float talus, const HeightMap::HydraulicErosionParameters &params)
+{
+    // Runs thermal erosion, then hydraulic erosion, over the whole height
+    // map. Erosion changes most of the texels, so everything is rebuilt
+    // rather than tracked as a dirty rectangle.
+
+    m_heightMap.erodeThermal(thermalIterations, talus, 1.0f);
+    m_heightMap.erodeHydraulic(params);
+    m_heightMap.buildMinMaxPyramid();
+    computePatchErrors();
+    return generateVertices();
+}
 
-        // Square step.
-        for (int z = 0; z < m_size; z += w)
-        {
-            for (int x = 0; x < m_size; x += w)
-            {
-                p1 = heightIndexAt(x, z);
-                p2 = heightIndexAt(x + w, z);
-                p3 = heightIndexAt(x + w / 2, z - w / 2);
-                p4 = heightIndexAt(x + w / 2, z + w / 2);
-                mid = heightIndexAt(x + w / 2, z);
+bool Terrain::generateUsingDiamondSquareFractal(float roughness)
+{
+    m_heightMap.generateDiamondSquareFractal(roughness);
+    m_heightMap.buildMinMaxPyramid();
+    computePatchErrors();
+    return generateVertices();
+}
 
-                m_heights[mid] = Math::random(-dH, dH) + (m_heights[p1] + m_heights[p2] + m_heights[p3] + m_heights[p4]) * 0.25f;
+bool Terrain::generateUsingNoise(const HeightMap::NoiseParameters &params)
+{
+    m_heightMap.generateNoise(params);
+    m_heightMap.buildMinMaxPyramid();
+    computePatchErrors();
+    return generateVertices();
+}
 
-                minH = min(minH, m_heights[mid]);
-                maxH = max(maxH, m_heights[mid]);
+size_t Terrain::getIndexBufferSize() const
+{
+    // The instanced vertex format only uses the shared patch indices, whose
+    // size doesn't depend on the size of the terrain.
 
-                p1 = heightIndexAt(x, z);
-                p2 = heightIndexAt(x, z + w);
-                p3 = heightIndexAt(x + w / 2, z + w / 2);
-                p3 = heightIndexAt(x - w / 2, z + w / 2);
-                mid = heightIndexAt(x, z + w / 2);
+    if (m_vertexFormat == VERTEX_FORMAT_INSTANCED)
+        return m_patchIndexCount * sizeof(unsigned short);
 
-                m_heights[mid] = Math::random(-dH, dH) + (m_heights[p1] + m_heights[p2] + m_heights[p3] + m_heights[p4]) * 0.25f;
+    size_t stripIndexSize = use16BitIndices() ? sizeof(unsigned short) : sizeof(unsigned int);
+    size_t lodIndexSize = use16BitLodIndices() ? sizeof(unsigned short) : sizeof(unsigned int);
 
-                minH = min(minH, m_heights[mid]);
-                maxH = max(maxH, m_heights[mid]);
-            }
-        }
+    return m_totalIndices * stripIndexSize + m_lodIndexCount * lodIndexSize;
+}
+
+size_t Terrain::getVertexBufferSize() const
+{
+    // Includes the height texture of the instanced vertex format.
+
+    size_t size = static_cast<size_t>(getVertexSize()) * m_totalVertices;
+
+    if (m_vertexFormat == VERTEX_FORMAT_INSTANCED)
+        size += (PATCH_SIZE + 1) * (PATCH_SIZE + 1) * sizeof(PatchPosition);
+
+    return size;
+}
+
+int Terrain::getVertexSize() const
+{
+    // The size of the data stored for each height map texel. That's a single
+    // float height texel for the instanced vertex format.
+
+    switch (m_vertexFormat)
+    {
+    case VERTEX_FORMAT_COMPACT:   return sizeof(CompactVertex);
+    case VERTEX_FORMAT_INSTANCED: return sizeof(float);
+    default:                      return sizeof(Vertex);
     }
+}
+
+bool Terrain::loadHeightMap(const char *pszFilename)
+{
+    // Replaces the height map with one loaded from a file written by
+    // HeightMap::save(). The file must have the same size and grid spacing
+    // as the terrain, since those determine the vertex and index buffers.
+    // The current height map is kept if the file isn't a valid height map
+    // file.
 
-    smooth();
+    HeightMapFile file;
 
-    // Normalize height field so altitudes fall into range [0,255].
-    for (int i = 0; i < m_size * m_size; ++i)
-        m_heights[i] = 255.0f * (m_heights[i] - minH) / (maxH - minH);
+    if (!file.open(pszFilename))
+        return false;
+
+    const HeightMapFileHeader &header = file.getHeader();
+
+    if (header.size != m_heightMap.getSize() || header.gridSpacing != m_heightMap.getGridSpacing())
+        return false;
+
+    file.close();
+
+    if (!m_heightMap.load(pszFilename))
+        return false;
+
+    m_heightMap.buildMinMaxPyramid();
+    computePatchErrors();
+    return generateVertices();
 }
 
-float HeightMap::heightAt(float x, float z) const
+bool Terrain::setIndexOrder(IndexOrder indexOrder)
 {
-    // Given a (x, z) position on the rendered height map this method
-    // calculates the exact height of the height map at that (x, z)
-    // position using bilinear interpolation.
+    // Rebuilds the full grid index buffer in the new order. Returns false
+    // when the order needs primitive restart and the driver doesn't support
+    // it, the previous order is kept then. The instanced vertex format has
+    // no full grid index buffer, so it's only rebuilt once the format
+    // changes.
+
+    if (indexOrder == m_indexOrder)
+        return true;
+
+    if (indexOrder == INDEX_ORDER_BLOCK_STRIPS && !GLStateCache::instance().supportsPrimitiveRestart())
+        return false;
+
+    m_indexOrder = indexOrder;
 
-    x /= static_cast<float>(m_gridSpacing);
-    z /= static_cast<float>(m_gridSpacing);
+    if (!m_indexBuffer || m_vertexFormat == VERTEX_FORMAT_INSTANCED)
+        return true;
 
-    assert(x >= 0.0f && x < float(m_size));
-    assert(z >= 0.0f && z < float(m_size));
+    return generateIndices();
+}
+
+void Terrain::setLodParameters(float maxPixelError, float viewportWidth, float fovxDegrees)
+{
+    // A patch is drawn at the coarsest level of detail whose geometric error,
+    // projected onto the screen at the patch's distance from the camera, is
+    // at most 'maxPixelError' pixels. 'viewportWidth' and 'fovxDegrees' are
+    // the width of the viewport in pixels and the horizontal field of view.
 
-    long ix = Math::floatToLong(x);
-    long iz = Math::floatToLong(z);
-    float topLeft = m_heights[heightIndexAt(ix, iz)] * m_heightScale;
-    float topRight = m_heights[heightIndexAt(ix + 1, iz)] * m_heightScale;
-    float bottomLeft = m_heights[heightIndexAt(ix, iz + 1)] * m_heightScale;
-    float bottomRight = m_heights[heightIndexAt(ix + 1, iz + 1)] * m_heightScale;
-    float percentX = x - static_cast<float>(ix);
-    float percentZ = z - static_cast<float>(iz);
+    float halfFovx = Math::degreesToRadians(fovxDegrees) * 0.5f;
 
-    return Math::bilerp(topLeft, topRight, bottomLeft, bottomRight, percentX, percentZ);
+    m_lodErrorPerDistance = maxPixelError * 2.0f * tanf(halfFovx) / viewportWidth;
 }
 
-void HeightMap::normalAt(float x, float z, Vector3 &n) const
+bool Terrain::setVertexFormat(VertexFormat vertexFormat)
 {
-    // Given a (x, z) position on the rendered height map this method
-    // calculates the exact normal of the height map at that (x, z) position
-    // using bilinear interpolation.
+    // Changes the layout of the vertex buffer. When the terrain has already
+    // been created its buffers are reallocated for the new format and the
+    // vertices are filled again from the height map. Returns false when the
+    // driver doesn't support the format, the previous format is kept then.
 
-    x /= static_cast<float>(m_gridSpacing);
-    z /= static_cast<float>(m_gridSpacing);
+    if (vertexFormat == m_vertexFormat)
+        return true;
 
-    assert(x >= 0.0f && x < float(m_size));
-    assert(z >= 0.0f && z < float(m_size));
+    VertexFormat previousFormat = m_vertexFormat;
 
-    long ix = Math::floatToLong(x);
-    long iz = Math::floatToLong(z);
+    m_vertexFormat = vertexFormat;
 
-    float percentX = x - static_cast<float>(ix);
-    float percentZ = z - static_cast<float>(iz);
+    if (!m_vertexBuffer)
+        return true;
 
-    Vector3 topLeft;
-    Vector3 topRight;
-    Vector3 bottomLeft;
-    Vector3 bottomRight;
-    Vector3 normal;
+    if (!allocateBuffers())
+    {
+        m_vertexFormat = previousFormat;
+        return false;
+    }
 
-    normalAtPixel(ix, iz, topLeft);
-    normalAtPixel(ix + 1, iz, topRight);
-    normalAtPixel(ix, iz + 1, bottomLeft);
-    normalAtPixel(ix + 1, iz + 1, bottomRight);
+    // generateVertices() resizes the vertex buffer for the new format.
+    createVertexArray();
+    countTriangles();
 
-    n = Math::bilerp(topLeft, topRight, bottomLeft, bottomRight, percentX, percentZ);
-    n.normalize();
+    return generateVertices();
 }
 
-void HeightMap::normalAtPixel(int x, int z, Vector3 &n) const
+void Terrain::update(const Vector3 &cameraPos, const Frustum &frustum)
 {
-    // Returns the normal at the specified location on the height map.
-    // The normal is calculated using the properties of the height map.
-    // This approach is much quicker and more elegant than triangulating the
-    // height map and averaging triangle surface normals.
+    PROFILE_ZONE("Terrain::update");
 
-    if (x > 0 && x < m_size - 1)
-        n.x = heightAtPixel(x - 1, z) - heightAtPixel(x + 1, z);
-    else if (x > 0)
-        n.x = 2.0f * (heightAtPixel(x - 1, z) - heightAtPixel(x, z));
-    else
-        n.x = 2.0f * (heightAtPixel(x, z) - heightAtPixel(x + 1, z));
+    updateDirtyRect();
+    terrainUpdate(cameraPos, frustum);
+}
 
-    if (z > 0 && z < m_size - 1)
-        n.z = heightAtPixel(x, z - 1) - heightAtPixel(x, z + 1);
-    else if (z > 0)
-        n.z = 2.0f * (heightAtPixel(x, z - 1) - heightAtPixel(x, z));
-    else
-        n.z = 2.0f * (heightAtPixel(x, z) - heightAtPixel(x, z + 1));
+bool Terrain::allocateBuffers()
+{
+    // Gives the index buffers of the current vertex format their contents,
+    // and frees the storage of the terrain sized buffers the format doesn't
+    // use. The vertex buffer is filled by generateVertices(). The instanced
+    // format draws every patch from the shared patch buffers, so the terrain
+    // sized buffers are emptied. Empty LOD ranges mean the terrain sized
+    // index buffers have to be rebuilt.
+
+    GLStateCache &stateCache = GLStateCache::instance();
 
-    n.y = 2.0f * m_gridSpacing;
-    n.normalize();
+    if (m_vertexFormat != VERTEX_FORMAT_INSTANCED)
+    {
+        if (!m_lodIndices.empty())
+            return true;
+
+        return generateIndices() && generateLodIndices();
+    }
+
+    if (!m_patchVertexBuffer && !createPatchBuffers())
+        return false;
+
+    stateCache.bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, 0, 0, GL_DYNAMIC_DRAW);
+
+    stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, 0, GL_STATIC_DRAW);
+
+    stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_lodIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 0, 0, GL_STATIC_DRAW);
+
+    m_lodIndices.clear();
+    m_lodIndexCount = 0;
+    return true;
 }
 
-void HeightMap::blur(float amount)
+void Terrain::bindVertexArrays(int x, int z)
 {
-    // Applies a simple FIR (Finite Impulse Response) filter across the height
-    // map to blur it. 'amount' is in range [0,1]. 0 is no blurring, and 1 is
-    // very strong blurring.
+    // Points the vertex arrays at the vertex at grid position (x, z), so
+    // indices are relative to that vertex.
 
-    float *pPixel = 0;
-    float *pPrevPixel = 0;
-    int width = m_size;
-    int height = m_size;
-    int pitch = m_size;
+    int size = m_heightMap.getSize();
+    size_t offset = static_cast<size_t>(z * size + x) * getVertexSize();
 
-    // Blur horizontally. Both left-to-right, and right-to-left.
-    for (int i = 0; i < height; ++i)
+    if (m_vertexFormat == VERTEX_FORMAT_COMPACT)
+    {
+        glVertexAttribPointer(COMPACT_HEIGHT_ATTRIB, 1, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(CompactVertex), BUFFER_OFFSET(offset));
+        glVertexAttribPointer(COMPACT_NORMAL_ATTRIB, 2, GL_BYTE, GL_FALSE, sizeof(CompactVertex), BUFFER_OFFSET(offset + sizeof(unsigned short)));
+        glVertexAttrib2f(COMPACT_ORIGIN_ATTRIB, static_cast<float>(x), static_cast<float>(z));
+    }
+    else
     {
-        pPrevPixel = &m_heights[i * pitch];
+        glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(offset + 6 * sizeof(float)));
+        glNormalPointer(GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(offset + 3 * sizeof(float)));
+        glVertexPointer(3, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(offset));
+    }
+}
 
-        // Left-to-right.
-        for (int j = 1; j < width; ++j)
+void Terrain::computePatchErrors()
+{
+    // Computes the height bounds of each patch and the geometric error of each
+    // of its levels of detail. See TerrainMesh::computePatchBounds().
+
+    int patchCount = static_cast<int>(m_patches.size());
+
+    auto computeErrors = [&](int begin, int end)
+    {
+        for (int p = begin; p < end; ++p)
         {
-            pPixel = &m_heights[(i * pitch) + j];
-            *pPixel = (*pPrevPixel * amount) + (*pPixel * (1.0f - amount));
-            pPrevPixel = pPixel;
+            Patch &patch = m_patches[p];
+
+            TerrainMesh::computePatchBounds(m_heightMap, patch.x, patch.z, patch.width, patch.height,
+                PATCH_LODS, patch.minY, patch.maxY, patch.errors);
         }
+    };
+
+    if (m_heightMap.getThreadPool())
+        m_heightMap.getThreadPool()->parallelFor(0, patchCount, computeErrors);
+    else
+        computeErrors(0, patchCount);
+}
+
+void Terrain::computePatchErrors(const HeightMap::Rect &rect)
+{
+    // Recomputes the bounds and errors of the patches that share a texel
+    // with 'rect'. Neighbouring patches share their edge texels.
 
-        pPrevPixel = &m_heights[(i * pitch) + (width - 1)];
+    if (m_patches.empty() || rect.isEmpty())
+        return;
 
-        // Right-to-left.
-        for (int j = width - 2; j >= 0; --j)
+    int px0 = max(rect.x0 - 1, 0) / PATCH_SIZE;
+    int pz0 = max(rect.z0 - 1, 0) / PATCH_SIZE;
+    int px1 = min((rect.x1 - 1) / PATCH_SIZE + 1, m_patchesPerSide);
+    int pz1 = min((rect.z1 - 1) / PATCH_SIZE + 1, m_patchesPerSide);
+
+    for (int pz = pz0; pz < pz1; ++pz)
+    {
+        for (int px = px0; px < px1; ++px)
         {
-            pPixel = &m_heights[(i * pitch) + j];
-            *pPixel = (*pPrevPixel * amount) + (*pPixel * (1.0f - amount));
-            pPrevPixel = pPixel;
+            Patch &patch = m_patches[pz * m_patchesPerSide + px];
+
+            TerrainMesh::computePatchBounds(m_heightMap, patch.x, patch.z, patch.width, patch.height,
+                PATCH_LODS, patch.minY, patch.maxY, patch.errors);
         }
     }
+}
 
-    // Blur vertically. Both top-to-bottom, and bottom-to-top.
-    for (int i = 0; i < width; ++i)
-    {
-        pPrevPixel = &m_heights[i];
+void Terrain::countTriangles()
+{
+    // Counts the patches and triangles the next call to draw() will draw.
+    // The whole grid is drawn as a single triangle strip when neither
+    // geomipmapping nor frustum culling are enabled, except by the instanced
+    // vertex format, which always draws patches.
+
+    m_visiblePatchCount = 0;
+    m_culledPatchCount = 0;
+    m_triangleCount = 0;
 
-        // Top-to-bottom.
-        for (int j = 1; j < height; ++j)
+    for (size_t i = 0; i < m_patches.size(); ++i)
+    {
+        if (m_patches[i].visible)
         {
-            pPixel = &m_heights[(j * pitch) + i];
-            *pPixel = (*pPrevPixel * amount) + (*pPixel * (1.0f - amount));
-            pPrevPixel = pPixel;
+            ++m_visiblePatchCount;
+            m_triangleCount += getPatchIndices(m_patches[i]).count / 3;
         }
-
-        pPrevPixel = &m_heights[((height - 1) * pitch) + i];
-
-        // Bottom-to-top.
-        for (int j = height - 2; j >= 0; --j)
+        else
         {
-            pPixel = &m_heights[(j * pitch) + i];
-            *pPixel = (*pPrevPixel * amount) + (*pPixel * (1.0f - amount));
-            pPrevPixel = pPixel;
+            ++m_culledPatchCount;
         }
     }
-}
 
-unsigned int HeightMap::heightIndexAt(int x, int z) const
-{
-    // Given a 2D height map coordinate, this method returns the index
-    // into the height map. This method wraps around for coordinates larger
-    // than the height map size.
-    return (((x + m_size) % m_size) + ((z + m_size) % m_size) * m_size);
+    if (!m_geomipmapping && !m_frustumCulling && m_vertexFormat != VERTEX_FORMAT_INSTANCED)
+    {
+        int size = m_heightMap.getSize();
+        m_triangleCount = 2 * (size - 1) * (size - 1);
+    }
 }
 
-void HeightMap::smooth()
+bool Terrain::createPatchBuffers()
 {
-    // Applies a box filter to the height map to smooth it out.
+    // Creates what VERTEX_FORMAT_INSTANCED shares between all patches: the
+    // vertex grid of a single patch, the triangle lists of every level of
+    // detail and edge mask of that grid, the height texture, and the ring
+    // buffer that the patch origins are streamed through. The grid and its
+    // indices have the same size for any terrain. Partial patches at the
+    // far edges are drawn as whole patches, so only the lists of the full
+    // patch shape are needed.
+
+    GLStateCache &stateCache = GLStateCache::instance();
 
-    std::vector<float> source(m_heights);
-    float value = 0.0f;
-    float cellAverage = 0.0f;
-    int i = 0;
-    int bounds = m_size * m_size;
+    if (!stateCache.supportsInstancing() || !stateCache.supportsVertexArrays())
+        return false;
 
-    for (int y = 0; y < m_size; ++y)
+    int gridSize = PATCH_SIZE + 1;
+    int size = m_heightMap.getSize();
+    std::vector<PatchPosition> vertices(gridSize * gridSize);
+    std::vector<unsigned int> indices;
+
+    for (int z = 0; z < gridSize; ++z)
     {
-        for (int x = 0; x < m_size; ++x)
+        for (int x = 0; x < gridSize; ++x)
         {
-            value = 0.0f;
-            cellAverage = 0.0f;
+            vertices[z * gridSize + x].x = static_cast<unsigned short>(x);
+            vertices[z * gridSize + x].z = static_cast<unsigned short>(z);
+        }
+    }
 
-            i = (y - 1) * m_size + (x - 1);
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    TerrainMesh::buildPatchLodIndices(gridSize, PATCH_SIZE, PATCH_LODS, indices, m_patchIndices);
 
-            i = (y - 1) * m_size + x;
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
 
-            i = (y - 1) * m_size + (x + 1);
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    m_patchIndexCount = static_cast<int>(shortIndices.size());
 
-            i = y * m_size + (x - 1);
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    glGenBuffers(1, &m_patchVertexBuffer);
+    stateCache.bindBuffer(GL_ARRAY_BUFFER, m_patchVertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(PatchPosition) * vertices.size(), &vertices[0], GL_STATIC_DRAW);
 
-            i = y * m_size + x;
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    glGenBuffers(1, &m_patchIndexBuffer);
+    stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patchIndexBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * shortIndices.size(), &shortIndices[0], GL_STATIC_DRAW);
 
-            i = y * m_size + (x + 1);
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    // The heights are fetched by texel, so the texture is never filtered.
 
-            i = (y + 1) * m_size + (x - 1);
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    glGenTextures(1, &m_heightTexture);
+    stateCache.bindTexture(HEIGHT_MAP_TEXTURE_UNIT, m_heightTexture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, size, size, 0, GL_RED, GL_FLOAT, 0);
 
-            i = (y + 1) * m_size + x;
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    // Room for the origins of every patch for 3 frames.
 
-            i = (y + 1) * m_size + (x + 1);
-            if (i >= 0 && i < bounds)
-            {
-                value += source[i];
-                cellAverage += 1.0f;
-            }
+    size_t instanceBytes = m_patches.size() * sizeof(PatchPosition) + StreamBuffer::ALIGNMENT;
 
-            m_heights[y * m_size + x] = value / cellAverage;
-        }
-    }
+    return m_instanceBuffer.create(GL_ARRAY_BUFFER, 3 * instanceBytes);
 }
 
-//-----------------------------------------------------------------------------
-// Terrain.
-//-----------------------------------------------------------------------------
+void Terrain::createVertexArray()
+{
+    // Records the vertex layout of the current vertex format in a vertex
+    // array object. The vertex arrays point at the first vertex, and patches
+    // are drawn with a base vertex, so this requires both vertex array
+    // objects and glDrawElementsBaseVertex(). Without them m_vertexArray
+    // stays 0 and terrainDraw() sets up the vertex arrays for every draw.
+    // The instanced vertex format can't be selected without them.
 
-Terrain::Terrain()
+    GLStateCache &stateCache = GLStateCache::instance();
+
+    if (m_vertexArray)
+    {
+        stateCache.deleteVertexArray(m_vertexArray);
+        m_vertexArray = 0;
+    }
+
+    if (!stateCache.supportsVertexArrays())
+        return;
+
+    if (m_vertexFormat != VERTEX_FORMAT_INSTANCED && !stateCache.supportsBaseVertex())
+        return;
+
+    glGenVertexArrays(1, &m_vertexArray);
+    stateCache.bindVertexArray(m_vertexArray);
+
+    if (m_vertexFormat == VERTEX_FORMAT_INSTANCED)
+    {
+        // The patch origins are pointed at the instance buffer by
+        // drawInstancedPatches(), since their offset changes every draw.
+
+        stateCache.bindBuffer(GL_ARRAY_BUFFER, m_patchVertexBuffer);
+        stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_patchIndexBuffer);
+        glEnableVertexAttribArray(PATCH_VERTEX_ATTRIB);
+        glVertexAttribPointer(PATCH_VERTEX_ATTRIB, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(PatchPosition), BUFFER_OFFSET(0));
+        glEnableVertexAttribArray(PATCH_ORIGIN_ATTRIB);
+        glVertexAttribDivisor(PATCH_ORIGIN_ATTRIB, 1);
+    }
+    else
+    {
+        stateCache.bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+        enableVertexArrays();
+        bindVertexArrays(0, 0);
+    }
+
+    stateCache.bindVertexArray(0);
+}
+
+void Terrain::cullPatches(const Frustum &frustum)
 {
-    m_vertexBuffer = 0;
-    m_indexBuffer = 0;
-    m_totalVertices = 0;
-    m_totalIndices = 0;
+    // Tests the bounding box of each patch against the view frustum. The
+    // boxes span the patch's grid extent and its height range.
+
+    float gridSpacing = static_cast<float>(m_heightMap.getGridSpacing());
+
+    for (size_t i = 0; i < m_patches.size(); ++i)
+    {
+        Patch &patch = m_patches[i];
+        Vector3 boxMin(patch.x * gridSpacing, patch.minY, patch.z * gridSpacing);
+        Vector3 boxMax((patch.x + patch.width) * gridSpacing, patch.maxY, (patch.z + patch.height) * gridSpacing);
+
+        patch.visible = frustum.boxVisible(boxMin, boxMax);
+    }
 }
 
-Terrain::~Terrain()
+void Terrain::disableVertexArrays()
 {
-    destroy();
+    if (m_vertexFormat == VERTEX_FORMAT_COMPACT)
+    {
+        glDisableVertexAttribArray(COMPACT_NORMAL_ATTRIB);
+        glDisableVertexAttribArray(COMPACT_HEIGHT_ATTRIB);
+    }
+    else
+    {
+        glDisableClientState(GL_VERTEX_ARRAY);
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    }
 }
 
-bool Terrain::create(int size, int gridSpacing, float scale)
+void Terrain::drawInstancedPatches()
 {
-    if (!m_heightMap.create(size, gridSpacing, scale))
-        return false;
+    // Draws the visible patches with one instanced draw call for each index
+    // range in use, that is for each combination of level of detail and
+    // edge mask. A counting sort groups the patches by index range, and
+    // their origins are streamed to the GPU in that order, so each draw's
+    // instances are consecutive in the instance buffer.
+
+    GLStateCache &stateCache = GLStateCache::instance();
+    const int rangeCount = PATCH_LODS * 16;
+    int first[rangeCount + 1] = {0};
+    int next[rangeCount];
+
+    for (size_t i = 0; i < m_patches.size(); ++i)
+    {
+        const Patch &patch = m_patches[i];
 
-    return terrainCreate(size, gridSpacing, scale);
+        if (patch.visible)
+            ++first[TerrainMesh::getLodRangeIndex(0, patch.lod, PATCH_LODS, patch.edgeMask) + 1];
+    }
+
+    for (int r = 0; r < rangeCount; ++r)
+    {
+        first[r + 1] += first[r];
+        next[r] = first[r];
+    }
+
+    int instanceCount = first[rangeCount];
+
+    if (!instanceCount)
+        return;
+
+    m_patchInstances.resize(instanceCount);
+
+    for (size_t i = 0; i < m_patches.size(); ++i)
+    {
+        const Patch &patch = m_patches[i];
+
+        if (!patch.visible)
+            continue;
+
+        PatchPosition &instance = m_patchInstances[next[TerrainMesh::getLodRangeIndex(0, patch.lod, PATCH_LODS, patch.edgeMask)]++];
+
+        instance.x = static_cast<unsigned short>(patch.x);
+        instance.z = static_cast<unsigned short>(patch.z);
+    }
+
+    size_t bytes = instanceCount * sizeof(PatchPosition);
+    size_t offset = 0;
+    void *pInstances = m_instanceBuffer.map(bytes, offset);
+
+    if (!pInstances)
+        return;
+
+    memcpy(pInstances, &m_patchInstances[0], bytes);
+    m_instanceBuffer.unmap(bytes);
+
+    stateCache.bindTexture(HEIGHT_MAP_TEXTURE_UNIT, m_heightTexture);
+    stateCache.bindVertexArray(m_vertexArray);
+    stateCache.bindBuffer(GL_ARRAY_BUFFER, m_instanceBuffer.getBuffer());
+
+    for (int r = 0; r < rangeCount; ++r)
+    {
+        int count = first[r + 1] - first[r];
+        const LodIndices &patchIndices = m_patchIndices[r];
+
+        if (!count)
+            continue;
+
+        glVertexAttribPointer(PATCH_ORIGIN_ATTRIB, 2, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(PatchPosition),
+            BUFFER_OFFSET(offset + first[r] * sizeof(PatchPosition)));
+        glDrawElementsInstanced(GL_TRIANGLES, patchIndices.count, GL_UNSIGNED_SHORT,
+            BUFFER_OFFSET(patchIndices.first * sizeof(unsigned short)), count);
+        ++m_drawCallCount;
+    }
 }
 
-void Terrain::destroy()
+void Terrain::enableVertexArrays()
 {
-    m_heightMap.destroy();
-    terrainDestroy();
+    if (m_vertexFormat == VERTEX_FORMAT_COMPACT)
+    {
+        glEnableVertexAttribArray(COMPACT_HEIGHT_ATTRIB);
+        glEnableVertexAttribArray(COMPACT_NORMAL_ATTRIB);
+    }
+    else
+    {
+        glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glEnableClientState(GL_VERTEX_ARRAY);
+    }
 }
 
-void Terrain::draw()
+bool Terrain::generateLodIndices()
 {
-    terrainDraw();
+    // Builds the triangle lists of every level of detail for every
+    // combination of coarser neighbours, and for every patch shape. All of
+    // them go into a single index buffer. See lodIndicesFor().
+
+    std::vector<unsigned int> indices;
+
+    TerrainMesh::buildPatchLodIndices(m_heightMap.getSize(), PATCH_SIZE, PATCH_LODS, indices, m_lodIndices);
+
+    m_lodIndexCount = static_cast<int>(indices.size());
+    GLStateCache::instance().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_lodIndexBuffer);
+
+    if (use16BitLodIndices())
+    {
+        std::vector<unsigned short> shortIndices(indices.begin(), indices.end());
+
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned short) * shortIndices.size(),
+            &shortIndices[0], GL_STATIC_DRAW);
+    }
+    else
+    {
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(unsigned int) * indices.size(),
+            &indices[0], GL_STATIC_DRAW);
+    }
+
+    return true;
 }
 
-bool Terrain::generateUsingDiamondSquareFractal(float roughness)
+const Terrain::LodIndices &Terrain::getPatchIndices(const Patch &patch) const
 {
-    m_heightMap.generateDiamondSquareFractal(roughness);
-    return generateVertices();
+    // Returns the triangle list 'patch' is drawn with. The instanced vertex
+    // format draws the shared patch's list for the same level of detail and
+    // edge mask.
+
+    if (m_vertexFormat == VERTEX_FORMAT_INSTANCED)
+        return m_patchIndices[TerrainMesh::getLodRangeIndex(0, patch.lod, PATCH_LODS, patch.edgeMask)];
+
+    return m_lodIndices[patch.lodIndices];
 }
 
-void Terrain::update(const Vector3 &cameraPos)
+int Terrain::lodIndicesFor(const Patch &patch, int edgeMask) const
 {
-    terrainUpdate(cameraPos);
+    // Returns the index into m_lodIndices of the triangle list for 'patch' at
+    // its current level of detail. Bit 0 to 3 of 'edgeMask' are set when the
+    // neighbour above, to the right, below, and to the left of the patch is
+    // one level coarser.
+
+    int shape = ((patch.width < PATCH_SIZE) ? 1 : 0) | ((patch.height < PATCH_SIZE) ? 2 : 0);
+
+    return TerrainMesh::getLodRangeIndex(shape, patch.lod, PATCH_LODS, edgeMask);
+}
+
+void Terrain::selectPatchLods(const Vector3 &cameraPos)
+{
+    // Picks the coarsest level of detail for each patch whose error is small
+    // enough at the patch's distance from the camera. Neighbouring patches
+    // are then limited to differ by at most 1 level, which is what the
+    // triangle lists built by generateLodIndices() can stitch together.
+
+    float gridSpacing = static_cast<float>(m_heightMap.getGridSpacing());
+    int patchCount = static_cast<int>(m_patches.size());
+
+    for (int p = 0; p < patchCount; ++p)
+    {
+        Patch &patch = m_patches[p];
+        Vector3 closest;
+
+        closest.x = min(max(cameraPos.x, patch.x * gridSpacing), (patch.x + patch.width) * gridSpacing);
+        closest.y = min(max(cameraPos.y, patch.minY), patch.maxY);
+        closest.z = min(max(cameraPos.z, patch.z * gridSpacing), (patch.z + patch.height) * gridSpacing);
+
+        float allowedError = Vector3::distance(cameraPos, closest) * m_lodErrorPerDistance;
+
+        patch.lod = 0;
+
+        while (patch.lod + 1 < PATCH_LODS && patch.errors[patch.lod + 1] <= allowedError)
+            ++patch.lod;
+    }
+
+    for (bool changed = true; changed; )
+    {
+        changed = false;
+
+        for (int p = 0; p < patchCount; ++p)
+        {
+            int px = p % m_patchesPerSide;
+            int pz = p / m_patchesPerSide;
+            int finest = m_patches[p].lod;
+
+            if (px > 0)
+                finest = min(finest, m_patches[p - 1].lod);
+            if (px < m_patchesPerSide - 1)
+                finest = min(finest, m_patches[p + 1].lod);
+            if (pz > 0)
+                finest = min(finest, m_patches[p - m_patchesPerSide].lod);
+            if (pz < m_patchesPerSide - 1)
+                finest = min(finest, m_patches[p + m_patchesPerSide].lod);
+
+            if (m_patches[p].lod > finest + 1)
+            {
+                m_patches[p].lod = finest + 1;
+                changed = true;
+            }
+        }
+    }
+
+    for (int p = 0; p < patchCount; ++p)
+    {
+        Patch &patch = m_patches[p];
+        int px = p % m_patchesPerSide;
+        int pz = p / m_patchesPerSide;
+        int coarser = patch.lod + 1;
+        int edgeMask = 0;
+
+        if (pz > 0 && m_patches[p - m_patchesPerSide].lod == coarser)
+            edgeMask |= 1;
+        if (px < m_patchesPerSide - 1 && m_patches[p + 1].lod == coarser)
+            edgeMask |= 2;
+        if (pz < m_patchesPerSide - 1 && m_patches[p + m_patchesPerSide].lod == coarser)
+            edgeMask |= 4;
+        if (px > 0 && m_patches[p - 1].lod == coarser)
+            edgeMask |= 8;
+
+        patch.lodIndices = lodIndicesFor(patch, edgeMask);
+        patch.edgeMask = edgeMask;
+    }
 }
 
 bool Terrain::terrainCreate(int size, int gridSpacing, float scale)
 {
-    // Initialize the vertex buffer object.
+    // Create the vertex and index buffer objects. Their storage is allocated
+    // by allocateBuffers() and generateVertices(), since it depends on the
+    // vertex format.
 
     m_totalVertices = size * size;
     glGenBuffers(1, &m_vertexBuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * m_totalVertices,0, GL_DYNAMIC_DRAW);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glGenBuffers(1, &m_indexBuffer);
+    glGenBuffers(1, &m_lodIndexBuffer);
 
-    // Initialize the index buffer object.
+    // Split the grid into patches for geomipmapping. When the number of quads
+    // isn't a multiple of PATCH_SIZE the last row and column of patches are
+    // smaller.
 
-    m_totalIndices = (size - 1) * (size * 2 + 1);
-    glGenBuffers(1, &m_indexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
-    
-    int indexSize = use16BitIndices() ? sizeof(unsigned short) : sizeof(unsigned int);
+    m_patchesPerSide = (size - 1 + PATCH_SIZE - 1) / PATCH_SIZE;
+    m_patches.resize(m_patchesPerSide * m_patchesPerSide);
 
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexSize * m_totalIndices, 0, GL_STATIC_DRAW);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    for (int pz = 0; pz < m_patchesPerSide; ++pz)
+    {
+        for (int px = 0; px < m_patchesPerSide; ++px)
+        {
+            Patch &patch = m_patches[pz * m_patchesPerSide + px];
+
+            patch.x = px * PATCH_SIZE;
+            patch.z = pz * PATCH_SIZE;
+            patch.width = min(static_cast<int>(PATCH_SIZE), size - 1 - patch.x);
+            patch.height = min(static_cast<int>(PATCH_SIZE), size - 1 - patch.z);
+            patch.minY = patch.maxY = 0.0f;
+            std::fill(patch.errors, patch.errors + PATCH_LODS, 0.0f);
+            patch.lod = 0;
+            patch.lodIndices = lodIndicesFor(patch, 0);
+            patch.edgeMask = 0;
+            patch.visible = true;
+        }
+    }
 
-    return generateIndices();
+    if (!allocateBuffers())
+        return false;
+
+    createVertexArray();
+    countTriangles();
+    return true;
 }
 
 void Terrain::terrainDestroy()
 {
+    GLStateCache &stateCache = GLStateCache::instance();
+
+    if (m_vertexArray)
+    {
+        stateCache.deleteVertexArray(m_vertexArray);
+        m_vertexArray = 0;
+    }
+
     if (m_vertexBuffer)
     {
-        glDeleteBuffers(1, &m_vertexBuffer);
+        stateCache.deleteBuffer(m_vertexBuffer);
         m_vertexBuffer = 0;
         m_totalVertices = 0;
     }
 
     if (m_indexBuffer)
     {
-        glDeleteBuffers(1, &m_indexBuffer);
+        stateCache.deleteBuffer(m_indexBuffer);
         m_indexBuffer = 0;
         m_totalIndices = 0;
     }
-}
 
-void Terrain::terrainDraw()
-{
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
-
-    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
-    glTexCoordPointer(2, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(6 * sizeof(float)));
-
-    glEnableClientState(GL_NORMAL_ARRAY);
-    glNormalPointer(GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(3 * sizeof(float)));
+    if (m_lodIndexBuffer)
+    {
+        stateCache.deleteBuffer(m_lodIndexBuffer);
+        m_lodIndexBuffer = 0;
+        m_lodIndexCount = 0;
+    }
 
-    glEnableClientState(GL_VERTEX_ARRAY);
-    glVertexPointer(3, GL_FLOAT, sizeof(Vertex), BUFFER_OFFSET(0));
+    if (m_patchVertexBuffer)
+    {
+        stateCache.deleteBuffer(m_patchVertexBuffer);
+        m_patchVertexBuffer = 0;
+    }
 
-    if (use16BitIndices())
-        glDrawElements(GL_TRIANGLE_STRIP, m_totalIndices, GL_UNSIGNED_SHORT, BUFFER_OFFSET(0));
-    else
-        glDrawElements(GL_TRIANGLE_STRIP, m_totalIndices, GL_UNSIGNED_INT, BUFFER_OFFSET(0));
+    if (m_patchIndexBuffer)
+    {
+        stateCache.deleteBuffer(m_patchIndexBuffer);
+        m_patchIndexBuffer = 0;
+        m_patchIndexCount = 0;
+    }
 
-    glDisableClientState(GL_VERTEX_ARRAY);
-    glDisableClientState(GL_NORMAL_ARRAY);
-    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    if (m_heightTexture)
+    {
+        stateCache.deleteTexture(m_heightTexture);
+        m_heightTexture = 0;
+    }
 
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    m_instanceBuffer.destroy();
+    m_patches.clear();
+    m_lodIndices.clear();
+    m_patchIndices.clear();
+    m_patchInstances.clear();
+    m_dirtyRect.x0 = m_dirtyRect.z0 = m_dirtyRect.x1 = m_dirtyRect.z1 = 0;
+    m_patchesPerSide = 0;
+    m_triangleCount = 0;
+    m_visiblePatchCount = 0;
+    m_culledPatchCount = 0;
 }
 
-void Terrain::terrainUpdate(const Vector3 &cameraPos)
+void Terrain::terrainDraw()
 {
+    // With a vertex array object the vertex layout was recorded once by
+    // createVertexArray(), and patches are drawn with a base vertex so the
+    // vertex array pointers never move. Otherwise the vertex arrays are
+    // enabled for the draw, pointed at each patch in turn, and disabled
+    // again so they don't affect anything else drawn with vertex arrays.
 
-}
+    GLStateCache &stateCache = GLStateCache::instance();
 
-bool Terrain::generateIndices()
-{
-    void *pBuffer = 0;
-    int size = m_heightMap.getSize();
+    m_drawCallCount = 0;
 
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
-    
-    if (!(pBuffer = glMapBuffer(GL_ELEMENT_ARRAY_BUFFER, GL_WRITE_ONLY)))
+    if (m_vertexFormat == VERTEX_FORMAT_INSTANCED)
     {
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        return false;
+        drawInstancedPatches();
+        return;
     }
 
-    if (use16BitIndices())
+    if (m_vertexArray)
+    {
+        stateCache.bindVertexArray(m_vertexArray);
+
+        if (m_vertexFormat == VERTEX_FORMAT_COMPACT)
+            glVertexAttrib2f(COMPACT_ORIGIN_ATTRIB, 0.0f, 0.0f);
+    }
+    else
     {
-        unsigned short *pIndex = static_cast<unsigned short *>(pBuffer);
+        stateCache.bindVertexArray(0);
+        stateCache.bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+        enableVertexArrays();
+    }
+
+    if (m_geomipmapping || m_frustumCulling)
+    {
+        // Each patch's indices are relative to its top left vertex.
+
+        GLenum indexType = use16BitLodIndices() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        size_t indexSize = use16BitLodIndices() ? sizeof(unsigned short) : sizeof(unsigned int);
+        int size = m_heightMap.getSize();
+
+        stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_lodIndexBuffer);
 
-        for (int z = 0; z < size - 1; ++z)
+        for (size_t i = 0; i < m_patches.size(); ++i)
         {
-            if (z % 2 == 0)
+            const Patch &patch = m_patches[i];
+            const LodIndices &lodIndices = m_lodIndices[patch.lodIndices];
+
+            if (!patch.visible)
+                continue;
+
+            if (m_vertexArray)
             {
-                for (int x = 0; x < size; ++x)
-                {
-                    *pIndex++ = static_cast<unsigned short>(x + z * size);
-                    *pIndex++ = static_cast<unsigned short>(x + (z + 1) * size);
-                }
-
-                // Add degenerate triangles to stitch strips together.
-                *pIndex++ = static_cast<unsigned short>((size - 1) + (z + 1) * size);
+                glDrawElementsBaseVertex(GL_TRIANGLES, lodIndices.count, indexType,
+                    BUFFER_OFFSET(lodIndices.first * indexSize), patch.z * size + patch.x);
             }
             else
             {
-                for (int x = size - 1; x >= 0; --x)
-                {
-                    *pIndex++ = static_cast<unsigned short>(x + z * size);
-                    *pIndex++ = static_cast<unsigned short>(x + (z + 1) * size);
-                }
-
-                // Add degenerate triangles to stitch strips together.
-                *pIndex++ = static_cast<unsigned short>((z + 1) * size);
+                bindVertexArrays(patch.x, patch.z);
+                glDrawElements(GL_TRIANGLES, lodIndices.count, indexType, BUFFER_OFFSET(lodIndices.first * indexSize));
             }
+
+            ++m_drawCallCount;
         }
     }
     else
     {
-        unsigned int *pIndex = static_cast<unsigned int *>(pBuffer);
+        GLenum mode = (m_indexOrder == INDEX_ORDER_BLOCK_LIST) ? GL_TRIANGLES : GL_TRIANGLE_STRIP;
+        GLenum indexType = use16BitIndices() ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+        bool primitiveRestart = (m_indexOrder == INDEX_ORDER_BLOCK_STRIPS);
 
-        for (int z = 0; z < size - 1; ++z)
+        stateCache.bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+
+        if (!m_vertexArray)
+            bindVertexArrays(0, 0);
+
+        if (primitiveRestart)
         {
-            if (z % 2 == 0)
-            {
-                for (int x = 0; x < size; ++x)
-                {
-                    *pIndex++ = x + z * size;
-                    *pIndex++ = x + (z + 1) * size;
-                }
-
-                // Add degenerate triangles to stitch strips together.
-                *pIndex++ = (size - 1) + (z + 1) * size;
-            }
-            else
-            {
-                for (int x = size - 1; x >= 0; --x)
-                {
-                    *pIndex++ = x + z * size;
-                    *pIndex++ = x + (z + 1) * size;
-                }
-
-                // Add degenerate triangles to stitch strips together.
-                *pIndex++ = (z + 1) * size;
-            }
+            glEnable(GL_PRIMITIVE_RESTART);
+            glPrimitiveRestartIndex(use16BitIndices() ? 0xFFFF : 0xFFFFFFFF);
         }
-    }   
 
-    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-    return true;
+        glDrawElements(mode, m_totalIndices, indexType, BUFFER_OFFSET(0));
+        ++m_drawCallCount;
+
+        if (primitiveRestart)
+            glDisable(GL_PRIMITIVE_RESTART);
+    }
+
+    if (!m_vertexArray)
+        disableVertexArrays();
 }
 
-bool Terrain::generateVertices()
+void Terrain::terrainUpdate(const Vector3 &cameraPos, const Frustum &frustum)
+{
+    if (m_geomipmapping)
+        selectPatchLods(cameraPos);
+
+    if (m_frustumCulling)
+        cullPatches(frustum);
+
+    countTriangles();
+}
+
+void Terrain::updateDirtyRect()
 {
-    Vertex *pVertices = 0;
-    Vertex *pVertex = 0;
-    int currVertex = 0;
+    PROFILE_ZONE("Terrain::updateDirtyRect");
+
+    // Uploads the vertices of the texels edited since the last update. Each
+    // vertex's normal depends on its neighbours' heights, so the vertices in
+    // a one texel border around the edited texels are rebuilt as well. Only
+    // the columns of the rectangle are uploaded from each of its rows,
+    // unless it spans whole rows, which are contiguous in the vertex buffer.
+    // The instanced vertex format only uploads the edited heights, since its
+    // vertex shader computes the normals.
+
+    HeightMap::Rect rect = m_dirtyRect;
     int size = m_heightMap.getSize();
-    int gridSpacing = m_heightMap.getGridSpacing();
-    float heightScale = m_heightMap.getHeightScale();
-    Vector3 normal;
 
-    glBindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
-    pVertices = static_cast<Vertex *>(glMapBuffer(GL_ARRAY_BUFFER, GL_WRITE_ONLY));
+    if (rect.isEmpty() || !m_vertexBuffer)
+        return;
 
-    if (!pVertices)
+    m_dirtyRect.x0 = m_dirtyRect.z0 = m_dirtyRect.x1 = m_dirtyRect.z1 = 0;
+
+    if (m_vertexFormat == VERTEX_FORMAT_INSTANCED)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        return false;
+        uploadHeightTexture(rect);
+        return;
     }
 
-    for (int z = 0; z < size; ++z)
+    rect.x0 = max(rect.x0 - 1, 0);
+    rect.z0 = max(rect.z0 - 1, 0);
+    rect.x1 = min(rect.x1 + 1, size);
+    rect.z1 = min(rect.z1 + 1, size);
+
+    int width = rect.x1 - rect.x0;
+    size_t vertexSize = getVertexSize();
+    size_t rowBytes = width * vertexSize;
+    std::vector<unsigned char> vertices(rowBytes * (rect.z1 - rect.z0));
+
+    if (m_vertexFormat == VERTEX_FORMAT_COMPACT)
+        TerrainMesh::buildCompactVertices(m_heightMap, rect, COMPACT_HEIGHT_RANGE, reinterpret_cast<CompactVertex *>(&vertices[0]));
+    else
+        TerrainMesh::buildVertices(m_heightMap, rect, reinterpret_cast<Vertex *>(&vertices[0]));
+
+    GLStateCache::instance().bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+
+    if (width == size)
     {
-        for (int x = 0; x < size; ++x)
-        {
-            currVertex = z * size + x;
-            pVertex = &pVertices[currVertex];
-
-            pVertex->x = static_cast<float>(x * gridSpacing);
-            pVertex->y = m_heightMap.heightAtPixel(x, z) * heightScale;
-            pVertex->z = static_cast<float>(z * gridSpacing);
-
-            m_heightMap.normalAtPixel(x, z, normal);
-            pVertex->nx = normal.x;
-            pVertex->ny = normal.y;
-            pVertex->nz = normal.z;
-            
-            pVertex->s = static_cast<float>(x) / static_cast<float>(size);
-            pVertex->t = static_cast<float>(z) / static_cast<float>(size);
-        }
+        StreamBuffer::bufferSubData(GL_ARRAY_BUFFER, rect.z0 * rowBytes, vertices.size(), &vertices[0]);
+        return;
+    }
+
+    for (int z = rect.z0; z < rect.z1; ++z)
+    {
+        StreamBuffer::bufferSubData(GL_ARRAY_BUFFER, (z * size + rect.x0) * vertexSize, rowBytes,
+            &vertices[(z - rect.z0) * rowBytes]);
     }
+}
+
+bool Terrain::uploadHeightTexture(const HeightMap::Rect &rect)
+{
+    // Copies the texels in 'rect' of the height map into the height texture
+    // of the instanced vertex format. The vertex shader scales the heights,
+    // and derives the normals from the neighbouring texels.
+
+    int size = m_heightMap.getSize();
+
+    if (rect.isEmpty())
+        return true;
+
+    GLStateCache::instance().bindTexture(HEIGHT_MAP_TEXTURE_UNIT, m_heightTexture);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, size);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x0, rect.z0, rect.x1 - rect.x0, rect.z1 - rect.z0, GL_RED, GL_FLOAT,
+        m_heightMap.getHeights() + rect.z0 * size + rect.x0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    return true;
+}
+
+bool Terrain::generateIndices()
+{
+    PROFILE_ZONE("Terrain::generateIndices");
+
+    // Builds the full grid indices in the current index order.
+
+    void *pBuffer = 0;
+    int size = m_heightMap.getSize();
+    int indexSize = use16BitIndices() ? sizeof(unsigned short) : sizeof(unsigned int);
+    int blockWidth = TerrainMesh::getCacheBlockWidth(VERTEX_CACHE_SIZE);
+
+    switch (m_indexOrder)
+    {
+    case INDEX_ORDER_BLOCK_LIST:
+        m_totalIndices = TerrainMesh::getBlockListIndexCount(size, blockWidth);
+        break;
+
+    case INDEX_ORDER_BLOCK_STRIPS:
+        m_totalIndices = TerrainMesh::getBlockStripIndexCount(size, blockWidth);
+        break;
+
+    default:
+        m_totalIndices = TerrainMesh::getStripIndexCount(size);
+        break;
+    }
+
+    GLStateCache::instance().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_indexBuffer);
+    pBuffer = StreamBuffer::mapForOverwrite(GL_ELEMENT_ARRAY_BUFFER, indexSize * m_totalIndices, GL_STATIC_DRAW);
+
+    if (!pBuffer)
+        return false;
+
+    if (use16BitIndices())
+        BuildIndices(m_indexOrder, size, blockWidth, static_cast<unsigned short *>(pBuffer));
+    else
+        BuildIndices(m_indexOrder, size, blockWidth, static_cast<unsigned int *>(pBuffer));
+
+    glUnmapBuffer(GL_ELEMENT_ARRAY_BUFFER);
+    return true;
+}
+
+bool Terrain::generateVertices()
+{
+    PROFILE_ZONE("Terrain::generateVertices");
+
+    // The whole vertex buffer is rewritten, so its old storage is orphaned
+    // rather than waiting for the frames still drawing from it. The
+    // instanced vertex format has no vertex buffer of its own, only the
+    // height texture.
+
+    void *pVertices = 0;
+    HeightMap::Rect rect = {0, 0, m_heightMap.getSize(), m_heightMap.getSize()};
+
+    // Any edits are included in the new vertices.
+    m_dirtyRect.x0 = m_dirtyRect.z0 = m_dirtyRect.x1 = m_dirtyRect.z1 = 0;
+
+    if (m_vertexFormat == VERTEX_FORMAT_INSTANCED)
+        return uploadHeightTexture(rect);
+
+    GLStateCache::instance().bindBuffer(GL_ARRAY_BUFFER, m_vertexBuffer);
+    pVertices = StreamBuffer::mapForOverwrite(GL_ARRAY_BUFFER, getVertexSize() * m_totalVertices, GL_DYNAMIC_DRAW);
+
+    if (!pVertices)
+        return false;
+
+    if (m_vertexFormat == VERTEX_FORMAT_COMPACT)
+        TerrainMesh::buildCompactVertices(m_heightMap, COMPACT_HEIGHT_RANGE, static_cast<CompactVertex *>(pVertices));
+    else
+        TerrainMesh::buildVertices(m_heightMap, static_cast<Vertex *>(pVertices));
 
     glUnmapBuffer(GL_ARRAY_BUFFER);
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
     return true;
-}
\ No newline at end of file
+}
@@ -4,63 +4,124 @@
 #define TERRAIN_H
 
 #include <vector>
-#include "bitmap.h"
+#include "height_map.h"
 #include "mathlib.h"
+#include "stream_buffer.h"
+#include "terrain_mesh.h"
 
-class HeightMap
+class Terrain
 {
 public:
-    HeightMap();
-    ~HeightMap();
-
-    float getHeightScale() const
-    { return m_heightScale; }
-
-    int getSize() const
-    { return m_size; }
-
-    int getGridSpacing() const
-    { return m_gridSpacing; }
-
-    const float *getHeights() const
-    { return &m_heights[0]; }
-
-    bool create(int size, int gridSpacing, float scale);
-    void destroy();
-
-    void generateDiamondSquareFractal(float roughness);
+    // VERTEX_FORMAT_FLOAT stores the position, normal and texture coordinates
+    // of each vertex as floats (32 bytes per vertex). VERTEX_FORMAT_COMPACT
+    // only stores a 16-bit height and an octahedral encoded normal (4 bytes
+    // per vertex). The vertex shader rebuilds the grid position and texture
+    // coordinates from gl_VertexID, which requires GL_EXT_gpu_shader4.
+    //
+    // VERTEX_FORMAT_INSTANCED has no terrain sized vertex or index buffers.
+    // Every patch is an instance of one shared patch grid and its 16-bit
+    // triangle lists, and the vertex shader reads the heights from a float
+    // texture (4 bytes per height map texel). The visible patches are drawn
+    // with one instanced draw call per level of detail and edge mask in use.
+    // This requires instanced arrays, vertex array objects, and
+    // GL_EXT_gpu_shader4 for texelFetch2D().
+    enum VertexFormat
+    {
+        VERTEX_FORMAT_FLOAT,
+        VERTEX_FORMAT_COMPACT,
+        VERTEX_FORMAT_INSTANCED
+    };
 
-    float heightAt(float x, float z) const;
+    // The order of the indices used to draw the whole grid when neither
+    // geomipmapping nor frustum culling is enabled. INDEX_ORDER_STRIP is the
+    // single serpentine strip. The block orders walk the grid in column
+    // blocks sized for a post-transform vertex cache of VERTEX_CACHE_SIZE
+    // vertices, so almost every vertex is only transformed once (see
+    // TerrainMesh). INDEX_ORDER_BLOCK_STRIPS requires primitive restart.
+    enum IndexOrder
+    {
+        INDEX_ORDER_STRIP,
+        INDEX_ORDER_BLOCK_LIST,
+        INDEX_ORDER_BLOCK_STRIPS
+    };
 
-    float heightAtPixel(int x, int z) const
-    { return m_heights[z * m_size + x]; };
+    // Smallest post-transform vertex cache of the GPUs the block orders are
+    // tuned for.
+    enum { VERTEX_CACHE_SIZE = 16 };
+
+    // Generic vertex attribute indices used by VERTEX_FORMAT_COMPACT. Bind
+    // the shader's 'compactHeight' and 'compactNormal' attributes to these
+    // before linking it. The height uses attribute 0 because legacy OpenGL
+    // only draws anything when either attribute 0 or the vertex array is
+    // enabled.
+    //
+    // 'compactOrigin' is the grid position of the first vertex of the
+    // vertex range being drawn. It's set as a constant attribute for each
+    // draw call. It's 0 when patches are drawn with a base vertex, since
+    // gl_VertexID then already includes the base vertex.
+    enum
+    {
+        COMPACT_HEIGHT_ATTRIB = 0,
+        COMPACT_NORMAL_ATTRIB = 1,
+        COMPACT_ORIGIN_ATTRIB = 2
+    };
 
-    void normalAt(float x, float z, Vector3 &n) const;
-    void normalAtPixel(int x, int z, Vector3 &n) const;
+    // Generic vertex attribute indices used by VERTEX_FORMAT_INSTANCED. Bind
+    // the shader's 'patchVertex' and 'patchOrigin' attributes to these
+    // before linking it. 'patchVertex' is the grid position of the vertex
+    // within the patch, and 'patchOrigin' is the grid position of the
+    // patch's top left vertex, which advances once per instance. The height
+    // texture is bound to texture unit HEIGHT_MAP_TEXTURE_UNIT.
+    enum
+    {
+        PATCH_VERTEX_ATTRIB = 0,
+        PATCH_ORIGIN_ATTRIB = 1,
+        HEIGHT_MAP_TEXTURE_UNIT = 4
+    };
 
-private:
-    void blur(float amount);
-    unsigned int heightIndexAt(int x, int z) const;
-    void smooth();
-
-    int m_size;
-    int m_gridSpacing;
-    float m_heightScale;
-    std::vector<float> m_heights;
-};
+    // Geomipmapping splits the terrain into patches of PATCH_SIZE x
+    // PATCH_SIZE quads. Each patch is drawn at one of PATCH_LODS levels of
+    // detail. Level i only uses every 2^i-th vertex.
+    enum
+    {
+        PATCH_SIZE = 32,
+        PATCH_LODS = 6
+    };
 
+    // Largest height map value VERTEX_FORMAT_COMPACT can store. The height
+    // map generators produce heights in the range [0,255].
+    static const float COMPACT_HEIGHT_RANGE;
 
-class Terrain
-{
-public:
     Terrain();
     virtual ~Terrain();
 
+    void applyBrush(HeightMap::BrushMode mode, float x, float z, float radius, float strength);
+
     bool create(int size, int gridSpacing, float scale);
     void destroy();
     void draw();
+    void enableFrustumCulling(bool enable);
+    void enableGeomipmapping(bool enable);
+    bool erode(int thermalIterations, float talus, const HeightMap::HydraulicErosionParameters &params);
     bool generateUsingDiamondSquareFractal(float roughness);
-    void update(const Vector3 &cameraPos);
+    bool generateUsingNoise(const HeightMap::NoiseParameters &params);
+    bool loadHeightMap(const char *pszFilename);
+    bool setIndexOrder(IndexOrder indexOrder);
+    void setLodParameters(float maxPixelError, float viewportWidth, float fovxDegrees);
+    bool setVertexFormat(VertexFormat vertexFormat);
+    void update(const Vector3 &cameraPos, const Frustum &frustum);
+
+    bool frustumCullingIsEnabled() const
+    { return m_frustumCulling; }
+
+    bool geomipmappingIsEnabled() const
+    { return m_geomipmapping; }
+
+    int getCulledPatchCount() const
+    { return m_culledPatchCount; }
+
+    int getDrawCallCount() const
+    { return m_drawCallCount; }
 
     const HeightMap &getHeightMap() const
     { return m_heightMap; }
@@ -68,30 +129,111 @@ public:
     HeightMap &getHeightMap()
     { return m_heightMap; }
 
+    float getCompactHeightScale() const
+    { return m_heightMap.getHeightScale() * COMPACT_HEIGHT_RANGE; }
+
+    size_t getIndexBufferSize() const;
+
+    IndexOrder getIndexOrder() const
+    { return m_indexOrder; }
+
+    size_t getVertexBufferSize() const;
+
+    VertexFormat getVertexFormat() const
+    { return m_vertexFormat; }
+
+    int getTriangleCount() const
+    { return m_triangleCount; }
+
+    int getVertexSize() const;
+
+    int getVisiblePatchCount() const
+    { return m_visiblePatchCount; }
+
 protected:
     virtual bool terrainCreate(int size, int gridSpacing, float scale);
     virtual void terrainDestroy();
     virtual void terrainDraw();
-    virtual void terrainUpdate(const Vector3 &cameraPos);
+    virtual void terrainUpdate(const Vector3 &cameraPos, const Frustum &frustum);
 
 private:
-    struct Vertex
+    typedef TerrainMesh::Vertex Vertex;
+    typedef TerrainMesh::CompactVertex CompactVertex;
+    typedef TerrainMesh::LodRange LodIndices;
+
+    // A grid position. Used for the vertices of the shared patch grid and
+    // for the per instance patch origins of VERTEX_FORMAT_INSTANCED.
+    struct PatchPosition
     {
-        float x, y, z;
-        float nx, ny, nz;
-        float s, t;
+        unsigned short x, z;
     };
 
+    struct Patch
+    {
+        int x, z;                   // grid position of the top left vertex
+        int width, height;          // size in quads (at most PATCH_SIZE)
+        float minY, maxY;
+        float errors[PATCH_LODS];   // world space error of each LOD
+        int lod;
+        int lodIndices;             // index into m_lodIndices
+        int edgeMask;               // edges next to a coarser neighbour
+        bool visible;
+    };
+
+    bool allocateBuffers();
+    void bindVertexArrays(int x, int z);
+    void computePatchErrors();
+    void computePatchErrors(const HeightMap::Rect &rect);
+    void countTriangles();
+    bool createPatchBuffers();
+    void createVertexArray();
+    void cullPatches(const Frustum &frustum);
+    void disableVertexArrays();
+    void drawInstancedPatches();
+    void enableVertexArrays();
+    bool generateLodIndices();
     bool generateIndices();
     bool generateVertices();
+    const LodIndices &getPatchIndices(const Patch &patch) const;
+    int lodIndicesFor(const Patch &patch, int edgeMask) const;
+    void selectPatchLods(const Vector3 &cameraPos);
+    void updateDirtyRect();
+    bool uploadHeightTexture(const HeightMap::Rect &rect);
     
+    // The largest 16-bit index is the primitive restart index.
     bool use16BitIndices() const
-    { return m_totalVertices <= 65536; }
+    { return m_totalVertices <= ((m_indexOrder == INDEX_ORDER_BLOCK_STRIPS) ? 65535 : 65536); }
+
+    bool use16BitLodIndices() const
+    { return PATCH_SIZE * m_heightMap.getSize() + PATCH_SIZE < 65536; }
 
+    unsigned int m_vertexArray;
     unsigned int m_vertexBuffer;
     unsigned int m_indexBuffer;
     int m_totalVertices;
     int m_totalIndices;
+    unsigned int m_lodIndexBuffer;
+    int m_lodIndexCount;
+    unsigned int m_patchVertexBuffer;
+    unsigned int m_patchIndexBuffer;
+    int m_patchIndexCount;
+    unsigned int m_heightTexture;
+    StreamBuffer m_instanceBuffer;      // patch origins, rewritten each draw
+    int m_patchesPerSide;
+    int m_triangleCount;
+    int m_visiblePatchCount;
+    int m_culledPatchCount;
+    int m_drawCallCount;
+    float m_lodErrorPerDistance;
+    bool m_geomipmapping;
+    bool m_frustumCulling;
+    VertexFormat m_vertexFormat;
+    IndexOrder m_indexOrder;
+    std::vector<Patch> m_patches;
+    std::vector<LodIndices> m_lodIndices;
+    std::vector<LodIndices> m_patchIndices;         // shared patch, shape 0 only
+    std::vector<PatchPosition> m_patchInstances;    // sorted by index range
+    HeightMap::Rect m_dirtyRect;        // edited texels not yet uploaded
     HeightMap m_heightMap;
 };
 
@@ -0,0 +1,591 @@
+
+
+#include <algorithm>
+#include <cmath>
+#include "height_map.h"
+#include "terrain_mesh.h"
+
+namespace
+{
+    signed char QuantizeSnorm8(float f)
+    {
+        // Maps 'f' in range [-1,1] to a signed byte in range [-127,127].
+        return static_cast<signed char>(static_cast<int>(f * 127.0f + ((f < 0.0f) ? -0.5f : 0.5f)));
+    }
+
+    void EncodeOctahedral(float x, float y, float z, signed char encoded[2])
+    {
+        // Encodes the unit vector (x, y, z) as 2 signed bytes by projecting it
+        // onto the octahedron |x| + |y| + |z| = 1 and unfolding the octahedron
+        // onto the xz plane. The lower half (y < 0) is folded over the
+        // diagonals. See "A Survey of Efficient Representations for Independent
+        // Unit Vectors" (Cigolle et al., JCGT 2014). The vertex shader in
+        // terrain.glsl does the inverse.
+
+        float invL1Norm = 1.0f / (fabsf(x) + fabsf(y) + fabsf(z));
+        float u = x * invL1Norm;
+        float v = z * invL1Norm;
+
+        if (y < 0.0f)
+        {
+            float foldedU = (1.0f - fabsf(v)) * ((u >= 0.0f) ? 1.0f : -1.0f);
+            float foldedV = (1.0f - fabsf(u)) * ((v >= 0.0f) ? 1.0f : -1.0f);
+
+            u = foldedU;
+            v = foldedV;
+        }
+
+        encoded[0] = QuantizeSnorm8(u);
+        encoded[1] = QuantizeSnorm8(v);
+    }
+
+    void Lattice(int step, int extent, std::vector<int> &positions)
+    {
+        // Returns the positions 0, step, 2 * step, ... that are less than
+        // 'extent', followed by 'extent'. Patches that are smaller than the
+        // patch size end with a shorter cell this way.
+
+        positions.clear();
+
+        for (int p = 0; p < extent; p += step)
+            positions.push_back(p);
+
+        positions.push_back(extent);
+    }
+
+    class PatchTriangulator
+    {
+    public:
+        // Builds the triangle list of a terrain patch at a given level of
+        // detail. The indices are relative to the patch's top left vertex in
+        // a grid that is 'gridSize' vertices wide.
+
+        PatchTriangulator(int gridSize, std::vector<unsigned int> &indices)
+            : m_gridSize(gridSize), m_pIndices(&indices)
+        {
+        }
+
+        void triangulate(int width, int height, int step, int edgeMask);
+
+    private:
+        struct Point
+        {
+            int x, z;
+        };
+
+        void addTriangle(const Point &a, const Point &b, const Point &c);
+        void makeLine(const std::vector<int> &positions, int fixed, bool alongX, std::vector<Point> &line) const;
+        void zip(const std::vector<Point> &outer, const std::vector<Point> &inner, bool alongX);
+
+        int m_gridSize;
+        std::vector<unsigned int> *m_pIndices;
+    };
+
+    void PatchTriangulator::triangulate(int width, int height, int step, int edgeMask)
+    {
+        // The interior cells of the patch are split into 2 triangles each. The
+        // outer ring of cells is built separately for each side by zipping the
+        // vertices of the patch edge to the vertices of the first interior row
+        // or column. An edge that borders a coarser patch (see
+        // Terrain::lodIndicesFor()) only uses every other vertex, which matches
+        // the coarser patch's edge and closes the crack between them.
+
+        std::vector<int> xs, zs, edges[4];
+
+        Lattice(step, width, xs);
+        Lattice(step, height, zs);
+        Lattice((edgeMask & 1) ? step * 2 : step, width, edges[0]);
+        Lattice((edgeMask & 2) ? step * 2 : step, height, edges[1]);
+        Lattice((edgeMask & 4) ? step * 2 : step, width, edges[2]);
+        Lattice((edgeMask & 8) ? step * 2 : step, height, edges[3]);
+
+        std::vector<Point> top, right, bottom, left;
+
+        makeLine(edges[0], 0, true, top);
+        makeLine(edges[1], width, false, right);
+        makeLine(edges[2], height, true, bottom);
+        makeLine(edges[3], 0, false, left);
+
+        int cellsX = static_cast<int>(xs.size()) - 1;
+        int cellsZ = static_cast<int>(zs.size()) - 1;
+
+        // A single row or column of cells has no interior.
+
+        if (cellsX == 1)
+        {
+            zip(left, right, false);
+            return;
+        }
+
+        if (cellsZ == 1)
+        {
+            zip(top, bottom, true);
+            return;
+        }
+
+        for (int j = 1; j < cellsZ - 1; ++j)
+        {
+            for (int i = 1; i < cellsX - 1; ++i)
+            {
+                Point p00 = {xs[i], zs[j]};
+                Point p10 = {xs[i + 1], zs[j]};
+                Point p01 = {xs[i], zs[j + 1]};
+                Point p11 = {xs[i + 1], zs[j + 1]};
+
+                addTriangle(p00, p01, p10);
+                addTriangle(p10, p01, p11);
+            }
+        }
+
+        std::vector<int> innerXs(xs.begin() + 1, xs.end() - 1);
+        std::vector<int> innerZs(zs.begin() + 1, zs.end() - 1);
+        std::vector<Point> inner;
+
+        makeLine(innerXs, zs[1], true, inner);
+        zip(top, inner, true);
+
+        makeLine(innerZs, xs[cellsX - 1], false, inner);
+        zip(right, inner, false);
+
+        makeLine(innerXs, zs[cellsZ - 1], true, inner);
+        zip(bottom, inner, true);
+
+        makeLine(innerZs, xs[1], false, inner);
+        zip(left, inner, false);
+    }
+
+    void PatchTriangulator::addTriangle(const Point &a, const Point &b, const Point &c)
+    {
+        // Adds the triangle with the same winding as the terrain's full grid
+        // triangle strips. Triangles without any area are dropped.
+
+        int cross = (b.x - a.x) * (c.z - a.z) - (b.z - a.z) * (c.x - a.x);
+
+        if (cross == 0)
+            return;
+
+        const Point &second = (cross < 0) ? b : c;
+        const Point &third = (cross < 0) ? c : b;
+
+        m_pIndices->push_back(a.z * m_gridSize + a.x);
+        m_pIndices->push_back(second.z * m_gridSize + second.x);
+        m_pIndices->push_back(third.z * m_gridSize + third.x);
+    }
+
+    void PatchTriangulator::makeLine(const std::vector<int> &positions, int fixed, bool alongX, std::vector<Point> &line) const
+    {
+        line.resize(positions.size());
+
+        for (size_t i = 0; i < positions.size(); ++i)
+        {
+            line[i].x = alongX ? positions[i] : fixed;
+            line[i].z = alongX ? fixed : positions[i];
+        }
+    }
+
+    void PatchTriangulator::zip(const std::vector<Point> &outer, const std::vector<Point> &inner, bool alongX)
+    {
+        // Triangulates the strip between 2 parallel lines of vertices by
+        // always advancing along the line whose next vertex comes first.
+
+        size_t i = 0;
+        size_t j = 0;
+
+        while (i + 1 < outer.size() || j + 1 < inner.size())
+        {
+            bool advanceOuter = (j + 1 == inner.size());
+
+            if (!advanceOuter && i + 1 < outer.size())
+            {
+                int nextOuter = alongX ? outer[i + 1].x : outer[i + 1].z;
+                int nextInner = alongX ? inner[j + 1].x : inner[j + 1].z;
+
+                advanceOuter = (nextOuter <= nextInner);
+            }
+
+            if (advanceOuter)
+            {
+                addTriangle(outer[i], outer[i + 1], inner[j]);
+                ++i;
+            }
+            else
+            {
+                addTriangle(outer[i], inner[j + 1], inner[j]);
+                ++j;
+            }
+        }
+    }
+
+    template <typename Index>
+    void BuildBlockListIndices(int size, int blockWidth, Index *pIndex)
+    {
+        // Column blocks of 'blockWidth' quads are drawn one after the other.
+        // Each block is drawn row by row, and each row from left to right,
+        // with the same 2 triangles per quad as the geomipmapping patches.
+        //
+        // A row only loads its bottom vertices into the vertex cache, its top
+        // vertices were loaded by the row above. The first row of a block
+        // would load both, which evicts the first vertices of its bottom row
+        // from a FIFO cache before the next row uses them, and every row
+        // after it would do the same. So each block starts with triangles
+        // along its top edge that have no area, but load its top vertices.
+
+        for (int x0 = 0; x0 < size - 1; x0 += blockWidth)
+        {
+            int x1 = std::min(x0 + blockWidth, size - 1);
+
+            for (int x = x0; x <= x1; x += 3)
+            {
+                *pIndex++ = static_cast<Index>(x);
+                *pIndex++ = static_cast<Index>(std::min(x + 1, x1));
+                *pIndex++ = static_cast<Index>(std::min(x + 2, x1));
+            }
+
+            for (int z = 0; z < size - 1; ++z)
+            {
+                for (int x = x0; x < x1; ++x)
+                {
+                    Index i00 = static_cast<Index>(x + z * size);
+                    Index i10 = static_cast<Index>(x + 1 + z * size);
+                    Index i01 = static_cast<Index>(x + (z + 1) * size);
+                    Index i11 = static_cast<Index>(x + 1 + (z + 1) * size);
+
+                    *pIndex++ = i00;
+                    *pIndex++ = i01;
+                    *pIndex++ = i10;
+                    *pIndex++ = i10;
+                    *pIndex++ = i01;
+                    *pIndex++ = i11;
+                }
+            }
+        }
+    }
+
+    template <typename Index>
+    void BuildBlockStripIndices(int size, int blockWidth, Index *pIndex)
+    {
+        // The same order as BuildBlockListIndices(), but each row of a block
+        // is a separate strip, ended by the restart index. The top vertices
+        // of a block are loaded by a strip along its top edge, whose
+        // triangles have no area.
+
+        const Index restartIndex = static_cast<Index>(~0u);
+
+        for (int x0 = 0; x0 < size - 1; x0 += blockWidth)
+        {
+            int x1 = std::min(x0 + blockWidth, size - 1);
+
+            for (int x = x0; x <= x1; ++x)
+                *pIndex++ = static_cast<Index>(x);
+
+            *pIndex++ = restartIndex;
+
+            for (int z = 0; z < size - 1; ++z)
+            {
+                for (int x = x0; x <= x1; ++x)
+                {
+                    *pIndex++ = static_cast<Index>(x + z * size);
+                    *pIndex++ = static_cast<Index>(x + (z + 1) * size);
+                }
+
+                *pIndex++ = restartIndex;
+            }
+        }
+    }
+
+    template <typename Index>
+    void BuildStripIndices(int size, Index *pIndex)
+    {
+        // Rows of quads are drawn as strips that alternate direction, and
+        // are stitched together with degenerate triangles.
+
+        for (int z = 0; z < size - 1; ++z)
+        {
+            if (z % 2 == 0)
+            {
+                for (int x = 0; x < size; ++x)
+                {
+                    *pIndex++ = static_cast<Index>(x + z * size);
+                    *pIndex++ = static_cast<Index>(x + (z + 1) * size);
+                }
+
+                *pIndex++ = static_cast<Index>((size - 1) + (z + 1) * size);
+            }
+            else
+            {
+                for (int x = size - 1; x >= 0; --x)
+                {
+                    *pIndex++ = static_cast<Index>(x + z * size);
+                    *pIndex++ = static_cast<Index>(x + (z + 1) * size);
+                }
+
+                *pIndex++ = static_cast<Index>((z + 1) * size);
+            }
+        }
+    }
+}
+
+void TerrainMesh::buildBlockListIndices(int size, int blockWidth, unsigned short *pIndices)
+{
+    // Fills getBlockListIndexCount(size, blockWidth) indices.
+    BuildBlockListIndices(size, blockWidth, pIndices);
+}
+
+void TerrainMesh::buildBlockListIndices(int size, int blockWidth, unsigned int *pIndices)
+{
+    // Fills getBlockListIndexCount(size, blockWidth) indices.
+    BuildBlockListIndices(size, blockWidth, pIndices);
+}
+
+void TerrainMesh::buildBlockStripIndices(int size, int blockWidth, unsigned short *pIndices)
+{
+    // Fills getBlockStripIndexCount(size, blockWidth) indices. The restart
+    // index is 0xFFFF, so 'size' * 'size' must be less than 65536.
+    BuildBlockStripIndices(size, blockWidth, pIndices);
+}
+
+void TerrainMesh::buildBlockStripIndices(int size, int blockWidth, unsigned int *pIndices)
+{
+    // Fills getBlockStripIndexCount(size, blockWidth) indices. The restart
+    // index is 0xFFFFFFFF.
+    BuildBlockStripIndices(size, blockWidth, pIndices);
+}
+
+void TerrainMesh::buildCompactVertices(const HeightMap &heightMap, float heightRange, CompactVertex *pVertices)
+{
+    HeightMap::Rect rect = {0, 0, heightMap.getSize(), heightMap.getSize()};
+
+    buildCompactVertices(heightMap, rect, heightRange, pVertices);
+}
+
+void TerrainMesh::buildCompactVertices(const HeightMap &heightMap, const HeightMap::Rect &rect, float heightRange, CompactVertex *pVertices)
+{
+    // Builds the vertices of the texels in 'rect' only, one row of the
+    // rectangle after another.
+    //
+    // Heights are stored as 16-bit fractions of 'heightRange' and normals
+    // are octahedral encoded. The normals are computed in bands of rows so
+    // the float normals never have to exist for the whole terrain.
+
+    const int BAND_ROWS = 64;
+
+    if (rect.isEmpty())
+        return;
+
+    int size = heightMap.getSize();
+    int width = rect.x1 - rect.x0;
+    std::vector<float> normals(BAND_ROWS * width * 3);
+    const float *pHeights = heightMap.getHeights();
+    float heightToUnorm16 = 65535.0f / heightRange;
+
+    for (int rowBegin = rect.z0; rowBegin < rect.z1; rowBegin += BAND_ROWS)
+    {
+        HeightMap::Rect band = {rect.x0, rowBegin, rect.x1, std::min(rowBegin + BAND_ROWS, rect.z1)};
+        int n = 0;
+
+        heightMap.computeNormals(band, &normals[0], 3);
+
+        for (int z = band.z0; z < band.z1; ++z)
+        {
+            CompactVertex *pVertex = &pVertices[(z - rect.z0) * width];
+
+            for (int x = rect.x0; x < rect.x1; ++x, ++pVertex, n += 3)
+            {
+                float height = std::min(std::max(pHeights[z * size + x] * heightToUnorm16, 0.0f), 65535.0f);
+
+                pVertex->height = static_cast<unsigned short>(height + 0.5f);
+                EncodeOctahedral(normals[n], normals[n + 1], normals[n + 2], pVertex->normal);
+            }
+        }
+    }
+}
+
+void TerrainMesh::buildPatchLodIndices(int size, int patchSize, int lodCount,
+                                       std::vector<unsigned int> &indices, std::vector<LodRange> &ranges)
+{
+    // Builds the triangle lists of every level of detail for every
+    // combination of coarser neighbours, and for every patch shape. The
+    // indices are relative to the patch's top left vertex. getLodRangeIndex()
+    // returns where the range of each list is in 'ranges'. Shape bit 0 is set
+    // for the narrower last column of patches, and bit 1 for the shorter last
+    // row, when size - 1 isn't a multiple of 'patchSize'.
+
+    int remainder = (size - 1) % patchSize;
+    PatchTriangulator triangulator(size, indices);
+
+    indices.clear();
+    ranges.resize(4 * lodCount * 16);
+
+    for (int shape = 0; shape < 4; ++shape)
+    {
+        int width = (shape & 1) ? remainder : patchSize;
+        int height = (shape & 2) ? remainder : patchSize;
+
+        for (int lod = 0; lod < lodCount; ++lod)
+        {
+            for (int edgeMask = 0; edgeMask < 16; ++edgeMask)
+            {
+                LodRange &range = ranges[getLodRangeIndex(shape, lod, lodCount, edgeMask)];
+
+                range.first = static_cast<int>(indices.size());
+
+                if (width > 0 && height > 0)
+                    triangulator.triangulate(width, height, 1 << lod, edgeMask);
+
+                range.count = static_cast<int>(indices.size()) - range.first;
+            }
+        }
+    }
+}
+
+void TerrainMesh::buildStripIndices(int size, unsigned short *pIndices)
+{
+    // Fills getStripIndexCount(size) indices.
+    BuildStripIndices(size, pIndices);
+}
+
+void TerrainMesh::buildStripIndices(int size, unsigned int *pIndices)
+{
+    // Fills getStripIndexCount(size) indices.
+    BuildStripIndices(size, pIndices);
+}
+
+void TerrainMesh::buildVertices(const HeightMap &heightMap, Vertex *pVertices)
+{
+    HeightMap::Rect rect = {0, 0, heightMap.getSize(), heightMap.getSize()};
+
+    buildVertices(heightMap, rect, pVertices);
+}
+
+void TerrainMesh::buildVertices(const HeightMap &heightMap, const HeightMap::Rect &rect, Vertex *pVertices)
+{
+    // Builds the vertices of the texels in 'rect' only, one row of the
+    // rectangle after another.
+
+    int size = heightMap.getSize();
+    int width = rect.x1 - rect.x0;
+    int gridSpacing = heightMap.getGridSpacing();
+    float heightScale = heightMap.getHeightScale();
+
+    if (rect.isEmpty())
+        return;
+
+    for (int z = rect.z0; z < rect.z1; ++z)
+    {
+        for (int x = rect.x0; x < rect.x1; ++x)
+        {
+            Vertex *pVertex = &pVertices[(z - rect.z0) * width + (x - rect.x0)];
+
+            pVertex->x = static_cast<float>(x * gridSpacing);
+            pVertex->y = heightMap.heightAtPixel(x, z) * heightScale;
+            pVertex->z = static_cast<float>(z * gridSpacing);
+
+            pVertex->s = static_cast<float>(x) / static_cast<float>(size);
+            pVertex->t = static_cast<float>(z) / static_cast<float>(size);
+        }
+    }
+
+    heightMap.computeNormals(rect, &pVertices[0].nx, sizeof(Vertex) / sizeof(float));
+}
+
+int TerrainMesh::getBlockListIndexCount(int size, int blockWidth)
+{
+    // 6 indices per quad, plus the triangles that load the top vertices of
+    // each block, 3 vertices per triangle.
+
+    int count = 0;
+
+    for (int x0 = 0; x0 < size - 1; x0 += blockWidth)
+    {
+        int width = std::min(blockWidth, size - 1 - x0);
+
+        count += (width + 3) / 3 * 3 + (size - 1) * width * 6;
+    }
+
+    return count;
+}
+
+int TerrainMesh::getBlockStripIndexCount(int size, int blockWidth)
+{
+    // A strip of 2 indices per vertex pair and a restart index for each row
+    // of each block, plus the strip that loads the top vertices of each
+    // block.
+
+    int count = 0;
+
+    for (int x0 = 0; x0 < size - 1; x0 += blockWidth)
+    {
+        int width = std::min(blockWidth, size - 1 - x0);
+
+        count += (width + 2) + (size - 1) * (2 * width + 3);
+    }
+
+    return count;
+}
+
+void TerrainMesh::computePatchBounds(const HeightMap &heightMap, int x0, int z0, int width, int height,
+                                     int lodCount, float &minY, float &maxY, float *pErrors)
+{
+    // Computes the height bounds of the patch of 'width' x 'height' quads
+    // starting at vertex (x0, z0), and the geometric error of each of its
+    // 'lodCount' levels of detail. The error of a level is the largest
+    // vertical distance between a vertex of the patch and the bilinear
+    // interpolation of the cell of the level's coarser grid that contains
+    // it. The errors are made to never decrease with the level.
+
+    const float *pHeights = heightMap.getHeights();
+    int size = heightMap.getSize();
+    float heightScale = heightMap.getHeightScale();
+    const float *pOrigin = &pHeights[z0 * size + x0];
+    std::vector<int> xs, zs;
+
+    minY = maxY = pOrigin[0] * heightScale;
+
+    for (int z = 0; z <= height; ++z)
+    {
+        for (int x = 0; x <= width; ++x)
+        {
+            float y = pOrigin[z * size + x] * heightScale;
+
+            minY = std::min(minY, y);
+            maxY = std::max(maxY, y);
+        }
+    }
+
+    pErrors[0] = 0.0f;
+
+    for (int lod = 1; lod < lodCount; ++lod)
+    {
+        float error = pErrors[lod - 1];
+
+        Lattice(1 << lod, width, xs);
+        Lattice(1 << lod, height, zs);
+
+        for (size_t j = 0; j + 1 < zs.size(); ++j)
+        {
+            for (size_t i = 0; i + 1 < xs.size(); ++i)
+            {
+                float h00 = pOrigin[zs[j] * size + xs[i]];
+                float h10 = pOrigin[zs[j] * size + xs[i + 1]];
+                float h01 = pOrigin[zs[j + 1] * size + xs[i]];
+                float h11 = pOrigin[zs[j + 1] * size + xs[i + 1]];
+                float invWidth = 1.0f / (xs[i + 1] - xs[i]);
+                float invHeight = 1.0f / (zs[j + 1] - zs[j]);
+
+                for (int z = zs[j]; z <= zs[j + 1]; ++z)
+                {
+                    for (int x = xs[i]; x <= xs[i + 1]; ++x)
+                    {
+                        float u = (x - xs[i]) * invWidth;
+                        float v = (z - zs[j]) * invHeight;
+                        float h = Math::bilerp(h00, h10, h01, h11, u, v);
+
+                        error = std::max(error, fabsf(pOrigin[z * size + x] - h) * heightScale);
+                    }
+                }
+            }
+        }
+
+        pErrors[lod] = error;
+    }
+}
@@ -0,0 +1,82 @@
+
+
+#if !defined(TERRAIN_MESH_H)
+#define TERRAIN_MESH_H
+
+#include <vector>
+#include "height_map.h"
+
+//-----------------------------------------------------------------------------
+// Builds the vertices and indices of a terrain mesh from a HeightMap.
+//
+// The mesh has one vertex per height map texel. The whole grid can be drawn
+// as a single triangle strip, or split into patches that are drawn as
+// triangle lists at different levels of detail (geomipmapping). Everything is
+// built on the CPU into caller supplied memory, so the mesh can be built
+// without an OpenGL context. Terrain copies the results into its buffers.
+//
+// The single strip walks whole rows of the grid, so by the time the next row
+// reuses a vertex it has long been evicted from the GPU's post-transform
+// vertex cache, and almost every vertex is transformed twice. The block
+// orders split the grid into columns of 'blockWidth' quads and walk each
+// column row by row. A row of a block reuses the whole previous row as long
+// as a FIFO cache holds 'blockWidth' + 2 vertices, see getCacheBlockWidth().
+// An LRU cache needs about twice that. They're drawn either as a triangle
+// list, or as one strip per block row separated by primitive restart
+// indices. tools/vertex_cache_report.cpp compares the orders with a
+// simulated vertex cache.
+//-----------------------------------------------------------------------------
+
+class TerrainMesh
+{
+public:
+    // 32 bytes per vertex.
+    struct Vertex
+    {
+        float x, y, z;
+        float nx, ny, nz;
+        float s, t;
+    };
+
+    // 4 bytes per vertex: a 16-bit height and an octahedral encoded normal.
+    // The grid position and texture coordinates are rebuilt from the vertex
+    // index.
+    struct CompactVertex
+    {
+        unsigned short height;
+        signed char normal[2];
+    };
+
+    // A range of the indices built by buildPatchLodIndices().
+    struct LodRange
+    {
+        int first;
+        int count;
+    };
+
+    static void buildBlockListIndices(int size, int blockWidth, unsigned short *pIndices);
+    static void buildBlockListIndices(int size, int blockWidth, unsigned int *pIndices);
+    static void buildBlockStripIndices(int size, int blockWidth, unsigned short *pIndices);
+    static void buildBlockStripIndices(int size, int blockWidth, unsigned int *pIndices);
+    static void buildCompactVertices(const HeightMap &heightMap, float heightRange, CompactVertex *pVertices);
+    static void buildCompactVertices(const HeightMap &heightMap, const HeightMap::Rect &rect, float heightRange, CompactVertex *pVertices);
+    static void buildPatchLodIndices(int size, int patchSize, int lodCount, std::vector<unsigned int> &indices, std::vector<LodRange> &ranges);
+    static void buildStripIndices(int size, unsigned short *pIndices);
+    static void buildStripIndices(int size, unsigned int *pIndices);
+    static void buildVertices(const HeightMap &heightMap, Vertex *pVertices);
+    static void buildVertices(const HeightMap &heightMap, const HeightMap::Rect &rect, Vertex *pVertices);
+    static void computePatchBounds(const HeightMap &heightMap, int x0, int z0, int width, int height, int lodCount, float &minY, float &maxY, float *pErrors);
+    static int getBlockListIndexCount(int size, int blockWidth);
+    static int getBlockStripIndexCount(int size, int blockWidth);
+
+    static int getCacheBlockWidth(int cacheSize)
+    { return (cacheSize > 3) ? cacheSize - 2 : 1; }
+
+    static int getLodRangeIndex(int shape, int lod, int lodCount, int edgeMask)
+    { return (shape * lodCount + lod) * 16 + edgeMask; }
+
+    static int getStripIndexCount(int size)
+    { return (size - 1) * (size * 2 + 1); }
+};
+
+#endif
@@ -0,0 +1,190 @@
+
+
+#include <system_error>
+#include "profiler.h"
+#include "thread_pool.h"
+
+int ThreadPool::getHardwareThreadCount()
+{
+    // std::thread::hardware_concurrency() is allowed to return 0 when the
+    // number of processors can't be determined.
+
+    int count = static_cast<int>(std::thread::hardware_concurrency());
+    return (count > 0) ? count : 1;
+}
+
+ThreadPool::ThreadPool() : m_nextChunk(0), m_chunksRemaining(0)
+{
+    m_job.pTask = 0;
+    m_job.begin = 0;
+    m_job.end = 0;
+    m_job.chunkCount = 0;
+    m_job.generation = 0;
+    m_threadCount = 1;
+    m_quit = false;
+}
+
+ThreadPool::~ThreadPool()
+{
+    destroy();
+}
+
+bool ThreadPool::create(int threadCount)
+{
+    destroy();
+
+    if (threadCount < 1)
+        threadCount = 1;
+
+    m_quit = false;
+    m_threadCount = threadCount;
+
+    try
+    {
+        for (int i = 0; i < threadCount - 1; ++i)
+            m_workers.push_back(std::thread(&ThreadPool::workerMain, this));
+    }
+    catch (const std::system_error &)
+    {
+        destroy();
+        return false;
+    }
+
+    return true;
+}
+
+void ThreadPool::destroy()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+
+    m_workReady.notify_all();
+
+    for (size_t i = 0; i < m_workers.size(); ++i)
+        m_workers[i].join();
+
+    m_workers.clear();
+    m_threadCount = 1;
+}
+
+void ThreadPool::parallelFor(int begin, int end, const Task &task)
+{
+    if (begin >= end)
+        return;
+
+    int chunkCount = m_threadCount;
+
+    if (chunkCount > end - begin)
+        chunkCount = end - begin;
+
+    if (chunkCount <= 1)
+    {
+        task(begin, end);
+        return;
+    }
+
+    std::lock_guard<std::mutex> dispatchLock(m_dispatchMutex);
+    Job job;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        m_job.pTask = &task;
+        m_job.begin = begin;
+        m_job.end = end;
+        m_job.chunkCount = chunkCount;
+        ++m_job.generation;
+        m_chunksRemaining = chunkCount;
+        m_nextChunk = static_cast<unsigned long long>(m_job.generation) << 32;
+        job = m_job;
+    }
+
+    m_workReady.notify_all();
+    runChunks(job);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_chunksRemaining > 0)
+        m_workDone.wait(lock);
+
+    m_job.pTask = 0;
+}
+
+bool ThreadPool::claimChunk(const Job &job, int &chunk)
+{
+    // The claim counter holds the generation of the job it counts chunks
+    // for, so a worker that is still finishing an older job can never claim
+    // a chunk of a newer one, or bump the newer job's counter.
+
+    unsigned long long claim = m_nextChunk.load();
+
+    while (true)
+    {
+        if (static_cast<unsigned int>(claim >> 32) != job.generation)
+            return false;
+
+        chunk = static_cast<int>(claim & 0xffffffffu);
+
+        if (chunk >= job.chunkCount)
+            return false;
+
+        if (m_nextChunk.compare_exchange_weak(claim, claim + 1))
+            return true;
+    }
+}
+
+void ThreadPool::runChunks(const Job &job)
+{
+    // Claims chunks of 'job' until there are none left. Chunk 'i' always
+    // covers the same sub-range of [job.begin, job.end) for a given chunk
+    // count.
+
+    int chunk = 0;
+
+    while (claimChunk(job, chunk))
+    {
+        long long count = job.end - job.begin;
+        int chunkBegin = job.begin + static_cast<int>((count * chunk) / job.chunkCount);
+        int chunkEnd = job.begin + static_cast<int>((count * (chunk + 1)) / job.chunkCount);
+
+        {
+            PROFILE_ZONE("ThreadPool::parallelFor chunk");
+            (*job.pTask)(chunkBegin, chunkEnd);
+        }
+
+        if (--m_chunksRemaining == 0)
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_workDone.notify_all();
+        }
+    }
+}
+
+void ThreadPool::workerMain()
+{
+    unsigned int generation = 0;
+
+    Profiler::instance().setThreadName("ThreadPool worker");
+
+    while (true)
+    {
+        Job job;
+
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            while (!m_quit && m_job.generation == generation)
+                m_workReady.wait(lock);
+
+            if (m_quit)
+                return;
+
+            job = m_job;
+            generation = job.generation;
+        }
+
+        runChunks(job);
+    }
+}
@@ -0,0 +1,80 @@
+#if !defined(THREAD_POOL_H)
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//-----------------------------------------------------------------------------
+// A small fixed size pool of worker threads used to split data parallel work
+// (such as the rows of a height map) across all available processors.
+//
+// The thread calling parallelFor() also does its share of the work, so a pool
+// created with a thread count of N starts N - 1 worker threads. A pool with a
+// thread count of 1 simply runs the work on the calling thread.
+//
+// parallelFor() splits the range [begin, end) into at most getThreadCount()
+// contiguous sub-ranges. The split only depends on the range and the thread
+// count, so callers can rely on the same sub-ranges being produced every time.
+// Calls to parallelFor() from several threads at once are serialized. Calling
+// parallelFor() from inside a task is not supported.
+//
+// To use the ThreadPool class:
+//  ThreadPool pool;
+//  pool.create(ThreadPool::getHardwareThreadCount());
+//  pool.parallelFor(0, rows, [&](int begin, int end) { ... });
+//  pool.destroy();
+//-----------------------------------------------------------------------------
+
+class ThreadPool
+{
+public:
+    typedef std::function<void(int, int)> Task;
+
+    static int getHardwareThreadCount();
+
+    ThreadPool();
+    ~ThreadPool();
+
+    bool create(int threadCount);
+    void destroy();
+
+    int getThreadCount() const
+    { return m_threadCount; }
+
+    void parallelFor(int begin, int end, const Task &task);
+
+private:
+    ThreadPool(const ThreadPool &);
+    ThreadPool &operator=(const ThreadPool &);
+
+    // A parallelFor() call. Workers copy it while holding m_mutex.
+    struct Job
+    {
+        const Task *pTask;
+        int begin;
+        int end;
+        int chunkCount;
+        unsigned int generation;
+    };
+
+    bool claimChunk(const Job &job, int &chunk);
+    void runChunks(const Job &job);
+    void workerMain();
+
+    std::vector<std::thread> m_workers;
+    std::mutex m_dispatchMutex;
+    std::mutex m_mutex;
+    std::condition_variable m_workReady;
+    std::condition_variable m_workDone;
+    std::atomic<unsigned long long> m_nextChunk;   // generation << 32 | chunk
+    std::atomic<int> m_chunksRemaining;
+    Job m_job;
+    int m_threadCount;
+    bool m_quit;
+};
+
+#endif
@@ -0,0 +1,738 @@
+//-----------------------------------------------------------------------------
+// Batch terrain baker.
+//
+// Generates a diamond-square or gradient noise terrain for every combination
+// of the given seeds and sizes, optionally smooths, blurs and erodes it, and
+// writes any of:
+//  - the height map, as a height map file (see height_map_file.h)
+//  - the normal map, as an uncompressed 24-bit TGA image
+//  - the mesh, as a Wavefront OBJ file with normals and texture coordinates
+//
+// Terrains are baked in parallel, one terrain per worker thread. A terrain is
+// only started while the estimated memory of all the terrains being baked
+// stays within the memory budget, so large batches can't exhaust memory. A
+// terrain that is larger than the whole budget is baked on its own. Normal
+// maps and meshes are written in bands of rows, so a terrain needs little
+// more memory than its heights.
+//
+// The time taken by each stage of each terrain is printed as it finishes,
+// followed by the total time of each stage and the overall throughput.
+//
+// Usage: terrain_baker [options]
+//  --seeds LIST        seeds to bake, e.g. 1,2,10-19 (default 1)
+//  --sizes LIST        height map sizes, powers of 2 for diamond-square,
+//                      at most 65535 with normals (default 512)
+//  --generator G       ds (diamond-square), fbm or ridged (default ds)
+//  --roughness R       diamond-square roughness (default 1.2)
+//  --frequency F       noise frequency in cycles per texel (default 1/256)
+//  --warp W            noise domain warp in texels, 0 disables it (default 0)
+//  --smooth N          number of smoothing passes (default 0)
+//  --blur AMOUNT       blur amount in [0,1], 0 disables it (default 0)
+//  --thermal N         thermal erosion iterations (default 0)
+//  --talus T           thermal erosion talus in height units (default 0.5)
+//  --droplets N        hydraulic erosion droplets (default 0)
+//  --grid-spacing N    world units between vertices (default 16)
+//  --height-scale S    world units per height map unit (default 2)
+//  --outputs LIST      any of hmap,normals,mesh (default hmap,normals)
+//  --format F          height map samples, float or uint16 (default float)
+//  --tile-size N       height map file tile size, 0 for rows (default 0)
+//  --output DIR        output directory, which must exist (default .)
+//  --jobs N            worker threads (default: hardware threads)
+//  --memory-mb N       memory budget in MB (default 1024)
+//
+// Output files are named terrain_<seed>_<size>.hmap, _normals.tga and .obj.
+//
+// Build (from a Visual Studio command prompt in this directory):
+//  cl /O2 /EHsc /I.. terrain_baker.cpp ..\height_map.cpp
+//     ..\height_map_file.cpp ..\profiler.cpp ..\terrain_mesh.cpp
+//     ..\thread_pool.cpp ..\mathlib.cpp
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build && cmake --build build --target terrain_baker
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "../benchmarks/bench_timer.h"
+#include "../height_map.h"
+#include "../terrain_mesh.h"
+#include "../thread_pool.h"
+
+namespace
+{
+    const int BAND_ROWS = 64;
+    const int MAX_NORMAL_MAP_SIZE = 65535;     // TGA sizes are 16 bits
+
+    enum Stage
+    {
+        STAGE_GENERATE,
+        STAGE_SMOOTH,
+        STAGE_BLUR,
+        STAGE_THERMAL,
+        STAGE_HYDRAULIC,
+        STAGE_HEIGHT_MAP,
+        STAGE_NORMAL_MAP,
+        STAGE_MESH,
+        STAGE_COUNT
+    };
+
+    const char *const STAGE_NAMES[STAGE_COUNT] =
+    {
+        "generate", "smooth", "blur", "thermal", "hydraulic", "hmap", "normals", "mesh"
+    };
+
+    enum Generator
+    {
+        GENERATOR_DIAMOND_SQUARE,
+        GENERATOR_FBM,
+        GENERATOR_RIDGED
+    };
+
+    struct Options
+    {
+        std::vector<unsigned int> seeds;
+        std::vector<int> sizes;
+        Generator generator;
+        float roughness;
+        float frequency;
+        float warp;
+        int smoothPasses;
+        float blurAmount;
+        int thermalIterations;
+        float talus;
+        int droplets;
+        int gridSpacing;
+        float heightScale;
+        bool writeHeightMap;
+        bool writeNormalMap;
+        bool writeMesh;
+        HeightMapFile::SampleFormat sampleFormat;
+        int tileSize;
+        std::string outputDir;
+        int jobs;
+        size_t memoryBudget;
+    };
+
+    struct Job
+    {
+        unsigned int seed;
+        int size;
+        size_t memory;
+        double stageMs[STAGE_COUNT];
+        bool succeeded;
+    };
+
+    //-------------------------------------------------------------------------
+    // Command line parsing.
+
+    bool ParseList(const char *pszList, std::vector<int> &values)
+    {
+        // Parses comma separated integers and inclusive ranges such as 10-19.
+
+        values.clear();
+
+        for (const char *p = pszList; *p; )
+        {
+            char *pEnd = 0;
+            long first = strtol(p, &pEnd, 10);
+            long last = first;
+
+            if (pEnd == p)
+                return false;
+
+            p = pEnd;
+
+            if (*p == '-')
+            {
+                last = strtol(p + 1, &pEnd, 10);
+
+                if (pEnd == p + 1 || last < first)
+                    return false;
+
+                p = pEnd;
+            }
+
+            for (long value = first; value <= last; ++value)
+                values.push_back(static_cast<int>(value));
+
+            if (*p == ',')
+                ++p;
+            else if (*p)
+                return false;
+        }
+
+        return !values.empty();
+    }
+
+    void PrintUsage()
+    {
+        fprintf(stderr,
+            "usage: terrain_baker [--seeds LIST] [--sizes LIST] [--generator ds|fbm|ridged]\n"
+            "                     [--roughness R] [--frequency F] [--warp W]\n"
+            "                     [--smooth N] [--blur AMOUNT] [--thermal N]\n"
+            "                     [--talus T] [--droplets N] [--grid-spacing N]\n"
+            "                     [--height-scale S] [--outputs hmap,normals,mesh]\n"
+            "                     [--format float|uint16] [--tile-size N]\n"
+            "                     [--output DIR] [--jobs N] [--memory-mb N]\n");
+    }
+
+    bool ParseOptions(int argc, char *argv[], Options &options)
+    {
+        std::vector<int> values;
+
+        options.seeds.assign(1, 1);
+        options.sizes.assign(1, 512);
+        options.generator = GENERATOR_DIAMOND_SQUARE;
+        options.roughness = 1.2f;
+        options.frequency = 1.0f / 256.0f;
+        options.warp = 0.0f;
+        options.smoothPasses = 0;
+        options.blurAmount = 0.0f;
+        options.thermalIterations = 0;
+        options.talus = 0.5f;
+        options.droplets = 0;
+        options.gridSpacing = 16;
+        options.heightScale = 2.0f;
+        options.writeHeightMap = true;
+        options.writeNormalMap = true;
+        options.writeMesh = false;
+        options.sampleFormat = HeightMapFile::SAMPLE_FLOAT;
+        options.tileSize = 0;
+        options.outputDir = ".";
+        options.jobs = ThreadPool::getHardwareThreadCount();
+        options.memoryBudget = static_cast<size_t>(1024) << 20;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *pszOption = argv[i];
+            const char *pszValue = (i + 1 < argc) ? argv[++i] : 0;
+
+            if (!pszValue)
+                return false;
+
+            if (strcmp(pszOption, "--seeds") == 0)
+            {
+                if (!ParseList(pszValue, values))
+                    return false;
+
+                options.seeds.assign(values.begin(), values.end());
+            }
+            else if (strcmp(pszOption, "--sizes") == 0)
+            {
+                if (!ParseList(pszValue, options.sizes))
+                    return false;
+            }
+            else if (strcmp(pszOption, "--generator") == 0)
+            {
+                if (strcmp(pszValue, "ds") == 0)
+                    options.generator = GENERATOR_DIAMOND_SQUARE;
+                else if (strcmp(pszValue, "fbm") == 0)
+                    options.generator = GENERATOR_FBM;
+                else if (strcmp(pszValue, "ridged") == 0)
+                    options.generator = GENERATOR_RIDGED;
+                else
+                    return false;
+            }
+            else if (strcmp(pszOption, "--roughness") == 0)
+            {
+                options.roughness = static_cast<float>(atof(pszValue));
+            }
+            else if (strcmp(pszOption, "--frequency") == 0)
+            {
+                options.frequency = static_cast<float>(atof(pszValue));
+            }
+            else if (strcmp(pszOption, "--warp") == 0)
+            {
+                options.warp = std::max(0.0f, static_cast<float>(atof(pszValue)));
+            }
+            else if (strcmp(pszOption, "--smooth") == 0)
+            {
+                options.smoothPasses = std::max(0, atoi(pszValue));
+            }
+            else if (strcmp(pszOption, "--blur") == 0)
+            {
+                options.blurAmount = static_cast<float>(atof(pszValue));
+            }
+            else if (strcmp(pszOption, "--thermal") == 0)
+            {
+                options.thermalIterations = std::max(0, atoi(pszValue));
+            }
+            else if (strcmp(pszOption, "--talus") == 0)
+            {
+                options.talus = std::max(0.0f, static_cast<float>(atof(pszValue)));
+            }
+            else if (strcmp(pszOption, "--droplets") == 0)
+            {
+                options.droplets = std::max(0, atoi(pszValue));
+            }
+            else if (strcmp(pszOption, "--grid-spacing") == 0)
+            {
+                options.gridSpacing = std::max(1, atoi(pszValue));
+            }
+            else if (strcmp(pszOption, "--height-scale") == 0)
+            {
+                options.heightScale = static_cast<float>(atof(pszValue));
+            }
+            else if (strcmp(pszOption, "--outputs") == 0)
+            {
+                std::string outputs = std::string(",") + pszValue + ",";
+
+                options.writeHeightMap = outputs.find(",hmap,") != std::string::npos;
+                options.writeNormalMap = outputs.find(",normals,") != std::string::npos;
+                options.writeMesh = outputs.find(",mesh,") != std::string::npos;
+            }
+            else if (strcmp(pszOption, "--format") == 0)
+            {
+                if (strcmp(pszValue, "float") == 0)
+                    options.sampleFormat = HeightMapFile::SAMPLE_FLOAT;
+                else if (strcmp(pszValue, "uint16") == 0)
+                    options.sampleFormat = HeightMapFile::SAMPLE_UINT16;
+                else
+                    return false;
+            }
+            else if (strcmp(pszOption, "--tile-size") == 0)
+            {
+                options.tileSize = std::max(0, atoi(pszValue));
+            }
+            else if (strcmp(pszOption, "--output") == 0)
+            {
+                options.outputDir = pszValue;
+            }
+            else if (strcmp(pszOption, "--jobs") == 0)
+            {
+                options.jobs = std::max(1, atoi(pszValue));
+            }
+            else if (strcmp(pszOption, "--memory-mb") == 0)
+            {
+                options.memoryBudget = static_cast<size_t>(std::max(1, atoi(pszValue))) << 20;
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        // Only diamond-square needs power of 2 sizes, and a normal map can't
+        // be larger than a TGA image.
+
+        for (size_t s = 0; s < options.sizes.size(); ++s)
+        {
+            if (options.sizes[s] < 2)
+                return false;
+
+            if (options.writeNormalMap && options.sizes[s] > MAX_NORMAL_MAP_SIZE)
+                return false;
+
+            if (options.generator == GENERATOR_DIAMOND_SQUARE && !Math::isPower2(options.sizes[s]))
+                return false;
+        }
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    // Output.
+
+    std::string OutputPath(const Options &options, const Job &job, const char *pszSuffix)
+    {
+        char name[64];
+
+        sprintf(name, "terrain_%u_%d%s", job.seed, job.size, pszSuffix);
+        return options.outputDir + "/" + name;
+    }
+
+    bool WriteNormalMap(const HeightMap &heightMap, const char *pszFilename)
+    {
+        // Writes the normals as an uncompressed 24-bit TGA image with the
+        // first row at the top. Each component is mapped from [-1,1] to
+        // [0,255] and stored in BGR order.
+
+        int size = heightMap.getSize();
+
+        if (size > MAX_NORMAL_MAP_SIZE)
+            return false;
+
+        FILE *pFile = fopen(pszFilename, "wb");
+
+        if (!pFile)
+            return false;
+
+        unsigned char header[18] = {0};
+
+        header[2] = 2;                                      // uncompressed true color
+        header[12] = static_cast<unsigned char>(size & 0xff);
+        header[13] = static_cast<unsigned char>(size >> 8);
+        header[14] = static_cast<unsigned char>(size & 0xff);
+        header[15] = static_cast<unsigned char>(size >> 8);
+        header[16] = 24;
+        header[17] = 0x20;                                  // top left origin
+
+        fwrite(header, sizeof(header), 1, pFile);
+
+        std::vector<float> normals(BAND_ROWS * size * 3);
+        std::vector<unsigned char> pixels(BAND_ROWS * size * 3);
+
+        for (int rowBegin = 0; rowBegin < size; rowBegin += BAND_ROWS)
+        {
+            int rowEnd = std::min(rowBegin + BAND_ROWS, size);
+            int count = (rowEnd - rowBegin) * size * 3;
+
+            heightMap.computeNormals(rowBegin, rowEnd, &normals[0], 3);
+
+            for (int i = 0; i < count; i += 3)
+            {
+                pixels[i + 0] = static_cast<unsigned char>(normals[i + 2] * 127.5f + 127.5f);
+                pixels[i + 1] = static_cast<unsigned char>(normals[i + 1] * 127.5f + 127.5f);
+                pixels[i + 2] = static_cast<unsigned char>(normals[i + 0] * 127.5f + 127.5f);
+            }
+
+            fwrite(&pixels[0], 1, count, pFile);
+        }
+
+        bool succeeded = !ferror(pFile);
+
+        fclose(pFile);
+        return succeeded;
+    }
+
+    bool WriteMesh(const HeightMap &heightMap, const char *pszFilename)
+    {
+        // Writes the full resolution grid as a Wavefront OBJ file. Positions
+        // and texture coordinates match TerrainMesh::buildVertices(). Each
+        // quad is split into 2 triangles that wind counterclockwise when
+        // viewed from above.
+
+        FILE *pFile = fopen(pszFilename, "w");
+
+        if (!pFile)
+            return false;
+
+        int size = heightMap.getSize();
+        float gridSpacing = static_cast<float>(heightMap.getGridSpacing());
+        float heightScale = heightMap.getHeightScale();
+        float invSize = 1.0f / static_cast<float>(size);
+        std::vector<float> normals(BAND_ROWS * size * 3);
+
+        fprintf(pFile, "# %d x %d terrain, seed %u\n", size, size, heightMap.getSeed());
+
+        for (int z = 0; z < size; ++z)
+        {
+            for (int x = 0; x < size; ++x)
+            {
+                fprintf(pFile, "v %g %g %g\n", x * gridSpacing,
+                    heightMap.heightAtPixel(x, z) * heightScale, z * gridSpacing);
+            }
+        }
+
+        for (int rowBegin = 0; rowBegin < size; rowBegin += BAND_ROWS)
+        {
+            int rowEnd = std::min(rowBegin + BAND_ROWS, size);
+            int count = (rowEnd - rowBegin) * size * 3;
+
+            heightMap.computeNormals(rowBegin, rowEnd, &normals[0], 3);
+
+            for (int i = 0; i < count; i += 3)
+                fprintf(pFile, "vn %.4f %.4f %.4f\n", normals[i], normals[i + 1], normals[i + 2]);
+        }
+
+        for (int z = 0; z < size; ++z)
+        {
+            for (int x = 0; x < size; ++x)
+                fprintf(pFile, "vt %g %g\n", x * invSize, z * invSize);
+        }
+
+        for (int z = 0; z < size - 1; ++z)
+        {
+            for (int x = 0; x < size - 1; ++x)
+            {
+                // OBJ indices start at 1.
+
+                int v00 = z * size + x + 1;
+                int v10 = v00 + 1;
+                int v01 = v00 + size;
+                int v11 = v01 + 1;
+
+                fprintf(pFile, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", v00, v00, v00, v01, v01, v01, v10, v10, v10);
+                fprintf(pFile, "f %d/%d/%d %d/%d/%d %d/%d/%d\n", v10, v10, v10, v01, v01, v01, v11, v11, v11);
+            }
+        }
+
+        bool succeeded = !ferror(pFile);
+
+        fclose(pFile);
+        return succeeded;
+    }
+
+    //-------------------------------------------------------------------------
+    // Baking.
+
+    size_t EstimateMemory(int size)
+    {
+        // The heights plus the bands of normals and output buffers, the
+        // blur's temporary tiles, and the second copy of the heights that
+        // thermal erosion writes to.
+
+        size_t texels = static_cast<size_t>(size) * size;
+        size_t bands = static_cast<size_t>(BAND_ROWS) * size * (3 * sizeof(float) + 3);
+
+        return texels * sizeof(float) * 2 + bands + texels / 4;
+    }
+
+    void Bake(const Options &options, Job &job)
+    {
+        HeightMap heightMap;
+
+        job.succeeded = false;
+        std::fill(job.stageMs, job.stageMs + STAGE_COUNT, 0.0);
+
+        if (!heightMap.create(job.size, options.gridSpacing, options.heightScale))
+            return;
+
+        BenchTimer timer;
+
+        if (options.generator == GENERATOR_DIAMOND_SQUARE)
+        {
+            heightMap.generateDiamondSquareFractal(options.roughness, job.seed);
+        }
+        else
+        {
+            HeightMap::NoiseParameters params;
+
+            params.frequency = options.frequency;
+            params.ridged = (options.generator == GENERATOR_RIDGED);
+            params.warp = options.warp;
+            params.seed = job.seed;
+            heightMap.generateNoise(params);
+        }
+
+        job.stageMs[STAGE_GENERATE] = timer.elapsedMs();
+
+        timer.start();
+
+        for (int i = 0; i < options.smoothPasses; ++i)
+            heightMap.smooth();
+
+        job.stageMs[STAGE_SMOOTH] = timer.elapsedMs();
+
+        timer.start();
+
+        if (options.blurAmount > 0.0f)
+            heightMap.blur(options.blurAmount);
+
+        job.stageMs[STAGE_BLUR] = timer.elapsedMs();
+
+        timer.start();
+        heightMap.erodeThermal(options.thermalIterations, options.talus, 1.0f);
+        job.stageMs[STAGE_THERMAL] = timer.elapsedMs();
+
+        timer.start();
+
+        if (options.droplets > 0)
+        {
+            HeightMap::HydraulicErosionParameters params;
+
+            params.dropletCount = options.droplets;
+            params.seed = job.seed;
+            heightMap.erodeHydraulic(params);
+        }
+
+        job.stageMs[STAGE_HYDRAULIC] = timer.elapsedMs();
+
+        bool succeeded = true;
+
+        if (options.writeHeightMap)
+        {
+            timer.start();
+            succeeded &= heightMap.save(OutputPath(options, job, ".hmap").c_str(),
+                options.sampleFormat, options.tileSize);
+            job.stageMs[STAGE_HEIGHT_MAP] = timer.elapsedMs();
+        }
+
+        if (options.writeNormalMap)
+        {
+            timer.start();
+            succeeded &= WriteNormalMap(heightMap, OutputPath(options, job, "_normals.tga").c_str());
+            job.stageMs[STAGE_NORMAL_MAP] = timer.elapsedMs();
+        }
+
+        if (options.writeMesh)
+        {
+            timer.start();
+            succeeded &= WriteMesh(heightMap, OutputPath(options, job, ".obj").c_str());
+            job.stageMs[STAGE_MESH] = timer.elapsedMs();
+        }
+
+        job.succeeded = succeeded;
+    }
+
+    class Scheduler
+    {
+    public:
+        // Hands out jobs to the worker threads in order. A job only starts
+        // once the memory of the jobs that are running leaves room for it,
+        // or when nothing else is running.
+
+        Scheduler(std::vector<Job> &jobs, size_t memoryBudget)
+            : m_jobs(jobs), m_memoryBudget(memoryBudget), m_memoryInUse(0), m_running(0), m_next(0)
+        {
+        }
+
+        Job *acquire()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+
+            for (;;)
+            {
+                if (m_next == m_jobs.size())
+                    return 0;
+
+                Job &job = m_jobs[m_next];
+
+                if (m_running == 0 || m_memoryInUse + job.memory <= m_memoryBudget)
+                {
+                    ++m_next;
+                    ++m_running;
+                    m_memoryInUse += job.memory;
+                    return &job;
+                }
+
+                m_jobFinished.wait(lock);
+            }
+        }
+
+        void release(const Job &job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                --m_running;
+                m_memoryInUse -= job.memory;
+            }
+
+            m_jobFinished.notify_all();
+        }
+
+    private:
+        Scheduler(const Scheduler &);
+        Scheduler &operator=(const Scheduler &);
+
+        std::vector<Job> &m_jobs;
+        size_t m_memoryBudget;
+        size_t m_memoryInUse;
+        int m_running;
+        size_t m_next;
+        std::mutex m_mutex;
+        std::condition_variable m_jobFinished;
+    };
+
+    void PrintStages(const char *pszLabel, const double *pStageMs, double totalMs, const char *pszStatus)
+    {
+        printf("%-22s", pszLabel);
+
+        for (int stage = 0; stage < STAGE_COUNT; ++stage)
+            printf(" %10.1f", pStageMs[stage]);
+
+        printf(" %10.1f%s%s\n", totalMs, *pszStatus ? " " : "", pszStatus);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    std::vector<Job> jobs;
+
+    for (size_t s = 0; s < options.sizes.size(); ++s)
+    {
+        for (size_t i = 0; i < options.seeds.size(); ++i)
+        {
+            Job job;
+
+            job.seed = options.seeds[i];
+            job.size = options.sizes[s];
+            job.memory = EstimateMemory(job.size);
+            job.succeeded = false;
+            jobs.push_back(job);
+        }
+    }
+
+    int workerCount = std::min(options.jobs, static_cast<int>(jobs.size()));
+
+    printf("baking %d terrains on %d threads, %d MB memory budget\n\n",
+        static_cast<int>(jobs.size()), workerCount, static_cast<int>(options.memoryBudget >> 20));
+    printf("%-22s", "terrain (ms)");
+
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+        printf(" %10s", STAGE_NAMES[stage]);
+
+    printf(" %10s\n", "total");
+
+    Scheduler scheduler(jobs, options.memoryBudget);
+    std::mutex printMutex;
+    std::vector<std::thread> workers;
+    BenchTimer wallTimer;
+
+    for (int i = 0; i < workerCount; ++i)
+    {
+        workers.push_back(std::thread([&]()
+        {
+            while (Job *pJob = scheduler.acquire())
+            {
+                BenchTimer timer;
+                char label[64];
+
+                Bake(options, *pJob);
+                scheduler.release(*pJob);
+
+                sprintf(label, "seed %u, %d", pJob->seed, pJob->size);
+
+                std::lock_guard<std::mutex> lock(printMutex);
+                PrintStages(label, pJob->stageMs, timer.elapsedMs(), pJob->succeeded ? "" : "FAILED");
+            }
+        }));
+    }
+
+    for (size_t i = 0; i < workers.size(); ++i)
+        workers[i].join();
+
+    double wallMs = wallTimer.elapsedMs();
+    double stageTotals[STAGE_COUNT] = {0};
+    double texels = 0.0;
+    int failures = 0;
+
+    for (size_t j = 0; j < jobs.size(); ++j)
+    {
+        for (int stage = 0; stage < STAGE_COUNT; ++stage)
+            stageTotals[stage] += jobs[j].stageMs[stage];
+
+        texels += static_cast<double>(jobs[j].size) * jobs[j].size;
+
+        if (!jobs[j].succeeded)
+            ++failures;
+    }
+
+    double totalMs = 0.0;
+
+    for (int stage = 0; stage < STAGE_COUNT; ++stage)
+        totalMs += stageTotals[stage];
+
+    printf("\n");
+    PrintStages("all terrains", stageTotals, totalMs, "");
+    printf("\nwall time %.1f ms, %.2f terrains/s, %.2f Mtexels/s, %d failed\n",
+        wallMs, jobs.size() / (wallMs / 1000.0), texels / (wallMs * 1000.0), failures);
+
+    return (failures > 0) ? 1 : 0;
+}
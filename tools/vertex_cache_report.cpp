@@ -0,0 +1,382 @@
+//-----------------------------------------------------------------------------
+// Vertex cache report.
+//
+// Compares the index orders TerrainMesh can build for the full terrain grid
+// by running them through a simulated post-transform vertex cache, so the
+// orders can be compared without a GPU. For every grid size, index order and
+// cache size it prints:
+//  - ACMR, the average cache miss ratio: vertices transformed per triangle.
+//    A regular grid can't do better than about 0.5.
+//  - ATVR, the average transform to vertex ratio: vertices transformed per
+//    vertex used. 1.0 means every vertex is transformed exactly once.
+//
+// The orders are:
+//  strip       the single serpentine strip with degenerate triangles
+//              (TerrainMesh::buildStripIndices())
+//  patches     every geomipmapping patch at full detail, one after another
+//              (TerrainMesh::buildPatchLodIndices())
+//  block list  cache sized column blocks as a triangle list
+//              (TerrainMesh::buildBlockListIndices())
+//  block strip the same blocks as strips with primitive restart
+//              (TerrainMesh::buildBlockStripIndices())
+//
+// The cache is simulated as a FIFO, which is how most GPUs with a fixed size
+// post-transform cache behave, or as an LRU with --lru. Restart indices
+// aren't fetched, and triangles without any area, such as the ones that
+// stitch the serpentine strip's rows or load the top row of a block, aren't
+// counted as triangles.
+//
+// Usage: vertex_cache_report [options]
+//  --sizes LIST        grid sizes in vertices (default 128,257,1024)
+//  --cache-sizes LIST  cache sizes in vertices (default 16,24,32)
+//  --block-width N     block width in quads, 0 to size the blocks for each
+//                      cache with TerrainMesh::getCacheBlockWidth()
+//                      (default 0)
+//  --patch-size N      geomipmapping patch size in quads (default 32)
+//  --lru               simulate an LRU cache instead of a FIFO
+//
+// With CMake (from this directory):
+//  cmake -S .. -B build -DTERRAIN_BUILD_TOOLS=ON
+//  cmake --build build --target vertex_cache_report
+//-----------------------------------------------------------------------------
+
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <vector>
+
+#include "../terrain_mesh.h"
+
+namespace
+{
+    const unsigned int RESTART_INDEX = ~0u;
+
+    enum Order
+    {
+        ORDER_STRIP,
+        ORDER_PATCHES,
+        ORDER_BLOCK_LIST,
+        ORDER_BLOCK_STRIP,
+        ORDER_COUNT
+    };
+
+    const char *const ORDER_NAMES[ORDER_COUNT] =
+    {
+        "strip", "patches", "block list", "block strip"
+    };
+
+    struct Options
+    {
+        std::vector<int> sizes;
+        std::vector<int> cacheSizes;
+        int blockWidth;
+        int patchSize;
+        bool lru;
+    };
+
+    struct CacheStats
+    {
+        int misses;
+        int triangles;
+        int vertices;       // distinct vertices used
+    };
+
+    //-------------------------------------------------------------------------
+    // Command line parsing.
+
+    bool ParseList(const char *pszList, std::vector<int> &values)
+    {
+        // Parses comma separated positive integers.
+
+        values.clear();
+
+        for (const char *p = pszList; *p; )
+        {
+            char *pEnd = 0;
+            long value = strtol(p, &pEnd, 10);
+
+            if (pEnd == p || value < 1)
+                return false;
+
+            values.push_back(static_cast<int>(value));
+            p = pEnd;
+
+            if (*p == ',')
+                ++p;
+            else if (*p)
+                return false;
+        }
+
+        return !values.empty();
+    }
+
+    void PrintUsage()
+    {
+        fprintf(stderr,
+            "usage: vertex_cache_report [--sizes LIST] [--cache-sizes LIST]\n"
+            "                           [--block-width N] [--patch-size N] [--lru]\n");
+    }
+
+    bool ParseOptions(int argc, char *argv[], Options &options)
+    {
+        options.sizes.clear();
+        options.sizes.push_back(128);
+        options.sizes.push_back(257);
+        options.sizes.push_back(1024);
+        options.cacheSizes.clear();
+        options.cacheSizes.push_back(16);
+        options.cacheSizes.push_back(24);
+        options.cacheSizes.push_back(32);
+        options.blockWidth = 0;
+        options.patchSize = 32;
+        options.lru = false;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            const char *pszOption = argv[i];
+
+            if (strcmp(pszOption, "--lru") == 0)
+            {
+                options.lru = true;
+                continue;
+            }
+
+            const char *pszValue = (i + 1 < argc) ? argv[++i] : 0;
+
+            if (!pszValue)
+                return false;
+
+            if (strcmp(pszOption, "--sizes") == 0)
+            {
+                if (!ParseList(pszValue, options.sizes))
+                    return false;
+
+                for (size_t s = 0; s < options.sizes.size(); ++s)
+                {
+                    if (options.sizes[s] < 2)
+                        return false;
+                }
+            }
+            else if (strcmp(pszOption, "--cache-sizes") == 0)
+            {
+                if (!ParseList(pszValue, options.cacheSizes))
+                    return false;
+            }
+            else if (strcmp(pszOption, "--block-width") == 0)
+            {
+                options.blockWidth = std::max(0, atoi(pszValue));
+            }
+            else if (strcmp(pszOption, "--patch-size") == 0)
+            {
+                options.patchSize = std::max(1, atoi(pszValue));
+            }
+            else
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    //-------------------------------------------------------------------------
+    // Index orders.
+
+    void BuildPatchIndices(int size, int patchSize, std::vector<unsigned int> &indices)
+    {
+        // Every patch at level of detail 0 without coarser neighbours, in the
+        // order Terrain draws them. The patch lists are relative to the
+        // patch's top left vertex, which Terrain passes as the base vertex.
+
+        std::vector<unsigned int> lists;
+        std::vector<TerrainMesh::LodRange> ranges;
+        int patchesPerSide = (size - 1 + patchSize - 1) / patchSize;
+        int remainder = (size - 1) % patchSize;
+
+        TerrainMesh::buildPatchLodIndices(size, patchSize, 1, lists, ranges);
+        indices.clear();
+
+        for (int pz = 0; pz < patchesPerSide; ++pz)
+        {
+            for (int px = 0; px < patchesPerSide; ++px)
+            {
+                int shape = ((remainder && px == patchesPerSide - 1) ? 1 : 0)
+                          | ((remainder && pz == patchesPerSide - 1) ? 2 : 0);
+                const TerrainMesh::LodRange &range = ranges[TerrainMesh::getLodRangeIndex(shape, 0, 1, 0)];
+                unsigned int baseVertex = pz * patchSize * size + px * patchSize;
+
+                for (int i = range.first; i < range.first + range.count; ++i)
+                    indices.push_back(lists[i] + baseVertex);
+            }
+        }
+    }
+
+    bool BuildIndices(Order order, int size, int blockWidth, int patchSize, std::vector<unsigned int> &indices)
+    {
+        // Returns true if the indices are a strip, false for a list.
+
+        switch (order)
+        {
+        case ORDER_STRIP:
+            indices.resize(TerrainMesh::getStripIndexCount(size));
+            TerrainMesh::buildStripIndices(size, &indices[0]);
+            return true;
+
+        case ORDER_PATCHES:
+            BuildPatchIndices(size, patchSize, indices);
+            return false;
+
+        case ORDER_BLOCK_LIST:
+            indices.resize(TerrainMesh::getBlockListIndexCount(size, blockWidth));
+            TerrainMesh::buildBlockListIndices(size, blockWidth, &indices[0]);
+            return false;
+
+        default:
+            indices.resize(TerrainMesh::getBlockStripIndexCount(size, blockWidth));
+            TerrainMesh::buildBlockStripIndices(size, blockWidth, &indices[0]);
+            return true;
+        }
+    }
+
+    //-------------------------------------------------------------------------
+    // Cache simulation.
+
+    bool HasArea(unsigned int a, unsigned int b, unsigned int c, int size)
+    {
+        int ax = a % size, az = a / size;
+        int bx = b % size, bz = b / size;
+        int cx = c % size, cz = c / size;
+
+        return (bx - ax) * (cz - az) - (bz - az) * (cx - ax) != 0;
+    }
+
+    int CountTriangles(const std::vector<unsigned int> &indices, bool strip, int size)
+    {
+        // Counts the triangles that have an area. Strips restart at each
+        // restart index.
+
+        int triangles = 0;
+
+        if (!strip)
+        {
+            for (size_t i = 0; i + 2 < indices.size(); i += 3)
+            {
+                if (HasArea(indices[i], indices[i + 1], indices[i + 2], size))
+                    ++triangles;
+            }
+
+            return triangles;
+        }
+
+        size_t stripStart = 0;
+
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            if (indices[i] == RESTART_INDEX)
+            {
+                stripStart = i + 1;
+                continue;
+            }
+
+            if (i >= stripStart + 2 && HasArea(indices[i - 2], indices[i - 1], indices[i], size))
+                ++triangles;
+        }
+
+        return triangles;
+    }
+
+    CacheStats SimulateCache(const std::vector<unsigned int> &indices, bool strip, int size,
+                             int cacheSize, bool lru)
+    {
+        // A vertex that's in the cache is a hit. A FIFO cache doesn't change
+        // on a hit, an LRU cache moves the vertex to the front. A miss
+        // transforms the vertex and pushes it to the front, evicting the
+        // vertex at the back once the cache is full.
+
+        CacheStats stats = {0, 0, 0};
+        std::deque<unsigned int> cache;
+        std::vector<bool> used(size * size, false);
+
+        for (size_t i = 0; i < indices.size(); ++i)
+        {
+            unsigned int index = indices[i];
+
+            if (index == RESTART_INDEX)
+                continue;
+
+            if (!used[index])
+            {
+                used[index] = true;
+                ++stats.vertices;
+            }
+
+            std::deque<unsigned int>::iterator it = std::find(cache.begin(), cache.end(), index);
+
+            if (it != cache.end())
+            {
+                if (lru)
+                {
+                    cache.erase(it);
+                    cache.push_front(index);
+                }
+
+                continue;
+            }
+
+            ++stats.misses;
+            cache.push_front(index);
+
+            if (static_cast<int>(cache.size()) > cacheSize)
+                cache.pop_back();
+        }
+
+        stats.triangles = CountTriangles(indices, strip, size);
+        return stats;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 1;
+    }
+
+    printf("%s post-transform vertex cache, patch size %d\n\n", options.lru ? "LRU" : "FIFO", options.patchSize);
+    printf("%-6s %-12s %6s %10s %10s", "size", "order", "cache", "indices", "triangles");
+    printf(" %8s %8s\n", "ACMR", "ATVR");
+
+    std::vector<unsigned int> indices;
+
+    for (size_t s = 0; s < options.sizes.size(); ++s)
+    {
+        int size = options.sizes[s];
+
+        for (size_t c = 0; c < options.cacheSizes.size(); ++c)
+        {
+            int cacheSize = options.cacheSizes[c];
+            int blockWidth = options.blockWidth ? options.blockWidth : TerrainMesh::getCacheBlockWidth(cacheSize);
+
+            for (int order = 0; order < ORDER_COUNT; ++order)
+            {
+                bool strip = BuildIndices(static_cast<Order>(order), size, blockWidth, options.patchSize, indices);
+                CacheStats stats = SimulateCache(indices, strip, size, cacheSize, options.lru);
+
+                printf("%-6d %-12s %6d %10d %10d", size, ORDER_NAMES[order], cacheSize,
+                    static_cast<int>(indices.size()), stats.triangles);
+                printf(" %8.3f %8.3f\n",
+                    static_cast<double>(stats.misses) / std::max(1, stats.triangles),
+                    static_cast<double>(stats.misses) / std::max(1, stats.vertices));
+            }
+        }
+
+        printf("\n");
+    }
+
+    return 0;
+}